@@ -0,0 +1,208 @@
+// DeviceSupervisor.cpp : Hot-plug detection and automatic reconnection of the cameras and the projector.
+//
+// Every poll the cameras are asked whether their device was removed, and the projector answers a status read.
+// A lost camera is destroyed, found again by serial number, opened and configured with the same callback used at
+// startup, then the array grabs again. A lost projector is reopened and reloaded with the last armed sequence
+// without starting it. The time from the loss being noticed to the device working again is printed and kept.
+
+
+#include "DeviceSupervisor.h"
+
+#include "../LightCrafter/LC_Flash.h"
+
+#include <iostream>
+#include <algorithm>
+
+using namespace Pylon;
+using namespace std;
+
+
+
+DeviceSupervisor::DeviceSupervisor(CBaslerUsbInstantCameraArray& cameras, ConfigureCamera configure, unsigned int pollMs)
+	: cameras(cameras), configure(configure), pollMs(pollMs)
+{
+	for (size_t i = 0; i < cameras.GetSize(); i++)
+		serials.push_back(string(cameras[i].GetDeviceInfo().GetSerialNumber().c_str()));
+
+	lostCameras.assign(serials.size(), false);
+}
+
+
+DeviceSupervisor::~DeviceSupervisor()
+{
+	Stop();
+}
+
+
+
+void DeviceSupervisor::Start()
+{
+	lock_guard<mutex> lock(runMutex);
+	if (running)
+		return;
+
+	running = true;
+	worker = thread(&DeviceSupervisor::Run, this);
+}
+
+
+void DeviceSupervisor::Stop()
+{
+	{
+		lock_guard<mutex> lock(runMutex);
+		running = false;
+	}
+	wake.notify_all();
+
+	if (worker.joinable())
+		worker.join();
+}
+
+
+
+void DeviceSupervisor::Run()
+{
+	unique_lock<mutex> lock(runMutex);
+
+	while (running)
+	{
+		lock.unlock();
+		CheckCameras();
+		CheckProjector();
+		lock.lock();
+
+		wake.wait_for(lock, chrono::milliseconds(pollMs), [this] { return !running; });
+	}
+}
+
+
+
+void DeviceSupervisor::CheckCameras()
+{
+	// Removal is polled without the camera mutex, pylon allows it while another thread grabs
+	bool removed = false;
+	for (size_t i = 0; i < cameras.GetSize(); i++)
+		if (cameras[i].IsCameraDeviceRemoved())
+			removed = lostCameras[i] = true;
+
+	if (removed && camerasReady)
+	{
+		camerasReady = false;
+		losses++;
+		cameraLost = chrono::steady_clock::now();
+		cout << "Camera lost, reconnecting" << endl;
+	}
+
+	if (camerasReady)
+		return;
+
+	lock_guard<mutex> lock(cameraMutex);
+
+	try
+	{
+		cameras.StopGrabbing();
+
+		for (size_t i = 0; i < cameras.GetSize(); i++)
+			if (cameras[i].IsCameraDeviceRemoved() && !ReopenCamera(i))
+				return; // Not back yet, try again next poll
+
+		cameras.StartGrabbing(GrabStrategy_LatestImageOnly, GrabLoop_ProvidedByUser);
+	}
+	catch (const GenericException& e)
+	{
+		cerr << "Camera reconnection failed: " << e.GetDescription() << endl;
+		return;
+	}
+
+	camerasReady = true;
+	for (size_t i = 0; i < serials.size(); i++)
+		if (lostCameras[i])
+		{
+			lostCameras[i] = false;
+			Recovered("camera " + serials[i], cameraLost);
+		}
+}
+
+
+bool DeviceSupervisor::ReopenCamera(size_t i)
+{
+	CTlFactory& tlFactory = CTlFactory::GetInstance();
+
+	cameras[i].DestroyDevice();
+
+	// Look for the same camera only
+	DeviceInfoList_t filter(1), devices;
+	filter[0].SetSerialNumber(serials[i].c_str());
+	if (tlFactory.EnumerateDevices(devices, filter) == 0)
+		return false;
+
+	cameras[i].Attach(tlFactory.CreateDevice(devices[0]));
+	cameras[i].Open();
+	configure(cameras[i]);
+
+	return true;
+}
+
+
+
+void DeviceSupervisor::CheckProjector()
+{
+	if (LightCrafterProbe())
+	{
+		projectorSeen = true;
+		projectorReady = true;
+		return;
+	}
+
+	if (!projectorSeen)
+		return;
+
+	if (projectorReady)
+	{
+		projectorReady = false;
+		losses++;
+		projectorLost = chrono::steady_clock::now();
+		cout << "Projector lost, reconnecting" << endl;
+	}
+
+	if (LightCrafterReconnect() < 0)
+		return;
+
+	projectorReady = true;
+	Recovered("projector", projectorLost);
+}
+
+
+
+void DeviceSupervisor::Recovered(const string& device, chrono::steady_clock::time_point lost)
+{
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - lost).count();
+	cout << "Recovered " << device << " in " << seconds << " s" << endl;
+
+	lock_guard<mutex> lock(eventMutex);
+	events.push_back({ device, seconds });
+}
+
+
+vector<RecoveryEvent> DeviceSupervisor::Recoveries() const
+{
+	lock_guard<mutex> lock(eventMutex);
+	return events;
+}
+
+
+void DeviceSupervisor::PrintRecoveries() const
+{
+	vector<RecoveryEvent> copy = Recoveries();
+	if (copy.empty())
+		return;
+
+	double total = 0, worst = 0;
+	for (const auto& e : copy)
+	{
+		total += e.seconds;
+		worst = max(worst, e.seconds);
+	}
+
+	cout << copy.size() << " device recoveries, " << total / copy.size() << " s mean, " << worst << " s max" << endl;
+}
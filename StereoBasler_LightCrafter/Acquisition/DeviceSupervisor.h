@@ -0,0 +1,73 @@
+#ifndef DEVICE_SUPERVISOR_H
+#define DEVICE_SUPERVISOR_H
+
+#include <pylon/PylonIncludes.h>
+#include <pylon/usb/BaslerUsbInstantCameraArray.h>
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+
+// A device that was lost and brought back
+struct RecoveryEvent
+{
+	std::string device; // Camera serial number or "projector"
+	double seconds; // From the loss being noticed to the device working again
+};
+
+// Watches the cameras and the projector from a background thread. A removed camera is reopened by serial number,
+// configured and grabbing again; a lost projector is reopened and reloaded with the last armed sequence, which the
+// next capture starts. The acquisition loop holds CameraMutex() while it uses the cameras and aborts the running
+// capture when Losses() changes.
+class DeviceSupervisor
+{
+public:
+	typedef std::function<void(Pylon::CBaslerUsbInstantCamera&)> ConfigureCamera;
+
+	DeviceSupervisor(Pylon::CBaslerUsbInstantCameraArray&, ConfigureCamera, unsigned int pollMs = 500);
+	~DeviceSupervisor();
+
+	void Start();
+	void Stop();
+
+	bool CamerasReady() const { return camerasReady; }
+	bool ProjectorReady() const { return projectorReady; }
+	unsigned int Losses() const { return losses; }
+	std::mutex& CameraMutex() { return cameraMutex; }
+	std::vector<RecoveryEvent> Recoveries() const;
+	void PrintRecoveries() const;
+
+private:
+	void Run();
+	void CheckCameras();
+	void CheckProjector();
+	bool ReopenCamera(size_t);
+	void Recovered(const std::string&, std::chrono::steady_clock::time_point);
+
+	Pylon::CBaslerUsbInstantCameraArray& cameras;
+	ConfigureCamera configure;
+	std::vector<std::string> serials;
+	std::vector<bool> lostCameras;
+	unsigned int pollMs;
+
+	std::atomic<bool> camerasReady{ true }, projectorReady{ false };
+	std::atomic<unsigned int> losses{ 0 };
+	bool projectorSeen = false; // Only a projector that was connected once is supervised
+	std::chrono::steady_clock::time_point cameraLost, projectorLost;
+
+	std::mutex cameraMutex;
+	std::thread worker;
+	std::mutex runMutex;
+	std::condition_variable wake;
+	bool running = false;
+
+	mutable std::mutex eventMutex;
+	std::vector<RecoveryEvent> events;
+};
+
+#endif
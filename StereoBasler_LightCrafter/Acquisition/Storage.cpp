@@ -0,0 +1,105 @@
+// Storage.cpp : Capture results written to disk off the acquisition and processing threads.
+//
+// One thread per open file takes the queued buffers in order. Appends go to the end of the file and positioned
+// writes seek back and return to the end, so both can be mixed in the queue.
+
+
+#include "Storage.h"
+
+#include <cstdio>
+
+using namespace std;
+
+
+
+int AsyncFileWriter::Open(const string& path)
+{
+	Close();
+
+	file.open(path, ios::binary | ios::trunc);
+	if (!file)
+	{
+		printf("Unable to create %s\n", path.c_str());
+		return -1;
+	}
+
+	closing = false;
+	failed = false;
+	queued = 0;
+	worker = thread(&AsyncFileWriter::Run, this);
+	return 0;
+}
+
+
+void AsyncFileWriter::Write(vector<char>&& data)
+{
+	queued += data.size();
+	Push({ true, 0, move(data) });
+}
+
+
+void AsyncFileWriter::WriteAt(uint64_t offset, vector<char>&& data)
+{
+	Push({ false, offset, move(data) });
+}
+
+
+void AsyncFileWriter::Push(Job&& job)
+{
+	unique_lock<mutex> lock(queueMutex);
+	changed.wait(lock, [this] { return jobs.size() < maxPending; });
+	jobs.push_back(move(job));
+	changed.notify_all();
+}
+
+
+int AsyncFileWriter::Close()
+{
+	if (!worker.joinable())
+		return 0;
+
+	{
+		lock_guard<mutex> lock(queueMutex);
+		closing = true;
+	}
+	changed.notify_all();
+	worker.join();
+
+	file.close();
+	return failed || file.fail() ? -1 : 0;
+}
+
+
+void AsyncFileWriter::Run()
+{
+	for (;;)
+	{
+		Job job;
+		{
+			unique_lock<mutex> lock(queueMutex);
+			changed.wait(lock, [this] { return !jobs.empty() || closing; });
+			if (jobs.empty())
+				return;
+
+			job = move(jobs.front());
+			jobs.pop_front();
+		}
+		changed.notify_all(); // Room for a waiting Write()
+
+		if (failed)
+			continue;
+
+		if (job.append)
+			file.write(job.data.data(), job.data.size());
+		else
+		{
+			streampos end = file.tellp();
+			file.seekp(static_cast<streamoff>(job.offset));
+			file.write(job.data.data(), job.data.size());
+			file.seekp(end);
+		}
+
+		if (!file)
+			failed = true;
+	}
+}
@@ -0,0 +1,52 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <deque>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Binary file written by a background thread. Buffers are queued and written in order while the caller goes on;
+// Write() waits while maxPending buffers are queued, so memory stays bounded when the disk is slower than the
+// producer. WriteAt() overwrites earlier data, e.g. a header completed at the end.
+class AsyncFileWriter
+{
+public:
+	explicit AsyncFileWriter(size_t maxPending = 4) : maxPending(maxPending) {}
+	AsyncFileWriter(const AsyncFileWriter&) = delete;
+	AsyncFileWriter& operator=(const AsyncFileWriter&) = delete;
+	~AsyncFileWriter() { Close(); }
+
+	int Open(const std::string&);
+	void Write(std::vector<char>&&);
+	void WriteAt(uint64_t, std::vector<char>&&);
+	int Close(); // Waits for the queued buffers, -1 if any of them failed
+	uint64_t Queued() const { return queued; } // Bytes appended so far
+
+private:
+	struct Job
+	{
+		bool append;
+		uint64_t offset;
+		std::vector<char> data;
+	};
+
+	void Push(Job&&);
+	void Run();
+
+	size_t maxPending;
+	std::ofstream file;
+	std::thread worker;
+	std::mutex queueMutex;
+	std::condition_variable changed;
+	std::deque<Job> jobs;
+	bool closing = false;
+	bool failed = false;
+	uint64_t queued = 0;
+};
+
+#endif
@@ -0,0 +1,269 @@
+// Telemetry.cpp : Background sampling of projector health and camera temperature and counters.
+//
+// The sampler reads the projector status, LED currents, PWM capture and sequencer state, and the temperature and
+// stream statistics of each camera, then pushes one record into a lock-free ring. The acquisition loop looks up
+// the record nearest to each grab and stores it with the capture set. Reads that cannot get the device right away
+// are skipped and the previous values are kept, marked as not valid.
+
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+#include "Telemetry.h"
+#include "DeviceSupervisor.h"
+
+#include "../LightCrafter/LC_Flash.h"
+#include "../LightCrafter/dlpc350_common.h"
+#include "../LightCrafter/dlpc350_usb.h"
+#include "../LightCrafter/dlpc350_api.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <type_traits>
+
+using namespace Pylon;
+using namespace std;
+
+
+
+double TelemetryClock()
+{
+	return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+
+TelemetryRing::TelemetryRing(size_t capacity) : slots(new Slot[capacity]), capacity(capacity)
+{
+}
+
+
+void TelemetryRing::Push(TelemetrySample sample)
+{
+	static_assert(is_trivially_copyable<TelemetrySample>::value, "Samples are copied word by word");
+
+	uint64_t index = head.load(memory_order_relaxed);
+	Slot& slot = slots[index % capacity];
+	sample.index = index;
+
+	uint64_t buffer[words] = {};
+	memcpy(buffer, &sample, sizeof(sample));
+
+	uint64_t version = slot.version.load(memory_order_relaxed);
+	slot.version.store(version + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	for (size_t i = 0; i < words; i++)
+		slot.data[i].store(buffer[i], memory_order_relaxed);
+
+	slot.version.store(version + 2, memory_order_release);
+	head.store(index + 1, memory_order_release);
+}
+
+
+bool TelemetryRing::Read(uint64_t index, TelemetrySample& sample) const
+{
+	const Slot& slot = slots[index % capacity];
+	uint64_t buffer[words];
+
+	for (int attempt = 0; attempt < 4; attempt++)
+	{
+		uint64_t before = slot.version.load(memory_order_acquire);
+		if (before & 1)
+			continue;
+
+		for (size_t i = 0; i < words; i++)
+			buffer[i] = slot.data[i].load(memory_order_relaxed);
+		atomic_thread_fence(memory_order_acquire);
+
+		if (slot.version.load(memory_order_relaxed) == before)
+		{
+			memcpy(&sample, buffer, sizeof(sample));
+			return sample.index == index; // Otherwise the slot already holds a newer record
+		}
+	}
+
+	return false;
+}
+
+
+bool TelemetryRing::Latest(TelemetrySample& sample) const
+{
+	uint64_t end = head.load(memory_order_acquire);
+	return end > 0 && Read(end - 1, sample);
+}
+
+
+bool TelemetryRing::Nearest(double time, TelemetrySample& sample) const
+{
+	// Walk back from the newest record, times only decrease
+	uint64_t end = head.load(memory_order_acquire);
+	uint64_t begin = end > capacity ? end - capacity : 0;
+	bool found = false;
+	double best = 0;
+
+	for (uint64_t i = end; i > begin; i--)
+	{
+		TelemetrySample s;
+		if (!Read(i - 1, s))
+			continue;
+
+		double distance = fabs(s.time - time);
+		if (found && distance >= best)
+			break;
+
+		found = true;
+		best = distance;
+		sample = s;
+	}
+
+	return found;
+}
+
+
+
+TelemetrySampler::TelemetrySampler(CBaslerUsbInstantCameraArray& cameras, DeviceSupervisor* supervisor, double rate, size_t capacity)
+	: cameras(cameras), supervisor(supervisor), rate(rate), ring(capacity)
+{
+}
+
+
+TelemetrySampler::~TelemetrySampler()
+{
+	Stop();
+}
+
+
+
+void TelemetrySampler::Start()
+{
+	lock_guard<mutex> lock(runMutex);
+	if (running)
+		return;
+
+	running = true;
+	worker = thread(&TelemetrySampler::Run, this);
+
+#ifdef _WIN32
+	SetThreadPriority(worker.native_handle(), THREAD_PRIORITY_BELOW_NORMAL);
+#endif
+}
+
+
+void TelemetrySampler::Stop()
+{
+	{
+		lock_guard<mutex> lock(runMutex);
+		running = false;
+	}
+	wake.notify_all();
+
+	if (worker.joinable())
+		worker.join();
+}
+
+
+
+void TelemetrySampler::Run()
+{
+	auto interval = chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(1.0 / rate));
+	auto next = chrono::steady_clock::now();
+	unique_lock<mutex> lock(runMutex);
+
+	while (running)
+	{
+		lock.unlock();
+
+		TelemetrySample sample = last;
+		sample.time = TelemetryClock();
+		sample.projectorValid = SampleProjector(sample);
+		sample.cameraValid = SampleCameras(sample);
+		ring.Push(sample);
+		last = sample;
+
+		lock.lock();
+
+		// Fixed rate, a slow sample does not shift the following ones
+		next += interval;
+		wake.wait_until(lock, next, [this] { return !running; });
+	}
+}
+
+
+
+bool TelemetrySampler::SampleProjector(TelemetrySample& s)
+{
+	if (quiet)
+		return false;
+
+	// One command per lock: a sequence being armed waits at most for the transfer in flight
+	auto command = [](const auto& read)
+	{
+		unique_lock<recursive_mutex> lock(LightCrafterMutex(), try_to_lock);
+		return lock.owns_lock() && DLPC350_USB_IsConnected() && read() >= 0;
+	};
+
+	return command([&] { return DLPC350_GetStatus(&s.hwStatus, &s.sysStatus, &s.mainStatus); }) &&
+		command([&] { return DLPC350_GetLedCurrents(&s.ledRed, &s.ledGreen, &s.ledBlue); }) &&
+		command([&] { return DLPC350_PWMCaptureRead(0, &s.pwmLow[0], &s.pwmHigh[0]); }) &&
+		command([&] { return DLPC350_PWMCaptureRead(1, &s.pwmLow[1], &s.pwmHigh[1]); }) &&
+		command([&] { return DLPC350_GetPatternDisplay(&s.patternDisplay); });
+}
+
+
+
+bool TelemetrySampler::SampleCameras(TelemetrySample& s)
+{
+	if (supervisor && !supervisor->CamerasReady())
+		return false;
+
+	// The acquisition loop holds the camera mutex while it retrieves frames, skip instead of waiting
+	unique_lock<mutex> lock;
+	if (supervisor)
+	{
+		lock = unique_lock<mutex>(supervisor->CameraMutex(), try_to_lock);
+		if (!lock.owns_lock())
+			return false;
+	}
+
+	try
+	{
+		for (size_t i = 0; i < cameras.GetSize() && i < TELEMETRY_CAMERAS; i++)
+		{
+			s.cameraTemperature[i] = cameras[i].DeviceTemperature.GetValue();
+			s.framesTotal[i] = cameras[i].GetStreamGrabberParams().Statistic_Total_Buffer_Count.GetValue();
+			s.framesFailed[i] = cameras[i].GetStreamGrabberParams().Statistic_Failed_Buffer_Count.GetValue();
+		}
+	}
+	catch (const GenericException&)
+	{
+		return false;
+	}
+
+	return true;
+}
+
+
+
+void TelemetrySampler::WriteHeader(ostream& out)
+{
+	out << "index,time,projector_valid,hw_status,sys_status,main_status,led_red,led_green,led_blue,"
+		"pwm0_low,pwm0_high,pwm1_low,pwm1_high,pattern_display,camera_valid";
+	for (int i = 0; i < TELEMETRY_CAMERAS; i++)
+		out << ",temperature" << i << ",frames_total" << i << ",frames_failed" << i;
+}
+
+
+void TelemetrySampler::Write(ostream& out, const TelemetrySample& s)
+{
+	out << s.index << ',' << s.time << ',' << s.projectorValid << ','
+		<< int(s.hwStatus) << ',' << int(s.sysStatus) << ',' << int(s.mainStatus) << ','
+		<< int(s.ledRed) << ',' << int(s.ledGreen) << ',' << int(s.ledBlue) << ','
+		<< s.pwmLow[0] << ',' << s.pwmHigh[0] << ',' << s.pwmLow[1] << ',' << s.pwmHigh[1] << ','
+		<< s.patternDisplay << ',' << s.cameraValid;
+	for (int i = 0; i < TELEMETRY_CAMERAS; i++)
+		out << ',' << s.cameraTemperature[i] << ',' << s.framesTotal[i] << ',' << s.framesFailed[i];
+}
@@ -0,0 +1,103 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <pylon/PylonIncludes.h>
+#include <pylon/usb/BaslerUsbInstantCameraArray.h>
+
+#include <cstdint>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <ostream>
+
+class DeviceSupervisor;
+
+#define TELEMETRY_CAMERAS 2
+
+// One telemetry record, time in seconds of TelemetryClock()
+struct TelemetrySample
+{
+	uint64_t index = 0;
+	double time = 0;
+
+	bool projectorValid = false; // Every projector read below succeeded
+	unsigned char hwStatus = 0, sysStatus = 0, mainStatus = 0;
+	unsigned char ledRed = 0, ledGreen = 0, ledBlue = 0; // LED current PWM values
+	unsigned int pwmLow[2] = { 0, 0 }, pwmHigh[2] = { 0, 0 }; // PWM capture samples of channels 0 and 1
+	unsigned int patternDisplay = 0; // 0 stopped, 1 paused, 2 running
+
+	bool cameraValid = false;
+	double cameraTemperature[TELEMETRY_CAMERAS] = {}; // Celsius
+	int64_t framesTotal[TELEMETRY_CAMERAS] = {}; // Buffers delivered by the stream grabber
+	int64_t framesFailed[TELEMETRY_CAMERAS] = {};
+};
+
+double TelemetryClock();
+
+// Ring of the last samples, one writer and any number of readers, no locks. Every slot carries a version that is
+// odd while the writer fills it; a reader retries or skips a slot whose version changed during the copy. Samples are
+// stored as relaxed atomic words, so a copy that overlaps the writer is discarded instead of being a data race.
+class TelemetryRing
+{
+public:
+	explicit TelemetryRing(size_t capacity = 4096);
+	void Push(TelemetrySample);
+	bool Latest(TelemetrySample&) const;
+	bool Nearest(double, TelemetrySample&) const;
+	uint64_t Count() const { return head.load(std::memory_order_acquire); }
+
+private:
+	static const size_t words = (sizeof(TelemetrySample) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+	struct Slot
+	{
+		std::atomic<uint64_t> version{ 0 };
+		std::atomic<uint64_t> data[words] = {};
+	};
+
+	bool Read(uint64_t, TelemetrySample&) const;
+
+	std::unique_ptr<Slot[]> slots;
+	size_t capacity;
+	std::atomic<uint64_t> head{ 0 };
+};
+
+// Low priority thread that samples the projector and the cameras at a fixed rate. Every projector command takes the
+// device mutex with try_lock and releases it right after, so a command batch is never interleaved with samples and
+// never waits for more than the one transfer in flight. SetQuiet(true) suspends projector reads while a capture is
+// being armed and acquired.
+class TelemetrySampler
+{
+public:
+	TelemetrySampler(Pylon::CBaslerUsbInstantCameraArray&, DeviceSupervisor*, double rate = 2, size_t capacity = 4096);
+	~TelemetrySampler();
+
+	void Start();
+	void Stop();
+	void SetQuiet(bool quiet) { this->quiet = quiet; }
+	const TelemetryRing& Ring() const { return ring; }
+
+	static void WriteHeader(std::ostream&);
+	static void Write(std::ostream&, const TelemetrySample&);
+
+private:
+	void Run();
+	bool SampleProjector(TelemetrySample&);
+	bool SampleCameras(TelemetrySample&);
+
+	Pylon::CBaslerUsbInstantCameraArray& cameras;
+	DeviceSupervisor* supervisor;
+	double rate;
+	TelemetryRing ring;
+	TelemetrySample last;
+
+	std::atomic<bool> quiet{ false };
+	std::thread worker;
+	std::mutex runMutex;
+	std::condition_variable wake;
+	bool running = false;
+};
+
+#endif
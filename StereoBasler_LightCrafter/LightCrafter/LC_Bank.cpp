@@ -0,0 +1,285 @@
+// LC_Bank.cpp : Bank of precompiled pattern sequences switched with the smallest LUT update.
+//
+// The device pattern and image LUTs are mirrored on the host. Selecting a sequence stops the display, writes the
+// runs of entries that differ from the mirror (runs closer than BANK_MERGE_GAP entries are sent as one, a mailbox
+// write costs four commands), updates the pattern configuration and exposure only when they change, validates and
+// starts. Entries past the end of the selected sequence are left in the device, so switching back to a longer
+// sequence often writes nothing. When the device LUT is unknown (first use, or a LightCrafterArm() load since the
+// last switch, which a reconnection also does) the sequence is loaded through LightCrafterArm().
+
+
+#include "LC_Bank.h"
+#include "LC_Flash.h"
+#include "LC_Timing.h"
+
+#include "dlpc350_common.h"
+#include "dlpc350_api.h"
+
+#include <cstdio>
+#include <chrono>
+#include <map>
+#include <algorithm>
+#include <mutex>
+
+
+#define BANK_MERGE_GAP 8
+
+
+using namespace std;
+
+
+static bool SameEntry(const SequenceLutEntry& a, const SequenceLutEntry& b)
+{
+	return a.trigType == b.trigType && a.patNum == b.patNum && a.bitDepth == b.bitDepth && a.ledSelect == b.ledSelect &&
+		a.invert == b.invert && a.insertBlack == b.insertBlack && a.bufSwap == b.bufSwap && a.trigOutPrev == b.trigOutPrev;
+}
+
+
+static vector<unsigned char> StoredImageLut(const vector<unsigned char>& imageLut)
+{
+	// DLPC350_SendImageLut() stores a two entry LUT swapped
+	vector<unsigned char> stored = imageLut;
+	if (stored.size() == 2)
+		swap(stored[0], stored[1]);
+
+	return stored;
+}
+
+
+template <class T, class Equal>
+static vector<pair<size_t, size_t>> DiffRuns(const vector<T>& device, const vector<T>& target, Equal equal)
+{
+	// Runs [first, first + count) of target entries that differ from the device, merging close runs
+	vector<pair<size_t, size_t>> runs;
+
+	for (size_t i = 0; i < target.size(); i++)
+	{
+		if (i < device.size() && equal(device[i], target[i]))
+			continue;
+
+		if (!runs.empty() && i - (runs.back().first + runs.back().second) <= BANK_MERGE_GAP)
+			runs.back().second = i + 1 - runs.back().first;
+		else
+			runs.push_back({ i, 1 });
+	}
+
+	return runs;
+}
+
+
+
+int SequenceBank::Add(const SequenceProgram& program)
+{
+	if (program.varExposure || program.patLut.size() > MAX_PAT_LUT_ENTRIES || program.imageLut.size() > MAX_IMAGE_LUT_ENTRIES)
+	{
+		printf("Bank sequences must be normal mode sequences within %d pattern and %d image LUT entries\n",
+			MAX_PAT_LUT_ENTRIES, MAX_IMAGE_LUT_ENTRIES);
+		return -1;
+	}
+
+	SequenceTimingReport timing;
+	if (CheckSequenceTiming(program, timing) < 0)
+	{
+		printf("Invalid sequence timing\n");
+		PrintSequenceTimingReport(timing);
+		return -1;
+	}
+
+	programs.push_back(program);
+	return static_cast<int>(programs.size() - 1);
+}
+
+
+
+int SequenceBank::Select(int index, BankSwitchReport* report)
+{
+	if (index < 0 || index >= static_cast<int>(programs.size()))
+		return -1;
+
+	lock_guard<recursive_mutex> lock(LightCrafterMutex());
+
+	auto t0 = chrono::steady_clock::now();
+	const SequenceProgram& target = programs[index];
+	// A full load since the last switch (a reconnection re-arms the last program) drops the entries past its end
+	bool known = current >= 0 && LightCrafterArmedHash() == programs[current].hash && LightCrafterLoads() == loads;
+	BankSwitchReport r = { known ? current : -1, index, false, 0, 0, 0, 0 };
+
+
+
+	if (!known || index == current)
+	{
+		// Unknown device LUT: full load. Same sequence: LightCrafterArm() only restarts it.
+		current = -1;
+		if (LightCrafterArm(target) < 0)
+			return -1;
+
+		if (!known)
+		{
+			loads = LightCrafterLoads();
+			patMirror = target.patLut;
+			imageMirror = StoredImageLut(target.imageLut);
+			r.fullLoad = true;
+			r.patEntries = static_cast<unsigned int>(target.patLut.size());
+			r.imageEntries = static_cast<unsigned int>(target.imageLut.size());
+		}
+		else
+			r.commands = 2;
+	}
+	else
+	{
+		const SequenceProgram& from = programs[current];
+		current = -1; // The device LUT is unknown until the switch completes
+
+		if (DLPC350_PatternDisplay(0) < 0)
+		{
+			printf("Failed to set pattern display");
+			return -1;
+		}
+		r.commands++;
+
+
+
+		// Pattern LUT entries that differ
+		auto patRuns = DiffRuns(patMirror, target.patLut, SameEntry);
+		if (!patRuns.empty())
+		{
+			// The whole LUT is staged and the runs are sent from it. Staging fails before any entry is sent, the mirror still
+			// matches the device then.
+			if (DLPC350_ClearPatLut() < 0)
+			{
+				printf("Failed to clear stored pattern LUT");
+				return -1;
+			}
+
+			for (const auto& e : target.patLut)
+			{
+				if (DLPC350_AddToPatLut(e.trigType, e.patNum, e.bitDepth, e.ledSelect, e.invert, e.insertBlack, e.bufSwap, e.trigOutPrev) < 0)
+				{
+					printf("Failed to add to pattern LUT");
+					return -1;
+				}
+			}
+
+			for (const auto& run : patRuns)
+			{
+				if (DLPC350_SendPatLutRange(static_cast<unsigned int>(run.first), static_cast<unsigned int>(run.second)) < 0)
+				{
+					printf("Failed to send pattern LUT");
+					return -1;
+				}
+
+				r.patEntries += static_cast<unsigned int>(run.second);
+				r.commands += 4;
+			}
+
+			patMirror.resize(max(patMirror.size(), target.patLut.size()));
+			copy(target.patLut.begin(), target.patLut.end(), patMirror.begin());
+		}
+
+
+
+		// Image LUT entries that differ
+		vector<unsigned char> stored = StoredImageLut(target.imageLut);
+		auto imageRuns = DiffRuns(imageMirror, stored, [](unsigned char a, unsigned char b) { return a == b; });
+
+		for (const auto& run : imageRuns)
+		{
+			if (DLPC350_SendImageLutRange(&stored[run.first], static_cast<unsigned int>(run.first), static_cast<unsigned int>(run.second)) < 0)
+			{
+				printf("Failed to send image LUT");
+				return -1;
+			}
+
+			r.imageEntries += static_cast<unsigned int>(run.second);
+			r.commands += 4;
+		}
+
+		imageMirror.resize(max(imageMirror.size(), stored.size()));
+		copy(stored.begin(), stored.end(), imageMirror.begin());
+
+
+
+		// Sequence configuration and exposure, only when they change
+		unsigned int numLutEntries = static_cast<unsigned int>(target.patLut.size());
+		unsigned int numImages = static_cast<unsigned int>(target.imageLut.size());
+
+		if (numLutEntries != from.patLut.size() || numImages != from.imageLut.size() || target.repeat != from.repeat ||
+			target.numPatsForTrigOut2 != from.numPatsForTrigOut2)
+		{
+			if (DLPC350_SetPatternConfig(numLutEntries, target.repeat, target.numPatsForTrigOut2, numImages) < 0)
+			{
+				printf("Failed to set pattern configuration");
+				return -1;
+			}
+			r.commands++;
+		}
+
+		if (target.exposure != from.exposure || target.period != from.period)
+		{
+			if (DLPC350_SetExposure_FramePeriod(target.exposure, target.period) < 0)
+			{
+				printf("Failed to set exposure/frame period");
+				return -1;
+			}
+			r.commands++;
+		}
+
+
+
+		// Validate and start
+		unsigned int status;
+		if (DLPC350_ValidatePatLutData(&status) < 0 || (status & (SEQ_STATUS_EXPOSURE | SEQ_STATUS_PATNUM | SEQ_STATUS_230US)))
+		{
+			printf("Failed to validate pattern LUT data");
+			return -1;
+		}
+
+		if (DLPC350_PatternDisplay(2) < 0)
+		{
+			printf("Failed to set pattern display");
+			return -1;
+		}
+		r.commands += 2;
+
+		LightCrafterSetArmed(target);
+	}
+
+	current = index;
+	r.seconds = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+	history.push_back(r);
+
+	if (report)
+		*report = r;
+
+	return 0;
+}
+
+
+
+void SequenceBank::PrintSwitchLatency() const
+{
+	struct Stats { unsigned int count = 0; double total = 0, worst = 0; unsigned long long entries = 0, commands = 0; };
+	map<pair<int, int>, Stats> transitions;
+
+	for (const auto& r : history)
+	{
+		Stats& s = transitions[{ r.from, r.to }];
+		s.count++;
+		s.total += r.seconds;
+		s.worst = max(s.worst, r.seconds);
+		s.entries += r.patEntries + r.imageEntries;
+		s.commands += r.commands;
+	}
+
+	for (const auto& t : transitions)
+	{
+		const Stats& s = t.second;
+		if (t.first.first < 0)
+			printf("Load -> %d", t.first.second);
+		else
+			printf("%d -> %d", t.first.first, t.first.second);
+
+		printf(": %u switches, %.3f ms mean, %.3f ms max, %.1f LUT entries, %.1f commands\n", s.count,
+			1000 * s.total / s.count, 1000 * s.worst, static_cast<double>(s.entries) / s.count, static_cast<double>(s.commands) / s.count);
+	}
+}
@@ -0,0 +1,42 @@
+#ifndef LC_BANK_H
+#define LC_BANK_H
+
+#include "LC_Sequence.h"
+
+#include <vector>
+
+// What one switch between bank sequences cost
+struct BankSwitchReport
+{
+	int from; // Previous sequence, -1 when the device LUT was unknown
+	int to;
+	bool fullLoad; // Everything reprogrammed through LightCrafterArm()
+	unsigned int patEntries; // Pattern LUT entries written
+	unsigned int imageEntries; // Image LUT entries written
+	unsigned int commands; // USB commands sent
+	double seconds;
+};
+
+// Normal mode sequences sharing the device LUT. The DLPC350 always starts at LUT entry 0, so a switch writes only
+// the pattern and image LUT entries that differ from what the device already holds, then the configuration.
+// A sequence that is a prefix of the device LUT is selected with SetPatternConfig alone.
+class SequenceBank
+{
+public:
+	int Add(const SequenceProgram&);
+	int Select(int, BankSwitchReport* report = nullptr);
+	int Current() const { return current; }
+	size_t Size() const { return programs.size(); }
+	const std::vector<BankSwitchReport>& History() const { return history; }
+	void PrintSwitchLatency() const;
+
+private:
+	std::vector<SequenceProgram> programs;
+	std::vector<SequenceLutEntry> patMirror; // Device pattern LUT
+	std::vector<unsigned char> imageMirror; // Device image LUT in the order it is stored
+	int current = -1;
+	unsigned int loads = 0; // LightCrafterLoads() when the mirror was taken
+	std::vector<BankSwitchReport> history;
+};
+
+#endif
@@ -0,0 +1,152 @@
+// LC_Bitplane.cpp : Packs stacks of binary or N-bit patterns into the bit planes of 24-bit DLPC350 frames.
+//
+// The 24 bit planes of a frame are numbered G0-G7, R0-R7, B0-B7 (table 2-66 of the programmer's guide).
+// A pattern of bit depth d takes d consecutive planes, so a frame holds 24 1-bit patterns, 12 2-bit, 8 3-bit,
+// 6 4-bit, 4 5-bit or 6-bit patterns and 3 8-bit patterns. 7-bit patterns use the 7 MSB planes of each color.
+// Input patterns are 8-bit images quantized to their d most significant bits, so binary patterns are 0/255.
+
+
+#include "LC_Bitplane.h"
+
+#include "dlpc350_common.h"
+
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BITPLANE_SSE2 1
+#endif
+
+
+using namespace std;
+
+
+struct PlaneSource
+{
+	int pattern; // Pattern of the frame feeding this plane, -1 if unused
+	int bit; // Bit of the 8-bit input pixel copied to this plane
+};
+
+
+int BitplanePatternsPerImage(int bitDepth)
+{
+	if (bitDepth < 1 || bitDepth > 8)
+		return -1;
+
+	return bitDepth == 7 ? 3 : 24 / bitDepth;
+}
+
+
+int BitplaneOffset(int bitDepth, int patNum)
+{
+	// First bit plane of the given pattern number
+	if (patNum < 0 || patNum >= BitplanePatternsPerImage(bitDepth))
+		return -1;
+
+	return bitDepth == 7 ? 8 * patNum + 1 : bitDepth * patNum;
+}
+
+
+static void PackFrame(const unsigned char* const* src, const PlaneSource* planes, size_t numPixels, unsigned char* dst)
+{
+	size_t i = 0;
+
+#ifdef BITPLANE_SSE2
+	// 16 pixels at a time: every plane is a shift of the source byte followed by a mask
+	alignas(16) unsigned char channel[3][16];
+
+	for (; i + 16 <= numPixels; i += 16)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			__m128i acc = _mm_setzero_si128();
+
+			for (int j = 0; j < 8; j++)
+			{
+				const PlaneSource& p = planes[8 * c + j];
+				if (p.pattern < 0)
+					continue;
+
+				__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src[p.pattern] + i));
+				if (p.bit > j)
+					v = _mm_srl_epi16(v, _mm_cvtsi32_si128(p.bit - j));
+				else if (p.bit < j)
+					v = _mm_sll_epi16(v, _mm_cvtsi32_si128(j - p.bit));
+
+				acc = _mm_or_si128(acc, _mm_and_si128(v, _mm_set1_epi8(static_cast<char>(1 << j))));
+			}
+
+			_mm_store_si128(reinterpret_cast<__m128i*>(channel[c]), acc);
+		}
+
+		unsigned char* out = dst + BYTES_PER_PIXEL * i;
+		for (int k = 0; k < 16; k++)
+		{
+			out[3 * k] = channel[0][k];
+			out[3 * k + 1] = channel[1][k];
+			out[3 * k + 2] = channel[2][k];
+		}
+	}
+#endif
+
+	for (; i < numPixels; i++)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			unsigned char value = 0;
+			for (int j = 0; j < 8; j++)
+			{
+				const PlaneSource& p = planes[8 * c + j];
+				if (p.pattern >= 0)
+					value |= ((src[p.pattern][i] >> p.bit) & 1) << j;
+			}
+			dst[BYTES_PER_PIXEL * i + c] = value;
+		}
+	}
+}
+
+
+int PackBitplanes(const vector<const unsigned char*>& patterns, unsigned int width, unsigned int height, int bitDepth,
+	vector<SplashFrame>& frames, vector<BitplaneLutEntry>& lut)
+{
+	int perImage = BitplanePatternsPerImage(bitDepth);
+	if (perImage < 0 || patterns.empty() || width == 0 || height == 0)
+		return -1;
+
+	size_t numPixels = static_cast<size_t>(width) * height;
+	size_t numFrames = (patterns.size() + perImage - 1) / perImage;
+
+	frames.assign(numFrames, SplashFrame());
+	lut.clear();
+
+	for (size_t f = 0; f < numFrames; f++)
+	{
+		// Which pattern and which bit of it feeds each of the 24 planes
+		PlaneSource planes[24];
+		const unsigned char* src[24];
+		int count = static_cast<int>(min<size_t>(perImage, patterns.size() - f * perImage));
+
+		for (auto& p : planes)
+			p.pattern = -1;
+
+		for (int k = 0; k < count; k++)
+		{
+			src[k] = patterns[f * perImage + k];
+			if (src[k] == nullptr)
+				return -1;
+
+			int offset = BitplaneOffset(bitDepth, k);
+			for (int b = 0; b < bitDepth; b++)
+				planes[offset + b] = { k, 8 - bitDepth + b };
+
+			lut.push_back({ static_cast<unsigned int>(f), k, bitDepth, k == 0 });
+		}
+
+		frames[f].width = width;
+		frames[f].height = height;
+		frames[f].pixels.resize(numPixels * BYTES_PER_PIXEL);
+		PackFrame(src, planes, numPixels, frames[f].pixels.data());
+	}
+
+	return 0;
+}
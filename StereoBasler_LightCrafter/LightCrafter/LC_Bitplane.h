@@ -0,0 +1,21 @@
+#ifndef LC_BITPLANE_H
+#define LC_BITPLANE_H
+
+#include "LC_Splash.h"
+
+#include <vector>
+
+// Pattern LUT parameters of one packed pattern, ready for DLPC350_AddToPatLut()
+struct BitplaneLutEntry
+{
+	unsigned int image; // Index of the packed 24-bit frame holding the pattern
+	int patNum; // Pattern number inside the frame
+	int bitDepth;
+	bool bufSwap; // True for the first pattern of each frame
+};
+
+int BitplanePatternsPerImage(int);
+int BitplaneOffset(int, int);
+int PackBitplanes(const std::vector<const unsigned char*>&, unsigned int, unsigned int, int, std::vector<SplashFrame>&, std::vector<BitplaneLutEntry>&);
+
+#endif
@@ -0,0 +1,578 @@
+// LC_FirmwareFile.cpp : Memory-mapped firmware, hex and .ini file readers.
+//
+// Files are mapped read-only and parsed in a streaming pass straight from the mapping, without the line by line
+// re-reading of ReadTextFromFile(). Hex digits are decoded 32 at a time with SSE2 while no separator shows up,
+// which covers whole hex dumps and the data field of Intel HEX records, and one byte at a time otherwise.
+// Hex images are decoded one flash sector at a time when the flash programmer reads them (LC_FlashProgram).
+
+
+#include "LC_FirmwareFile.h"
+
+#include "dlpc350_common.h"
+
+#include <cstdio>
+#include <cstring>
+#include <climits>
+#include <cstdint>
+#include <algorithm>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FIRMWARE_SSE2 1
+#endif
+
+
+using namespace std;
+
+
+#define INTEL_HEX_DATA 0x00
+#define INTEL_HEX_EOF 0x01
+#define INTEL_HEX_SEGMENT 0x02 // Extended segment address
+#define INTEL_HEX_START_SEGMENT 0x03
+#define INTEL_HEX_LINEAR 0x04 // Extended linear address
+#define INTEL_HEX_START_LINEAR 0x05
+#define INTEL_HEX_MAX_RECORD (5 + 255)
+
+
+
+int MappedFile::Open(const string& path, bool copy)
+{
+	Close();
+	copyOnWrite = copy;
+
+#ifdef _WIN32
+	HANDLE f = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (f == INVALID_HANDLE_VALUE)
+		return -1;
+	file = f;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(f, &fileSize))
+	{
+		Close();
+		return -1;
+	}
+
+	size = static_cast<size_t>(fileSize.QuadPart);
+	if (size == 0)
+		return 0; // Empty files can't be mapped
+
+	mapping = CreateFileMappingA(f, NULL, copyOnWrite ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, NULL);
+	if (mapping != NULL)
+		data = static_cast<unsigned char*>(MapViewOfFile(mapping, copyOnWrite ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0));
+#else
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	struct stat st;
+	if (fstat(fd, &st) < 0)
+	{
+		close(fd);
+		return -1;
+	}
+
+	size = static_cast<size_t>(st.st_size);
+	if (size == 0)
+	{
+		close(fd);
+		return 0;
+	}
+
+	void* p = mmap(nullptr, size, copyOnWrite ? PROT_READ | PROT_WRITE : PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (p != MAP_FAILED)
+	{
+		data = static_cast<unsigned char*>(p);
+		madvise(p, size, MADV_SEQUENTIAL);
+	}
+#endif
+
+	if (data == nullptr)
+	{
+		Close();
+		return -1;
+	}
+
+	return 0;
+}
+
+
+void MappedFile::Close()
+{
+#ifdef _WIN32
+	if (data)
+		UnmapViewOfFile(data);
+	if (mapping)
+		CloseHandle(mapping);
+	if (file)
+		CloseHandle(file);
+	mapping = nullptr;
+	file = nullptr;
+#else
+	if (data)
+		munmap(data, size);
+#endif
+
+	data = nullptr;
+	size = 0;
+	copyOnWrite = false;
+}
+
+
+
+static inline int HexNibble(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	c |= 0x20;
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+
+	return -1;
+}
+
+
+#ifdef FIRMWARE_SSE2
+static inline bool HexNibbles(__m128i v, __m128i* nibbles)
+{
+	// 16 characters to their values, false if any of them isn't a hex digit
+	__m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+	__m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+	__m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(lower, _mm_set1_epi8('f' + 1)));
+
+	if (_mm_movemask_epi8(_mm_or_si128(digit, alpha)) != 0xFFFF)
+		return false;
+
+	*nibbles = _mm_or_si128(_mm_and_si128(digit, _mm_sub_epi8(v, _mm_set1_epi8('0'))),
+		_mm_and_si128(alpha, _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10))));
+	return true;
+}
+
+
+static inline __m128i HexBytes(__m128i nibbles)
+{
+	// Pairs of nibbles, first one high, as 16-bit values
+	return _mm_or_si128(_mm_slli_epi16(_mm_and_si128(nibbles, _mm_set1_epi16(0xFF)), 4), _mm_srli_epi16(nibbles, 8));
+}
+#endif
+
+
+size_t HexDecode(const char* text, size_t len, unsigned char* out, size_t outSize, size_t* used)
+{
+	// Decodes up to outSize bytes, skipping characters that aren't hex digits. A last lone digit is left unused.
+	size_t i = 0, n = 0;
+
+	while (n < outSize && i < len)
+	{
+#ifdef FIRMWARE_SSE2
+		for (; n + 16 <= outSize && i + 32 <= len; i += 32, n += 16)
+		{
+			__m128i a, b;
+			if (!HexNibbles(_mm_loadu_si128(reinterpret_cast<const __m128i*>(text + i)), &a) ||
+				!HexNibbles(_mm_loadu_si128(reinterpret_cast<const __m128i*>(text + i + 16)), &b))
+				break;
+
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + n), _mm_packus_epi16(HexBytes(a), HexBytes(b)));
+		}
+
+		if (n == outSize || i == len)
+			break;
+#endif
+
+		// One byte, skipping separators
+		size_t hi = i;
+		while (hi < len && HexNibble(text[hi]) < 0)
+			hi++;
+
+		size_t lo = hi + 1;
+		while (lo < len && HexNibble(text[lo]) < 0)
+			lo++;
+
+		if (lo >= len)
+		{
+			i = hi < len ? hi : len;
+			break;
+		}
+
+		out[n++] = static_cast<unsigned char>(HexNibble(text[hi]) << 4 | HexNibble(text[lo]));
+		i = lo + 1;
+	}
+
+	if (used)
+		*used = i;
+
+	return n;
+}
+
+
+
+// Intel HEX record at pos (':'), decoded into rec. Returns its length in characters up to the end of the line,
+// 0 if it is malformed or its checksum is wrong.
+static size_t ParseRecord(const char* text, size_t len, size_t pos, unsigned char* rec)
+{
+	const char* eol = static_cast<const char*>(memchr(text + pos, '\n', len - pos));
+	size_t end = eol ? eol - text + 1 : len;
+
+	size_t n = HexDecode(text + pos + 1, end - pos - 1, rec, INTEL_HEX_MAX_RECORD, nullptr);
+	if (n < 5 || n != 5u + rec[0])
+		return 0;
+
+	unsigned char sum = 0;
+	for (size_t i = 0; i < n; i++)
+		sum += rec[i];
+
+	return sum == 0 ? end - pos : 0;
+}
+
+
+static inline bool IsSpace(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+
+template <class F>
+static int ForEachRecord(const char* text, size_t begin, size_t end, unsigned int upper, F record)
+{
+	// Calls record(pos, length, address, rec) for every data record of [begin, end), tracking the upper address
+	unsigned char rec[INTEL_HEX_MAX_RECORD];
+
+	for (size_t pos = begin; pos < end; )
+	{
+		if (IsSpace(text[pos]))
+		{
+			pos++;
+			continue;
+		}
+
+		size_t n = text[pos] == ':' ? ParseRecord(text, end, pos, rec) : 0;
+		if (n == 0)
+		{
+			printf("Invalid Intel HEX record at offset %zu\n", pos);
+			return -1;
+		}
+
+		switch (rec[3])
+		{
+		case INTEL_HEX_DATA:
+			record(pos, n, upper + (rec[1] << 8 | rec[2]), rec);
+			break;
+		case INTEL_HEX_EOF:
+			return 0;
+		case INTEL_HEX_SEGMENT:
+			upper = (rec[4] << 8 | rec[5]) << 4;
+			break;
+		case INTEL_HEX_LINEAR:
+			upper = static_cast<unsigned int>(rec[4] << 8 | rec[5]) << 16;
+			break;
+		case INTEL_HEX_START_SEGMENT:
+		case INTEL_HEX_START_LINEAR:
+			break;
+		default:
+			printf("Unknown Intel HEX record type %u at offset %zu\n", rec[3], pos);
+			return -1;
+		}
+
+		pos += n;
+	}
+
+	return 0;
+}
+
+
+
+int FirmwareFile::Open(const string& path, unsigned int sectorBytes)
+{
+	format = FIRMWARE_BINARY;
+	size = base = 0;
+	sectors.clear();
+	buffered = -1;
+	sectorSize = sectorBytes;
+
+	if (sectorSize == 0 || file.Open(path) < 0)
+	{
+		printf("Unable to open %s\n", path.c_str());
+		return -1;
+	}
+
+	if (file.Size() > UINT_MAX)
+	{
+		printf("%s is too large\n", path.c_str());
+		return -1;
+	}
+
+	string ext = path.size() >= 4 ? path.substr(path.size() - 4) : "";
+	transform(ext.begin(), ext.end(), ext.begin(), [](char c) { return static_cast<char>(tolower(c)); });
+
+	if (ext != ".hex")
+	{
+		size = static_cast<unsigned int>(file.Size());
+		return 0;
+	}
+
+	// Intel HEX when the first character is a record mark
+	const char* text = reinterpret_cast<const char*>(file.Data());
+	size_t first = 0;
+	while (first < file.Size() && IsSpace(text[first]))
+		first++;
+
+	format = first < file.Size() && text[first] == ':' ? FIRMWARE_INTEL_HEX : FIRMWARE_HEX_TEXT;
+	return format == FIRMWARE_INTEL_HEX ? IndexIntelHex() : IndexHexText();
+}
+
+
+int FirmwareFile::IndexHexText()
+{
+	// Decode sector by sector to find where each one starts in the text
+	const char* text = reinterpret_cast<const char*>(file.Data());
+	size_t len = file.Size(), pos = 0;
+	buffer.resize(sectorSize);
+
+	while (pos < len)
+	{
+		size_t used;
+		size_t n = HexDecode(text + pos, len - pos, buffer.data(), sectorSize, &used);
+		if (n == 0)
+			break;
+
+		sectors.push_back({ pos, pos + used, 0 });
+		buffered = static_cast<int>(sectors.size()) - 1;
+		size += static_cast<unsigned int>(n);
+		pos += used;
+	}
+
+	return 0;
+}
+
+
+int FirmwareFile::IndexIntelHex()
+{
+	const char* text = reinterpret_cast<const char*>(file.Data());
+	size_t len = file.Size();
+
+	// First pass: check the records and find the address range
+	unsigned long long lowest = ULLONG_MAX, highest = 0;
+	int result = ForEachRecord(text, 0, len, 0, [&](size_t, size_t, unsigned int addr, const unsigned char* rec)
+	{
+		if (rec[0] == 0)
+			return;
+		lowest = min<unsigned long long>(lowest, addr);
+		highest = max<unsigned long long>(highest, static_cast<unsigned long long>(addr) + rec[0]);
+	});
+
+	if (result < 0)
+		return -1;
+
+	if (lowest == ULLONG_MAX || highest - lowest > UINT_MAX)
+	{
+		printf("No data in Intel HEX file or address range too large\n");
+		return -1;
+	}
+
+	base = static_cast<unsigned int>(lowest);
+	size = static_cast<unsigned int>(highest - lowest);
+
+
+
+	// Second pass: text span of the records of each sector
+	unsigned int upper = 0;
+	sectors.assign(DIV_CEIL(size, sectorSize), { SIZE_MAX, 0, 0 });
+
+	ForEachRecord(text, 0, len, 0, [&](size_t pos, size_t n, unsigned int addr, const unsigned char* rec)
+	{
+		if (rec[0] == 0)
+			return;
+
+		// Upper address in effect at this record, rebuilt from its absolute address
+		upper = addr - (rec[1] << 8 | rec[2]);
+		unsigned int firstSector = (addr - base) / sectorSize, lastSector = (addr - base + rec[0] - 1) / sectorSize;
+
+		for (unsigned int s = firstSector; s <= lastSector; s++)
+		{
+			if (sectors[s].begin == SIZE_MAX)
+				sectors[s] = { pos, pos + n, upper };
+			else
+				sectors[s].end = pos + n;
+		}
+	});
+
+	return 0;
+}
+
+
+int FirmwareFile::DecodeSector(unsigned int s)
+{
+	const char* text = reinterpret_cast<const char*>(file.Data());
+	unsigned int len = min(sectorSize, size - s * sectorSize);
+	const SectorText& span = sectors[s];
+	buffered = -1;
+	buffer.assign(len, 0xFF);
+
+	if (format == FIRMWARE_HEX_TEXT)
+	{
+		if (HexDecode(text + span.begin, span.end - span.begin, buffer.data(), len, nullptr) != len)
+			return -1;
+	}
+	else if (span.begin != SIZE_MAX)
+	{
+		// Copy the part of every record that falls in the sector
+		unsigned long long start = static_cast<unsigned long long>(base) + s * sectorSize;
+		int result = ForEachRecord(text, span.begin, span.end, span.upper, [&](size_t, size_t, unsigned int addr, const unsigned char* rec)
+		{
+			unsigned long long from = max<unsigned long long>(addr, start);
+			unsigned long long to = min<unsigned long long>(static_cast<unsigned long long>(addr) + rec[0], start + len);
+			if (from < to)
+				memcpy(buffer.data() + (from - start), rec + 4 + (from - addr), static_cast<size_t>(to - from));
+		});
+
+		if (result < 0)
+			return -1;
+	}
+
+	buffered = static_cast<int>(s);
+	return 0;
+}
+
+
+const unsigned char* FirmwareFile::Read(unsigned int offset, unsigned int len)
+{
+	if (offset > size || len > size - offset)
+		return nullptr;
+
+	if (format == FIRMWARE_BINARY)
+		return file.Data() + offset;
+
+	unsigned int s = offset / sectorSize;
+	if (offset % sectorSize + len > sectorSize)
+		return nullptr;
+
+	if (buffered != static_cast<int>(s) && DecodeSector(s) < 0)
+		return nullptr;
+
+	return buffer.data() + offset % sectorSize;
+}
+
+
+
+static bool ParseValue(const char* p, const char* end, unsigned int* value)
+{
+	// Hex with a 0x prefix or decimal
+	unsigned long long v = 0;
+	int radix = 10;
+	if (end - p > 2 && p[0] == '0' && (p[1] | 0x20) == 'x')
+	{
+		radix = 16;
+		p += 2;
+	}
+
+	if (p == end)
+		return false;
+
+	for (; p < end; p++)
+	{
+		int d = radix == 16 ? HexNibble(*p) : (*p >= '0' && *p <= '9' ? *p - '0' : -1);
+		if (d < 0)
+			return false;
+
+		v = v * radix + d;
+		if (v > UINT_MAX)
+			return false;
+	}
+
+	*value = static_cast<unsigned int>(v);
+	return true;
+}
+
+
+int ReadIniFile(const string& path, const function<int(const IniEntry&)>& entry)
+{
+	// Entries end at ';' or at the end of the line. Comments start with '#' or "//" and run to the end of the line,
+	// "/* */" comments may span lines.
+	MappedFile file;
+	if (file.Open(path) < 0)
+	{
+		printf("Unable to open %s\n", path.c_str());
+		return -1;
+	}
+
+	const char* p = reinterpret_cast<const char*>(file.Data());
+	const char* end = p + file.Size();
+	IniEntry e;
+	e.line = 1;
+	unsigned int line = 1;
+	bool inEntry = false;
+
+	auto finish = [&]()
+	{
+		int result = inEntry ? entry(e) : 0;
+		inEntry = false;
+		e.key.clear();
+		e.values.clear();
+		return result;
+	};
+
+	while (p < end)
+	{
+		char c = *p;
+
+		if (c == '\n' || c == ';')
+		{
+			if (finish() < 0)
+				return -1;
+			if (c == '\n')
+				line++;
+			p++;
+		}
+		else if (c == ' ' || c == '\t' || c == '\r' || c == '=' || c == ',')
+			p++;
+		else if (c == '#' || (c == '/' && p + 1 < end && p[1] == '/'))
+		{
+			const char* eol = static_cast<const char*>(memchr(p, '\n', end - p));
+			p = eol ? eol : end;
+		}
+		else if (c == '/' && p + 1 < end && p[1] == '*')
+		{
+			for (p += 2; p < end && !(p[0] == '*' && p + 1 < end && p[1] == '/'); p++)
+				if (*p == '\n')
+					line++;
+			p = min(p + 2, end);
+		}
+		else
+		{
+			// Key or value token
+			const char* t = p;
+			while (p < end && !IsSpace(*p) && *p != ';' && *p != '=' && *p != ',' && *p != '#' && !(p[0] == '/' && p + 1 < end && (p[1] == '/' || p[1] == '*')))
+				p++;
+
+			if (!inEntry)
+			{
+				inEntry = true;
+				e.key.assign(t, p);
+				e.line = line;
+			}
+			else
+			{
+				unsigned int v;
+				if (!ParseValue(t, p, &v))
+				{
+					printf("%s:%u: invalid value %s\n", path.c_str(), line, string(t, p).c_str());
+					return -1;
+				}
+				e.values.push_back(v);
+			}
+		}
+	}
+
+	return finish() < 0 ? -1 : 0;
+}
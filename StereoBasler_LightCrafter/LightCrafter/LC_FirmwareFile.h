@@ -0,0 +1,91 @@
+#ifndef LC_FIRMWARE_FILE_H
+#define LC_FIRMWARE_FILE_H
+
+#include "LC_FlashProgram.h"
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstddef>
+
+// Read-only memory mapping of a whole file
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	~MappedFile() { Close(); }
+
+	int Open(const std::string&, bool copyOnWrite = false);
+	void Close();
+	const unsigned char* Data() const { return data; }
+	size_t Size() const { return size; }
+
+	// Only for copy on write mappings: writes go to private copies of the pages and never reach the file
+	unsigned char* WritableData() const { return copyOnWrite ? data : nullptr; }
+
+private:
+	unsigned char* data = nullptr;
+	size_t size = 0;
+	bool copyOnWrite = false;
+#ifdef _WIN32
+	void* file = nullptr;
+	void* mapping = nullptr;
+#endif
+};
+
+enum FirmwareFormat
+{
+	FIRMWARE_BINARY, // Raw image
+	FIRMWARE_HEX_TEXT, // Hex digits, anything else is skipped as in Hex2BinArray()
+	FIRMWARE_INTEL_HEX // Intel HEX records, gaps read as erased flash (0xFF)
+};
+
+// Firmware or splash image file streamed to the flash programmer. Binary files are read in place from the mapping.
+// Hex files are checked and indexed at Open() and every sector is decoded again when it is read, so the image is
+// never held in memory as a whole.
+class FirmwareFile : public FlashImageSource
+{
+public:
+	int Open(const std::string&, unsigned int sectorSize = FLASH_SECTOR_SIZE);
+	FirmwareFormat Format() const { return format; }
+	unsigned int BaseAddress() const { return base; } // Lowest address of an Intel HEX file, 0 otherwise
+	unsigned int Size() const override { return size; }
+	const unsigned char* Read(unsigned int, unsigned int) override;
+
+private:
+	// Text span holding the records of a sector and the Intel HEX upper address at its start
+	struct SectorText
+	{
+		size_t begin;
+		size_t end;
+		unsigned int upper;
+	};
+
+	int IndexHexText();
+	int IndexIntelHex();
+	int DecodeSector(unsigned int);
+
+	MappedFile file;
+	FirmwareFormat format = FIRMWARE_BINARY;
+	unsigned int sectorSize = FLASH_SECTOR_SIZE;
+	unsigned int size = 0;
+	unsigned int base = 0;
+	std::vector<SectorText> sectors;
+	std::vector<unsigned char> buffer; // Last decoded sector
+	int buffered = -1;
+};
+
+// One "KEY value value ...;" setting of an .ini file, values in hex (0x prefix) or decimal
+struct IniEntry
+{
+	std::string key;
+	std::vector<unsigned int> values;
+	unsigned int line;
+};
+
+size_t HexDecode(const char*, size_t, unsigned char*, size_t, size_t*);
+int ReadIniFile(const std::string&, const std::function<int(const IniEntry&)>&);
+
+#endif
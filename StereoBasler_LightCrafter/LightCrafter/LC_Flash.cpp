@@ -7,68 +7,120 @@
 #include "dlpc350_common.h"
 #include "dlpc350_usb.h"
 #include "dlpc350_api.h"
+#include "LC_Timing.h"
 
 #include <string>
 #include <cstdio>
-#include <string>
-#include <sstream>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <chrono>
 
 
 using namespace std;
 
 
-int LightCrafterFlash(int exposurePeriod, int framePeriod, int repeat, string seq="all")
+#define FLASH_COUNT_RETRIES 3 // Attempts at reading the number of flash images after opening the device
+
+
+// State kept for each USB device slot, the calling thread works on the slot selected with DLPC350_USB_Select()
+struct DeviceState
+{
+	uint64_t armedHash = 0; // Hash of the program currently stored in the device, 0 if unknown
+	unsigned int numImgInFlash = 0; // Total number of images stored in flash memory
+	SequenceProgram lastProgram; // Last program armed, reapplied after a reconnection
+	bool haveLastProgram = false;
+	unsigned int loads = 0; // Full LUT loads started, whatever else the device held is gone after one
+	recursive_mutex mutex; // Serializes USB traffic between the acquisition and the supervisor threads
+};
+
+static DeviceState devices[DLPC350_USB_MAX_DEVICES];
+static once_flag hidInit;
+
+static DeviceState& Device()
 {
+	return devices[DLPC350_USB_Selected()];
+}
 
-	unsigned char splashLut[64]; // Array where LUT entries to be sent are stored
-	int numFlashImSeq; // Number of flash images in the sequence
-	bool empty_seq{ true }; // Flag to know if a pattern sequence is parsed
 
 
-	// Connect to device
-	DLPC350_USB_Init();
+static int ConnectDevice(bool verbose = true)
+{
+	// Keep an open connection, re-arming a sequence should not pay for USB enumeration
 	if (DLPC350_USB_IsConnected())
-		DLPC350_USB_Close();
+		return 0;
 
+	DeviceState& device = Device();
+	device.armedHash = 0;
+	call_once(hidInit, [] { DLPC350_USB_Init(); });
 	DLPC350_USB_Open();
 	if (!DLPC350_USB_IsConnected())
 	{
-		printf("Failed to open");
+		if (verbose)
+			printf("Failed to open");
 		return -1;
 	}
 
+	// Get the total number of images stored in flash memory. The first read after opening can time out, an unknown
+	// count would reject every image index later on, so the connection is dropped if it keeps failing.
+	for (int i = 0; i < FLASH_COUNT_RETRIES; i++)
+	{
+		if (DLPC350_GetNumImagesInFlash(&device.numImgInFlash) >= 0)
+			return 0;
+
+		this_thread::sleep_for(chrono::milliseconds(50));
+	}
+
+	device.numImgInFlash = 0;
+	DLPC350_USB_Close();
+	if (verbose)
+		printf("Failed to get the number of images in flash");
+	return -1;
+}
+
 
 
-	// Get the total number of images stored in flash memory
-	unsigned int NumImgInFlash;
-	DLPC350_GetNumImagesInFlash(&NumImgInFlash);
+recursive_mutex& LightCrafterMutex()
+{
+	return Device().mutex;
+}
 
 
-    // Constrcut image sequence
-    if (seq == "all")
-    {
-        numFlashImSeq = NumImgInFlash;
-        for (unsigned int i = 0; i < NumImgInFlash; i++)
-            splashLut[i] = i;
 
-    }
-    else
-    {
-        istringstream fstr(seq);
-        string s;
-        numFlashImSeq = 0; // Get number of images in the given sequence
+int LightCrafterArm(const SequenceProgram& program, bool start)
+{
+	DeviceState& device = Device();
+	lock_guard<recursive_mutex> lock(device.mutex);
 
-        while (getline(fstr, s, '-'))
-        {
-            if (NumImgInFlash - 1 < stoul(s, 0, 10))
-            {
-                printf("Image index error");
-                return -1;
-            }
+	// Check the sequence timing before touching the device
+	SequenceTimingReport timing;
+	if (CheckSequenceTiming(program, timing) < 0)
+	{
+		printf("Invalid sequence timing\n");
+		PrintSequenceTimingReport(timing);
+		return -1;
+	}
 
-            splashLut[numFlashImSeq++] = stoi(s);
-        }
-    }
+	if (ConnectDevice() < 0)
+		return -1;
+
+
+
+	// Same program already in the device: only restart the sequence
+	if (program.hash != 0 && program.hash == device.armedHash)
+	{
+		if (start && (DLPC350_PatternDisplay(0) < 0 || DLPC350_PatternDisplay(2) < 0))
+		{
+			printf("Failed to set pattern display");
+			device.armedHash = 0;
+			return -1;
+		}
+
+		return 0;
+	}
+
+	device.armedHash = 0;
+	device.loads++;
 
 
 
@@ -103,33 +155,20 @@ int LightCrafterFlash(int exposurePeriod, int framePeriod, int repeat, string se
 
 
 
-	// Set up pattern LUT
-	int trigType = 0; // 0 internal, 1 external positive, 2 external negative, 3 no input trigger
-	int bitDepth = 8; // from 1 to 8
-	int bitplaneGroups = 1; // Number of bitplane groups, for 8-bit depth there are 3 patterns to stream
-	int patNum[] = { 0, 1, 2 }; // Index of the 3 bitplane groups (patterns) with 8 bitplanes each one
-	int ledSelect = 7; // 0 no led, 1 red, 2 green, 3 yellow, 4 blue, 5 magenta, 6 cyan, 7 white
-	bool invertPat = false; // true: invert pattern, false: do not invert pattern
-	bool insertBlack = false; // true: insert black-fill pattern, false: do not do it
-	bool bufSwap = false; // true: perform a buffer swap, false: do not do it
-	bool trigOutPrev = false; // true: Trigger Out 1 will continue to be high.
-							// false: Trigger Out 1 has a rising edge at the start of a pattern, 
-							// and a falling edge at the end of the pattern
-	int result;
-	for (int i = 0; i < numFlashImSeq; i++)
+	// Set up pattern LUT, with per-pattern exposure and period in variable exposure mode
+	for (const auto& e : program.patLut)
 	{
-		for (int j = 0; j < bitplaneGroups; j++)
+		int result;
+		if (program.varExposure)
+			result = DLPC350_AddToExpLut(e.trigType, e.patNum, e.bitDepth, e.ledSelect, e.invert, e.insertBlack, e.bufSwap, e.trigOutPrev,
+				e.exposure, e.period);
+		else
+			result = DLPC350_AddToPatLut(e.trigType, e.patNum, e.bitDepth, e.ledSelect, e.invert, e.insertBlack, e.bufSwap, e.trigOutPrev);
+
+		if (result < 0)
 		{
-			if (j == 0)
-				result = DLPC350_AddToPatLut(trigType, patNum[j], bitDepth, ledSelect, invertPat, insertBlack, !bufSwap, trigOutPrev);
-			else
-				result = DLPC350_AddToPatLut(trigType, patNum[j], bitDepth, ledSelect, invertPat, insertBlack, bufSwap, trigOutPrev);
-
-			if (result < 0)
-			{
-				printf("Failed to add to pattern LUT");
-				return -1;
-			}
+			printf("Failed to add to pattern LUT");
+			return -1;
 		}
 	}
 
@@ -146,30 +185,37 @@ int LightCrafterFlash(int exposurePeriod, int framePeriod, int repeat, string se
 
 
 
-	// Set the sequence parameters
-	unsigned int numPatsForTrigOut2; // Number of patterns to display
-
-	numPatsForTrigOut2 = repeat ? 1 : numFlashImSeq * bitplaneGroups; // If repeat, variable must be set to 1, else, must be number of LUT patterns
+	// Set the sequence parameters, and exposure time and frame period in normal mode
+	unsigned int numLutEntries = static_cast<unsigned int>(program.patLut.size());
+	unsigned int numImages = static_cast<unsigned int>(program.imageLut.size());
 
-	if (DLPC350_SetPatternConfig(numFlashImSeq*bitplaneGroups, repeat, numPatsForTrigOut2, numFlashImSeq) < 0)
+	if (program.varExposure)
 	{
-		printf("Failed to set pattern configuration");
-		return -1;
+		if (DLPC350_SetVarExpPatternConfig(numLutEntries, program.numPatsForTrigOut2, numImages, program.repeat) < 0)
+		{
+			printf("Failed to set pattern configuration");
+			return -1;
+		}
 	}
-
-
-
-	// Set exposure time and frame period
-	if (DLPC350_SetExposure_FramePeriod(exposurePeriod, framePeriod) < 0)
+	else
 	{
-		printf("Failed to set exposure/frame period");
-		return -1;
+		if (DLPC350_SetPatternConfig(numLutEntries, program.repeat, program.numPatsForTrigOut2, numImages) < 0)
+		{
+			printf("Failed to set pattern configuration");
+			return -1;
+		}
+
+		if (DLPC350_SetExposure_FramePeriod(program.exposure, program.period) < 0)
+		{
+			printf("Failed to set exposure/frame period");
+			return -1;
+		}
 	}
 
 
 
 	// Set the pattern trigger mode
-	int trigMode = 1; // 0 VSYNC serves to trigger the pattern display sequence
+	int trigMode = program.trigMode; // 0 VSYNC serves to trigger the pattern display sequence
 					// 1 Internally or Externally (through TRIG_IN1 and TRIG_IN2) generated trigger
 					// 2 TRIG_IN_1 alternates between two patterns,while TRIG_IN_2 advances to the next pair of patterns
 					// 3 Internally or externally generated trigger for Variable Exposure display sequence
@@ -183,17 +229,17 @@ int LightCrafterFlash(int exposurePeriod, int framePeriod, int repeat, string se
 
 
 
-	// Send pattern LUT to device
-	if (DLPC350_SendPatLut() < 0)
+	// Send pattern and image LUT to device
+	vector<unsigned char> imageLut = program.imageLut;
+	int result = program.varExposure ? DLPC350_SendVarExpPatLut() : DLPC350_SendPatLut();
+	if (result < 0)
 	{
 		printf("Failed to send pattern LUT");
 		return -1;
 	}
 
-
-
-	// Send image LUT to device
-	if (DLPC350_SendImageLut(&splashLut[0], numFlashImSeq) < 0)
+	result = program.varExposure ? DLPC350_SendVarExpImageLut(imageLut.data(), numImages) : DLPC350_SendImageLut(imageLut.data(), numImages);
+	if (result < 0)
 	{
 		printf("Failed to send image LUT");
 		return -1;
@@ -201,7 +247,7 @@ int LightCrafterFlash(int exposurePeriod, int framePeriod, int repeat, string se
 
 
 
-	// Validate the pattern LUT
+	// Validate the pattern LUT, which confirms the host timing model
 	unsigned int status;
 
 	if (DLPC350_ValidatePatLutData(&status) < 0)
@@ -210,15 +256,158 @@ int LightCrafterFlash(int exposurePeriod, int framePeriod, int repeat, string se
 		return -1;
 	}
 
+	if ((status & SEQ_STATUS_DEVICE_MASK) != (timing.status & SEQ_STATUS_DEVICE_MASK))
+		printf("Pattern LUT validation status 0x%02X, predicted 0x%02X\n", status, timing.status & SEQ_STATUS_DEVICE_MASK);
+
+	if (status & (SEQ_STATUS_EXPOSURE | SEQ_STATUS_PATNUM | SEQ_STATUS_230US))
+	{
+		printf("Pattern LUT rejected by the device");
+		return -1;
+	}
+
 
 
 	// Start the pattern sequence
 	action = 2; // 0 stop, 1 pause, 2 start
-	if (DLPC350_PatternDisplay(action) < 0)
+	if (start && DLPC350_PatternDisplay(action) < 0)
+	{
+		printf("Failed to set pattern display");
+		return -1;
+	}
+
+	device.armedHash = program.hash;
+	if (&program != &device.lastProgram)
+	{
+		device.lastProgram = program;
+		device.haveLastProgram = true;
+	}
+
+	return 0;
+}
+
+
+
+int LightCrafterStop()
+{
+	// Stop a repeating sequence, the program stays armed
+	lock_guard<recursive_mutex> lock(Device().mutex);
+
+	if (!DLPC350_USB_IsConnected())
+		return -1;
+
+	if (DLPC350_PatternDisplay(0) < 0)
 	{
 		printf("Failed to set pattern display");
 		return -1;
 	}
 
 	return 0;
-}
\ No newline at end of file
+}
+
+
+
+int LightCrafterReconnect()
+{
+	// Reopen a lost device and load the last program without starting it
+	DeviceState& device = Device();
+	lock_guard<recursive_mutex> lock(device.mutex);
+
+	if (DLPC350_USB_IsConnected())
+		return 0;
+
+	if (ConnectDevice(false) < 0)
+		return -1;
+
+	return device.haveLastProgram ? LightCrafterArm(device.lastProgram, false) : 0;
+}
+
+
+
+bool LightCrafterProbe()
+{
+	// A status read notices an unplugged device, which the USB layer then marks as disconnected
+	lock_guard<recursive_mutex> lock(Device().mutex);
+
+	unsigned char hwStatus, sysStatus, mainStatus;
+	if (DLPC350_USB_IsConnected())
+		DLPC350_GetStatus(&hwStatus, &sysStatus, &mainStatus);
+
+	return DLPC350_USB_IsConnected() != 0;
+}
+
+
+
+uint64_t LightCrafterArmedHash()
+{
+	return DLPC350_USB_IsConnected() ? Device().armedHash : 0;
+}
+
+
+
+unsigned int LightCrafterLoads()
+{
+	return Device().loads;
+}
+
+
+
+void LightCrafterSetArmed(const SequenceProgram& program)
+{
+	// For code that updates the device LUT without LightCrafterArm()
+	DeviceState& device = Device();
+	lock_guard<recursive_mutex> lock(device.mutex);
+	device.armedHash = program.hash;
+	device.lastProgram = program;
+	device.haveLastProgram = true;
+}
+
+
+
+int LightCrafterFlash(int exposurePeriod, int framePeriod, int repeat, string seq)
+{
+	DeviceState& device = Device();
+	lock_guard<recursive_mutex> lock(device.mutex);
+
+	if (ConnectDevice() < 0)
+		return -1;
+
+
+
+	// Construct image sequence
+	vector<unsigned int> images;
+
+	if (seq == "all")
+	{
+		for (unsigned int i = 0; i < device.numImgInFlash; i++)
+			images.push_back(i);
+	}
+	else
+	{
+		if (ParseImageList(seq, images) < 0)
+		{
+			printf("Invalid image sequence");
+			return -1;
+		}
+
+		for (unsigned int image : images)
+		{
+			if (image >= device.numImgInFlash)
+			{
+				printf("Image index error");
+				return -1;
+			}
+		}
+	}
+
+
+
+	// One 8-bit pattern (first bitplane group) per flash image
+	const SequenceProgram* program = CompileSequenceCached(SequenceFromImages(images, exposurePeriod, framePeriod, repeat != 0));
+	if (program == nullptr)
+	{
+		printf("Invalid pattern sequence");
+		return -1;
+	}
+
+	return LightCrafterArm(*program);
+}
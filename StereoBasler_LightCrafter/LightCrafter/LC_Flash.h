@@ -1,8 +1,19 @@
 #ifndef LC_FLASH_H
 #define LC_FLASH_H
 
+#include "LC_Sequence.h"
+
 #include <string>
+#include <mutex>
 
+int LightCrafterArm(const SequenceProgram&, bool start = true);
+uint64_t LightCrafterArmedHash();
+unsigned int LightCrafterLoads(); // Changes with every full LUT load of the selected device
+void LightCrafterSetArmed(const SequenceProgram&);
 int LightCrafterFlash(int, int, int, std::string);
+int LightCrafterStop();
+int LightCrafterReconnect();
+bool LightCrafterProbe();
+std::recursive_mutex& LightCrafterMutex();
 
 #endif
\ No newline at end of file
@@ -0,0 +1,558 @@
+// LC_FlashProgram.cpp : Flash programming engine on top of the DLPC350 bootloader commands.
+//
+// The device must already be in programming mode (DLPC350_EnterProgrammingMode) with the flash type set
+// (DLPC350_SetFlashType). Sectors are compared against the image through the bootloader checksum and only
+// the ones that changed are erased and rewritten. The sectors come from the flash ID, as boot block parts mix sector
+// sizes. Host and device work overlap: the image part of the next sector is read and summed while the device computes
+// the checksum of the current one, and the data of a sector is prepared while the device erases it. The bootloader
+// has no read command, so the flash bytes of a partly covered sector that lie outside the image can't be kept: an
+// image must start and end on sector boundaries, unless the caller confirms that the rest of those sectors is erased,
+// which one checksum per side then proves before anything is erased.
+// The image is read from a FlashImageSource a piece at a time, so firmware files can be streamed from disk.
+// LightCrafterUpdateFlash() also switches the device to programming mode and back, and leaves the bootloader alone.
+
+
+#include "LC_FlashProgram.h"
+
+#include "dlpc350_common.h"
+#include "dlpc350_api.h"
+#include "dlpc350_usb.h"
+
+#include <cstdio>
+#include <vector>
+#include <functional>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+
+
+using namespace std;
+using namespace std::chrono;
+
+
+static const unsigned int eraseTimeoutMs = 5000; // Worst case sector erase time of the flash part
+static const unsigned int checksumTimeoutMs = 5000; // Checksum over the whole image can take a while
+static const unsigned int programTimeoutMs = 2000; // Time to flush the last uploaded bytes
+
+
+static unsigned int ByteChecksum(const unsigned char* data, unsigned int len)
+{
+	// Same checksum the bootloader computes: 32-bit sum of all bytes
+	unsigned int sum = 0;
+	for (unsigned int i = 0; i < len; i++)
+		sum += data[i];
+
+	return sum;
+}
+
+
+static unsigned int ProgrammedLength(const unsigned char* data, unsigned int len)
+{
+	// Erased flash reads as 0xFF, so trailing 0xFF bytes don't need to be uploaded
+	unsigned int n = len;
+	while (n > 0 && data[n - 1] == 0xFF)
+		n--;
+
+	return n;
+}
+
+
+static double Seconds(steady_clock::time_point start)
+{
+	return duration<double>(steady_clock::now() - start).count();
+}
+
+
+// Host work run while the device is busy with the command just sent, and the seconds of it the device was still busy
+struct FlashOverlap
+{
+	function<void()> work;
+	double* overlapped;
+};
+
+
+static int WaitFlashReady(unsigned int timeoutMs, const FlashOverlap& overlap = { nullptr, nullptr })
+{
+	// Same as DLPC350_WaitForFlashReady() but backing off between polls instead of spinning on the USB link
+	auto start = steady_clock::now();
+	auto delay = microseconds(100);
+	unsigned char status;
+
+	double workTime = 0;
+	if (overlap.work)
+	{
+		overlap.work();
+		workTime = Seconds(start);
+	}
+
+	for (bool first = true; ; first = false)
+	{
+		if (DLPC350_GetBLStatus(&status) < 0)
+			return -1;
+
+		// Still busy after the host work: all of it was hidden behind the device. Otherwise only part of it was, which
+		// is not counted.
+		if (first && overlap.overlapped && (status & STAT_BIT_FLASH_BUSY) != 0)
+			*overlap.overlapped += workTime;
+
+		if ((status & STAT_BIT_FLASH_BUSY) == 0)
+			return 0;
+
+		if (steady_clock::now() - start > milliseconds(timeoutMs))
+			return -1;
+
+		this_thread::sleep_for(delay);
+		delay = min(delay * 2, microseconds(20000));
+	}
+}
+
+
+static int ReadFlashChecksum(unsigned int addr, unsigned int len, unsigned int* checksum, unsigned int timeoutMs,
+	const FlashOverlap& overlap = { nullptr, nullptr })
+{
+	if (DLPC350_SetFlashAddr(addr) < 0 || DLPC350_SetUploadSize(len) < 0)
+		return -1;
+
+	if (DLPC350_CalculateFlashChecksum() < 0 || WaitFlashReady(timeoutMs, overlap) < 0)
+		return -1;
+
+	return DLPC350_GetFlashChecksum(checksum);
+}
+
+
+static int CheckFlashErased(unsigned int addr, unsigned int len)
+{
+	// A byte sum of 0xFF per byte can only come from bytes that are all 0xFF
+	unsigned int sum;
+	if (len > 0 && ReadFlashChecksum(addr, len, &sum, checksumTimeoutMs) < 0)
+		return -1;
+
+	return len == 0 || sum == 0xFFu * len ? 0 : 1;
+}
+
+
+// Calls fn with the pieces of [offset, offset + len) of the image, split where the source needs it
+static int ReadImage(FlashImageSource& source, unsigned int offset, unsigned int len, const function<int(const unsigned char*, unsigned int)>& fn)
+{
+	while (len > 0)
+	{
+		unsigned int n = min(len, FLASH_SECTOR_SIZE - offset % FLASH_SECTOR_SIZE);
+		const unsigned char* data = source.Read(offset, n);
+		if (data == nullptr || fn(data, n) < 0)
+			return -1;
+
+		offset += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+
+
+const unsigned char* ImageWindow::Read(unsigned int offset, unsigned int len)
+{
+	if (offset > size || len > size - offset)
+		return nullptr;
+
+	// Copied only when the piece crosses a sector boundary of the source
+	unsigned int from = start + offset;
+	if (from % FLASH_SECTOR_SIZE + len <= FLASH_SECTOR_SIZE)
+		return source.Read(from, len);
+
+	buffer.clear();
+	int result = ReadImage(source, from, len, [this](const unsigned char* data, unsigned int n)
+	{
+		buffer.insert(buffer.end(), data, data + n);
+		return 0;
+	});
+
+	return result < 0 ? nullptr : buffer.data();
+}
+
+
+
+// Micron (Numonyx) P30 boot block parts: 128 KB main sectors and four 32 KB parameter sectors at one end
+struct FlashPart
+{
+	unsigned short manID, devID;
+	const char* name;
+	unsigned int mbit;
+	bool top; // Parameter sectors at the top of the address space
+};
+
+static const FlashPart flashParts[] =
+{
+	{ 0x0089, 0x8817, "28F640P30T", 64, true },
+	{ 0x0089, 0x881A, "28F640P30B", 64, false },
+	{ 0x0089, 0x8818, "28F128P30T", 128, true },
+	{ 0x0089, 0x881B, "28F128P30B", 128, false },
+	{ 0x0089, 0x8919, "28F256P30T", 256, true },
+	{ 0x0089, 0x891C, "28F256P30B", 256, false },
+};
+
+static const unsigned int parameterSectors = 4;
+static const unsigned int parameterSectorSize = 0x8000;
+static const unsigned int mainSectorSize = 0x20000;
+
+
+int FlashGeometryFromID(unsigned short manID, unsigned short devID, FlashGeometry& geometry)
+{
+	for (const FlashPart& part : flashParts)
+	{
+		if (part.manID != manID || part.devID != devID)
+			continue;
+
+		FlashGeometry g;
+		g.manID = manID;
+		g.devID = devID;
+		g.name = part.name;
+		g.size = part.mbit << 17;
+
+		unsigned int parameterStart = part.top ? g.size - mainSectorSize : 0;
+		for (unsigned int addr = 0; addr < g.size; )
+		{
+			g.sectors.push_back(addr);
+			addr += addr >= parameterStart && addr < parameterStart + mainSectorSize ? parameterSectorSize : mainSectorSize;
+		}
+
+		geometry = g;
+		return 0;
+	}
+
+	printf("Unknown flash part, manufacturer ID 0x%04X, device ID 0x%04X\n", manID, devID);
+	return -1;
+}
+
+
+int LightCrafterFlashGeometry(FlashGeometry& geometry)
+{
+	unsigned short manID;
+	unsigned long long devID;
+	if (DLPC350_GetFlashManID(&manID) < 0 || DLPC350_GetFlashDevID(&devID) < 0)
+	{
+		printf("Failed to read the flash ID\n");
+		return -1;
+	}
+
+	// The device code is the first word of the ID
+	return FlashGeometryFromID(manID, static_cast<unsigned short>(devID & 0xFFFF), geometry);
+}
+
+
+
+int LightCrafterProgramFlash(unsigned int startAddr, const unsigned char* data, unsigned int dataLen, const FlashGeometry& geometry,
+	FlashProgramReport& report, FlashProgressCallback progress, bool erasedAround)
+{
+	if (data == nullptr)
+	{
+		report = FlashProgramReport();
+		printf("Invalid flash image or start address");
+		return -1;
+	}
+
+	MemoryImageSource source(data, dataLen);
+	return LightCrafterProgramFlash(startAddr, source, geometry, report, progress, erasedAround);
+}
+
+
+int LightCrafterProgramFlash(unsigned int startAddr, FlashImageSource& source, const FlashGeometry& geometry, FlashProgramReport& report,
+	FlashProgressCallback progress, bool erasedAround)
+{
+	report = FlashProgramReport();
+	unsigned int dataLen = source.Size();
+
+	if (dataLen == 0 || geometry.sectors.empty() || startAddr >= geometry.size || dataLen > geometry.size - startAddr)
+	{
+		printf("Invalid flash image or start address");
+		return -1;
+	}
+
+	// Flash address where every covered sector starts, and the end of the last one
+	unsigned int endAddr = startAddr + dataLen;
+	auto firstSector = prev(upper_bound(geometry.sectors.begin(), geometry.sectors.end(), startAddr));
+	vector<unsigned int> starts;
+	auto it = firstSector;
+	for (; it != geometry.sectors.end() && *it < endAddr; ++it)
+		starts.push_back(*it);
+	starts.push_back(it == geometry.sectors.end() ? geometry.size : *it);
+
+	// Image offset where the image part of every sector starts, and the end of the image
+	unsigned int numSectors = static_cast<unsigned int>(starts.size()) - 1;
+	vector<unsigned int> begins(numSectors + 1);
+	for (unsigned int s = 0; s < numSectors; s++)
+		begins[s] = max(starts[s], startAddr) - startAddr;
+	begins[numSectors] = dataLen;
+
+	// Flash bytes of the first and last sector outside the image, written back erased
+	unsigned int headLen = startAddr - starts[0], tailLen = starts[numSectors] - endAddr;
+	vector<unsigned char> head, tail;
+
+	if ((headLen > 0 || tailLen > 0) && !erasedAround)
+	{
+		printf("Flash image 0x%X-0x%X not on sector boundaries 0x%X-0x%X, the rest of these sectors must be erased",
+			startAddr, endAddr, starts[0], starts[numSectors]);
+		return -1;
+	}
+
+	auto tStart = steady_clock::now();
+	unsigned int bytesDone = 0;
+	report.sectorsTotal = numSectors;
+
+
+
+	// Sector diffing: checksum of the image part of every sector on the host, checksum of the same flash bytes on the
+	// device. The host sums the next sector while the device sums the current one.
+	auto t = steady_clock::now();
+	vector<unsigned int> sums(numSectors);
+	vector<bool> dirty(numSectors);
+	int imageRead = 0;
+	auto sumSector = [&](unsigned int s)
+	{
+		auto tPrepare = steady_clock::now();
+		imageRead = ReadImage(source, begins[s], begins[s + 1] - begins[s], [&](const unsigned char* data, unsigned int n)
+		{
+			sums[s] += ByteChecksum(data, n);
+			return 0;
+		});
+		report.prepareTime += Seconds(tPrepare);
+	};
+
+	sumSector(0);
+	for (unsigned int s = 0; s < numSectors; s++)
+	{
+		if (imageRead < 0)
+		{
+			printf("Failed to read flash image");
+			return -1;
+		}
+
+		unsigned int len = begins[s + 1] - begins[s], devSum;
+		FlashOverlap next = { nullptr, &report.overlapTime };
+		if (s + 1 < numSectors)
+			next.work = [&, s] { sumSector(s + 1); };
+
+		if (ReadFlashChecksum(startAddr + begins[s], len, &devSum, checksumTimeoutMs, next) < 0)
+		{
+			printf("Failed to read flash sector checksum");
+			return -1;
+		}
+
+		// Note that a byte sum can't tell apart sectors whose bytes were only reordered
+		dirty[s] = sums[s] != devSum;
+		if (!dirty[s])
+		{
+			report.sectorsSkipped++;
+			bytesDone += len;
+		}
+	}
+
+	// Partly covered sectors that change are only rewritten when the rest of their content is erased
+	if (headLen > 0 && dirty[0])
+		head.assign(headLen, 0xFF);
+	if (tailLen > 0 && dirty[numSectors - 1])
+		tail.assign(tailLen, 0xFF);
+
+	int erased = CheckFlashErased(starts[0], static_cast<unsigned int>(head.size()));
+	if (erased == 0)
+		erased = CheckFlashErased(endAddr, static_cast<unsigned int>(tail.size()));
+	if (erased != 0)
+	{
+		printf(erased < 0 ? "Failed to read flash checksum" : "Flash bytes around the image are not erased");
+		return -1;
+	}
+	report.diffTime = Seconds(t);
+
+	if (progress)
+		progress(bytesDone, dataLen);
+
+
+
+	// Erase and rewrite every changed sector. Its flash content, erased head bytes, image part and erased tail bytes, is
+	// put together while the device erases it.
+	vector<unsigned char> buffer;
+	for (unsigned int s = 0; s < numSectors; s++)
+	{
+		if (!dirty[s])
+			continue;
+
+		unsigned int sectorLen = begins[s + 1] - begins[s];
+		unsigned int len = 0;
+		auto prepare = [&]
+		{
+			auto tPrepare = steady_clock::now();
+			buffer.clear();
+			if (s == 0)
+				buffer.insert(buffer.end(), head.begin(), head.end());
+			imageRead = ReadImage(source, begins[s], sectorLen, [&](const unsigned char* data, unsigned int n)
+			{
+				buffer.insert(buffer.end(), data, data + n);
+				return 0;
+			});
+			if (s + 1 == numSectors)
+				buffer.insert(buffer.end(), tail.begin(), tail.end());
+
+			// Trailing erased bytes are not uploaded, the length stays word aligned for the bootloader
+			unsigned int k = ProgrammedLength(buffer.data(), static_cast<unsigned int>(buffer.size()));
+			len = min<unsigned int>(ALIGN_BYTES_NEXT(k, 4), static_cast<unsigned int>(buffer.size()));
+			report.prepareTime += Seconds(tPrepare);
+		};
+
+		t = steady_clock::now();
+		if (DLPC350_SetFlashAddr(starts[s]) < 0 || DLPC350_FlashSectorErase() < 0 ||
+			WaitFlashReady(eraseTimeoutMs, { prepare, &report.overlapTime }) < 0)
+		{
+			printf("Failed to erase flash sector");
+			return -1;
+		}
+		report.eraseTime += Seconds(t);
+		report.sectorsErased++;
+
+		if (imageRead < 0)
+		{
+			printf("Failed to read flash image");
+			return -1;
+		}
+
+		unsigned int sent = 0;
+
+		t = steady_clock::now();
+		if (len > 0)
+		{
+			if (DLPC350_SetFlashAddr(starts[s]) < 0 || DLPC350_SetUploadSize(len) < 0)
+			{
+				printf("Failed to set flash upload address/size");
+				return -1;
+			}
+
+			while (sent < len)
+			{
+				int n = DLPC350_UploadData(buffer.data() + sent, len - sent);
+				if (n <= 0)
+				{
+					printf("Failed to upload flash data");
+					return -1;
+				}
+
+				sent += n;
+				if (progress)
+					progress(bytesDone + min(sent, sectorLen), dataLen);
+			}
+
+			// UploadData is not acknowledged, wait for the bootloader to finish programming the sector instead
+			if (WaitFlashReady(programTimeoutMs) < 0)
+			{
+				printf("Flash programming timeout");
+				return -1;
+			}
+		}
+		report.uploadTime += Seconds(t);
+		report.bytesUploaded += sent;
+
+		bytesDone += sectorLen;
+		if (progress)
+			progress(bytesDone, dataLen);
+	}
+
+
+
+	// Verify the whole image and the bytes kept around it
+	t = steady_clock::now();
+	unsigned int expected = 0;
+	for (unsigned int sum : sums)
+		expected += sum;
+
+	unsigned int headSum = 0, tailSum = 0;
+	if (ReadFlashChecksum(startAddr, dataLen, &report.checksum, checksumTimeoutMs) < 0 ||
+		(!head.empty() && ReadFlashChecksum(starts[0], headLen, &headSum, checksumTimeoutMs) < 0) ||
+		(!tail.empty() && ReadFlashChecksum(endAddr, tailLen, &tailSum, checksumTimeoutMs) < 0))
+	{
+		printf("Failed to calculate flash checksum");
+		return -1;
+	}
+	report.verifyTime = Seconds(t);
+	report.totalTime = Seconds(tStart);
+
+	if (report.checksum != expected)
+	{
+		printf("Flash checksum mismatch: device 0x%08X, expected 0x%08X", report.checksum, expected);
+		return -1;
+	}
+
+	if (headSum != ByteChecksum(head.data(), static_cast<unsigned int>(head.size())) || tailSum != ByteChecksum(tail.data(), static_cast<unsigned int>(tail.size())))
+	{
+		printf("Flash content around the image changed");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+int LightCrafterUpdateFlash(unsigned int startAddr, FlashImageSource& source, FlashProgramReport& report, FlashProgressCallback progress,
+	bool bootloader, bool erasedAround)
+{
+	// The part of the image that falls on the bootloader is left out, unless it is meant to be replaced
+	unsigned int skip = 0;
+	if (!bootloader && startAddr < FLASH_BOOTLOADER_SIZE)
+	{
+		skip = min(FLASH_BOOTLOADER_SIZE - startAddr, source.Size());
+		printf("Leaving the bootloader alone, %u bytes of the image not written\n", skip);
+	}
+
+	report = FlashProgramReport();
+	if (skip == source.Size())
+		return 0;
+
+	ImageWindow window(source, skip, source.Size() - skip);
+
+	// Connect to device and switch to the bootloader
+	DLPC350_USB_Init();
+	if (DLPC350_USB_IsConnected())
+		DLPC350_USB_Close();
+
+	DLPC350_USB_Open();
+	if (!DLPC350_USB_IsConnected())
+	{
+		printf("Failed to open");
+		return -1;
+	}
+
+	DLPC350_EnterProgrammingMode();
+	DLPC350_USB_Close();
+
+	// The device re-enumerates in programming mode
+	for (int i = 0; i < 50 && !DLPC350_USB_IsConnected(); i++)
+	{
+		this_thread::sleep_for(milliseconds(200));
+		DLPC350_USB_Open();
+	}
+
+	if (!DLPC350_USB_IsConnected())
+	{
+		printf("Failed to reconnect in programming mode");
+		return -1;
+	}
+
+	FlashGeometry geometry;
+	int result = LightCrafterFlashGeometry(geometry);
+	if (result == 0)
+		result = LightCrafterProgramFlash(startAddr + skip, window, geometry, report, progress, erasedAround);
+
+	DLPC350_ExitProgrammingMode();
+	DLPC350_USB_Close();
+
+	return result;
+}
+
+
+void PrintFlashProgramReport(const FlashProgramReport& report)
+{
+	double uploadRate = report.uploadTime > 0 ? report.bytesUploaded / 1024.0 / report.uploadTime : 0;
+
+	printf("Flash update: %u of %u sectors rewritten, %u unchanged\n", report.sectorsErased, report.sectorsTotal, report.sectorsSkipped);
+	printf("  diff %.2f s, erase %.2f s, upload %.2f s (%u bytes, %.1f KB/s), verify %.2f s\n",
+		report.diffTime, report.eraseTime, report.uploadTime, report.bytesUploaded, uploadRate, report.verifyTime);
+	printf("  image read %.2f s, %.2f s of it while the device was busy\n", report.prepareTime, report.overlapTime);
+	printf("  total %.2f s, checksum 0x%08X\n", report.totalTime, report.checksum);
+}
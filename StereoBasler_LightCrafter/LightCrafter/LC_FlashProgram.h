@@ -0,0 +1,92 @@
+#ifndef LC_FLASHPROGRAM_H
+#define LC_FLASHPROGRAM_H
+
+#include <functional>
+#include <vector>
+
+#define FLASH_SECTOR_SIZE 0x20000 // Read granularity of the image sources, the main block size of the LightCrafter 4500 flash (128 KB)
+#define FLASH_BOOTLOADER_SIZE 0x20000 // Bootloader at the start of the flash, the first 128 KB of a firmware image
+
+// Called with the number of bytes already handled (skipped sectors included) and the total number of bytes
+typedef std::function<void(unsigned int, unsigned int)> FlashProgressCallback;
+
+struct FlashProgramReport
+{
+	unsigned int sectorsTotal = 0; // Sectors covered by the image
+	unsigned int sectorsSkipped = 0; // Sectors whose flash content already matched the image
+	unsigned int sectorsErased = 0; // Sectors erased and rewritten
+	unsigned int bytesUploaded = 0; // Bytes actually sent through DLPC350_UploadData
+	unsigned int checksum = 0; // Checksum computed by the device over the whole image after programming
+
+	double diffTime = 0; // Seconds spent reading back sector checksums
+	double eraseTime = 0; // Seconds spent erasing
+	double uploadTime = 0; // Seconds spent uploading data
+	double verifyTime = 0; // Seconds spent on the final checksum
+	double prepareTime = 0; // Seconds spent reading and summing the image on the host, part of the times above
+	double overlapTime = 0; // Seconds of prepareTime during which the device was busy erasing or summing, at least
+	double totalTime = 0;
+};
+
+// Erase sectors of the flash part, found from its manufacturer and device ID. Boot block parts have smaller
+// parameter sectors at the bottom or the top, so the sector size can't be assumed.
+struct FlashGeometry
+{
+	unsigned short manID = 0;
+	unsigned short devID = 0;
+	const char* name = "";
+	unsigned int size = 0; // Bytes
+	std::vector<unsigned int> sectors; // Start address of every sector, increasing
+};
+
+// Flash image read by the programmer one piece at a time, so it doesn't have to be in memory as a whole.
+// Read() returns bytes [offset, offset + len), never crossing a FLASH_SECTOR_SIZE boundary, valid until the next call,
+// or nullptr on error. Reads happen from one thread at a time.
+class FlashImageSource
+{
+public:
+	virtual ~FlashImageSource() = default;
+	virtual unsigned int Size() const = 0;
+	virtual const unsigned char* Read(unsigned int, unsigned int) = 0;
+};
+
+// Image already in memory
+class MemoryImageSource : public FlashImageSource
+{
+public:
+	MemoryImageSource(const unsigned char* data, unsigned int size) : data(data), size(size) {}
+	unsigned int Size() const override { return size; }
+	const unsigned char* Read(unsigned int offset, unsigned int) override { return data + offset; }
+
+private:
+	const unsigned char* data;
+	unsigned int size;
+};
+
+// Bytes [start, start + size) of another image
+class ImageWindow : public FlashImageSource
+{
+public:
+	ImageWindow(FlashImageSource& source, unsigned int start, unsigned int size) : source(source), start(start), size(size) {}
+	unsigned int Size() const override { return size; }
+	const unsigned char* Read(unsigned int, unsigned int) override;
+
+private:
+	FlashImageSource& source;
+	unsigned int start;
+	unsigned int size;
+	std::vector<unsigned char> buffer; // Pieces that cross a sector boundary of the source
+};
+
+int FlashGeometryFromID(unsigned short, unsigned short, FlashGeometry&); // -1 for a part that isn't known
+int LightCrafterFlashGeometry(FlashGeometry&); // Programming mode only
+// An image that does not start and end on sector boundaries is refused, unless erasedAround confirms that the rest of
+// its first and last sector is erased
+int LightCrafterProgramFlash(unsigned int, const unsigned char*, unsigned int, const FlashGeometry&, FlashProgramReport&,
+	FlashProgressCallback progress = nullptr, bool erasedAround = false);
+int LightCrafterProgramFlash(unsigned int, FlashImageSource&, const FlashGeometry&, FlashProgramReport&, FlashProgressCallback progress = nullptr,
+	bool erasedAround = false);
+int LightCrafterUpdateFlash(unsigned int, FlashImageSource&, FlashProgramReport&, FlashProgressCallback progress = nullptr,
+	bool bootloader = false, bool erasedAround = false);
+void PrintFlashProgramReport(const FlashProgramReport&);
+
+#endif
@@ -0,0 +1,613 @@
+// LC_Hidraw.cpp : Linux transport for the DLPC350 over /dev/hidraw, without hidapi.
+//
+// Implements the part of the hidapi interface used by dlpc350_usb.cpp on top of non-blocking hidraw descriptors:
+// devices are found through sysfs (vendor, product and serial number from the uevent of each hidraw node), writes
+// wait for the descriptor to become writable, and reads wait with poll() for the given timeout instead of blocking.
+// HidrawEventLoop drives several devices and several in-flight commands from one epoll thread, assembling the reports
+// of each reply and matching it to the oldest message waiting on its device. dlpc350_usb.cpp registers every device
+// it opens with one shared loop, so the replies of all projectors are read by that thread; the synchronous hid_*
+// functions remain for enumeration and for callers without a loop. On Windows this file is empty and hidapi.lib is
+// used.
+
+
+#ifdef __linux__
+
+#include "LC_Hidraw.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cwchar>
+#include <cerrno>
+#include <string>
+#include <fstream>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+
+using namespace std;
+
+
+struct hid_device_
+{
+	int fd;
+	bool blocking;
+};
+
+
+
+static wchar_t* Widen(const string& s)
+{
+	wchar_t* w = static_cast<wchar_t*>(calloc(s.size() + 1, sizeof(wchar_t)));
+	for (size_t i = 0; i < s.size(); i++)
+		w[i] = static_cast<unsigned char>(s[i]);
+
+	return w;
+}
+
+
+static bool ReadUevent(const string& node, unsigned short& vendor, unsigned short& product, string& serial)
+{
+	// HID_ID=0003:00000451:00006401 and HID_UNIQ=<serial> in /sys/class/hidraw/hidrawN/device/uevent
+	ifstream uevent("/sys/class/hidraw/" + node + "/device/uevent");
+	string line;
+	bool found = false;
+
+	while (getline(uevent, line))
+	{
+		unsigned int bus, v, p;
+		if (sscanf(line.c_str(), "HID_ID=%x:%x:%x", &bus, &v, &p) == 3)
+		{
+			vendor = static_cast<unsigned short>(v);
+			product = static_cast<unsigned short>(p);
+			found = true;
+		}
+		else if (line.compare(0, 9, "HID_UNIQ=") == 0)
+			serial = line.substr(9);
+	}
+
+	return found;
+}
+
+
+
+int HID_API_EXPORT HID_API_CALL hid_init(void)
+{
+	return 0;
+}
+
+
+int HID_API_EXPORT HID_API_CALL hid_exit(void)
+{
+	return 0;
+}
+
+
+struct hid_device_info HID_API_EXPORT * HID_API_CALL hid_enumerate(unsigned short vendor_id, unsigned short product_id)
+{
+	DIR* dir = opendir("/sys/class/hidraw");
+	if (!dir)
+		return nullptr;
+
+	vector<string> nodes;
+	while (dirent* entry = readdir(dir))
+		if (strncmp(entry->d_name, "hidraw", 6) == 0)
+			nodes.push_back(entry->d_name);
+	closedir(dir);
+	sort(nodes.begin(), nodes.end());
+
+	hid_device_info* first = nullptr;
+	hid_device_info** last = &first;
+
+	for (const auto& node : nodes)
+	{
+		unsigned short vendor, product;
+		string serial;
+		if (!ReadUevent(node, vendor, product, serial))
+			continue;
+		if ((vendor_id && vendor != vendor_id) || (product_id && product != product_id))
+			continue;
+
+		hid_device_info* info = static_cast<hid_device_info*>(calloc(1, sizeof(hid_device_info)));
+		info->path = strdup(("/dev/" + node).c_str());
+		info->vendor_id = vendor;
+		info->product_id = product;
+		info->serial_number = Widen(serial);
+		info->manufacturer_string = Widen("");
+		info->product_string = Widen("");
+		info->interface_number = -1;
+
+		*last = info;
+		last = &info->next;
+	}
+
+	return first;
+}
+
+
+void HID_API_EXPORT HID_API_CALL hid_free_enumeration(struct hid_device_info* devs)
+{
+	while (devs)
+	{
+		hid_device_info* next = devs->next;
+		free(devs->path);
+		free(devs->serial_number);
+		free(devs->manufacturer_string);
+		free(devs->product_string);
+		free(devs);
+		devs = next;
+	}
+}
+
+
+HID_API_EXPORT hid_device* HID_API_CALL hid_open(unsigned short vendor_id, unsigned short product_id, const wchar_t* serial_number)
+{
+	hid_device_info* devs = hid_enumerate(vendor_id, product_id);
+	hid_device* device = nullptr;
+
+	for (hid_device_info* d = devs; d && !device; d = d->next)
+		if (!serial_number || wcscmp(serial_number, d->serial_number) == 0)
+			device = hid_open_path(d->path);
+
+	hid_free_enumeration(devs);
+	return device;
+}
+
+
+HID_API_EXPORT hid_device* HID_API_CALL hid_open_path(const char* path)
+{
+	int fd = HidrawOpenPath(path);
+	return fd < 0 ? nullptr : HidrawWrap(fd);
+}
+
+
+int HID_API_EXPORT HID_API_CALL hid_write(hid_device* device, const unsigned char* data, size_t length)
+{
+	// First byte is the report number, 0 for the DLPC350, as with hidapi
+	for (;;)
+	{
+		ssize_t n = write(device->fd, data, length);
+		if (n >= 0)
+			return static_cast<int>(n);
+		if (errno == EINTR)
+			continue;
+		if (errno != EAGAIN)
+			return -1;
+
+		pollfd p = { device->fd, POLLOUT, 0 };
+		if (poll(&p, 1, 1000) <= 0 || (p.revents & (POLLERR | POLLHUP)))
+			return -1;
+	}
+}
+
+
+int HID_API_EXPORT HID_API_CALL hid_read_timeout(hid_device* device, unsigned char* data, size_t length, int milliseconds)
+{
+	pollfd p = { device->fd, POLLIN, 0 };
+	int ready;
+	while ((ready = poll(&p, 1, milliseconds)) < 0 && errno == EINTR)
+		;
+
+	if (ready < 0 || (p.revents & (POLLERR | POLLHUP | POLLNVAL)))
+		return -1;
+	if (ready == 0)
+		return 0;
+
+	ssize_t n = read(device->fd, data, length);
+	if (n < 0)
+		return errno == EAGAIN || errno == EINTR ? 0 : -1;
+
+	return static_cast<int>(n);
+}
+
+
+int HID_API_EXPORT HID_API_CALL hid_read(hid_device* device, unsigned char* data, size_t length)
+{
+	return hid_read_timeout(device, data, length, device->blocking ? -1 : 0);
+}
+
+
+int HID_API_EXPORT HID_API_CALL hid_set_nonblocking(hid_device* device, int nonblock)
+{
+	device->blocking = !nonblock;
+	return 0;
+}
+
+
+void HID_API_EXPORT HID_API_CALL hid_close(hid_device* device)
+{
+	if (!device)
+		return;
+
+	close(device->fd);
+	delete device;
+}
+
+
+
+int HidrawOpenPath(const char* path)
+{
+	return open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+}
+
+
+hid_device* HidrawWrap(int fd)
+{
+	// The descriptor stays non-blocking, hid_read_timeout() waits with poll()
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	return new hid_device{ fd, true };
+}
+
+
+int HidrawDescriptor(hid_device* device)
+{
+	return device ? device->fd : -1;
+}
+
+
+
+HidrawEventLoop::HidrawEventLoop()
+{
+	epollFd = epoll_create1(EPOLL_CLOEXEC);
+	wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	epoll_event ev = {};
+	ev.events = EPOLLIN;
+	ev.data.u64 = ~0ull;
+	epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &ev);
+}
+
+
+HidrawEventLoop::~HidrawEventLoop()
+{
+	Stop();
+
+	// Whatever is left fails
+	RunOnce(0);
+	for (auto& d : devices)
+		Fail(*d);
+
+	close(wakeFd);
+	close(epollFd);
+}
+
+
+
+int HidrawEventLoop::Add(int fd, unsigned int maxInFlight)
+{
+	// The loop thread takes the device over before it handles the first event of the descriptor
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+	unique_ptr<Device> device(new Device());
+	device->fd = fd;
+	device->maxInFlight = max(1u, maxInFlight);
+
+	lock_guard<mutex> lock(incomingMutex);
+	device->index = numDevices;
+
+	epoll_event ev = {};
+	ev.events = EPOLLIN;
+	ev.data.u64 = device->index;
+	if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) < 0)
+		return -1;
+
+	added.push_back(move(device));
+	return numDevices++;
+}
+
+
+
+int HidrawEventLoop::Remove(int device)
+{
+	// Returns once the loop let go of the descriptor, the caller closes it. Messages still pending fail.
+	if (device < 0 || device >= numDevices)
+		return -1;
+
+	unique_lock<mutex> lock(incomingMutex);
+	removing.push_back(device);
+	unsigned long long request = ++removeRequests;
+
+	if (!running)
+	{
+		lock.unlock();
+		RunOnce(0);
+		return 0;
+	}
+
+	lock.unlock();
+	Wake();
+	lock.lock();
+	removed.wait(lock, [&] { return removesDone >= request; });
+	return 0;
+}
+
+
+
+int HidrawEventLoop::Submit(int device, const unsigned char* message, size_t length, HidrawCallback callback, int timeoutMs)
+{
+	if (device < 0 || device >= numDevices || length < 4)
+		return -1;
+
+	// Split the message into reports, each one starting with report number 0
+	Message m;
+	size_t numReports = (length + HIDRAW_REPORT_SIZE - 1) / HIDRAW_REPORT_SIZE;
+	m.reports.assign(numReports * (HIDRAW_REPORT_SIZE + 1), 0);
+	for (size_t r = 0; r < numReports; r++)
+	{
+		size_t n = min<size_t>(HIDRAW_REPORT_SIZE, length - r * HIDRAW_REPORT_SIZE);
+		memcpy(&m.reports[r * (HIDRAW_REPORT_SIZE + 1) + 1], message + r * HIDRAW_REPORT_SIZE, n);
+	}
+
+	m.reply = (message[0] & 0xC0) != 0; // Read, or write with reply requested
+	m.callback = move(callback);
+	m.timeout = chrono::milliseconds(timeoutMs);
+
+	{
+		lock_guard<mutex> lock(incomingMutex);
+		incoming.push_back({ device, move(m) });
+	}
+	pending++;
+
+	Wake();
+	return 0;
+}
+
+
+void HidrawEventLoop::Wake()
+{
+	uint64_t one = 1;
+	if (write(wakeFd, &one, sizeof(one)) < 0)
+		perror("eventfd");
+}
+
+
+
+void HidrawEventLoop::Complete(Message& m, int status, const unsigned char* reply, size_t length)
+{
+	if (m.callback)
+		m.callback(status, reply, length);
+	pending--;
+}
+
+
+void HidrawEventLoop::Fail(Device& d)
+{
+	// A closed or broken descriptor stays readable, it is taken out of the epoll set
+	if (!d.failed && d.fd >= 0)
+		epoll_ctl(epollFd, EPOLL_CTL_DEL, d.fd, nullptr);
+
+	d.failed = true;
+	for (auto& m : d.waiting)
+		Complete(m, -1, nullptr, 0);
+	for (auto& m : d.queued)
+		Complete(m, -1, nullptr, 0);
+
+	d.waiting.clear();
+	d.queued.clear();
+	d.reply.clear();
+}
+
+
+void HidrawEventLoop::Watch(Device& d, bool wantWrite)
+{
+	if (d.failed || d.wantWrite == wantWrite)
+		return;
+
+	epoll_event ev = {};
+	ev.events = wantWrite ? EPOLLIN | EPOLLOUT : EPOLLIN;
+	ev.data.u64 = d.index;
+
+	epoll_ctl(epollFd, EPOLL_CTL_MOD, d.fd, &ev);
+	d.wantWrite = wantWrite;
+}
+
+
+void HidrawEventLoop::Read(Device& d)
+{
+	unsigned char report[HIDRAW_REPORT_SIZE + 1];
+
+	for (;;)
+	{
+		ssize_t n = read(d.fd, report, sizeof(report));
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN)
+				Fail(d);
+			return;
+		}
+		if (n == 0)
+		{
+			Fail(d); // Peer closed
+			return;
+		}
+
+		// The device answers in order: the reply belongs to the oldest waiting message. Stray reports are dropped.
+		if (d.waiting.empty())
+		{
+			d.reply.clear();
+			continue;
+		}
+
+		// A reply longer than a report continues in the next ones; the header gives the length of the payload
+		d.reply.insert(d.reply.end(), report, report + n);
+		if (d.reply.size() < 4)
+			continue;
+
+		size_t length = 4 + (d.reply[2] | (d.reply[3] << 8));
+		bool nack = (d.reply[0] & 0x20) != 0;
+		if (!nack && d.reply.size() < length)
+			continue;
+
+		d.reply.resize(min(length, d.reply.size()));
+		Message m = move(d.waiting.front());
+		d.waiting.pop_front();
+		Complete(m, 0, d.reply.data(), d.reply.size());
+		d.reply.clear();
+	}
+}
+
+
+void HidrawEventLoop::Write(Device& d)
+{
+	while (!d.failed && !d.queued.empty() && d.waiting.size() < d.maxInFlight)
+	{
+		Message& m = d.queued.front();
+		size_t numReports = m.reports.size() / (HIDRAW_REPORT_SIZE + 1);
+
+		while (m.written < numReports)
+		{
+			ssize_t n = write(d.fd, &m.reports[m.written * (HIDRAW_REPORT_SIZE + 1)], HIDRAW_REPORT_SIZE + 1);
+			if (n < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				if (errno == EAGAIN)
+				{
+					Watch(d, true);
+					return;
+				}
+				Fail(d);
+				return;
+			}
+			m.written++;
+		}
+
+		Message done = move(m);
+		d.queued.pop_front();
+
+		if (done.reply)
+		{
+			done.deadline = chrono::steady_clock::now() + done.timeout;
+			d.waiting.push_back(move(done));
+		}
+		else
+			Complete(done, 0, nullptr, 0);
+	}
+
+	Watch(d, false);
+}
+
+
+
+int HidrawEventLoop::RunOnce(int timeoutMs)
+{
+	// Wake up for the nearest reply deadline at the latest
+	auto now = chrono::steady_clock::now();
+	for (auto& d : devices)
+		if (!d->waiting.empty())
+		{
+			long long left = max<long long>(0, chrono::duration_cast<chrono::milliseconds>(d->waiting.front().deadline - now).count() + 1);
+			if (timeoutMs < 0 || left < timeoutMs)
+				timeoutMs = static_cast<int>(left);
+		}
+
+	epoll_event events[16];
+	int n = epoll_wait(epollFd, events, 16, timeoutMs);
+	if (n < 0 && errno != EINTR)
+		return -1;
+
+	// Devices, messages and removals from other threads
+	vector<pair<int, Message>> batch;
+	vector<int> removals;
+	unsigned long long requests;
+	{
+		lock_guard<mutex> lock(incomingMutex);
+		for (auto& d : added)
+			devices.push_back(move(d));
+		added.clear();
+		batch.swap(incoming);
+		removals.swap(removing);
+		requests = removeRequests;
+	}
+
+	for (int r : removals)
+	{
+		Fail(*devices[r]);
+		devices[r]->fd = -1;
+	}
+
+	if (!removals.empty())
+	{
+		lock_guard<mutex> lock(incomingMutex);
+		removesDone = requests;
+		removed.notify_all();
+	}
+
+	for (int i = 0; i < n; i++)
+	{
+		if (events[i].data.u64 == ~0ull)
+		{
+			uint64_t count;
+			while (read(wakeFd, &count, sizeof(count)) > 0)
+				;
+			continue;
+		}
+
+		Device& d = *devices[events[i].data.u64];
+		if (d.failed)
+			continue; // Removed, or failed on an earlier event
+		if (events[i].events & EPOLLIN)
+			Read(d);
+		if (events[i].events & (EPOLLERR | EPOLLHUP))
+			Fail(d);
+	}
+
+	// New messages
+	for (auto& b : batch)
+	{
+		if (devices[b.first]->failed)
+			Complete(b.second, -1, nullptr, 0);
+		else
+			devices[b.first]->queued.push_back(move(b.second));
+	}
+
+	// Replies that did not come
+	now = chrono::steady_clock::now();
+	for (auto& d : devices)
+		while (!d->waiting.empty() && d->waiting.front().deadline <= now)
+		{
+			Message m = move(d->waiting.front());
+			d->waiting.pop_front();
+			d->reply.clear(); // Part of a reply that did not finish
+			Complete(m, -2, nullptr, 0);
+		}
+
+	for (auto& d : devices)
+		Write(*d);
+
+	return n;
+}
+
+
+
+void HidrawEventLoop::Start()
+{
+	if (running.exchange(true))
+		return;
+
+	worker = thread([this]
+	{
+		while (running)
+			RunOnce(100);
+	});
+}
+
+
+void HidrawEventLoop::Stop()
+{
+	if (!running.exchange(false))
+		return;
+
+	Wake();
+	worker.join();
+}
+
+#endif
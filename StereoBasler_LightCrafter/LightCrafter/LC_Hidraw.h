@@ -0,0 +1,97 @@
+#ifndef LC_HIDRAW_H
+#define LC_HIDRAW_H
+
+#ifdef __linux__
+
+#include "hidapi.h"
+
+#include <functional>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+#define HIDRAW_REPORT_SIZE 64
+
+// Completion of one message: status 0 with the whole reply, header and payload (nullptr for messages without reply),
+// -1 when the device failed or was removed, -2 when the reply did not come in time
+typedef std::function<void(int, const unsigned char*, size_t)> HidrawCallback;
+
+// One thread serving several devices. Messages are whole DLPC350 commands (header and payload), split into
+// reports when written; a message that asks for a reply or reads is completed once the device has sent as many
+// reports as the length in the reply header needs, or a NACK.
+// Up to maxInFlight messages per device wait for their replies, the rest are queued. Devices can be added and
+// removed while the loop runs; any non-blocking, message-preserving descriptor works, a SOCK_SEQPACKET socketpair
+// can stand in for a device. dlpc350_usb.cpp sends all DLPC350 traffic through one loop on Linux.
+class HidrawEventLoop
+{
+public:
+	HidrawEventLoop();
+	~HidrawEventLoop();
+
+	int Add(int fd, unsigned int maxInFlight = 1);
+	int Remove(int device);
+	int Submit(int device, const unsigned char* message, size_t length, HidrawCallback callback, int timeoutMs = 2000);
+	int RunOnce(int timeoutMs);
+	void Start();
+	void Stop();
+	size_t Pending() const { return pending; }
+
+private:
+	struct Message
+	{
+		std::vector<unsigned char> reports; // Report number and payload of each report
+		size_t written = 0; // Reports written
+		bool reply = false;
+		HidrawCallback callback;
+		std::chrono::milliseconds timeout;
+		std::chrono::steady_clock::time_point deadline;
+	};
+
+	struct Device
+	{
+		int fd;
+		size_t index;
+		unsigned int maxInFlight;
+		std::deque<Message> queued;
+		std::deque<Message> waiting; // Written, waiting for the reply
+		std::vector<unsigned char> reply; // Reports received so far of the reply to waiting.front()
+		bool wantWrite = false;
+		bool failed = false;
+	};
+
+	void Complete(Message&, int, const unsigned char*, size_t);
+	void Fail(Device&);
+	void Read(Device&);
+	void Write(Device&);
+	void Watch(Device&, bool);
+	void Wake();
+
+	int epollFd;
+	int wakeFd;
+	std::vector<std::unique_ptr<Device>> devices; // Used by the loop thread only
+
+	std::mutex incomingMutex; // Guards the hand-over from other threads below
+	std::vector<std::unique_ptr<Device>> added;
+	std::vector<std::pair<int, Message>> incoming;
+	std::vector<int> removing;
+	unsigned long long removeRequests = 0, removesDone = 0;
+	std::condition_variable removed;
+	std::atomic<int> numDevices{ 0 };
+	std::atomic<size_t> pending{ 0 };
+
+	std::thread worker;
+	std::atomic<bool> running{ false };
+};
+
+int HidrawOpenPath(const char*);
+hid_device* HidrawWrap(int);
+int HidrawDescriptor(hid_device*);
+
+#endif
+
+#endif
@@ -0,0 +1,657 @@
+// LC_PixelFormat.cpp : Row converters between the DLPC350 image pixel formats and planar 8-bit.
+//
+// Byte layouts: RGB32 is B, G, R, X (X written as 0xFF), RGB24 is R, G, B, RGB16 is little endian 5:6:5 with the
+// red field in the high bits, GREY10 is 10 bits in little endian 16-bit words, UYVY16 is U, Y0, V, Y1 for each
+// pair of pixels (full range BT.601) and SBGGR is an 8-bit Bayer mosaic with B G on even rows and G R on odd rows.
+// Narrow fields are widened by bit replication so full scale stays full scale both ways. A Bayer 2x2 cell becomes
+// one color (the two greens averaged) shared by its four pixels.
+// Every kernel runs an AVX2 loop, then an SSE2 loop and finishes with scalar code, each one taking what the
+// previous left. SIMD and scalar code use the same integer arithmetic, so they give identical results. The AVX2 loops
+// are in LC_PixelFormatAVX2.cpp, the only file built with AVX2 code generation, and are used when the CPU and the
+// operating system support AVX2.
+
+
+#include "LC_PixelFormat.h"
+#include "LC_PixelFormatAVX2.h"
+
+#include <cstring>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PIXEL_SSE2 1
+#endif
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <cpuid.h>
+#endif
+
+
+using namespace std;
+
+
+static bool CpuHasAVX2()
+{
+	// AVX2 in the CPU, and the YMM registers saved by the operating system (OSXSAVE, XCR0 bits 1 and 2)
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+
+	__cpuid(info, 1);
+	if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0 || (_xgetbv(0) & 6) != 6)
+		return false;
+
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	unsigned int a, b, c, d;
+	if (!__get_cpuid(1, &a, &b, &c, &d) || (c & bit_OSXSAVE) == 0 || (c & bit_AVX) == 0)
+		return false;
+
+	unsigned int xcr0, xcr0High;
+	__asm__("xgetbv" : "=a"(xcr0), "=d"(xcr0High) : "c"(0));
+	if ((xcr0 & 6) != 6)
+		return false;
+
+	return __get_cpuid_count(7, 0, &a, &b, &c, &d) && (b & bit_AVX2) != 0;
+#else
+	return false;
+#endif
+}
+
+
+static int SimdSupported()
+{
+#ifdef PIXEL_SSE2
+	return PixelAVX2Built() && CpuHasAVX2() ? PIXEL_SIMD_AVX2 : PIXEL_SIMD_SSE2;
+#else
+	return PIXEL_SIMD_SCALAR;
+#endif
+}
+
+
+static const int simdCompiled = SimdSupported();
+static atomic<int> simdLevel{ simdCompiled };
+
+
+unsigned int PixelFormatBytes(ImagePixFormat_t format)
+{
+	switch (format)
+	{
+	case IMAGE_PIX_FORMAT_RGB32: return 4;
+	case IMAGE_PIX_FORMAT_GREY8: return 1;
+	case IMAGE_PIX_FORMAT_GREY10: return 2;
+	case IMAGE_PIX_FORMAT_UYVY16: return 2;
+	case IMAGE_PIX_FORMAT_RGB16: return 2;
+	case IMAGE_PIX_FORMAT_SBGGR: return 1;
+	case IMAGE_PIX_FORMAT_RGB24: return 3;
+	}
+
+	return 0;
+}
+
+
+const char* PixelFormatName(ImagePixFormat_t format)
+{
+	switch (format)
+	{
+	case IMAGE_PIX_FORMAT_RGB32: return "RGB32";
+	case IMAGE_PIX_FORMAT_GREY8: return "GREY8";
+	case IMAGE_PIX_FORMAT_GREY10: return "GREY10";
+	case IMAGE_PIX_FORMAT_UYVY16: return "UYVY16";
+	case IMAGE_PIX_FORMAT_RGB16: return "RGB16";
+	case IMAGE_PIX_FORMAT_SBGGR: return "SBGGR";
+	case IMAGE_PIX_FORMAT_RGB24: return "RGB24";
+	}
+
+	return "?";
+}
+
+
+int PixelSimdLevel(int level)
+{
+	// Negative levels only query, higher levels than the supported ones are capped
+	if (level >= 0)
+		simdLevel = min(level, simdCompiled);
+
+	return simdLevel;
+}
+
+
+const char* PixelSimdName(int level)
+{
+	return level >= PIXEL_SIMD_AVX2 ? "avx2" : level == PIXEL_SIMD_SSE2 ? "sse2" : "scalar";
+}
+
+
+
+static inline unsigned char Clamp8(int v)
+{
+	return static_cast<unsigned char>(v < 0 ? 0 : v > 255 ? 255 : v);
+}
+
+
+static inline unsigned int Load16(const unsigned char* p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+
+static inline void Store16(unsigned char* p, unsigned int v)
+{
+	p[0] = static_cast<unsigned char>(v);
+	p[1] = static_cast<unsigned char>(v >> 8);
+}
+
+
+#ifdef PIXEL_SSE2
+static inline __m128i Pack32to8(__m128i a, __m128i b, __m128i c, __m128i d)
+{
+	// 16 32-bit values below 256 to 16 bytes
+	return _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+}
+#endif
+
+
+
+// GREY10: 10-bit words to 8 bits and back (v << 2 | v >> 6)
+
+static void Grey10ToPlanar(const unsigned char* src, unsigned int width, unsigned char* dst, int level)
+{
+	unsigned int i = 0;
+
+	if (level >= PIXEL_SIMD_AVX2)
+		i = Grey10ToPlanarAVX2(src, width, dst);
+
+#ifdef PIXEL_SSE2
+	if (level >= PIXEL_SIMD_SSE2)
+		for (; i + 16 <= width; i += 16)
+		{
+			__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 2 * i));
+			__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 2 * i + 16));
+			__m128i v = _mm_packus_epi16(_mm_srli_epi16(a, 2), _mm_srli_epi16(b, 2));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), v);
+		}
+#endif
+
+	for (; i < width; i++)
+		dst[i] = static_cast<unsigned char>(min(Load16(src + 2 * i) >> 2, 255u));
+}
+
+
+static void Grey10FromPlanar(const unsigned char* src, unsigned int width, unsigned char* dst, int level)
+{
+	unsigned int i = 0;
+
+#ifdef PIXEL_SSE2
+	if (level >= PIXEL_SIMD_SSE2)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		for (; i + 16 <= width; i += 16)
+		{
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+			__m128i lo = _mm_unpacklo_epi8(v, zero), hi = _mm_unpackhi_epi8(v, zero);
+			lo = _mm_or_si128(_mm_slli_epi16(lo, 2), _mm_srli_epi16(lo, 6));
+			hi = _mm_or_si128(_mm_slli_epi16(hi, 2), _mm_srli_epi16(hi, 6));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 2 * i), lo);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 2 * i + 16), hi);
+		}
+	}
+#endif
+
+	for (; i < width; i++)
+		Store16(dst + 2 * i, (src[i] << 2) | (src[i] >> 6));
+}
+
+
+
+// RGB32: B, G, R, X bytes
+
+static void Rgb32ToPlanar(const unsigned char* src, unsigned int width, unsigned char* r, unsigned char* g, unsigned char* b, int level)
+{
+	unsigned int i = 0;
+
+	if (level >= PIXEL_SIMD_AVX2)
+		i = Rgb32ToPlanarAVX2(src, width, r, g, b);
+
+#ifdef PIXEL_SSE2
+	if (level >= PIXEL_SIMD_SSE2)
+	{
+		const __m128i mask = _mm_set1_epi32(0xFF);
+		for (; i + 16 <= width; i += 16)
+		{
+			__m128i v[4];
+			for (int k = 0; k < 4; k++)
+				v[k] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 4 * i + 16 * k));
+
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(b + i), Pack32to8(_mm_and_si128(v[0], mask),
+				_mm_and_si128(v[1], mask), _mm_and_si128(v[2], mask), _mm_and_si128(v[3], mask)));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(g + i), Pack32to8(_mm_and_si128(_mm_srli_epi32(v[0], 8), mask),
+				_mm_and_si128(_mm_srli_epi32(v[1], 8), mask), _mm_and_si128(_mm_srli_epi32(v[2], 8), mask),
+				_mm_and_si128(_mm_srli_epi32(v[3], 8), mask)));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(r + i), Pack32to8(_mm_and_si128(_mm_srli_epi32(v[0], 16), mask),
+				_mm_and_si128(_mm_srli_epi32(v[1], 16), mask), _mm_and_si128(_mm_srli_epi32(v[2], 16), mask),
+				_mm_and_si128(_mm_srli_epi32(v[3], 16), mask)));
+		}
+	}
+#endif
+
+	for (; i < width; i++)
+	{
+		b[i] = src[4 * i];
+		g[i] = src[4 * i + 1];
+		r[i] = src[4 * i + 2];
+	}
+}
+
+
+static void Rgb32FromPlanar(const unsigned char* r, const unsigned char* g, const unsigned char* b, unsigned int width, unsigned char* dst, int level)
+{
+	unsigned int i = 0;
+
+#ifdef PIXEL_SSE2
+	if (level >= PIXEL_SIMD_SSE2)
+	{
+		const __m128i opaque = _mm_set1_epi8(-1);
+		for (; i + 16 <= width; i += 16)
+		{
+			__m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+			__m128i vg = _mm_loadu_si128(reinterpret_cast<const __m128i*>(g + i));
+			__m128i vr = _mm_loadu_si128(reinterpret_cast<const __m128i*>(r + i));
+			__m128i bgLo = _mm_unpacklo_epi8(vb, vg), bgHi = _mm_unpackhi_epi8(vb, vg);
+			__m128i rxLo = _mm_unpacklo_epi8(vr, opaque), rxHi = _mm_unpackhi_epi8(vr, opaque);
+
+			__m128i* out = reinterpret_cast<__m128i*>(dst + 4 * i);
+			_mm_storeu_si128(out, _mm_unpacklo_epi16(bgLo, rxLo));
+			_mm_storeu_si128(out + 1, _mm_unpackhi_epi16(bgLo, rxLo));
+			_mm_storeu_si128(out + 2, _mm_unpacklo_epi16(bgHi, rxHi));
+			_mm_storeu_si128(out + 3, _mm_unpackhi_epi16(bgHi, rxHi));
+		}
+	}
+#endif
+
+	for (; i < width; i++)
+	{
+		dst[4 * i] = b[i];
+		dst[4 * i + 1] = g[i];
+		dst[4 * i + 2] = r[i];
+		dst[4 * i + 3] = 0xFF;
+	}
+}
+
+
+
+// RGB16: 5:6:5, fields widened with their top bits
+
+static void Rgb16ToPlanar(const unsigned char* src, unsigned int width, unsigned char* r, unsigned char* g, unsigned char* b, int level)
+{
+	unsigned int i = 0;
+
+	if (level >= PIXEL_SIMD_AVX2)
+		i = Rgb16ToPlanarAVX2(src, width, r, g, b);
+
+#ifdef PIXEL_SSE2
+	if (level >= PIXEL_SIMD_SSE2)
+	{
+		const __m128i mask5 = _mm_set1_epi16(0x1F), mask6 = _mm_set1_epi16(0x3F);
+		for (; i + 16 <= width; i += 16)
+		{
+			__m128i v[2], cr[2], cg[2], cb[2];
+			for (int k = 0; k < 2; k++)
+			{
+				v[k] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 2 * i + 16 * k));
+				__m128i r5 = _mm_srli_epi16(v[k], 11);
+				__m128i g6 = _mm_and_si128(_mm_srli_epi16(v[k], 5), mask6);
+				__m128i b5 = _mm_and_si128(v[k], mask5);
+				cr[k] = _mm_or_si128(_mm_slli_epi16(r5, 3), _mm_srli_epi16(r5, 2));
+				cg[k] = _mm_or_si128(_mm_slli_epi16(g6, 2), _mm_srli_epi16(g6, 4));
+				cb[k] = _mm_or_si128(_mm_slli_epi16(b5, 3), _mm_srli_epi16(b5, 2));
+			}
+
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(r + i), _mm_packus_epi16(cr[0], cr[1]));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(g + i), _mm_packus_epi16(cg[0], cg[1]));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(b + i), _mm_packus_epi16(cb[0], cb[1]));
+		}
+	}
+#endif
+
+	for (; i < width; i++)
+	{
+		unsigned int v = Load16(src + 2 * i);
+		unsigned int r5 = v >> 11, g6 = (v >> 5) & 0x3F, b5 = v & 0x1F;
+		r[i] = static_cast<unsigned char>((r5 << 3) | (r5 >> 2));
+		g[i] = static_cast<unsigned char>((g6 << 2) | (g6 >> 4));
+		b[i] = static_cast<unsigned char>((b5 << 3) | (b5 >> 2));
+	}
+}
+
+
+static void Rgb16FromPlanar(const unsigned char* r, const unsigned char* g, const unsigned char* b, unsigned int width, unsigned char* dst, int level)
+{
+	unsigned int i = 0;
+
+#ifdef PIXEL_SSE2
+	if (level >= PIXEL_SIMD_SSE2)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		for (; i + 16 <= width; i += 16)
+		{
+			__m128i vr = _mm_loadu_si128(reinterpret_cast<const __m128i*>(r + i));
+			__m128i vg = _mm_loadu_si128(reinterpret_cast<const __m128i*>(g + i));
+			__m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+
+			__m128i lo = _mm_or_si128(_mm_slli_epi16(_mm_srli_epi16(_mm_unpacklo_epi8(vr, zero), 3), 11),
+				_mm_or_si128(_mm_slli_epi16(_mm_srli_epi16(_mm_unpacklo_epi8(vg, zero), 2), 5), _mm_srli_epi16(_mm_unpacklo_epi8(vb, zero), 3)));
+			__m128i hi = _mm_or_si128(_mm_slli_epi16(_mm_srli_epi16(_mm_unpackhi_epi8(vr, zero), 3), 11),
+				_mm_or_si128(_mm_slli_epi16(_mm_srli_epi16(_mm_unpackhi_epi8(vg, zero), 2), 5), _mm_srli_epi16(_mm_unpackhi_epi8(vb, zero), 3)));
+
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 2 * i), lo);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 2 * i + 16), hi);
+		}
+	}
+#endif
+
+	for (; i < width; i++)
+		Store16(dst + 2 * i, ((r[i] >> 3) << 11) | ((g[i] >> 2) << 5) | (b[i] >> 3));
+}
+
+
+
+// RGB24: R, G, B bytes. Deinterleaving 48 bytes takes byte shuffles (SSSE3), which come with the AVX2 loops.
+
+static void Rgb24ToPlanar(const unsigned char* src, unsigned int width, unsigned char* r, unsigned char* g, unsigned char* b, int level)
+{
+	unsigned int i = 0;
+
+	// No SSE2 path
+	if (level >= PIXEL_SIMD_AVX2)
+		i = Rgb24ToPlanarAVX2(src, width, r, g, b);
+
+	for (; i < width; i++)
+	{
+		r[i] = src[3 * i];
+		g[i] = src[3 * i + 1];
+		b[i] = src[3 * i + 2];
+	}
+}
+
+
+static void Rgb24FromPlanar(const unsigned char* r, const unsigned char* g, const unsigned char* b, unsigned int width, unsigned char* dst, int level)
+{
+	unsigned int i = 0;
+
+	// No SSE2 path
+	if (level >= PIXEL_SIMD_AVX2)
+		i = Rgb24FromPlanarAVX2(r, g, b, width, dst);
+
+	for (; i < width; i++)
+	{
+		dst[3 * i] = r[i];
+		dst[3 * i + 1] = g[i];
+		dst[3 * i + 2] = b[i];
+	}
+}
+
+
+
+// UYVY16: full range BT.601. Chroma differences are scaled by 64 and multiplied by coefficients in 1/1024 taking the
+// high 16 bits, which is what _mm_mulhi_epi16 does.
+
+static inline int MulHi(int a, int b)
+{
+	return (a * b) >> 16;
+}
+
+
+static void UyvyToPlanar(const unsigned char* src, unsigned int width, unsigned char* r, unsigned char* g, unsigned char* b, int level)
+{
+	unsigned int i = 0;
+
+#ifdef PIXEL_SSE2
+	if (level >= PIXEL_SIMD_SSE2)
+	{
+		const __m128i lowByte = _mm_set1_epi16(0xFF), lowWord = _mm_set1_epi32(0xFFFF), highWord = _mm_set1_epi32(static_cast<int>(0xFFFF0000));
+		const __m128i bias = _mm_set1_epi16(128);
+		const __m128i kr = _mm_set1_epi16(1436), kgu = _mm_set1_epi16(352), kgv = _mm_set1_epi16(731), kb = _mm_set1_epi16(1815);
+
+		for (; i + 16 <= width; i += 16)
+		{
+			__m128i cr[2], cg[2], cb[2];
+			for (int k = 0; k < 2; k++)
+			{
+				__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 2 * i + 16 * k));
+				__m128i y = _mm_srli_epi16(v, 8);
+				__m128i uv = _mm_and_si128(v, lowByte);
+
+				// Each chroma sample for both pixels of its pair
+				__m128i u = _mm_or_si128(_mm_and_si128(uv, lowWord), _mm_slli_epi32(uv, 16));
+				__m128i w = _mm_or_si128(_mm_srli_epi32(uv, 16), _mm_and_si128(uv, highWord));
+				u = _mm_slli_epi16(_mm_sub_epi16(u, bias), 6);
+				w = _mm_slli_epi16(_mm_sub_epi16(w, bias), 6);
+
+				cr[k] = _mm_add_epi16(y, _mm_mulhi_epi16(w, kr));
+				cg[k] = _mm_sub_epi16(y, _mm_add_epi16(_mm_mulhi_epi16(u, kgu), _mm_mulhi_epi16(w, kgv)));
+				cb[k] = _mm_add_epi16(y, _mm_mulhi_epi16(u, kb));
+			}
+
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(r + i), _mm_packus_epi16(cr[0], cr[1]));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(g + i), _mm_packus_epi16(cg[0], cg[1]));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(b + i), _mm_packus_epi16(cb[0], cb[1]));
+		}
+	}
+#endif
+
+	for (; i < width; i++)
+	{
+		const unsigned char* pair = src + 4 * (i / 2);
+		int y = src[2 * i + 1];
+		int u = (pair[0] - 128) * 64, v = (pair[2] - 128) * 64;
+
+		r[i] = Clamp8(y + MulHi(v, 1436));
+		g[i] = Clamp8(y - (MulHi(u, 352) + MulHi(v, 731)));
+		b[i] = Clamp8(y + MulHi(u, 1815));
+	}
+}
+
+
+static void UyvyFromPlanar(const unsigned char* r, const unsigned char* g, const unsigned char* b, unsigned int width, unsigned char* dst)
+{
+	// Chroma of the mean color of each pair of pixels
+	for (unsigned int i = 0; i < width; i += 2)
+	{
+		int mr = (r[i] + r[i + 1] + 1) >> 1, mg = (g[i] + g[i + 1] + 1) >> 1, mb = (b[i] + b[i + 1] + 1) >> 1;
+
+		dst[2 * i] = Clamp8(((-43 * mr - 85 * mg + 128 * mb + 128) >> 8) + 128);
+		dst[2 * i + 1] = static_cast<unsigned char>((77 * r[i] + 150 * g[i] + 29 * b[i] + 128) >> 8);
+		dst[2 * i + 2] = Clamp8(((128 * mr - 107 * mg - 21 * mb + 128) >> 8) + 128);
+		dst[2 * i + 3] = static_cast<unsigned char>((77 * r[i + 1] + 150 * g[i + 1] + 29 * b[i + 1] + 128) >> 8);
+	}
+}
+
+
+
+int PixelRowToPlanar(ImagePixFormat_t format, const unsigned char* src, unsigned int width, unsigned char* r, unsigned char* g, unsigned char* b)
+{
+	bool grey = format == IMAGE_PIX_FORMAT_GREY8 || format == IMAGE_PIX_FORMAT_GREY10;
+	if (src == nullptr || r == nullptr || (!grey && (g == nullptr || b == nullptr)))
+		return -1;
+
+	int level = simdLevel;
+	switch (format)
+	{
+	case IMAGE_PIX_FORMAT_GREY8:
+		memcpy(r, src, width);
+		return 0;
+	case IMAGE_PIX_FORMAT_GREY10:
+		Grey10ToPlanar(src, width, r, level);
+		return 0;
+	case IMAGE_PIX_FORMAT_RGB32:
+		Rgb32ToPlanar(src, width, r, g, b, level);
+		return 0;
+	case IMAGE_PIX_FORMAT_RGB24:
+		Rgb24ToPlanar(src, width, r, g, b, level);
+		return 0;
+	case IMAGE_PIX_FORMAT_RGB16:
+		Rgb16ToPlanar(src, width, r, g, b, level);
+		return 0;
+	case IMAGE_PIX_FORMAT_UYVY16:
+		if (width % 2)
+			return -1;
+		UyvyToPlanar(src, width, r, g, b, level);
+		return 0;
+	default:
+		return -1;
+	}
+}
+
+
+int PixelRowFromPlanar(ImagePixFormat_t format, const unsigned char* r, const unsigned char* g, const unsigned char* b, unsigned int width, unsigned char* dst)
+{
+	bool grey = format == IMAGE_PIX_FORMAT_GREY8 || format == IMAGE_PIX_FORMAT_GREY10;
+	if (dst == nullptr || r == nullptr || (!grey && (g == nullptr || b == nullptr)))
+		return -1;
+
+	int level = simdLevel;
+	switch (format)
+	{
+	case IMAGE_PIX_FORMAT_GREY8:
+		memcpy(dst, r, width);
+		return 0;
+	case IMAGE_PIX_FORMAT_GREY10:
+		Grey10FromPlanar(r, width, dst, level);
+		return 0;
+	case IMAGE_PIX_FORMAT_RGB32:
+		Rgb32FromPlanar(r, g, b, width, dst, level);
+		return 0;
+	case IMAGE_PIX_FORMAT_RGB24:
+		Rgb24FromPlanar(r, g, b, width, dst, level);
+		return 0;
+	case IMAGE_PIX_FORMAT_RGB16:
+		Rgb16FromPlanar(r, g, b, width, dst, level);
+		return 0;
+	case IMAGE_PIX_FORMAT_UYVY16:
+		if (width % 2)
+			return -1;
+		UyvyFromPlanar(r, g, b, width, dst);
+		return 0;
+	default:
+		return -1;
+	}
+}
+
+
+
+static bool ValidImage(const Image_t& image)
+{
+	unsigned int bytes = PixelFormatBytes(image.PixFormat);
+	if (image.Buffer == nullptr || bytes == 0 || image.LineWidth < image.Width * bytes)
+		return false;
+
+	// Pairs of pixels (UYVY) and 2x2 cells (SBGGR)
+	if ((image.PixFormat == IMAGE_PIX_FORMAT_UYVY16 || image.PixFormat == IMAGE_PIX_FORMAT_SBGGR) && image.Width % 2)
+		return false;
+
+	return image.PixFormat != IMAGE_PIX_FORMAT_SBGGR || image.Height % 2 == 0;
+}
+
+
+int ImageToPlanar(const Image_t& image, unsigned char* const planes[3], unsigned int pitch)
+{
+	if (!ValidImage(image) || pitch < image.Width)
+		return -1;
+
+	bool grey = image.PixFormat == IMAGE_PIX_FORMAT_GREY8 || image.PixFormat == IMAGE_PIX_FORMAT_GREY10;
+	if (grey && planes[0] == nullptr && planes[1] == nullptr && planes[2] == nullptr)
+		return -1;
+
+	// Rows of missing planes go to scratch rows
+	vector<unsigned char> scratch(3 * static_cast<size_t>(image.Width));
+	size_t w = image.Width;
+
+	for (unsigned int y = 0; y < image.Height; y++)
+	{
+		const unsigned char* src = image.Buffer + static_cast<size_t>(y) * image.LineWidth;
+		unsigned char* row[3];
+		for (int c = 0; c < 3; c++)
+			row[c] = planes[c] ? planes[c] + static_cast<size_t>(y) * pitch : scratch.data() + c * w;
+
+		if (image.PixFormat == IMAGE_PIX_FORMAT_SBGGR)
+		{
+			// A whole 2x2 cell per step, writing both rows
+			if (y % 2)
+				continue;
+
+			const unsigned char* next = src + image.LineWidth;
+			unsigned char* below[3];
+			for (int c = 0; c < 3; c++)
+				below[c] = planes[c] ? row[c] + pitch : row[c];
+
+			for (size_t x = 0; x < w; x += 2)
+			{
+				unsigned char cell[3] = { next[x + 1], static_cast<unsigned char>((src[x + 1] + next[x] + 1) >> 1), src[x] };
+				for (int c = 0; c < 3; c++)
+				{
+					row[c][x] = row[c][x + 1] = cell[c];
+					below[c][x] = below[c][x + 1] = cell[c];
+				}
+			}
+			continue;
+		}
+
+		if (grey)
+		{
+			// Plane 0 may be missing for a grey image, convert into the first plane given
+			int first = planes[0] ? 0 : planes[1] ? 1 : 2;
+			PixelRowToPlanar(image.PixFormat, src, image.Width, row[first], nullptr, nullptr);
+			for (int c = first + 1; c < 3; c++)
+				if (planes[c])
+					memcpy(row[c], row[first], w);
+		}
+		else
+			PixelRowToPlanar(image.PixFormat, src, image.Width, row[0], row[1], row[2]);
+	}
+
+	return 0;
+}
+
+
+int ImageFromPlanar(const unsigned char* const planes[3], unsigned int pitch, Image_t& image)
+{
+	if (!ValidImage(image) || pitch < image.Width)
+		return -1;
+
+	bool grey = image.PixFormat == IMAGE_PIX_FORMAT_GREY8 || image.PixFormat == IMAGE_PIX_FORMAT_GREY10;
+	vector<unsigned char> zeros(image.Width, 0);
+
+	for (unsigned int y = 0; y < image.Height; y++)
+	{
+		unsigned char* dst = image.Buffer + static_cast<size_t>(y) * image.LineWidth;
+		const unsigned char* row[3];
+		for (int c = 0; c < 3; c++)
+			row[c] = planes[c] ? planes[c] + static_cast<size_t>(y) * pitch : zeros.data();
+
+		if (image.PixFormat == IMAGE_PIX_FORMAT_SBGGR)
+		{
+			// B G on even rows, G R on odd rows
+			const unsigned char* even = y % 2 ? row[1] : row[2];
+			const unsigned char* odd = y % 2 ? row[0] : row[1];
+			for (unsigned int x = 0; x < image.Width; x += 2)
+			{
+				dst[x] = even[x];
+				dst[x + 1] = odd[x + 1];
+			}
+		}
+		else if (grey)
+			PixelRowFromPlanar(image.PixFormat, row[0], nullptr, nullptr, image.Width, dst);
+		else
+			PixelRowFromPlanar(image.PixFormat, row[0], row[1], row[2], image.Width, dst);
+	}
+
+	return 0;
+}
@@ -0,0 +1,29 @@
+#ifndef LC_PIXEL_FORMAT_H
+#define LC_PIXEL_FORMAT_H
+
+#include "dlpc350_common.h"
+
+// Instruction sets used by the converters, PixelSimdLevel() caps them for benchmarking
+enum PixelSimd
+{
+	PIXEL_SIMD_SCALAR = 0,
+	PIXEL_SIMD_SSE2 = 1,
+	PIXEL_SIMD_AVX2 = 2 // AVX2, plus SSSE3 shuffles for RGB24
+};
+
+unsigned int PixelFormatBytes(ImagePixFormat_t);
+const char* PixelFormatName(ImagePixFormat_t);
+int PixelSimdLevel(int level = -1);
+const char* PixelSimdName(int);
+
+// Row converters between a packed format and planar 8-bit. Color formats use R, G and B planes, grey formats
+// only the first one (the others are ignored). SBGGR needs two rows and is only converted by whole images.
+int PixelRowToPlanar(ImagePixFormat_t, const unsigned char*, unsigned int, unsigned char*, unsigned char*, unsigned char*);
+int PixelRowFromPlanar(ImagePixFormat_t, const unsigned char*, const unsigned char*, const unsigned char*, unsigned int, unsigned char*);
+
+// Whole images, planes of the given pitch. Missing (nullptr) color planes are skipped when converting to planar and
+// read as zeros when converting from planar. Grey images are replicated into every non-null plane.
+int ImageToPlanar(const Image_t&, unsigned char* const[3], unsigned int);
+int ImageFromPlanar(const unsigned char* const[3], unsigned int, Image_t&);
+
+#endif
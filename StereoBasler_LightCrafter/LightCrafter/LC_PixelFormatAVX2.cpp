@@ -0,0 +1,200 @@
+// LC_PixelFormatAVX2.cpp : AVX2 loops of the pixel format converters, called by LC_PixelFormat.cpp.
+//
+// This file is built with AVX2 code generation (/arch:AVX2, -mavx2) and the rest of the program without, so nothing
+// in it may run before the CPU has been checked: there are no static objects, the RGB24 shuffle tables are built on
+// first use. RGB24 takes SSSE3 byte shuffles, which every AVX2 CPU has. Without AVX2 code generation the loops are
+// left out and PixelAVX2Built() tells the dispatcher.
+
+
+#include "LC_PixelFormatAVX2.h"
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+
+#ifdef __AVX2__
+
+bool PixelAVX2Built()
+{
+	return true;
+}
+
+
+
+static inline __m256i Pack32to8(__m256i a, __m256i b, __m256i c, __m256i d)
+{
+	// The packs work inside 128-bit lanes, the permutation restores the order of the 32 values
+	__m256i v = _mm256_packus_epi16(_mm256_packs_epi32(a, b), _mm256_packs_epi32(c, d));
+	return _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+}
+
+
+static inline __m256i Pack16to8(__m256i a, __m256i b)
+{
+	return _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8);
+}
+
+
+
+unsigned int Grey10ToPlanarAVX2(const unsigned char* src, unsigned int width, unsigned char* dst)
+{
+	unsigned int i = 0;
+	for (; i + 32 <= width; i += 32)
+	{
+		__m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 2 * i));
+		__m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 2 * i + 32));
+		__m256i v = Pack16to8(_mm256_srli_epi16(a, 2), _mm256_srli_epi16(b, 2));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), v);
+	}
+
+	return i;
+}
+
+
+unsigned int Rgb32ToPlanarAVX2(const unsigned char* src, unsigned int width, unsigned char* r, unsigned char* g, unsigned char* b)
+{
+	unsigned int i = 0;
+	const __m256i mask = _mm256_set1_epi32(0xFF);
+	for (; i + 32 <= width; i += 32)
+	{
+		__m256i v[4];
+		for (int k = 0; k < 4; k++)
+			v[k] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 4 * i + 32 * k));
+
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(b + i), Pack32to8(_mm256_and_si256(v[0], mask),
+			_mm256_and_si256(v[1], mask), _mm256_and_si256(v[2], mask), _mm256_and_si256(v[3], mask)));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(g + i), Pack32to8(_mm256_and_si256(_mm256_srli_epi32(v[0], 8), mask),
+			_mm256_and_si256(_mm256_srli_epi32(v[1], 8), mask), _mm256_and_si256(_mm256_srli_epi32(v[2], 8), mask),
+			_mm256_and_si256(_mm256_srli_epi32(v[3], 8), mask)));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(r + i), Pack32to8(_mm256_and_si256(_mm256_srli_epi32(v[0], 16), mask),
+			_mm256_and_si256(_mm256_srli_epi32(v[1], 16), mask), _mm256_and_si256(_mm256_srli_epi32(v[2], 16), mask),
+			_mm256_and_si256(_mm256_srli_epi32(v[3], 16), mask)));
+	}
+
+	return i;
+}
+
+
+unsigned int Rgb16ToPlanarAVX2(const unsigned char* src, unsigned int width, unsigned char* r, unsigned char* g, unsigned char* b)
+{
+	unsigned int i = 0;
+	const __m256i mask5 = _mm256_set1_epi16(0x1F), mask6 = _mm256_set1_epi16(0x3F);
+	for (; i + 32 <= width; i += 32)
+	{
+		__m256i v[2], cr[2], cg[2], cb[2];
+		for (int k = 0; k < 2; k++)
+		{
+			v[k] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 2 * i + 32 * k));
+			__m256i r5 = _mm256_srli_epi16(v[k], 11);
+			__m256i g6 = _mm256_and_si256(_mm256_srli_epi16(v[k], 5), mask6);
+			__m256i b5 = _mm256_and_si256(v[k], mask5);
+			cr[k] = _mm256_or_si256(_mm256_slli_epi16(r5, 3), _mm256_srli_epi16(r5, 2));
+			cg[k] = _mm256_or_si256(_mm256_slli_epi16(g6, 2), _mm256_srli_epi16(g6, 4));
+			cb[k] = _mm256_or_si256(_mm256_slli_epi16(b5, 3), _mm256_srli_epi16(b5, 2));
+		}
+
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(r + i), Pack16to8(cr[0], cr[1]));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(g + i), Pack16to8(cg[0], cg[1]));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(b + i), Pack16to8(cb[0], cb[1]));
+	}
+
+	return i;
+}
+
+
+
+// RGB24: deinterleaving 48 bytes takes three byte shuffles per plane
+
+struct Rgb24Shuffles
+{
+	alignas(16) signed char toPlanar[3][3][16]; // [plane][input register][byte]
+	alignas(16) signed char fromPlanar[3][3][16]; // [output register][plane][byte]
+
+	Rgb24Shuffles()
+	{
+		for (int c = 0; c < 3; c++)
+			for (int o = 0; o < 3; o++)
+				for (int j = 0; j < 16; j++)
+				{
+					// Planar byte j of plane c is packed byte 3j + c; packed byte 16o + j is pixel (16o + j) / 3
+					int in = 3 * j + c, out = 16 * o + j;
+					toPlanar[c][o][j] = static_cast<signed char>(in / 16 == o ? in % 16 : -128);
+					fromPlanar[o][c][j] = static_cast<signed char>(out % 3 == c ? out / 3 : -128);
+				}
+	}
+};
+
+
+static const Rgb24Shuffles& Rgb24Tables()
+{
+	static const Rgb24Shuffles tables;
+	return tables;
+}
+
+
+static inline __m128i Shuffle(__m128i v, const signed char* table)
+{
+	return _mm_shuffle_epi8(v, _mm_load_si128(reinterpret_cast<const __m128i*>(table)));
+}
+
+
+unsigned int Rgb24ToPlanarAVX2(const unsigned char* src, unsigned int width, unsigned char* r, unsigned char* g, unsigned char* b)
+{
+	const Rgb24Shuffles& tables = Rgb24Tables();
+	unsigned char* planes[3] = { r, g, b };
+
+	unsigned int i = 0;
+	for (; i + 16 <= width; i += 16)
+	{
+		__m128i v[3];
+		for (int k = 0; k < 3; k++)
+			v[k] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 3 * i + 16 * k));
+
+		for (int c = 0; c < 3; c++)
+		{
+			__m128i p = _mm_or_si128(_mm_or_si128(Shuffle(v[0], tables.toPlanar[c][0]),
+				Shuffle(v[1], tables.toPlanar[c][1])), Shuffle(v[2], tables.toPlanar[c][2]));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(planes[c] + i), p);
+		}
+	}
+
+	return i;
+}
+
+
+unsigned int Rgb24FromPlanarAVX2(const unsigned char* r, const unsigned char* g, const unsigned char* b, unsigned int width, unsigned char* dst)
+{
+	const Rgb24Shuffles& tables = Rgb24Tables();
+
+	unsigned int i = 0;
+	for (; i + 16 <= width; i += 16)
+	{
+		__m128i v[3] = { _mm_loadu_si128(reinterpret_cast<const __m128i*>(r + i)),
+			_mm_loadu_si128(reinterpret_cast<const __m128i*>(g + i)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)) };
+
+		for (int o = 0; o < 3; o++)
+		{
+			__m128i p = _mm_or_si128(_mm_or_si128(Shuffle(v[0], tables.fromPlanar[o][0]),
+				Shuffle(v[1], tables.fromPlanar[o][1])), Shuffle(v[2], tables.fromPlanar[o][2]));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 3 * i + 16 * o), p);
+		}
+	}
+
+	return i;
+}
+
+#else
+
+bool PixelAVX2Built()
+{
+	return false;
+}
+
+unsigned int Grey10ToPlanarAVX2(const unsigned char*, unsigned int, unsigned char*) { return 0; }
+unsigned int Rgb32ToPlanarAVX2(const unsigned char*, unsigned int, unsigned char*, unsigned char*, unsigned char*) { return 0; }
+unsigned int Rgb16ToPlanarAVX2(const unsigned char*, unsigned int, unsigned char*, unsigned char*, unsigned char*) { return 0; }
+unsigned int Rgb24ToPlanarAVX2(const unsigned char*, unsigned int, unsigned char*, unsigned char*, unsigned char*) { return 0; }
+unsigned int Rgb24FromPlanarAVX2(const unsigned char*, const unsigned char*, const unsigned char*, unsigned int, unsigned char*) { return 0; }
+
+#endif
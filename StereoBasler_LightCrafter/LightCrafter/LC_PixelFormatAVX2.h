@@ -0,0 +1,14 @@
+#ifndef LC_PIXEL_FORMAT_AVX2_H
+#define LC_PIXEL_FORMAT_AVX2_H
+
+// AVX2 loops of the LC_PixelFormat converters. They are compiled with AVX2 code generation in a file of their own and
+// only called when the CPU has AVX2. Each one converts the first pixels of the row in whole blocks and returns how
+// many it converted, the caller finishes the row.
+bool PixelAVX2Built();
+unsigned int Grey10ToPlanarAVX2(const unsigned char*, unsigned int, unsigned char*);
+unsigned int Rgb32ToPlanarAVX2(const unsigned char*, unsigned int, unsigned char*, unsigned char*, unsigned char*);
+unsigned int Rgb16ToPlanarAVX2(const unsigned char*, unsigned int, unsigned char*, unsigned char*, unsigned char*);
+unsigned int Rgb24ToPlanarAVX2(const unsigned char*, unsigned int, unsigned char*, unsigned char*, unsigned char*);
+unsigned int Rgb24FromPlanarAVX2(const unsigned char*, const unsigned char*, const unsigned char*, unsigned int, unsigned char*);
+
+#endif
@@ -0,0 +1,289 @@
+// LC_Projectors.cpp : Several LightCrafters on the same host, found by serial number and programmed in parallel.
+//
+// Each projector is assigned a USB device slot and a thread; the TI API keeps its buffers and LUTs per slot, so
+// the threads program their devices concurrently and the setup time is that of the slowest projector. Start
+// commands are released together once every program is loaded. InterleaveSequences() builds time-multiplexed
+// sequences: the projectors take turns, each showing black-fill while another one projects, and all of them keep
+// the same pattern periods so the cameras can follow the Trigger Out 1 of any of them.
+
+
+#include "LC_Projectors.h"
+#include "LC_Flash.h"
+
+#include "dlpc350_common.h"
+#include "dlpc350_usb.h"
+#include "dlpc350_api.h"
+#include "hidapi.h"
+
+#include <cstdio>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+#include <mutex>
+#include <algorithm>
+
+
+using namespace std;
+
+
+static string Narrow(const wchar_t* s)
+{
+	// Serial numbers are ASCII
+	string out;
+	for (; s && *s; s++)
+		out.push_back(static_cast<char>(*s));
+
+	return out;
+}
+
+
+
+int EnumerateProjectors(vector<ProjectorInfo>& projectors)
+{
+	projectors.clear();
+
+	DLPC350_USB_Init();
+	hid_device_info* devs = hid_enumerate(MY_VID, MY_PID);
+	for (hid_device_info* d = devs; d; d = d->next)
+		projectors.push_back({ Narrow(d->serial_number), d->path ? d->path : "" });
+	hid_free_enumeration(devs);
+
+	// Stable order, so that projector indices do not depend on the USB port enumeration
+	sort(projectors.begin(), projectors.end(), [](const ProjectorInfo& a, const ProjectorInfo& b) { return a.serial < b.serial; });
+
+	return static_cast<int>(projectors.size());
+}
+
+
+
+int ProjectorArray::Open(const vector<string>& wanted)
+{
+	vector<ProjectorInfo> found;
+	EnumerateProjectors(found);
+
+	serials.clear();
+	if (wanted.empty())
+	{
+		for (const auto& p : found)
+			serials.push_back(p.serial);
+	}
+	else
+	{
+		for (const auto& serial : wanted)
+		{
+			if (find_if(found.begin(), found.end(), [&](const ProjectorInfo& p) { return p.serial == serial; }) == found.end())
+			{
+				printf("Projector %s not found\n", serial.c_str());
+				return -1;
+			}
+			serials.push_back(serial);
+		}
+	}
+
+	if (serials.empty() || serials.size() > DLPC350_USB_MAX_DEVICES)
+	{
+		printf("Found %zu projectors, from 1 to %d can be used\n", serials.size(), DLPC350_USB_MAX_DEVICES);
+		return -1;
+	}
+
+	// Bind each slot to its serial number, reconnections then find the same projector
+	return Parallel([this](size_t i)
+	{
+		wstring serial(serials[i].begin(), serials[i].end());
+		lock_guard<recursive_mutex> lock(LightCrafterMutex());
+
+		DLPC350_USB_SetSerial(serial.c_str());
+		if (DLPC350_USB_IsConnected())
+			DLPC350_USB_Close();
+
+		if (DLPC350_USB_Open() < 0)
+		{
+			printf("Failed to open projector %s\n", serials[i].c_str());
+			return -1;
+		}
+
+		return 0;
+	});
+}
+
+
+
+int ProjectorArray::Parallel(const function<int(size_t)>& work, vector<double>* seconds)
+{
+	// One thread per projector, each one talking to its own device slot
+	vector<thread> threads;
+	vector<int> results(serials.size(), 0);
+	vector<double> times(serials.size(), 0);
+
+	for (size_t i = 0; i < serials.size(); i++)
+		threads.emplace_back([&, i]
+		{
+			auto t0 = chrono::steady_clock::now();
+			DLPC350_USB_Select(static_cast<int>(i));
+			results[i] = work(i);
+			times[i] = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+		});
+
+	for (auto& t : threads)
+		t.join();
+
+	if (results.empty())
+		return -1;
+
+	if (seconds)
+		*seconds = times;
+
+	return *min_element(results.begin(), results.end()) < 0 ? -1 : 0;
+}
+
+
+
+int ProjectorArray::Arm(const vector<SequenceProgram>& programs, ProjectorArrayReport* report)
+{
+	if (programs.size() != serials.size())
+	{
+		printf("%zu programs for %zu projectors\n", programs.size(), serials.size());
+		return -1;
+	}
+
+	auto t0 = chrono::steady_clock::now();
+	ProjectorArrayReport r;
+
+
+
+	// Load every program without starting it
+	if (Parallel([&](size_t i) { return LightCrafterArm(programs[i], false); }, &r.perProjector) < 0)
+		return -1;
+
+
+
+	// Stop every projector, wait for all of them, then start together
+	mutex barrierMutex;
+	condition_variable allStopped;
+	size_t stopped = 0;
+	vector<chrono::steady_clock::time_point> started(serials.size());
+
+	int result = Parallel([&](size_t i)
+	{
+		lock_guard<recursive_mutex> lock(LightCrafterMutex());
+
+		int ok = DLPC350_PatternDisplay(0);
+		{
+			unique_lock<mutex> barrier(barrierMutex);
+			if (++stopped == serials.size())
+				allStopped.notify_all();
+			else
+				allStopped.wait(barrier, [&] { return stopped == serials.size(); });
+		}
+
+		if (ok < 0 || DLPC350_PatternDisplay(2) < 0)
+		{
+			printf("Failed to start projector %s\n", serials[i].c_str());
+			return -1;
+		}
+
+		started[i] = chrono::steady_clock::now();
+		return 0;
+	});
+
+	if (result < 0)
+		return -1;
+
+	auto range = minmax_element(started.begin(), started.end());
+	r.startSkew = chrono::duration<double>(*range.second - *range.first).count();
+	r.seconds = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+
+	if (report)
+		*report = r;
+
+	return 0;
+}
+
+
+
+int ProjectorArray::ArmAll(const SequenceProgram& program, ProjectorArrayReport* report)
+{
+	return Arm(vector<SequenceProgram>(serials.size(), program), report);
+}
+
+
+
+int ProjectorArray::Stop()
+{
+	return Parallel([](size_t)
+	{
+		lock_guard<recursive_mutex> lock(LightCrafterMutex());
+		return DLPC350_PatternDisplay(0);
+	});
+}
+
+
+
+int InterleaveSequences(const vector<SequenceDescription>& in, vector<SequenceDescription>& out)
+{
+	// Round robin over the projectors, pattern by pattern. A projector that has nothing to show in a slot displays
+	// black-fill on the image of its nearest pattern, which avoids extra buffer swaps.
+	out.assign(in.size(), SequenceDescription());
+
+	// Unrolled pattern lists
+	vector<vector<SequencePattern>> patterns(in.size());
+	size_t longest = 0;
+	for (size_t p = 0; p < in.size(); p++)
+	{
+		for (unsigned int r = 0; r < in[p].repeats; r++)
+			patterns[p].insert(patterns[p].end(), in[p].patterns.begin(), in[p].patterns.end());
+
+		if (patterns[p].empty())
+		{
+			printf("Empty sequence\n");
+			return -1;
+		}
+		longest = max(longest, patterns[p].size());
+	}
+
+	for (size_t p = 0; p < in.size(); p++)
+	{
+		out[p].exposure = in[p].exposure;
+		out[p].period = in[p].period;
+		out[p].repeats = 1;
+		out[p].repeat = in[p].repeat;
+	}
+
+	for (size_t k = 0; k < longest; k++)
+		for (size_t active = 0; active < in.size(); active++)
+		{
+			if (k >= patterns[active].size())
+				continue;
+
+			// Timing of the slot comes from the projector that owns it
+			const SequencePattern& shown = patterns[active][k];
+			unsigned int exposure = shown.exposure ? shown.exposure : in[active].exposure;
+			unsigned int period = shown.period ? shown.period : in[active].period;
+
+			for (size_t p = 0; p < in.size(); p++)
+			{
+				if (p == active)
+				{
+					SequencePattern pattern = shown;
+					pattern.exposure = exposure;
+					pattern.period = period;
+					out[p].patterns.push_back(pattern);
+					continue;
+				}
+
+				const SequencePattern& nearest = patterns[p][min(k, patterns[p].size() - 1)];
+
+				SequencePattern black;
+				black.image = nearest.image;
+				black.patNum = SEQ_FILL_PATTERN;
+				black.bitDepth = 1;
+				black.invert = true;
+				black.ledSelect = nearest.ledSelect;
+				black.exposure = exposure;
+				black.period = period;
+				out[p].patterns.push_back(black);
+			}
+		}
+
+	return 0;
+}
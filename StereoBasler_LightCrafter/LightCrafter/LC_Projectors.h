@@ -0,0 +1,45 @@
+#ifndef LC_PROJECTORS_H
+#define LC_PROJECTORS_H
+
+#include "LC_Sequence.h"
+
+#include <string>
+#include <vector>
+#include <functional>
+
+// A LightCrafter found on the USB bus
+struct ProjectorInfo
+{
+	std::string serial;
+	std::string path;
+};
+
+// What one operation on all projectors cost
+struct ProjectorArrayReport
+{
+	double seconds = 0; // Wall time of the whole operation
+	std::vector<double> perProjector; // Time each projector took to load its program
+	double startSkew = 0; // Spread of the start commands between projectors, seconds
+};
+
+// Several LightCrafters, projector i in USB device slot i. Every projector is driven from its own thread, so loading
+// programs into all of them takes about as long as loading the slowest one; the sequences are then started together.
+class ProjectorArray
+{
+public:
+	int Open(const std::vector<std::string>& serials = std::vector<std::string>());
+	size_t Size() const { return serials.size(); }
+	const std::string& Serial(size_t i) const { return serials[i]; }
+	int Arm(const std::vector<SequenceProgram>&, ProjectorArrayReport* report = nullptr);
+	int ArmAll(const SequenceProgram&, ProjectorArrayReport* report = nullptr);
+	int Stop();
+	int Parallel(const std::function<int(size_t)>&, std::vector<double>* seconds = nullptr);
+
+private:
+	std::vector<std::string> serials;
+};
+
+int EnumerateProjectors(std::vector<ProjectorInfo>&);
+int InterleaveSequences(const std::vector<SequenceDescription>&, std::vector<SequenceDescription>&);
+
+#endif
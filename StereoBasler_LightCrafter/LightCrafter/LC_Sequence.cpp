@@ -0,0 +1,237 @@
+// LC_Sequence.cpp : Compiles pattern sequence descriptions into DLPC350 pattern LUT, image LUT and sequence configuration.
+//
+// A sequence is a list of patterns, each one a bit plane group of a flash image. Consecutive patterns of the same
+// image share an image LUT entry; a buffer swap is requested whenever the image changes. Normal mode is used when
+// all patterns have the sequence exposure and period, variable exposure mode otherwise.
+
+
+#include "LC_Sequence.h"
+#include "LC_Bitplane.h"
+
+#include "dlpc350_common.h"
+
+#include <cstdio>
+#include <sstream>
+#include <unordered_map>
+#include <mutex>
+
+
+using namespace std;
+
+
+static void AppendKey(string& key, uint32_t value)
+{
+	for (int i = 0; i < 4; i++)
+		key.push_back(static_cast<char>(value >> (8 * i)));
+}
+
+
+static string SequenceKey(const SequenceDescription& desc)
+{
+	// Canonical byte string of a description, used for hashing and cache lookups
+	string key;
+	AppendKey(key, desc.exposure);
+	AppendKey(key, desc.period);
+	AppendKey(key, desc.repeats);
+	AppendKey(key, desc.repeat);
+
+	for (const auto& p : desc.patterns)
+	{
+		AppendKey(key, p.image);
+		AppendKey(key, p.patNum);
+		AppendKey(key, p.bitDepth);
+		AppendKey(key, p.ledSelect);
+		AppendKey(key, p.trigType);
+		AppendKey(key, p.invert | p.insertBlack << 1 | p.trigOutPrev << 2);
+		AppendKey(key, p.exposure);
+		AppendKey(key, p.period);
+	}
+
+	return key;
+}
+
+
+static uint64_t HashKey(const string& key)
+{
+	// 64-bit FNV-1a
+	uint64_t hash = 14695981039346656037ull;
+	for (unsigned char c : key)
+		hash = (hash ^ c) * 1099511628211ull;
+
+	return hash;
+}
+
+
+uint64_t SequenceHash(const SequenceDescription& desc)
+{
+	return HashKey(SequenceKey(desc));
+}
+
+
+
+int CompileSequence(const SequenceDescription& desc, SequenceProgram& program)
+{
+	if (desc.patterns.empty() || desc.repeats == 0)
+	{
+		printf("Empty pattern sequence\n");
+		return -1;
+	}
+
+	// Check every pattern and pick the display mode
+	bool varExposure = false;
+
+	for (size_t i = 0; i < desc.patterns.size(); i++)
+	{
+		const SequencePattern& p = desc.patterns[i];
+
+		bool fill = p.patNum == SEQ_FILL_PATTERN && p.bitDepth == 1;
+		if (!fill && (p.patNum < 0 || p.patNum >= BitplanePatternsPerImage(p.bitDepth)))
+		{
+			printf("Pattern %zu: invalid pattern number %d for bit depth %d\n", i, p.patNum, p.bitDepth);
+			return -1;
+		}
+		if (p.ledSelect < 0 || p.ledSelect > 7 || p.trigType < 0 || p.trigType > 3 || p.image > 255)
+		{
+			printf("Pattern %zu: invalid image, LED or trigger type\n", i);
+			return -1;
+		}
+
+		unsigned int exposure = p.exposure ? p.exposure : desc.exposure;
+		unsigned int period = p.period ? p.period : desc.period;
+		if (exposure == 0 || period == 0 || exposure > period)
+		{
+			printf("Pattern %zu: invalid exposure %u us / period %u us\n", i, exposure, period);
+			return -1;
+		}
+
+		if (exposure != desc.exposure || period != desc.period)
+			varExposure = true;
+	}
+
+
+
+	// Unroll the pattern list and build both LUTs
+	SequenceProgram prog;
+	prog.varExposure = varExposure;
+	prog.repeat = desc.repeat;
+	prog.exposure = desc.exposure;
+	prog.period = desc.period;
+	prog.trigMode = varExposure ? 3 : 1;
+
+	for (unsigned int r = 0; r < desc.repeats; r++)
+	{
+		for (const auto& p : desc.patterns)
+		{
+			bool bufSwap = prog.imageLut.empty() || prog.imageLut.back() != p.image;
+			if (bufSwap)
+				prog.imageLut.push_back(static_cast<unsigned char>(p.image));
+
+			prog.patLut.push_back({ p.trigType, p.patNum, p.bitDepth, p.ledSelect, p.invert, p.insertBlack, bufSwap, p.trigOutPrev,
+				p.exposure ? p.exposure : desc.exposure, p.period ? p.period : desc.period });
+		}
+	}
+
+	size_t maxPatterns = varExposure ? MAX_VAR_EXP_PAT_LUT_ENTRIES : MAX_PAT_LUT_ENTRIES;
+	size_t maxImages = varExposure ? MAX_VAR_EXP_IMAGE_LUT_ENTRIES : MAX_IMAGE_LUT_ENTRIES;
+	if (prog.patLut.size() > maxPatterns || prog.imageLut.size() > maxImages)
+	{
+		printf("Sequence needs %zu pattern and %zu image LUT entries, the limits are %zu and %zu\n",
+			prog.patLut.size(), prog.imageLut.size(), maxPatterns, maxImages);
+		return -1;
+	}
+
+	// If repeat, variable must be set to 1, else, must be number of LUT patterns
+	prog.numPatsForTrigOut2 = desc.repeat ? 1 : static_cast<unsigned int>(prog.patLut.size());
+	prog.hash = SequenceHash(desc);
+
+	program = move(prog);
+	return 0;
+}
+
+
+
+const SequenceProgram* CompileSequenceCached(const SequenceDescription& desc)
+{
+	// Compiled programs keyed by the canonical description. Entries are never removed, so returned pointers stay valid.
+	static unordered_map<string, SequenceProgram> cache;
+	static mutex cacheMutex;
+
+	string key = SequenceKey(desc);
+
+	lock_guard<mutex> lock(cacheMutex);
+
+	auto it = cache.find(key);
+	if (it != cache.end())
+		return &it->second;
+
+	SequenceProgram program;
+	if (CompileSequence(desc, program) < 0)
+		return nullptr;
+
+	return &cache.emplace(move(key), move(program)).first->second;
+}
+
+
+
+SequenceDescription SequenceFromImages(const vector<unsigned int>& images, unsigned int exposure, unsigned int period, bool repeat,
+	int bitDepth, int patternsPerImage)
+{
+	SequenceDescription desc;
+	desc.exposure = exposure;
+	desc.period = period;
+	desc.repeat = repeat;
+
+	for (unsigned int image : images)
+	{
+		for (int k = 0; k < patternsPerImage; k++)
+		{
+			SequencePattern p;
+			p.image = image;
+			p.patNum = k;
+			p.bitDepth = bitDepth;
+			desc.patterns.push_back(p);
+		}
+	}
+
+	return desc;
+}
+
+
+
+static bool ParseValue(const string& s, unsigned int& value)
+{
+	try
+	{
+		size_t end;
+		unsigned long v = stoul(s, &end, 0);
+		if (end != s.size())
+			return false;
+
+		value = static_cast<unsigned int>(v);
+		return true;
+	}
+	catch (const exception&)
+	{
+		return false;
+	}
+}
+
+
+int ParseImageList(const string& seq, vector<unsigned int>& images)
+{
+	// Flash image indices separated by '-', e.g. "0-1-2"
+	istringstream fstr(seq);
+	string s;
+	unsigned int value;
+
+	images.clear();
+	while (getline(fstr, s, '-'))
+	{
+		if (!ParseValue(s, value))
+			return -1;
+
+		images.push_back(value);
+	}
+
+	return images.empty() ? -1 : 0;
+}
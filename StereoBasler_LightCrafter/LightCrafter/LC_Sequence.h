@@ -0,0 +1,70 @@
+#ifndef LC_SEQUENCE_H
+#define LC_SEQUENCE_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#define SEQ_FILL_PATTERN 24 // 1-bit pattern number of the white-fill pattern, inverted for black-fill
+
+// One displayed pattern of a sequence
+struct SequencePattern
+{
+	unsigned int image = 0; // Flash image index
+	int patNum = 0; // Bit plane group inside the image
+	int bitDepth = 8; // from 1 to 8
+	int ledSelect = 7; // 0 no led, 1 red, 2 green, 3 yellow, 4 blue, 5 magenta, 6 cyan, 7 white
+	int trigType = 0; // 0 internal, 1 external positive, 2 external negative, 3 no input trigger
+	bool invert = false; // Invert pattern
+	bool insertBlack = false; // Insert black-fill pattern after this one
+	bool trigOutPrev = false; // Trigger Out 1 stays high from the previous pattern
+	unsigned int exposure = 0; // Exposure time in us, 0 to use the sequence default
+	unsigned int period = 0; // Frame period in us, 0 to use the sequence default
+};
+
+// Declarative description of a pattern sequence
+struct SequenceDescription
+{
+	std::vector<SequencePattern> patterns;
+	unsigned int exposure = 0; // Default exposure time in us
+	unsigned int period = 0; // Default frame period in us
+	unsigned int repeats = 1; // Number of times the pattern list is unrolled in the LUT
+	bool repeat = false; // true: repeat the sequence until stopped, false: display it once
+};
+
+// Arguments of one DLPC350_AddToPatLut()/DLPC350_AddToExpLut() call
+struct SequenceLutEntry
+{
+	int trigType;
+	int patNum;
+	int bitDepth;
+	int ledSelect;
+	bool invert;
+	bool insertBlack;
+	bool bufSwap;
+	bool trigOutPrev;
+	unsigned int exposure;
+	unsigned int period;
+};
+
+// Everything the device needs to run a sequence
+struct SequenceProgram
+{
+	std::vector<SequenceLutEntry> patLut;
+	std::vector<unsigned char> imageLut;
+	bool varExposure = false; // Variable exposure mode: per-pattern exposure/period in the LUT
+	bool repeat = false;
+	unsigned int numPatsForTrigOut2 = 0;
+	unsigned int exposure = 0; // Exposure and frame period for normal mode
+	unsigned int period = 0;
+	int trigMode = 1; // 1 internal/external trigger, 3 same for variable exposure
+	uint64_t hash = 0; // Hash of the description the program was compiled from
+};
+
+uint64_t SequenceHash(const SequenceDescription&);
+int CompileSequence(const SequenceDescription&, SequenceProgram&);
+const SequenceProgram* CompileSequenceCached(const SequenceDescription&);
+int ParseImageList(const std::string&, std::vector<unsigned int>&);
+SequenceDescription SequenceFromImages(const std::vector<unsigned int>&, unsigned int, unsigned int, bool, int bitDepth = 8, int patternsPerImage = 1);
+
+#endif
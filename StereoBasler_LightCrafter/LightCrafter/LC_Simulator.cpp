@@ -0,0 +1,227 @@
+// LC_Simulator.cpp : A DLPC350 behind the USB layer, for benchmarks and checks without a projector.
+//
+// The simulated device takes the reports hid_write() would send and returns the reports hid_read_timeout() would,
+// in real time. One 64 byte report goes each way per USB frame, as on the full-speed interrupt endpoints of the
+// DLPC350, and a write returns once its frame went out. Commands run one after the other: each costs a fixed
+// decoding time, plus 9 SCL periods per byte and a start and a stop for I2C0 transactions, and its reply is ready in
+// the first IN frame after it finished. The I2C0 port has a single slave at the given address, an auto-incremented
+// pointer set by the first byte written in front of 256 byte registers; other addresses are not acknowledged, which
+// I2C0_STAT reports until it is read. Other reads return zeros and other writes are acknowledged when asked to.
+
+
+#include "LC_Simulator.h"
+
+#include <algorithm>
+#include <thread>
+#include <cstring>
+#include <cstdint>
+
+using namespace std;
+
+
+#define SIM_I2C0_CMD2 0x1A
+#define SIM_I2C0_CTRL_CMD3 0x3B
+#define SIM_I2C0_STAT_CMD3 0x43
+#define SIM_I2C0_NO_ACK 0x01
+#define SIM_DEFAULT_READ_BYTES 4
+#define SIM_DEFAULT_SCL 100000
+
+
+
+SimulatedDLPC350::SimulatedDLPC350(unsigned int i2cAddress, const SimulatorTiming& timing)
+	: i2cAddress(i2cAddress), timing(timing)
+{
+	start = nextOut = nextIn = deviceFree = Clock::now();
+}
+
+
+
+DLPC350_USB_Port SimulatedDLPC350::Port()
+{
+	DLPC350_USB_Port port;
+	port.write = [](void* context, const unsigned char* data, size_t length)
+	{
+		return static_cast<SimulatedDLPC350*>(context)->Write(data, length);
+	};
+	port.read = [](void* context, unsigned char* data, size_t length, int milliseconds)
+	{
+		return static_cast<SimulatedDLPC350*>(context)->Read(data, length, milliseconds);
+	};
+	port.context = this;
+	return port;
+}
+
+
+
+SimulatedDLPC350::Clock::time_point SimulatedDLPC350::NextFrame(Clock::time_point t, Clock::time_point& next)
+{
+	// First frame of the endpoint at or after t, the endpoint is busy until the frame after it
+	chrono::microseconds frame(timing.frameUs);
+	Clock::time_point at = start + ((t - start) + frame - chrono::nanoseconds(1)) / frame * frame;
+	at = max(at, next);
+	next = at + frame;
+	return at;
+}
+
+
+
+int SimulatedDLPC350::Write(const unsigned char* data, size_t length)
+{
+	// Report number first, as for hid_write()
+	if (data == nullptr || length < 2)
+		return -1;
+
+	Clock::time_point sent;
+	{
+		lock_guard<mutex> lock(stateMutex);
+		sent = NextFrame(Clock::now(), nextOut);
+
+		size_t n = min<size_t>(length - 1, SIMULATOR_REPORT_SIZE);
+		message.insert(message.end(), data + 1, data + 1 + n);
+
+		size_t total = message.size() >= 4 ? 4 + (message[2] | message[3] << 8) : SIZE_MAX;
+		if (message.size() >= total)
+		{
+			message.resize(total);
+			Execute(message, sent);
+			message.clear();
+		}
+	}
+
+	this_thread::sleep_until(sent);
+	return static_cast<int>(length);
+}
+
+
+
+int SimulatedDLPC350::Read(unsigned char* data, size_t length, int milliseconds)
+{
+	// Returns 0 on timeout, as hid_read_timeout(); a negative timeout waits forever
+	Clock::time_point deadline = milliseconds < 0 ? Clock::time_point::max() : Clock::now() + chrono::milliseconds(milliseconds);
+
+	unique_lock<mutex> lock(stateMutex);
+	for (;;)
+	{
+		Clock::time_point now = Clock::now();
+		if (!replies.empty() && replies.front().ready <= now)
+			break;
+		if (now >= deadline)
+			return 0;
+
+		replied.wait_until(lock, replies.empty() ? deadline : min(replies.front().ready, deadline));
+	}
+
+	size_t n = min<size_t>(length, SIMULATOR_REPORT_SIZE);
+	memcpy(data, replies.front().data, n);
+	replies.pop_front();
+	return static_cast<int>(n);
+}
+
+
+
+bool SimulatedDLPC350::ExecuteI2C(const unsigned char* params, size_t length, bool read, vector<unsigned char>& reply,
+	chrono::microseconds& busy)
+{
+	// 7-bit flag, SCL clock, RFU, device address, write count, read count for reads, then the bytes to write
+	size_t header = read ? 15 : 13;
+	if (length < header)
+		return false;
+
+	unsigned int clk = params[1] | params[2] << 8 | params[3] << 16 | static_cast<unsigned int>(params[4]) << 24;
+	unsigned int devAddr = params[9] | params[10] << 8;
+	size_t numWrite = params[11] | params[12] << 8;
+	size_t numRead = read ? params[13] | params[14] << 8 : 0;
+	if (length < header + numWrite)
+		return false;
+
+	if (clk == 0)
+		clk = SIM_DEFAULT_SCL;
+	transactions++;
+
+	// Address byte and the bytes that follow it, with a repeated start and the address again for a read
+	size_t bytes = 1;
+	bool present = devAddr == i2cAddress;
+	if (present)
+		bytes += numWrite + (read ? 1 + numRead : 0);
+	busy += chrono::microseconds((bytes * 9 + 2) * 1000000ull / clk);
+
+	if (!present)
+	{
+		i2cStatus |= SIM_I2C0_NO_ACK;
+		return !read;
+	}
+
+	const unsigned char* w = params + header;
+	if (numWrite > 0)
+		pointer = w[0];
+	for (size_t i = 1; i < numWrite; i++)
+		registers[pointer++] = w[i];
+
+	for (size_t i = 0; i < numRead; i++)
+		reply.push_back(registers[pointer++]);
+
+	return true;
+}
+
+
+
+void SimulatedDLPC350::Execute(const vector<unsigned char>& m, Clock::time_point received)
+{
+	// Header: flags, sequence number, length, then the command word, CMD3 first
+	commands++;
+
+	bool read = (m[0] & 0x80) != 0;
+	bool wantsReply = (m[0] & 0x40) != 0;
+	vector<unsigned char> data;
+	chrono::microseconds busy(timing.commandUs);
+	bool nack = m.size() < 6;
+
+	if (!nack && m[5] == SIM_I2C0_CMD2 && m[4] == SIM_I2C0_CTRL_CMD3)
+		nack = !ExecuteI2C(m.data() + 6, m.size() - 6, read, data, busy);
+	else if (!nack && m[5] == SIM_I2C0_CMD2 && m[4] == SIM_I2C0_STAT_CMD3 && read)
+	{
+		data.push_back(i2cStatus);
+		i2cStatus = 0;
+	}
+	else if (read)
+		data.assign(SIM_DEFAULT_READ_BYTES, 0);
+
+	deviceFree = max(deviceFree, received) + busy;
+
+	if (!read && !wantsReply)
+		return;
+
+	if (nack)
+		data.clear();
+
+	vector<unsigned char> reply = { static_cast<unsigned char>((m[0] & 0xC7) | (nack ? 0x20 : 0)), m[1],
+		static_cast<unsigned char>(data.size()), static_cast<unsigned char>(data.size() >> 8) };
+	reply.insert(reply.end(), data.begin(), data.end());
+
+	for (size_t offset = 0; offset < reply.size(); offset += SIMULATOR_REPORT_SIZE)
+	{
+		Report report;
+		size_t n = min<size_t>(reply.size() - offset, SIMULATOR_REPORT_SIZE);
+		memset(report.data, 0, sizeof(report.data));
+		memcpy(report.data, &reply[offset], n);
+		report.ready = NextFrame(deviceFree, nextIn);
+		replies.push_back(report);
+	}
+
+	replied.notify_all();
+}
+
+
+
+unsigned int SimulatedDLPC350::Commands() const
+{
+	lock_guard<mutex> lock(stateMutex);
+	return commands;
+}
+
+
+unsigned int SimulatedDLPC350::I2CTransactions() const
+{
+	lock_guard<mutex> lock(stateMutex);
+	return transactions;
+}
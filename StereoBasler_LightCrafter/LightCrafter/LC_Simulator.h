@@ -0,0 +1,64 @@
+#ifndef LC_SIMULATOR_H
+#define LC_SIMULATOR_H
+
+#include "dlpc350_usb.h"
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+#define SIMULATOR_REPORT_SIZE 64
+#define SIMULATOR_REGISTERS 256
+
+// USB and controller timing of the simulated projector
+struct SimulatorTiming
+{
+	unsigned int frameUs = 1000; // USB frame, one report per direction and frame
+	unsigned int commandUs = 100; // Decoding and executing a command, before any I2C traffic
+};
+
+// A DLPC350 on the other side of hid_write() and hid_read_timeout(), for benchmarks and checks without a projector.
+// It answers every command and runs I2C0 transactions against one slave with 256 byte registers.
+class SimulatedDLPC350
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	SimulatedDLPC350(unsigned int i2cAddress, const SimulatorTiming& = SimulatorTiming());
+
+	int Write(const unsigned char*, size_t);
+	int Read(unsigned char*, size_t, int);
+	DLPC350_USB_Port Port(); // For DLPC350_USB_OpenPort()
+
+	unsigned int Commands() const;
+	unsigned int I2CTransactions() const;
+
+private:
+	struct Report
+	{
+		Clock::time_point ready;
+		unsigned char data[SIMULATOR_REPORT_SIZE];
+	};
+
+	Clock::time_point NextFrame(Clock::time_point, Clock::time_point&);
+	void Execute(const std::vector<unsigned char>&, Clock::time_point);
+	bool ExecuteI2C(const unsigned char*, size_t, bool, std::vector<unsigned char>&, std::chrono::microseconds&);
+
+	unsigned int i2cAddress;
+	SimulatorTiming timing;
+	Clock::time_point start, nextOut, nextIn, deviceFree;
+
+	mutable std::mutex stateMutex;
+	std::condition_variable replied;
+	std::vector<unsigned char> message; // Reports of the message being received
+	std::deque<Report> replies;
+
+	unsigned char registers[SIMULATOR_REGISTERS] = {};
+	unsigned char pointer = 0; // Register the next access of the slave starts at
+	unsigned char i2cStatus = 0; // Errors since the last I2C0_STAT read
+	unsigned int commands = 0, transactions = 0;
+};
+
+#endif
@@ -0,0 +1,303 @@
+// LC_Splash.cpp : Host-side encoder/decoder of DLPC350 splash images.
+//
+// Pattern images are packed into 24-bit frames and encoded in the splash formats stored in the projector
+// flash, so new pattern sets can be built and uploaded without TI's GUI.
+
+
+#include "LC_Splash.h"
+#include "LC_PixelFormat.h"
+
+#include "dlpc350_common.h"
+
+#include <cstring>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+
+using namespace std;
+
+
+static void PutWord16(vector<unsigned char>& out, size_t pos, unsigned int value)
+{
+	out[pos] = GET_BYTE0(value);
+	out[pos + 1] = GET_BYTE1(value);
+}
+
+
+static void PutWord32(vector<unsigned char>& out, size_t pos, unsigned int value)
+{
+	out[pos] = GET_BYTE0(value);
+	out[pos + 1] = GET_BYTE1(value);
+	out[pos + 2] = GET_BYTE2(value);
+	out[pos + 3] = GET_BYTE3(value);
+}
+
+
+static void PutCount(vector<unsigned char>& out, unsigned int n)
+{
+	if (n < 128)
+		out.push_back(n);
+	else
+	{
+		out.push_back(0x80 | (n & 0x7F));
+		out.push_back(n >> 7);
+	}
+}
+
+
+static int GetCount(const unsigned char*& p, const unsigned char* end, unsigned int& n)
+{
+	if (p >= end)
+		return -1;
+
+	n = *p++;
+	if (n & 0x80)
+	{
+		if (p >= end)
+			return -1;
+		n = (n & 0x7F) | (*p++ << 7);
+	}
+
+	return 0;
+}
+
+
+static inline bool SamePixel(const unsigned char* a, const unsigned char* b)
+{
+	return a[0] == b[0] && a[1] == b[1] && a[2] == b[2];
+}
+
+
+static void EncodeLine(const unsigned char* line, const unsigned char* above, unsigned int width, vector<unsigned char>& out)
+{
+	unsigned int x = 0;
+	unsigned int litStart = 0; // First pixel of the pending literal block
+
+	auto flushLiterals = [&](unsigned int stop)
+	{
+		while (litStart < stop)
+		{
+			unsigned int n = min(stop - litStart, 0x7FFFu);
+			if (n == 1)
+			{
+				// A single pixel is cheaper as a run of one (0x00 0x01 is reserved)
+				out.push_back(1);
+			}
+			else
+			{
+				out.push_back(0);
+				PutCount(out, n);
+			}
+			out.insert(out.end(), line + 3 * litStart, line + 3 * (litStart + n));
+			litStart += n;
+		}
+	};
+
+	while (x < width)
+	{
+		unsigned int copy = 0;
+		if (above)
+			while (x + copy < width && copy < 0x7FFF && SamePixel(line + 3 * (x + copy), above + 3 * (x + copy)))
+				copy++;
+
+		unsigned int run = 1;
+		while (x + run < width && run < 0x7FFF && SamePixel(line + 3 * (x + run), line + 3 * x))
+			run++;
+
+		if (copy >= 2 && copy >= run)
+		{
+			flushLiterals(x);
+			out.push_back(0);
+			out.push_back(1);
+			PutCount(out, copy);
+			x += copy;
+			litStart = x;
+		}
+		else if (run >= 2)
+		{
+			flushLiterals(x);
+			PutCount(out, run);
+			out.insert(out.end(), line + 3 * x, line + 3 * x + 3);
+			x += run;
+			litStart = x;
+		}
+		else
+			x++;
+	}
+	flushLiterals(width);
+
+	// End of line
+	out.push_back(0);
+	out.push_back(0);
+}
+
+
+int PackSplashFrame(const vector<const unsigned char*>& patterns, unsigned int width, unsigned int height, SplashFrame& frame)
+{
+	// Up to three 8-bit patterns per frame, placed in the G, R and B channels (pattern numbers 0, 1 and 2 of an 8-bit LUT entry)
+	if (patterns.empty() || patterns.size() > 3 || width == 0 || height == 0)
+		return -1;
+
+	frame.width = width;
+	frame.height = height;
+	frame.pixels.resize(static_cast<size_t>(width) * height * BYTES_PER_PIXEL);
+
+	// The frame bytes are laid out as RGB24 with the patterns as planes, missing patterns are black
+	const unsigned char* planes[3] = { nullptr, nullptr, nullptr };
+	copy(patterns.begin(), patterns.end(), planes);
+	Image_t image = { frame.pixels.data(), width, height, width * BYTES_PER_PIXEL, IMAGE_PIX_FORMAT_RGB24 };
+
+	return ImageFromPlanar(planes, width, image);
+}
+
+
+vector<unsigned char> EncodeSplash(const SplashFrame& frame, SplashCompression compression)
+{
+	vector<unsigned char> out(SPLASH_HEADER_SIZE, 0);
+	size_t lineBytes = static_cast<size_t>(frame.width) * BYTES_PER_PIXEL;
+
+	if (compression == SPLASH_UNCOMPRESSED)
+		out.insert(out.end(), frame.pixels.begin(), frame.pixels.end());
+	else
+	{
+		out.reserve(SPLASH_HEADER_SIZE + frame.pixels.size() / 4);
+		for (unsigned int y = 0; y < frame.height; y++)
+		{
+			const unsigned char* line = frame.pixels.data() + y * lineBytes;
+			const unsigned char* above = (compression == SPLASH_4LINE_COMPRESSION && y > 0) ? line - lineBytes : nullptr;
+			EncodeLine(line, above, frame.width, out);
+		}
+	}
+
+	// Data is padded to a 4 byte boundary in flash
+	out.resize(ALIGN_BYTES_NEXT(out.size(), 4), 0);
+
+	// Header
+	PutWord32(out, 0, SPLASH_SIGNATURE);
+	PutWord16(out, 4, frame.width);
+	PutWord16(out, 6, frame.height);
+	PutWord32(out, 8, static_cast<unsigned int>(out.size() - SPLASH_HEADER_SIZE)); // Byte count
+	out[36] = 0; // Pixel format: 24-bit
+	out[37] = compression;
+	out[38] = 1; // Color order: G, R, B
+	out[39] = 0; // Chroma order (unused for RGB)
+	out[40] = 0; // Byte order: little endian
+
+	return out;
+}
+
+
+int DecodeSplash(const unsigned char* data, size_t len, SplashFrame& frame)
+{
+	if (data == nullptr || len < SPLASH_HEADER_SIZE || PARSE_WORD32_LE(data) != SPLASH_SIGNATURE)
+		return -1;
+
+	unsigned int width = PARSE_WORD16_LE(data + 4);
+	unsigned int height = PARSE_WORD16_LE(data + 6);
+	unsigned int byteCount = PARSE_WORD32_LE(data + 8);
+	unsigned int compression = data[37];
+
+	if (byteCount > len - SPLASH_HEADER_SIZE || width == 0 || height == 0)
+		return -1;
+
+	size_t lineBytes = static_cast<size_t>(width) * BYTES_PER_PIXEL;
+	const unsigned char* p = data + SPLASH_HEADER_SIZE;
+	const unsigned char* end = p + byteCount;
+
+	frame.width = width;
+	frame.height = height;
+	frame.pixels.assign(lineBytes * height, 0);
+
+	if (compression == SPLASH_UNCOMPRESSED)
+	{
+		if (byteCount < frame.pixels.size())
+			return -1;
+		memcpy(frame.pixels.data(), p, frame.pixels.size());
+		return 0;
+	}
+
+	if (compression != SPLASH_RLE_COMPRESSION && compression != SPLASH_4LINE_COMPRESSION)
+		return -1;
+
+	for (unsigned int y = 0; y < height; y++)
+	{
+		unsigned char* line = frame.pixels.data() + y * lineBytes;
+		unsigned int x = 0;
+		unsigned int n;
+
+		while (true)
+		{
+			if (GetCount(p, end, n) < 0)
+				return -1;
+
+			if (n > 0)
+			{
+				// Run of one pixel
+				if (x + n > width || end - p < 3)
+					return -1;
+				for (unsigned int i = 0; i < n; i++, x++)
+					memcpy(line + 3 * x, p, 3);
+				p += 3;
+				continue;
+			}
+
+			if (GetCount(p, end, n) < 0)
+				return -1;
+
+			if (n == 0)
+				break; // End of line
+
+			if (n == 1)
+			{
+				// Copy from the line above
+				if (compression != SPLASH_4LINE_COMPRESSION || y == 0 || GetCount(p, end, n) < 0 || x + n > width)
+					return -1;
+				memcpy(line + 3 * x, line - lineBytes + 3 * x, 3 * n);
+				x += n;
+			}
+			else
+			{
+				// Literal pixels
+				if (x + n > width || static_cast<size_t>(end - p) < 3 * n)
+					return -1;
+				memcpy(line + 3 * x, p, 3 * n);
+				p += 3 * n;
+				x += n;
+			}
+		}
+
+		if (x != width)
+			return -1;
+	}
+
+	return 0;
+}
+
+
+vector<vector<unsigned char>> EncodeSplashImages(const vector<SplashFrame>& frames, SplashCompression compression, unsigned int numThreads)
+{
+	vector<vector<unsigned char>> images(frames.size());
+	atomic<size_t> next{ 0 };
+
+	if (numThreads == 0)
+		numThreads = max(1u, thread::hardware_concurrency());
+	numThreads = static_cast<unsigned int>(min<size_t>(numThreads, frames.size()));
+
+	// Each worker takes the next frame to encode until all are done
+	auto worker = [&]()
+	{
+		for (size_t i = next++; i < frames.size(); i = next++)
+			images[i] = EncodeSplash(frames[i], compression);
+	};
+
+	vector<thread> workers;
+	for (unsigned int t = 1; t < numThreads; t++)
+		workers.emplace_back(worker);
+	worker();
+
+	for (auto& w : workers)
+		w.join();
+
+	return images;
+}
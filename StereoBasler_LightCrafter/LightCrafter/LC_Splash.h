@@ -0,0 +1,40 @@
+#ifndef LC_SPLASH_H
+#define LC_SPLASH_H
+
+#include <vector>
+#include <cstddef>
+
+#define SPLASH_SIGNATURE 0x636C7053 // "Splc"
+#define SPLASH_HEADER_SIZE 48
+
+// Splash image data formats of the DLPC350
+//	SPLASH_UNCOMPRESSED: raw 24-bit pixels, line after line
+//	SPLASH_RLE_COMPRESSION: run-length encoded lines, each line made of
+//		[n] P			pixel P repeated n times
+//		0x00 [n] P1..Pn	n (>= 2) literal pixels
+//		0x00 0x00		end of line
+//	SPLASH_4LINE_COMPRESSION: RLE plus
+//		0x00 0x01 [n]	copy n pixels from the line above
+// Counts below 128 take one byte, larger counts two: (0x80 | n & 0x7F), n >> 7
+enum SplashCompression
+{
+	SPLASH_UNCOMPRESSED = 0,
+	SPLASH_RLE_COMPRESSION = 1,
+	SPLASH_4LINE_COMPRESSION = 2
+};
+
+// 24-bit frame as stored in flash. Each pixel takes 3 bytes in the order of the DLPC350 bit planes:
+// byte 0 holds G0-G7 (patterns 0-7), byte 1 R0-R7 (patterns 8-15) and byte 2 B0-B7 (patterns 16-23)
+struct SplashFrame
+{
+	unsigned int width = 0;
+	unsigned int height = 0;
+	std::vector<unsigned char> pixels;
+};
+
+int PackSplashFrame(const std::vector<const unsigned char*>&, unsigned int, unsigned int, SplashFrame&);
+std::vector<unsigned char> EncodeSplash(const SplashFrame&, SplashCompression);
+int DecodeSplash(const unsigned char*, size_t, SplashFrame&);
+std::vector<std::vector<unsigned char>> EncodeSplashImages(const std::vector<SplashFrame>&, SplashCompression, unsigned int numThreads = 0);
+
+#endif
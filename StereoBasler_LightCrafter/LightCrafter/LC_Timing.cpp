@@ -0,0 +1,242 @@
+// LC_Timing.cpp : Host-side timing model of the DLPC350 pattern sequencer and the triggered cameras.
+//
+// Checks a compiled sequence against the rules the device applies in DLPC350_ValidatePatLutData() (minimum exposure
+// per bit depth, 230 us between exposure end and next pattern for black-fill or exposure < period, Trigger Out 1
+// overlap, black-fill before externally triggered patterns) and two rules it does not check: every flash image
+// must be displayed long enough to load the next one, and the cameras must be able to expose and read out within
+// each Trigger Out 1 pulse. The image load time is an assumed value, so missing it is a warning and only lengthens
+// the shortest legal sequence. It predicts the sequence duration and the shortest legal one for the same LUT, so the
+// device validation only confirms settings found on the host.
+
+
+#include "LC_Timing.h"
+
+#include <cstdio>
+#include <algorithm>
+
+
+using namespace std;
+
+
+static void AddProblem(SequenceTimingReport& report, unsigned int status, const string& message)
+{
+	report.status |= status;
+	report.problems.push_back(message);
+}
+
+
+
+unsigned int MinPatternPeriod(int bitDepth, bool insertBlack, const SequencerTiming& timing)
+{
+	if (bitDepth < 1 || bitDepth > 8)
+		return 0;
+
+	return timing.minExposure[bitDepth] + (insertBlack ? timing.blackFillTime : 0);
+}
+
+
+
+static unsigned int CameraMinPeriod(const CameraTiming& camera)
+{
+	return camera.overlapped ? max(camera.exposure, camera.readout) : camera.exposure + camera.readout;
+}
+
+
+static bool CheckGroups(const SequenceProgram& program, const vector<unsigned int>& exposure, const vector<unsigned int>& period,
+	const CameraTiming* camera, const SequencerTiming& timing, SequenceTimingReport* report, vector<unsigned int>* pad)
+{
+	// Constraints spanning several patterns. Missing time is reported as a problem when report is given and
+	// added to the last pattern of the group when pad is given.
+	size_t n = program.patLut.size();
+	bool ok = true;
+
+	auto deficit = [&](size_t last, unsigned long long have, unsigned long long need, unsigned int status, const char* what)
+	{
+		if (have >= need)
+			return;
+
+		ok = false;
+		if (report)
+		{
+			char message[160];
+			snprintf(message, sizeof(message), "Pattern %zu: %s needs %llu us, the sequence gives %llu us", last, what, need, have);
+			AddProblem(*report, status, message);
+		}
+		if (pad)
+			(*pad)[last] = max<unsigned int>((*pad)[last], static_cast<unsigned int>(need - have));
+	};
+
+	// Each flash image must stay on long enough to load the next one into the idle buffer
+	size_t numImages = program.imageLut.size();
+	for (size_t i = 0, image = 0; i < n; image++)
+	{
+		size_t j = i + 1;
+		unsigned long long shown = period[i];
+		for (; j < n && !program.patLut[j].bufSwap; j++)
+			shown += period[j];
+
+		if (numImages > 1 && (image + 1 < numImages || program.repeat))
+			deficit(j - 1, shown, timing.imageLoadTime, SEQ_STATUS_IMAGE_LOAD, "flash image load");
+
+		i = j;
+	}
+
+	// Each Trigger Out 1 pulse starts a camera frame that must be exposed while the patterns are lit
+	if (camera)
+	{
+		for (size_t i = 0; i < n;)
+		{
+			size_t j = i + 1;
+			unsigned long long lit = 0, spacing = period[i];
+			for (; j < n && program.patLut[j].trigOutPrev; j++)
+			{
+				lit += period[j - 1];
+				spacing += period[j];
+			}
+			lit += exposure[j - 1];
+
+			deficit(j - 1, lit, camera->triggerDelay + camera->exposure, SEQ_STATUS_CAMERA, "camera exposure");
+			if (j < n || program.repeat)
+				deficit(j - 1, spacing, CameraMinPeriod(*camera), SEQ_STATUS_CAMERA, "camera frame period");
+
+			i = j;
+		}
+	}
+
+	return ok;
+}
+
+
+
+int CheckSequenceTiming(const SequenceProgram& program, SequenceTimingReport& report, const CameraTiming* camera, const SequencerTiming& timing)
+{
+	report = SequenceTimingReport();
+	size_t n = program.patLut.size();
+	char message[160];
+
+	if (n == 0)
+	{
+		AddProblem(report, SEQ_STATUS_PATNUM, "Empty pattern LUT");
+		return -1;
+	}
+
+
+
+	// Rules of a single pattern
+	for (size_t i = 0; i < n; i++)
+	{
+		const SequenceLutEntry& e = program.patLut[i];
+		const SequenceLutEntry& prev = program.patLut[(i + n - 1) % n];
+
+		if (e.bitDepth < 1 || e.bitDepth > 8)
+		{
+			snprintf(message, sizeof(message), "Pattern %zu: invalid bit depth %d", i, e.bitDepth);
+			AddProblem(report, SEQ_STATUS_PATNUM, message);
+			continue;
+		}
+
+		unsigned int minExposure = timing.minExposure[e.bitDepth];
+		if (e.exposure < minExposure || e.exposure > e.period)
+		{
+			snprintf(message, sizeof(message), "Pattern %zu: exposure %u us / period %u us, %d-bit patterns need at least %u us",
+				i, e.exposure, e.period, e.bitDepth, minExposure);
+			AddProblem(report, SEQ_STATUS_EXPOSURE, message);
+		}
+		else if ((e.insertBlack || e.exposure < e.period) && e.period - e.exposure < timing.blackFillTime)
+		{
+			snprintf(message, sizeof(message), "Pattern %zu: period exceeds exposure by %u us, at least %u us are needed",
+				i, e.period - e.exposure, timing.blackFillTime);
+			AddProblem(report, SEQ_STATUS_230US, message);
+		}
+
+		if (e.trigOutPrev && (i == 0 || prev.insertBlack))
+		{
+			snprintf(message, sizeof(message), "Pattern %zu: Trigger Out 1 continued %s", i, i == 0 ? "from before the sequence" : "over a black-fill");
+			AddProblem(report, SEQ_STATUS_TRIGOUT, message);
+		}
+
+		if (e.trigType == 1 || e.trigType == 2)
+		{
+			report.externalTrigger = true;
+			if (!prev.insertBlack)
+			{
+				snprintf(message, sizeof(message), "Pattern %zu: externally triggered without black-fill on the previous pattern", i);
+				AddProblem(report, SEQ_STATUS_POST_VECTOR, message);
+			}
+		}
+
+		if (i == 0 || !e.trigOutPrev)
+			report.numTriggers++;
+	}
+
+	if (report.status & SEQ_STATUS_PATNUM)
+		return -1;
+
+
+
+	// Image loads and camera with the programmed periods
+	vector<unsigned int> exposure(n), period(n);
+	for (size_t i = 0; i < n; i++)
+	{
+		exposure[i] = program.patLut[i].exposure;
+		period[i] = program.patLut[i].period;
+		report.duration += period[i];
+	}
+
+	CheckGroups(program, exposure, period, camera, timing, &report, nullptr);
+
+
+
+	// Shortest legal periods: start from the per-pattern minimum and lengthen the last pattern of every group
+	// that misses a constraint. Normal mode needs the same exposure and period for every pattern.
+	for (size_t i = 0; i < n; i++)
+	{
+		exposure[i] = timing.minExposure[program.patLut[i].bitDepth];
+		period[i] = MinPatternPeriod(program.patLut[i].bitDepth, program.patLut[i].insertBlack, timing);
+	}
+
+	for (int iter = 0; iter < 16; iter++)
+	{
+		if (!program.varExposure)
+		{
+			unsigned int maxExposure = *max_element(exposure.begin(), exposure.end());
+			unsigned int maxGap = 0;
+			for (size_t i = 0; i < n; i++)
+				maxGap = max(maxGap, period[i] - exposure[i]);
+
+			fill(exposure.begin(), exposure.end(), maxExposure);
+			fill(period.begin(), period.end(), maxExposure + maxGap);
+		}
+
+		vector<unsigned int> pad(n, 0);
+		if (CheckGroups(program, exposure, period, camera, timing, nullptr, &pad))
+			break;
+
+		for (size_t i = 0; i < n; i++)
+		{
+			exposure[i] += pad[i];
+			period[i] += pad[i];
+		}
+	}
+
+	for (size_t i = 0; i < n; i++)
+		report.minDuration += period[i];
+
+	report.rate = report.duration ? 1e6 / report.duration : 0;
+	report.maxRate = report.minDuration ? 1e6 / report.minDuration : 0;
+
+	return (report.status & ~SEQ_STATUS_WARNING_MASK) ? -1 : 0;
+}
+
+
+
+void PrintSequenceTimingReport(const SequenceTimingReport& report)
+{
+	printf("Sequence: %u camera triggers, %.3f ms per pass (%.2f captures/s)\n", report.numTriggers, report.duration / 1000.0, report.rate);
+	printf("Shortest legal: %.3f ms per pass (%.2f captures/s)\n", report.minDuration / 1000.0, report.maxRate);
+	if (report.externalTrigger)
+		printf("  Patterns wait for TRIG_IN: durations are lower bounds\n");
+
+	for (const auto& p : report.problems)
+		printf("  %s\n", p.c_str());
+}
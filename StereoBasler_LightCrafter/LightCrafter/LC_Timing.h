@@ -0,0 +1,54 @@
+#ifndef LC_TIMING_H
+#define LC_TIMING_H
+
+#include "LC_Sequence.h"
+
+#include <string>
+#include <vector>
+
+// Predicted status bits, the low five match DLPC350_ValidatePatLutData()
+#define SEQ_STATUS_EXPOSURE         0x01 // Exposure or frame period invalid
+#define SEQ_STATUS_PATNUM           0x02 // Pattern numbers invalid
+#define SEQ_STATUS_TRIGOUT          0x04 // Continuous Trigger Out 1 request or overlapping black sectors (warning)
+#define SEQ_STATUS_POST_VECTOR      0x08 // No black-fill before an externally triggered pattern (warning)
+#define SEQ_STATUS_230US            0x10 // Frame period and exposure differ by less than 230 us
+#define SEQ_STATUS_IMAGE_LOAD       0x20 // Next flash image may not be loaded in time (host model only, warning)
+#define SEQ_STATUS_CAMERA           0x40 // Camera cannot follow the triggers (host model only)
+
+#define SEQ_STATUS_DEVICE_MASK      0x1F
+#define SEQ_STATUS_WARNING_MASK     (SEQ_STATUS_TRIGOUT | SEQ_STATUS_POST_VECTOR | SEQ_STATUS_IMAGE_LOAD)
+
+// Pattern sequencer constants, in us
+struct SequencerTiming
+{
+	unsigned int minExposure[9] = { 0, 235, 700, 1570, 1700, 2000, 2500, 4500, 8333 }; // Minimum exposure per bit depth
+	unsigned int blackFillTime = 230; // Time between exposure end and next pattern for black-fill and exposure < period
+	unsigned int imageLoadTime = 8333; // Flash image load into the idle buffer, assumed one 120 Hz frame and not measured, so only a warning
+};
+
+// Triggered camera, in us
+struct CameraTiming
+{
+	unsigned int exposure = 0;
+	unsigned int readout = 0; // Sensor readout time
+	unsigned int triggerDelay = 0;
+	bool overlapped = true; // Exposure of a frame may overlap the readout of the previous one
+};
+
+struct SequenceTimingReport
+{
+	unsigned int status = 0; // SEQ_STATUS_* bits
+	std::vector<std::string> problems;
+	unsigned int numTriggers = 0; // Trigger Out 1 pulses (camera frames) per sequence
+	bool externalTrigger = false; // Durations are lower bounds when patterns wait for TRIG_IN
+	unsigned long long duration = 0; // One pass of the sequence with the programmed periods, us
+	unsigned long long minDuration = 0; // Shortest legal pass for the same LUT and camera, us
+	double rate = 0; // Sequences (3D captures) per second with the programmed periods
+	double maxRate = 0; // Sequences per second with the shortest legal periods
+};
+
+unsigned int MinPatternPeriod(int, bool, const SequencerTiming& timing = SequencerTiming());
+int CheckSequenceTiming(const SequenceProgram&, SequenceTimingReport&, const CameraTiming* camera = nullptr, const SequencerTiming& timing = SequencerTiming());
+void PrintSequenceTimingReport(const SequenceTimingReport&);
+
+#endif
@@ -46,8 +46,9 @@
 #include "dlpc350_api.h"
 #include "dlpc350_usb.h"
 
-extern unsigned char g_OutputBuffer[];
-extern unsigned char g_InputBuffer[];
+/* Report buffers of the selected device slot */
+#define g_OutputBuffer (DLPC350_USB_OutputBuffer())
+#define g_InputBuffer (DLPC350_USB_InputBuffer())
 
 CmdFormat CmdList[255] =
 {
@@ -134,16 +135,78 @@ CmdFormat CmdList[255] =
     {   0x00,  0x30,  0x01   }     //BL_PROG_MODE,
 };
 
-static unsigned char g_SeqNum=0;
-static unsigned long int g_PatLut[MAX_PAT_LUT_ENTRIES] = {0};
-static unsigned int g_PatLutIndex = 0;
-static unsigned long int g_ExpLut[MAX_VAR_EXP_PAT_LUT_ENTRIES*3] = {0};
-static unsigned int g_ExpLutIndex = 0;
+/* Queued I2C0 transaction, see DLPC350_I2C0BatchBegin() */
+typedef struct _i2cBatchOp
+{
+    bool read;
+    unsigned int devAddr;
+    unsigned int numWriteBytes;
+    unsigned int numReadBytes;
+    unsigned int dataOffset;
+    unsigned char *pRData;
+}i2cBatchOp;
+
+/* Staging state of one device slot, like the USB buffers. It belongs to the device and not to a thread, so a LUT
+   staged by one thread can be sent by another; calls on the same slot must be serialized by the caller. */
+typedef struct _apiContext
+{
+    unsigned char seqNum;
+    unsigned long int patLut[MAX_PAT_LUT_ENTRIES];
+    unsigned int patLutIndex;
+    unsigned long int expLut[MAX_VAR_EXP_PAT_LUT_ENTRIES*3];
+    unsigned int expLutIndex;
+
+    i2cBatchOp i2cBatch[MAX_I2C0_BATCH_OPS];
+    unsigned int i2cBatchCount;
+    unsigned char i2cBatchData[MAX_I2C0_BATCH_DATA];
+    unsigned int i2cBatchDataLen;
+    bool i2cBatch7Bit = true;
+    unsigned int i2cBatchClk = 100000;
+}apiContext;
+
+static apiContext g_Context[DLPC350_USB_MAX_DEVICES];
+
+static apiContext *Context()
+{
+    return &g_Context[DLPC350_USB_Selected()];
+}
+
+#define g_SeqNum (Context()->seqNum)
+#define g_PatLut (Context()->patLut)
+#define g_PatLutIndex (Context()->patLutIndex)
+#define g_ExpLut (Context()->expLut)
+#define g_ExpLutIndex (Context()->expLutIndex)
+#define g_I2CBatch (Context()->i2cBatch)
+#define g_I2CBatchCount (Context()->i2cBatchCount)
+#define g_I2CBatchData (Context()->i2cBatchData)
+#define g_I2CBatchDataLen (Context()->i2cBatchDataLen)
+#define g_I2CBatch7Bit (Context()->i2cBatch7Bit)
+#define g_I2CBatchClk (Context()->i2cBatchClk)
+
+/* Local types */
+typedef struct _hidSpan
+{
+    const unsigned char *data;
+    unsigned int len;
+}hidSpan;
+
+typedef enum
+{
+    HID_REPLY_NONE,     /* No response expected after the last report */
+    HID_REPLY_ACK,      /* Last report is followed by an ACK/NACK read */
+    HID_REPLY_READ,     /* Last report is a read request, response is left in g_InputBuffer */
+    HID_REPLY_DEFERRED  /* Last report is a read request, response is read later with DLPC350_USB_Read() */
+}hidReplyType;
+
+#define HID_MAX_PAYLOAD_SPANS   4
 
 /* Local functions */
 static int DLPC350_Write(bool ackRequired);
 static int DLPC350_Read();
 static int DLPC350_ContinueRead();
+static unsigned int DLPC350_PackReport(const hidSpan *spans, unsigned int numSpans, unsigned int *pSpan, unsigned int *pOffset);
+static void DLPC350_StageReport(const hidMessageStruct *pMsg);
+static int DLPC350_SendPackets(hidMessageStruct *pMsg, const hidSpan *payload, unsigned int numPayload, hidReplyType reply);
 static int DLPC350_SendMsg(hidMessageStruct *pMsg, bool ackRequired);
 static int DLPC350_PrepReadCmd(DLPC350_CMD cmd);
 static int DLPC350_PrepReadCmdWithParam(DLPC350_CMD cmd, unsigned char param);
@@ -209,60 +272,158 @@ static int DLPC350_ContinueRead()
     return DLPC350_USB_Read();
 }
 
-static int DLPC350_SendMsg(hidMessageStruct *pMsg, bool ackRequired)
+static unsigned int DLPC350_PackReport(const hidSpan *spans, unsigned int numSpans, unsigned int *pSpan, unsigned int *pOffset)
 /**
- * This function is private to this file. This function is called to send a message over USB; in chunks of 64 bytes.
+ * This function is private to this file. Fills g_OutputBuffer with the next report worth of message bytes, gathered
+ * straight from the span list starting at the given cursor, and advances the cursor. The unused tail of the last
+ * report is zeroed.
+ *
+ * @param   spans - I - list of byte ranges that make up the message (header first)
+ * @param   numSpans - I - number of entries in spans
+ * @param   pSpan - I/O - index of the span to continue from
+ * @param   pOffset - I/O - byte offset within that span
+ *
+ * @return  number of message bytes packed into the report
+ *
+ */
+{
+    unsigned int filled = 0;
+    unsigned int n;
+
+    g_OutputBuffer[0]=0; // First byte is the report number
+
+    while((filled < USB_MAX_PACKET_SIZE) && (*pSpan < numSpans))
+    {
+        n = MIN(spans[*pSpan].len - *pOffset, USB_MAX_PACKET_SIZE - filled);
+        memcpy(&g_OutputBuffer[1+filled], spans[*pSpan].data + *pOffset, n);
+        filled += n;
+        *pOffset += n;
+
+        if(*pOffset >= spans[*pSpan].len)
+        {
+            (*pSpan)++;
+            *pOffset = 0;
+        }
+    }
+
+    memset(&g_OutputBuffer[1+filled], 0, USB_MAX_PACKET_SIZE - filled);
+
+    return filled;
+}
+
+static void DLPC350_StageReport(const hidMessageStruct *pMsg)
+/**
+ * This function is private to this file. Copies a single-report message (read requests) to g_OutputBuffer
+ * so that the next DLPC350_Read() sends it.
+ *
+ * @param   pMsg - I - Pointer to the message, head.length must already be set.
+ *
+ */
+{
+    hidSpan span;
+    unsigned int spanIdx = 0, offset = 0;
+
+    span.data = (const unsigned char *)pMsg;
+    span.len = MIN(sizeof(pMsg->head) + pMsg->head.length, USB_MAX_PACKET_SIZE);
+
+    DLPC350_PackReport(&span, 1, &spanIdx, &offset);
+}
+
+static int DLPC350_SendPackets(hidMessageStruct *pMsg, const hidSpan *payload, unsigned int numPayload, hidReplyType reply)
+/**
+ * This function is private to this file. It is the one packetizer shared by every sender (commands, LUT uploads,
+ * bootloader downloads and I2C0 transactions). The header and command word are taken from pMsg, the payload is
+ * gathered from the given spans directly into each 64 byte report, so the payload is copied only once on its way
+ * to hid_write. head.length is computed here from the payload size.
+ *
+ * @param   pMsg - I - Message whose head and text.cmd are already prepared
+ * @param   payload - I - list of payload byte ranges following the command word
+ * @param   numPayload - I - number of payload spans (up to HID_MAX_PAYLOAD_SPANS)
+ * @param   reply - I - what happens after the last report, see hidReplyType
  *
  * @return  number of bytes sent
  *          -1 = FAIL
  *
  */
 {
-    int maxDataSize = USB_MAX_PACKET_SIZE-sizeof(pMsg->head);
-    int dataBytesSent = MIN(pMsg->head.length, maxDataSize);    //Send all data or max possible
+    hidSpan spans[1+HID_MAX_PAYLOAD_SPANS];
+    unsigned int totalLen = sizeof(pMsg->text.cmd);
+    unsigned int numSpans = 1;
+    unsigned int spanIdx = 0, offset = 0;
+    unsigned int bytesPacked = 0;
+    unsigned int i;
+    int ret_val;
+
+    if(numPayload > HID_MAX_PAYLOAD_SPANS)
+        return -1;
+
+    for(i=0; i<numPayload; i++)
+    {
+        totalLen += payload[i].len;
+        spans[numSpans++] = payload[i];
+    }
+
+    if(totalLen > HID_MESSAGE_MAX_SIZE)
+        return -1;
 
     // Default the DLPC350_PrepWriteCmd() update write message for ACK
     // if user not expecting adjust accordingly
-    if(!ackRequired)
+    if(reply == HID_REPLY_NONE)
         pMsg->head.flags.reply = 0;
 
-    g_OutputBuffer[0]=0; // First byte is the report number
-    memcpy(&g_OutputBuffer[1], pMsg, (sizeof(pMsg->head) + dataBytesSent));
+    pMsg->head.length = totalLen;
+    spans[0].data = (const unsigned char *)pMsg;
+    spans[0].len = sizeof(pMsg->head) + sizeof(pMsg->text.cmd);
+    totalLen += sizeof(pMsg->head);
 
-    //Single packet transaction
-    if(dataBytesSent >= pMsg->head.length)
+    do
     {
-        if(DLPC350_Write(ackRequired) < 0)
+        bytesPacked += DLPC350_PackReport(spans, numSpans, &spanIdx, &offset);
+
+        if(bytesPacked < totalLen)
+        {
+            //middle packet
+            ret_val = DLPC350_USB_Write();
+        }
+        else if(reply == HID_REPLY_READ)
+        {
+            //last packet carries the read request
+            ret_val = DLPC350_Read();
+        }
+        else if(reply == HID_REPLY_DEFERRED)
+        {
+            //last packet carries the read request, the caller collects the response
+            ret_val = DLPC350_USB_Write();
+        }
+        else
+        {
+            //last packet request for ACK if required
+            ret_val = DLPC350_Write(reply == HID_REPLY_ACK);
+        }
+
+        if(ret_val < 0)
             return -1;
     }
-    else
-    {
-        //Send ACK request only for the last packet
-        if(DLPC350_Write(0) < 0)
-            return -1;
+    while(bytesPacked < totalLen);
 
-        while(dataBytesSent < pMsg->head.length)
-        {
-            memcpy(&g_OutputBuffer[1], &pMsg->text.data[dataBytesSent], USB_MAX_PACKET_SIZE);
+    return totalLen;
+}
 
-            if((dataBytesSent+USB_MAX_PACKET_SIZE) >= (pMsg->head.length))
-            {
-                //last packet request for ACK
-                if(DLPC350_Write(ackRequired) < 0)
-                    return -1;
-            }
-            else
-            {
-                //middle packet
-                if(DLPC350_Write(0) < 0)
-                    return -1;
-            }
+static int DLPC350_SendMsg(hidMessageStruct *pMsg, bool ackRequired)
+/**
+ * This function is private to this file. This function is called to send a message over USB; in chunks of 64 bytes.
+ *
+ * @return  number of bytes sent
+ *          -1 = FAIL
+ *
+ */
+{
+    hidSpan payload;
 
-            dataBytesSent += USB_MAX_PACKET_SIZE;
-        }
-    }
+    payload.data = &pMsg->text.data[sizeof(pMsg->text.cmd)];
+    payload.len = pMsg->head.length - sizeof(pMsg->text.cmd);
 
-    return dataBytesSent+sizeof(pMsg->head);
+    return DLPC350_SendPackets(pMsg, &payload, 1, ackRequired ? HID_REPLY_ACK : HID_REPLY_NONE);
 }
 
 static int DLPC350_PrepReadCmd(DLPC350_CMD cmd)
@@ -304,8 +465,7 @@ static int DLPC350_PrepReadCmd(DLPC350_CMD cmd)
         msg.head.length += 1;
     }
 
-    g_OutputBuffer[0]=0; // First byte is the report number
-    memcpy(&g_OutputBuffer[1], &msg, (sizeof(msg.head)+sizeof(msg.text.cmd) + msg.head.length));
+    DLPC350_StageReport(&msg);
     return 0;
 }
 
@@ -335,8 +495,7 @@ static int DLPC350_PrepReadCmdWithParam(DLPC350_CMD cmd, unsigned char param)
 
     msg.text.data[2] = param;
 
-    g_OutputBuffer[0]=0; // First byte is the report number
-    memcpy(&g_OutputBuffer[1], &msg, (sizeof(msg.head)+sizeof(msg.text.cmd) + msg.head.length));
+    DLPC350_StageReport(&msg);
     return 0;
 }
 
@@ -368,8 +527,7 @@ static int DLPC350_PrepMemReadCmd(unsigned int addr)
     msg.text.data[4] = addr >>16;
     msg.text.data[5] = addr >>24;
 
-    g_OutputBuffer[0]=0; // First byte is the report number
-    memcpy(&g_OutputBuffer[1], &msg, (sizeof(msg.head)+sizeof(msg.text.cmd) + msg.head.length));
+    DLPC350_StageReport(&msg);
     return 0;
 }
 
@@ -1007,6 +1165,7 @@ int DLPC350_UploadData(unsigned char *pByteArray, unsigned int dataLen)
  */
 {
     hidMessageStruct msg;
+    hidSpan payload;
     int retval;
     unsigned int sendSize;
 
@@ -1016,12 +1175,13 @@ int DLPC350_UploadData(unsigned char *pByteArray, unsigned int dataLen)
     if(dataLen > sendSize)
         dataLen = sendSize;
 
-    CmdList[BL_DNLD_DATA].len = dataLen;
-    memcpy(&msg.text.data[2], pByteArray, dataLen);
-
     DLPC350_PrepWriteCmd(&msg, BL_DNLD_DATA);
 
-    retval = DLPC350_SendMsg(&msg,false);
+    //Payload goes straight from the caller's buffer into the HID reports
+    payload.data = pByteArray;
+    payload.len = dataLen;
+
+    retval = DLPC350_SendPackets(&msg, &payload, 1, HID_REPLY_NONE);
     if(retval > 0)
         return dataLen;
 
@@ -2929,6 +3089,105 @@ int DLPC350_SendImageLut(unsigned char *lutEntries, unsigned int numEntries)
     return bytes_sent;
 }
 
+int DLPC350_SendPatLutRange(unsigned int first, unsigned int numEntries)
+/**
+ * (I2C: 0x78)
+ * (USB: CMD2: 0x1A, CMD3: 0x34)
+ * This API sends a range of the pattern LUT created by calling DLPC350_AddToPatLut() API to the same
+ * offsets of the DLPC350 controller LUT. Entries outside the range are left unchanged in the controller.
+ *
+ * @param   first - I - Index of the first entry to send
+ *
+ * @param   numEntries - I - number of entries to be sent to the controller
+ *
+ * @return  0 = PASS    <BR>
+ *          -1 = FAIL  <BR>
+ *
+ */
+{
+    hidMessageStruct msg;
+    unsigned int i;
+
+    if(numEntries < 1 || first + numEntries > g_PatLutIndex)
+        return -1;
+
+    if(DLPC350_OpenMailbox(2) < 0)
+        return -1;
+
+    if(DLPC350_MailboxSetAddr(first) < 0)
+    {
+        DLPC350_CloseMailbox();
+        return -1;
+    }
+
+    CmdList[MBOX_DATA].len = numEntries*3;
+    DLPC350_PrepWriteCmd(&msg, MBOX_DATA);
+
+    for(i=0; i<numEntries; i++)
+    {
+        msg.text.data[2+3*i] = static_cast<unsigned char>(g_PatLut[first+i]);
+        msg.text.data[2+3*i+1] = static_cast<unsigned char>(g_PatLut[first+i]>>8);
+        msg.text.data[2+3*i+2] = static_cast<unsigned char>(g_PatLut[first+i]>>16);
+    }
+
+    if(DLPC350_SendMsg(&msg,true) < 0)
+    {
+        DLPC350_CloseMailbox();
+        return -1;
+    }
+
+    return DLPC350_CloseMailbox() < 0 ? -1 : 0;
+}
+
+int DLPC350_SendImageLutRange(unsigned char *lutEntries, unsigned int first, unsigned int numEntries)
+/**
+ * (I2C: 0x78)
+ * (USB: CMD2: 0x1A, CMD3: 0x34)
+ * This API writes entries of the image LUT starting at the given offset of the DLPC350 controller LUT.
+ * Entries outside the range are left unchanged in the controller. Unlike DLPC350_SendImageLut(), the
+ * entries are written in the given order: for a two entry LUT the caller passes them swapped.
+ *
+ * @param   *lutEntries - I - Pointer to the array in which LUT entries to be sent are stored
+ *
+ * @param   first - I - Offset of the first entry in the controller LUT
+ *
+ * @param   numEntries - I - number of entries to be sent to the controller
+ *
+ * @return  0 = PASS    <BR>
+ *          -1 = FAIL  <BR>
+ *
+ */
+{
+    hidMessageStruct msg;
+    unsigned int i;
+
+    if(numEntries < 1 || first + numEntries > MAX_IMAGE_LUT_ENTRIES)
+        return -1;
+
+    if(DLPC350_OpenMailbox(1) < 0)
+        return -1;
+
+    if(DLPC350_MailboxSetAddr(first) < 0)
+    {
+        DLPC350_CloseMailbox();
+        return -1;
+    }
+
+    for(i=0; i < numEntries; i++)
+        msg.text.data[2+i] = lutEntries[i];
+
+    CmdList[MBOX_DATA].len = numEntries;
+    DLPC350_PrepWriteCmd(&msg, MBOX_DATA);
+
+    if(DLPC350_SendMsg(&msg,true) < 0)
+    {
+        DLPC350_CloseMailbox();
+        return -1;
+    }
+
+    return DLPC350_CloseMailbox() < 0 ? -1 : 0;
+}
+
 int DLPC350_GetPatLut(int numEntries)
 /**
  * (I2C: 0x78)
@@ -4460,8 +4719,8 @@ int  DLPC350_I2C0WriteData(bool is7Bit, unsigned int sclClk, unsigned int devAdd
   *          <0 = FAIL  <BR>
   */
 {
-    unsigned int i;
     hidMessageStruct msg;
+    hidSpan payload[2];
 
     msg.text.data[2] = (is7Bit == true) ? 0x00 : 0x01;
     msg.text.data[3] = sclClk;  //LSB first
@@ -4479,13 +4738,14 @@ int  DLPC350_I2C0WriteData(bool is7Bit, unsigned int sclClk, unsigned int devAdd
     msg.text.data[13] = numWriteBytes;  //LSB first
     msg.text.data[14] = numWriteBytes >> 8;
 
-    for(i=0;i<numWriteBytes;i++)
-        msg.text.data[15+i] = pWData[i];
+    payload[0].data = &msg.text.data[2];
+    payload[0].len = 13;
+    payload[1].data = pWData;
+    payload[1].len = numWriteBytes;
 
     g_SeqNum = 0;
     DLPC350_PrepWriteCmd(&msg, I2C0_CTRL);
-    msg.head.length += (13 + numWriteBytes);
-    if(DLPC350_SendMsg(&msg,true) < 0)
+    if(DLPC350_SendPackets(&msg, payload, 2, HID_REPLY_ACK) < 0)
         return -1;
 
     return 0;
@@ -4514,10 +4774,12 @@ int  DLPC350_I2C0ReadData(bool is7Bit, unsigned int sclClk, unsigned int devAddr
   *          <0 = FAIL  <BR>
   */
 {
-    unsigned int i;
     unsigned int tmpUIntVar;
+    unsigned int n;
 
     hidMessageStruct msg;
+    hidSpan payload[2];
+
     msg.head.flags.rw = 1; //Read
     msg.head.flags.reply = 1; //Host wants a reply from device
     msg.head.flags.dest = 0; //Projector Control Endpoint
@@ -4545,71 +4807,35 @@ int  DLPC350_I2C0ReadData(bool is7Bit, unsigned int sclClk, unsigned int devAddr
     msg.text.data[15] = numReadBytes;  //LSB first
     msg.text.data[16] = numReadBytes >> 8;
 
-    //Copy number of bytes to written before reading
-    for(i=0;i<numWriteBytes;i++)
-    {
-        msg.text.data[17+i] = pWData[i];
-    }
-    msg.head.length = (2 + 15 + numWriteBytes);
-
-    int maxDataSize = USB_MAX_PACKET_SIZE-sizeof(msg.head);
-    int dataBytesSent = MIN(msg.head.length, maxDataSize);
-
-    g_OutputBuffer[0]=0; // First byte is the report number
-    memcpy(&g_OutputBuffer[1], &msg, (sizeof(msg.head) + dataBytesSent));
-
-    //Check if it is single or multiple packet transaction
-    if(dataBytesSent < msg.head.length)
-    {
-        //Send first packet
-        if(DLPC350_USB_Write() < 0)
-            return -1;
+    payload[0].data = &msg.text.data[2];
+    payload[0].len = 15;
+    payload[1].data = pWData;
+    payload[1].len = numWriteBytes;
 
-        //Send all intermediate packets
-        while(dataBytesSent < msg.head.length)
-        {
-            memcpy(&g_OutputBuffer[1], &msg.text.data[dataBytesSent], USB_MAX_PACKET_SIZE);
-
-            if((dataBytesSent+USB_MAX_PACKET_SIZE) >= (msg.head.length))
-            {
-                //last packet
-                break;
-            }
-            else
-            {
-                if(DLPC350_USB_Write() < 0)
-                    return -1;
-            }
-
-            dataBytesSent += USB_MAX_PACKET_SIZE;
-        }
-    }
+    //The last report carries the read request, the first response packet lands in g_InputBuffer
+    if(DLPC350_SendPackets(&msg, payload, 2, HID_REPLY_READ) < 0)
+        return -1;
 
     //Begin reading the response
 
     tmpUIntVar = numReadBytes;
 
-    if(DLPC350_Read() < 0)
-        return -1;
-
     hidMessageStruct *pMsg = (hidMessageStruct *)g_InputBuffer;
-    if(pMsg != NULL)
-    {
-        memcpy(pRdata, g_InputBuffer+sizeof(pMsg->head), MIN((unsigned int)tmpUIntVar,64-sizeof(pMsg->head)));
-        pRdata+= (64-sizeof(pMsg->head));
-        if(tmpUIntVar > 64)
-            tmpUIntVar -= (64-sizeof(pMsg->head));
-        else
-           tmpUIntVar = 0;
-    }
+    n = MIN(tmpUIntVar, 64-sizeof(pMsg->head));
+    memcpy(pRdata, g_InputBuffer+sizeof(pMsg->head), n);
+    pRdata += n;
+    tmpUIntVar -= n;
 
     /* If number of bytes to be read in response is > 64 bytes */
     while(tmpUIntVar > 0)
     {
-        DLPC350_ContinueRead();
-        memcpy(pRdata, g_InputBuffer, MIN(tmpUIntVar,64));
-        pRdata+=64;
-        tmpUIntVar -= 64;
+        if(DLPC350_ContinueRead() <= 0)
+            return -1;
+
+        n = MIN(tmpUIntVar, 64);
+        memcpy(pRdata, g_InputBuffer, n);
+        pRdata += n;
+        tmpUIntVar -= n;
     }
 
     return 0;
@@ -4645,3 +4871,273 @@ int  DLPC350_I2C0TranStat(unsigned char *pStat)
 
     return -1;
 }
+
+static unsigned int DLPC350_I2C0PrepMsg(hidMessageStruct *pMsg, const i2cBatchOp *pOp)
+/**
+ * This function is private to this file. Prepares the I2C0_CTRL message of a queued transaction, the same
+ * layout DLPC350_I2C0WriteData() and DLPC350_I2C0ReadData() use. The write bytes are sent as a second span.
+ *
+ * @return  number of parameter bytes in pMsg->text.data[2..]
+ *
+ */
+{
+    unsigned int len = 13;
+
+    if(pOp->read)
+    {
+        pMsg->head.flags.rw = 1; //Read
+        pMsg->head.flags.reply = 1; //Host wants a reply from device
+        pMsg->head.flags.dest = 0; //Projector Control Endpoint
+        pMsg->head.flags.reserved = 0;
+        pMsg->head.flags.nack = 0;
+        pMsg->head.seq = 0;
+        pMsg->text.cmd = (CmdList[I2C0_CTRL].CMD2 << 8) | CmdList[I2C0_CTRL].CMD3;
+    }
+    else
+    {
+        g_SeqNum = 0;
+        DLPC350_PrepWriteCmd(pMsg, I2C0_CTRL);
+    }
+
+    pMsg->text.data[2] = (g_I2CBatch7Bit == true) ? 0x00 : 0x01;
+    pMsg->text.data[3] = g_I2CBatchClk;  //LSB first
+    pMsg->text.data[4] = g_I2CBatchClk >> 8;
+    pMsg->text.data[5] = g_I2CBatchClk >> 16;
+    pMsg->text.data[6] = g_I2CBatchClk >> 24;
+    //RFU
+    pMsg->text.data[7] = 0x00;
+    pMsg->text.data[8] = 0x00;
+    pMsg->text.data[9] = 0x00;
+    pMsg->text.data[10] = 0x00;
+
+    pMsg->text.data[11] = pOp->devAddr;  //LSB first
+    pMsg->text.data[12] = pOp->devAddr >> 8;
+    pMsg->text.data[13] = pOp->numWriteBytes;  //LSB first
+    pMsg->text.data[14] = pOp->numWriteBytes >> 8;
+
+    if(pOp->read)
+    {
+        pMsg->text.data[15] = pOp->numReadBytes;  //LSB first
+        pMsg->text.data[16] = pOp->numReadBytes >> 8;
+        len = 15;
+    }
+
+    return len;
+}
+
+static int DLPC350_I2C0CollectRead(const i2cBatchOp *pOp)
+/**
+ * This function is private to this file. Reads the response of a read transaction sent with HID_REPLY_DEFERRED
+ * and copies exactly numReadBytes to the caller's buffer.
+ *
+ * @return  0 = PASS    <BR>
+ *          -1 = FAIL  <BR>
+ *          -2 = nack from target <BR>
+ *
+ */
+{
+    hidMessageStruct *pMsg = (hidMessageStruct *)g_InputBuffer;
+    unsigned int remaining = pOp->numReadBytes;
+    unsigned char *pRData = pOp->pRData;
+    unsigned int n;
+
+    if(DLPC350_USB_Read() <= 0)
+        return -1;
+    if(pMsg->head.flags.nack == 1)
+        return -2;
+
+    n = MIN(remaining, 64-sizeof(pMsg->head));
+    memcpy(pRData, g_InputBuffer+sizeof(pMsg->head), n);
+    pRData += n;
+    remaining -= n;
+
+    /* If number of bytes to be read in response is > 64 bytes */
+    while(remaining > 0)
+    {
+        if(DLPC350_ContinueRead() <= 0)
+            return -1;
+
+        n = MIN(remaining, 64);
+        memcpy(pRData, g_InputBuffer, n);
+        pRData += n;
+        remaining -= n;
+    }
+
+    return 0;
+}
+
+int DLPC350_I2C0BatchBegin(bool is7Bit, unsigned int sclClk)
+/**
+ * This API starts a batch of I2C0 master transactions. Transactions queued with DLPC350_I2C0BatchWrite() and
+ * DLPC350_I2C0BatchRead() are sent by DLPC350_I2C0BatchExecute(): writes without waiting for an ACK, reads
+ * pipelined, and the transaction status read back after each group of transactions.
+ *
+ * @param   is7Bit - I - true - For 7bit device addressing
+ *                       false - For 10bit device addressing
+ *
+ * @param   sclClk - I - I2C master clock setting 18194 to 400000
+ *
+ * @return  0 = PASS    <BR>
+ *
+ */
+{
+    g_I2CBatch7Bit = is7Bit;
+    g_I2CBatchClk = sclClk;
+    g_I2CBatchCount = 0;
+    g_I2CBatchDataLen = 0;
+
+    return 0;
+}
+
+int DLPC350_I2C0BatchWrite(unsigned int devAddr, unsigned int numWriteBytes, unsigned char *pWData)
+/**
+ * This API queues an I2C0 master write transaction. The data bytes are copied.
+ *
+ * @param   devAddr - I - I2C slave device address
+ *
+ * @param   numWriteBytes  - I - Number of data bytes to be sent
+ *
+ * @param   *pWData - I - pointer to data bytes array to be sent
+ *
+ * @return  index of the transaction in the batch <BR>
+ *          -1 = FAIL, batch full  <BR>
+ */
+{
+    i2cBatchOp *pOp;
+
+    if(g_I2CBatchCount >= MAX_I2C0_BATCH_OPS || g_I2CBatchDataLen + numWriteBytes > MAX_I2C0_BATCH_DATA)
+        return -1;
+
+    pOp = &g_I2CBatch[g_I2CBatchCount];
+    pOp->read = false;
+    pOp->devAddr = devAddr;
+    pOp->numWriteBytes = numWriteBytes;
+    pOp->numReadBytes = 0;
+    pOp->dataOffset = g_I2CBatchDataLen;
+    pOp->pRData = NULL;
+
+    memcpy(&g_I2CBatchData[g_I2CBatchDataLen], pWData, numWriteBytes);
+    g_I2CBatchDataLen += numWriteBytes;
+
+    return g_I2CBatchCount++;
+}
+
+int DLPC350_I2C0BatchRead(unsigned int devAddr, unsigned int numWriteBytes, unsigned int numReadBytes, unsigned char *pWData, unsigned char *pRData)
+/**
+ * This API queues an I2C0 master read transaction, e.g. a register address write followed by a block read.
+ * pRData must stay valid until DLPC350_I2C0BatchExecute() returns.
+ *
+ * @param   devAddr - I - I2C slave device address
+ *
+ * @param   numWriteBytes  - I - Number of data bytes to be sent before reading
+ *
+ * @param   numReadBytes  - I - Number of data bytes to be read
+ *
+ * @param   *pWData - I - pointer to data bytes array to be sent
+ *
+ * @param   *pRData - O - pointer to data bytes array where the response is copied
+ *
+ * @return  index of the transaction in the batch <BR>
+ *          -1 = FAIL, batch full  <BR>
+ */
+{
+    int index = DLPC350_I2C0BatchWrite(devAddr, numWriteBytes, pWData);
+
+    if(index < 0)
+        return -1;
+
+    g_I2CBatch[index].read = true;
+    g_I2CBatch[index].numReadBytes = numReadBytes;
+    g_I2CBatch[index].pRData = pRData;
+
+    return index;
+}
+
+int DLPC350_I2C0BatchExecute(unsigned int maxInFlight, unsigned int groupSize, unsigned char *pStat)
+/**
+ * This API sends the queued I2C0 transactions in order. Writes are posted without ACK. Up to maxInFlight read
+ * requests are sent before the oldest response is collected, so the USB round trips overlap. The controller
+ * executes the transactions in order. Posted writes get no ACK/NACK of their own, so the I2C0 status is read
+ * back after every groupSize transactions, once the responses of the group are collected, and the batch stops
+ * at the first group that failed. groupSize 1 reads the status after every transaction and returns exactly the
+ * failing one; larger groups save round trips and return the first transaction of the failing group, the
+ * transactions before it having succeeded. The batch is empty afterwards.
+ *
+ * @param   maxInFlight - I - read requests sent ahead of their responses, 1 for no pipelining
+ *
+ * @param   groupSize - I - transactions per status read, 0 for a single read after the last transaction
+ *
+ * @param   *pStat - O - I2C0 status of the last group read back, see DLPC350_I2C0TranStat()
+ *
+ * @return  number of transactions in the batch = PASS <BR>
+ *          index of the first transaction of the failing group, smaller than the number of transactions, when
+ *          the I2C0 status reports an error or a read is NACKed <BR>
+ *          -1 = FAIL  <BR>
+ */
+{
+    hidMessageStruct msg;
+    hidSpan payload[2];
+    unsigned int inFlight[MAX_I2C0_BATCH_OPS];
+    unsigned int head = 0, tail = 0;
+    unsigned int count = g_I2CBatchCount;
+    unsigned int groupStart = 0;
+    unsigned int i;
+    bool nacked = false;
+    int ret;
+
+    if(maxInFlight == 0)
+        maxInFlight = 1;
+    if(groupSize == 0)
+        groupSize = MAX_I2C0_BATCH_OPS;
+
+    g_I2CBatchCount = 0;
+    g_I2CBatchDataLen = 0;
+
+    if(count == 0)
+        return DLPC350_I2C0TranStat(pStat) < 0 ? -1 : 0;
+
+    for(i=0; i<count; i++)
+    {
+        const i2cBatchOp *pOp = &g_I2CBatch[i];
+
+        //Keep the number of outstanding responses bounded
+        if(pOp->read && head - tail >= maxInFlight)
+        {
+            if((ret = DLPC350_I2C0CollectRead(&g_I2CBatch[inFlight[tail++]])) == -1)
+                return -1;
+            nacked |= ret == -2;
+        }
+
+        payload[0].data = &msg.text.data[2];
+        payload[0].len = DLPC350_I2C0PrepMsg(&msg, pOp);
+        payload[1].data = &g_I2CBatchData[pOp->dataOffset];
+        payload[1].len = pOp->numWriteBytes;
+
+        if(DLPC350_SendPackets(&msg, payload, 2, pOp->read ? HID_REPLY_DEFERRED : HID_REPLY_NONE) < 0)
+            return -1;
+
+        if(pOp->read)
+            inFlight[head++] = i;
+
+        if(i + 1 - groupStart < groupSize && i + 1 < count)
+            continue;
+
+        //End of a group: every response is in before the status is read
+        while(tail < head)
+        {
+            if((ret = DLPC350_I2C0CollectRead(&g_I2CBatch[inFlight[tail++]])) == -1)
+                return -1;
+            nacked |= ret == -2;
+        }
+
+        if(DLPC350_I2C0TranStat(pStat) < 0)
+            return -1;
+
+        if(nacked || *pStat != 0)
+            return groupStart;
+
+        groupStart = i + 1;
+    }
+
+    return count;
+}
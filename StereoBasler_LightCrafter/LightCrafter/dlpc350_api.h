@@ -276,6 +276,8 @@ int  DLPC350_API_EXPORT DLPC350_SendPatLut(void);
 int  DLPC350_API_EXPORT DLPC350_SendVarExpPatLut(void);
 int  DLPC350_API_EXPORT DLPC350_SendImageLut(unsigned char *lutEntries, unsigned int numEntries);
 int  DLPC350_API_EXPORT DLPC350_SendVarExpImageLut(unsigned char *lutEntries, unsigned int numEntries);
+int  DLPC350_API_EXPORT DLPC350_SendPatLutRange(unsigned int first, unsigned int numEntries);
+int  DLPC350_API_EXPORT DLPC350_SendImageLutRange(unsigned char *lutEntries, unsigned int first, unsigned int numEntries);
 int  DLPC350_API_EXPORT DLPC350_GetPatLut(int numEntries);
 int  DLPC350_API_EXPORT DLPC350_GetVarExpPatLut(int numEntries);
 int  DLPC350_API_EXPORT DLPC350_GetImageLut(unsigned char *pLut, int numEntries);
@@ -305,4 +307,8 @@ int  DLPC350_API_EXPORT DLPC350_GetFirmwareTagInfo(unsigned char *pFwTagInfo);
 int  DLPC350_API_EXPORT DLPC350_I2C0WriteData(bool is7Bit,unsigned int sclClk, unsigned int devAddr, unsigned int numWriteBytes, unsigned char *pWdata);
 int  DLPC350_API_EXPORT DLPC350_I2C0ReadData(bool is7Bit, unsigned int sclClk, unsigned int devAddr, unsigned int numWriteBytes, unsigned int numReadBytes, unsigned char *pWData, unsigned char *pRdata);
 int  DLPC350_API_EXPORT DLPC350_I2C0TranStat(unsigned char *pStat);
+int  DLPC350_API_EXPORT DLPC350_I2C0BatchBegin(bool is7Bit, unsigned int sclClk);
+int  DLPC350_API_EXPORT DLPC350_I2C0BatchWrite(unsigned int devAddr, unsigned int numWriteBytes, unsigned char *pWData);
+int  DLPC350_API_EXPORT DLPC350_I2C0BatchRead(unsigned int devAddr, unsigned int numWriteBytes, unsigned int numReadBytes, unsigned char *pWData, unsigned char *pRData);
+int  DLPC350_API_EXPORT DLPC350_I2C0BatchExecute(unsigned int maxInFlight, unsigned int groupSize, unsigned char *pStat);
 #endif // DLPC350_API_H
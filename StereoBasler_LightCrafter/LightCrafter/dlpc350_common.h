@@ -148,6 +148,8 @@ typedef unsigned short uint16;
 #define MAX_VAR_EXP_PAT_LUT_ENTRIES     1824
 #define MAX_IMAGE_LUT_ENTRIES       64
 #define MAX_VAR_EXP_IMAGE_LUT_ENTRIES   256
+#define MAX_I2C0_BATCH_OPS          256
+#define MAX_I2C0_BATCH_DATA         4096
 
 #define STAT_BIT_FLASH_BUSY         BIT3
 
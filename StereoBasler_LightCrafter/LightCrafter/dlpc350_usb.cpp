@@ -39,11 +39,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <wchar.h>
 #include "dlpc350_usb.h"
 #ifdef Q_OS_WIN32
 #include <setupapi.h>
 #endif
 #include "hidapi.h"
+#ifdef __linux__
+#include "LC_Hidraw.h"
+#endif
 
 //#include "mainwindow.h"
 //#include "ui_mainwindow.h"
@@ -54,18 +58,168 @@
 *                  GLOBAL VARIABLES
 ****************************************************/
 
-static hid_device *DeviceHandle;	//Handle to write
+//Devices are kept in slots, each thread talks to the slot it selected (slot 0 by default)
+static hid_device *DeviceHandle[DLPC350_USB_MAX_DEVICES];	//Handle to write
+static wchar_t DeviceSerial[DLPC350_USB_MAX_DEVICES][DLPC350_USB_SERIAL_LENGTH];	//Serial number opened in each slot, empty for the first device found
+static thread_local int SelectedDevice = 0;
 //In/Out buffers equal to HID endpoint size + 1
 //First byte is for Windows internal use and it is always 0
-unsigned char g_OutputBuffer[USB_MAX_PACKET_SIZE+1];
-unsigned char g_InputBuffer[USB_MAX_PACKET_SIZE+1];
+//Per slot, so that devices in different slots can be driven concurrently and a slot keeps its buffers whichever
+//thread talks to it. Calls on the same slot must be serialized by the caller.
+static unsigned char OutputBuffers[DLPC350_USB_MAX_DEVICES][USB_MAX_PACKET_SIZE+1];
+static unsigned char InputBuffers[DLPC350_USB_MAX_DEVICES][USB_MAX_PACKET_SIZE+1];
+#define g_OutputBuffer (OutputBuffers[SelectedDevice])
+#define g_InputBuffer (InputBuffers[SelectedDevice])
+
+
+static int USBConnected[DLPC350_USB_MAX_DEVICES];      //Boolean true when device is connected
+static DLPC350_USB_Port DevicePort[DLPC350_USB_MAX_DEVICES];   //Stand-in for the HID device of a slot, see DLPC350_USB_OpenPort()
+
+#ifdef __linux__
+//On Linux the opened devices are served by one HidrawEventLoop thread. DLPC350_USB_Write() gathers the reports of a
+//message and submits it whole, the loop hands the reports of the reply to the slot for DLPC350_USB_Read().
+#define USB_LOOP_IN_FLIGHT 8        //Messages of a slot waiting for their replies at the same time
 
+typedef struct
+{
+    bool registered;                //Device registered with the loop
+    int loopDevice;                 //Device number in the loop
+    unsigned int generation;        //Changes with every registration, replies for an older one are dropped
+    bool failed;                    //The loop lost the device
+    std::vector<unsigned char> message;     //Message being written, until all its reports are in
+    std::deque<std::vector<unsigned char> > reports;   //Reply reports not read yet
+    std::mutex mutex;
+    std::condition_variable ready;
+}USBLoopSlot;
+
+static USBLoopSlot LoopSlots[DLPC350_USB_MAX_DEVICES];
+
+static HidrawEventLoop &USB_EventLoop()
+{
+    static HidrawEventLoop loop;
+    static std::once_flag started;
+
+    std::call_once(started, [] { loop.Start(); });
+    return loop;
+}
+
+static void USB_LoopReply(int dev, unsigned int generation, int status, const unsigned char *reply, size_t length)
+{
+    //Runs on the loop thread
+    USBLoopSlot &slot = LoopSlots[dev];
+    std::lock_guard<std::mutex> lock(slot.mutex);
+
+    if(generation != slot.generation)
+        return;
+
+    if(status == -1)
+        slot.failed = true;
+    else if(status == 0 && reply != NULL)
+    {
+        for(size_t offset = 0; offset < length; offset += USB_MAX_PACKET_SIZE)
+        {
+            std::vector<unsigned char> report(USB_MAX_PACKET_SIZE, 0);
+            size_t n = length - offset < USB_MAX_PACKET_SIZE ? length - offset : USB_MAX_PACKET_SIZE;
+
+            memcpy(report.data(), reply + offset, n);
+            slot.reports.push_back(report);
+        }
+    }
+    //A reply that timed out (-2) leaves DLPC350_USB_Read() to time out as well
+
+    slot.ready.notify_all();
+}
+
+static int USB_LoopAttach(int dev)
+{
+    USBLoopSlot &slot = LoopSlots[dev];
+    int device = USB_EventLoop().Add(HidrawDescriptor(DeviceHandle[dev]), USB_LOOP_IN_FLIGHT);
+
+    if(device < 0)
+        return -1;
+
+    std::lock_guard<std::mutex> lock(slot.mutex);
+    slot.registered = true;
+    slot.loopDevice = device;
+    slot.generation++;
+    slot.failed = false;
+    slot.message.clear();
+    slot.reports.clear();
+
+    return 0;
+}
+
+static void USB_LoopDetach(int dev)
+{
+    USBLoopSlot &slot = LoopSlots[dev];
 
-static int USBConnected = 0;      //Boolean true when device is connected
+    if(!slot.registered)
+        return;
+
+    //Pending messages fail through USB_LoopReply(), the slot mutex must not be held here
+    USB_EventLoop().Remove(slot.loopDevice);
+
+    std::lock_guard<std::mutex> lock(slot.mutex);
+    slot.registered = false;
+    slot.generation++;
+    slot.message.clear();
+    slot.reports.clear();
+}
+
+static int USB_LoopWrite(int dev)
+{
+    USBLoopSlot &slot = LoopSlots[dev];
+    std::vector<unsigned char> message;
+    unsigned int generation;
+    size_t length;
+
+    {
+        std::lock_guard<std::mutex> lock(slot.mutex);
+
+        if(slot.failed)
+            return -1;
+
+        //The header of the first report gives the length of the message
+        slot.message.insert(slot.message.end(), &g_OutputBuffer[1], &g_OutputBuffer[1] + USB_MIN_PACKET_SIZE);
+        length = 4 + (slot.message[2] | (slot.message[3] << 8));
+        if(slot.message.size() < length)
+            return USB_MIN_PACKET_SIZE+1;
+
+        slot.message.resize(length);
+        message.swap(slot.message);
+        generation = slot.generation;
+    }
+
+    if(USB_EventLoop().Submit(slot.loopDevice, message.data(), message.size(),
+                              [dev, generation](int status, const unsigned char *reply, size_t replyLength)
+                              { USB_LoopReply(dev, generation, status, reply, replyLength); }) < 0)
+        return -1;
+
+    return USB_MIN_PACKET_SIZE+1;
+}
+
+static int USB_LoopRead(int dev)
+{
+    USBLoopSlot &slot = LoopSlots[dev];
+    std::unique_lock<std::mutex> lock(slot.mutex);
+
+    //0 on timeout, as hid_read_timeout()
+    if(!slot.ready.wait_for(lock, std::chrono::milliseconds(2000), [&slot] { return slot.failed || !slot.reports.empty(); }))
+        return 0;
+
+    if(slot.reports.empty())
+        return -1;
+
+    memcpy(g_InputBuffer, slot.reports.front().data(), USB_MAX_PACKET_SIZE);
+    slot.reports.pop_front();
+
+    return USB_MAX_PACKET_SIZE;
+}
+#endif
 
 int DLPC350_USB_IsConnected()
 {
-    return USBConnected;
+    return USBConnected[SelectedDevice];
 }
 
 int DLPC350_USB_Init(void)
@@ -78,19 +232,133 @@ int DLPC350_USB_Exit(void)
     return hid_exit();
 }
 
+int DLPC350_USB_Select(int device)
+/**
+ * Selects the device slot used by the calling thread for all further USB transfers.
+ *
+ * @param   device - I - slot number, from 0 to DLPC350_USB_MAX_DEVICES-1
+ *
+ * @return  0 = PASS    <BR>
+ *          -1 = FAIL  <BR>
+ *
+ */
+{
+    if(device < 0 || device >= DLPC350_USB_MAX_DEVICES)
+        return -1;
+
+    SelectedDevice = device;
+    return 0;
+}
+
+int DLPC350_USB_Selected()
+{
+    return SelectedDevice;
+}
+
+unsigned char *DLPC350_USB_OutputBuffer()
+{
+    return OutputBuffers[SelectedDevice];
+}
+
+unsigned char *DLPC350_USB_InputBuffer()
+{
+    return InputBuffers[SelectedDevice];
+}
+
+int DLPC350_USB_SetSerial(const wchar_t *serial)
+/**
+ * Sets the serial number that DLPC350_USB_Open() looks for in the selected slot.
+ *
+ * @param   serial - I - serial number string, NULL or empty for the first device found
+ *
+ * @return  0 = PASS    <BR>
+ *          -1 = FAIL  <BR>
+ *
+ */
+{
+    if(serial == NULL)
+    {
+        DeviceSerial[SelectedDevice][0] = 0;
+        return 0;
+    }
+
+    if(wcslen(serial) >= DLPC350_USB_SERIAL_LENGTH)
+        return -1;
+
+    wcscpy(DeviceSerial[SelectedDevice], serial);
+    return 0;
+}
+
 int DLPC350_USB_Open()
 {
     // Open the device using the VID, PID,
     // and optionally the Serial number.
-    DeviceHandle = hid_open(MY_VID, MY_PID, NULL);
+    int dev = SelectedDevice;
+    DeviceHandle[dev] = hid_open(MY_VID, MY_PID, DeviceSerial[dev][0] ? DeviceSerial[dev] : NULL);
 
-    if(DeviceHandle == NULL)
+    if(DeviceHandle[dev] == NULL)
     {
-        USBConnected = 0;
+        USBConnected[dev] = 0;
         return -1;
     }
 
-    USBConnected = 1;
+#ifdef __linux__
+    //Without the loop the synchronous hid_* functions are used
+    USB_LoopAttach(dev);
+#endif
+
+    USBConnected[dev] = 1;
+
+    return 0;
+}
+
+#ifdef __linux__
+int DLPC350_USB_OpenDescriptor(int fd)
+/**
+ * Connects the selected slot to an open hidraw descriptor, or to anything that behaves like one such as one end of
+ * a SOCK_SEQPACKET socketpair. The descriptor is closed by DLPC350_USB_Close().
+ *
+ * @param   fd - I - descriptor open for reading and writing
+ *
+ * @return  0 = PASS    <BR>
+ *          -1 = FAIL  <BR>
+ *
+ */
+{
+    int dev = SelectedDevice;
+
+    if(fd < 0)
+        return -1;
+
+    DLPC350_USB_Close();
+    DeviceHandle[dev] = HidrawWrap(fd);
+    USB_LoopAttach(dev);
+    USBConnected[dev] = 1;
+
+    return 0;
+}
+#endif
+
+int DLPC350_USB_OpenPort(const DLPC350_USB_Port *port)
+/**
+ * Connects the selected slot to a stand-in for the HID device, e.g. a simulated projector, instead of opening a
+ * USB device. The port is used until DLPC350_USB_Close().
+ *
+ * @param   port - I - write and read functions with the semantics of hid_write() and hid_read_timeout()
+ *
+ * @return  0 = PASS    <BR>
+ *          -1 = FAIL  <BR>
+ *
+ */
+{
+    int dev = SelectedDevice;
+
+    if(port == NULL || port->write == NULL || port->read == NULL)
+        return -1;
+
+    DLPC350_USB_Close();
+    DevicePort[dev] = *port;
+    USBConnected[dev] = 1;
 
     return 0;
 }
@@ -98,14 +366,22 @@ int DLPC350_USB_Open()
 int DLPC350_USB_Write()
 {
     int bytesWritten;
+    int dev = SelectedDevice;
 
-    if(DeviceHandle == NULL)
+    if(DevicePort[dev].write != NULL)
+        bytesWritten = DevicePort[dev].write(DevicePort[dev].context, g_OutputBuffer, USB_MIN_PACKET_SIZE+1);
+#ifdef __linux__
+    else if(LoopSlots[dev].registered)
+        bytesWritten = USB_LoopWrite(dev);
+#endif
+    else if(DeviceHandle[dev] != NULL)
+        bytesWritten = hid_write(DeviceHandle[dev], g_OutputBuffer, USB_MIN_PACKET_SIZE+1);
+    else
         return -1;
 
-    if((bytesWritten = hid_write(DeviceHandle, g_OutputBuffer, USB_MIN_PACKET_SIZE+1)) == -1)
+    if(bytesWritten == -1)
     {
-        hid_close(DeviceHandle);
-        USBConnected = 0;
+        DLPC350_USB_Close();
         return -1;
     }
 
@@ -115,17 +391,26 @@ int DLPC350_USB_Write()
 int DLPC350_USB_Read()
 {
     int bytesRead;
+    int dev = SelectedDevice;
 
-    if(DeviceHandle == NULL)
+    if(DeviceHandle[dev] == NULL && DevicePort[dev].read == NULL)
         return -1;
 
     //clear out the input buffer
     memset((void*)&g_InputBuffer[0],0x00,USB_MIN_PACKET_SIZE+1);
 
-    if((bytesRead = hid_read_timeout(DeviceHandle, g_InputBuffer, USB_MIN_PACKET_SIZE+1, 2000)) == -1)
+    if(DevicePort[dev].read != NULL)
+        bytesRead = DevicePort[dev].read(DevicePort[dev].context, g_InputBuffer, USB_MIN_PACKET_SIZE+1, 2000);
+#ifdef __linux__
+    else if(LoopSlots[dev].registered)
+        bytesRead = USB_LoopRead(dev);
+#endif
+    else
+        bytesRead = hid_read_timeout(DeviceHandle[dev], g_InputBuffer, USB_MIN_PACKET_SIZE+1, 2000);
+
+    if(bytesRead == -1)
     {
-        hid_close(DeviceHandle);
-        USBConnected = 0;
+        DLPC350_USB_Close();
         return -1;
     }
 
@@ -134,8 +419,17 @@ int DLPC350_USB_Read()
 
 int DLPC350_USB_Close()
 {
-    hid_close(DeviceHandle);
-    USBConnected = 0;
+    int dev = SelectedDevice;
+
+#ifdef __linux__
+    //The loop lets go of the descriptor before hid_close() closes it
+    USB_LoopDetach(dev);
+#endif
+    if(DeviceHandle[dev] != NULL)
+        hid_close(DeviceHandle[dev]);
+    DeviceHandle[dev] = NULL;
+    memset(&DevicePort[dev], 0, sizeof(DevicePort[dev]));
+    USBConnected[dev] = 0;
 
     return 0;
 }
@@ -55,6 +55,20 @@
 #define MY_VID 0x0451
 #define MY_PID 0x6401
 
+#define DLPC350_USB_MAX_DEVICES 8
+#define DLPC350_USB_SERIAL_LENGTH 64
+
+#include <stddef.h>
+
+/* Stand-in for the HID device of a slot, e.g. a simulated projector. write and read have the semantics of
+   hid_write() and hid_read_timeout(), context is passed back to them. */
+typedef struct
+{
+    int (*write)(void *context, const unsigned char *data, size_t length);
+    int (*read)(void *context, unsigned char *data, size_t length, int milliseconds);
+    void *context;
+}DLPC350_USB_Port;
+
 int DLPC350_USB_EXPORT DLPC350_USB_Open(void);
 int DLPC350_USB_EXPORT DLPC350_USB_IsConnected();
 int DLPC350_USB_EXPORT DLPC350_USB_Write();
@@ -62,5 +76,14 @@ int DLPC350_USB_EXPORT DLPC350_USB_Read();
 int DLPC350_USB_EXPORT DLPC350_USB_Close();
 int DLPC350_USB_EXPORT DLPC350_USB_Init();
 int DLPC350_USB_EXPORT DLPC350_USB_Exit();
+int DLPC350_USB_EXPORT DLPC350_USB_Select(int device);
+int DLPC350_USB_EXPORT DLPC350_USB_Selected();
+int DLPC350_USB_EXPORT DLPC350_USB_SetSerial(const wchar_t *serial);
+int DLPC350_USB_EXPORT DLPC350_USB_OpenPort(const DLPC350_USB_Port *port);
+#ifdef __linux__
+int DLPC350_USB_EXPORT DLPC350_USB_OpenDescriptor(int fd);
+#endif
+unsigned char DLPC350_USB_EXPORT *DLPC350_USB_OutputBuffer();
+unsigned char DLPC350_USB_EXPORT *DLPC350_USB_InputBuffer();
 
 #endif //USB_H
@@ -0,0 +1,253 @@
+// Calibration.cpp : Stereo calibration from checkerboard views captured by the acquisition program.
+//
+// The board is searched on a half size image, which is several times faster and keeps the detection close to the
+// frame rate, and its corners are refined with cornerSubPix() at full size. A view is blurry when the variance of
+// the Laplacian over the board is low, and a duplicate when its corners moved too little from an accepted view, so
+// the solver gets distinct and sharp poses only.
+// Both cameras are calibrated on their own at the same time, then stereoCalibrate() finds the pose of the right
+// camera with the intrinsics fixed, which converges faster and better than solving everything together.
+
+
+#include "Calibration.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <future>
+
+using namespace cv;
+using namespace std;
+
+
+#define CALIBRATION_MAX_WINDOW 10 // Largest half size of the cornerSubPix() window
+
+
+
+int LoadCalibrationBoard(const string& file, CalibrationBoard& board)
+{
+	FileStorage fs(file, FileStorage::READ);
+	if (!fs.isOpened())
+		return -1;
+
+	CalibrationBoard b;
+	fs["corners"] >> b.corners;
+	fs["squareSize"] >> b.squareSize;
+	fs["views"] >> b.views;
+	fs["minSharpness"] >> b.minSharpness;
+	fs["minMotion"] >> b.minMotion;
+
+	if (b.corners.width < 2 || b.corners.height < 2 || b.squareSize <= 0 || b.views < CALIBRATION_MIN_VIEWS)
+	{
+		printf("Invalid calibration board %s\n", file.c_str());
+		return -1;
+	}
+
+	board = b;
+	return 0;
+}
+
+
+
+bool FindCalibrationCorners(const CalibrationBoard& board, const Mat& image, vector<Point2f>& corners, double& sharpness)
+{
+	Mat small;
+	resize(image, small, Size(), 0.5, 0.5, INTER_AREA);
+	if (!findChessboardCorners(small, board.corners, corners, CALIB_CB_ADAPTIVE_THRESH | CALIB_CB_NORMALIZE_IMAGE | CALIB_CB_FAST_CHECK))
+		return false;
+
+	// Half size pixel centres to full size, and a window smaller than half a square
+	for (Point2f& p : corners)
+		p = Point2f(2 * p.x + 0.5f, 2 * p.y + 0.5f);
+
+	float spacing = static_cast<float>(norm(corners[1] - corners[0]));
+	int window = max(2, min(CALIBRATION_MAX_WINDOW, static_cast<int>(spacing * 0.4f)));
+	cornerSubPix(image, corners, Size(window, window), Size(-1, -1), TermCriteria(TermCriteria::EPS + TermCriteria::COUNT, 30, 0.01));
+
+	Mat laplacian;
+	Scalar mean, deviation;
+	Rect area = boundingRect(corners) & Rect(0, 0, image.cols, image.rows);
+	Laplacian(image(area), laplacian, CV_32F);
+	meanStdDev(laplacian, mean, deviation);
+	sharpness = deviation[0] * deviation[0];
+
+	return true;
+}
+
+
+CalibrationVerdict DetectCalibrationView(const CalibrationBoard& board, const Mat& left, const Mat& right, CalibrationView& view)
+{
+	double sharpnessL, sharpnessR;
+	if (!FindCalibrationCorners(board, left, view.left, sharpnessL) || !FindCalibrationCorners(board, right, view.right, sharpnessR))
+		return CALIB_VIEW_NO_BOARD;
+
+	view.sharpness = min(sharpnessL, sharpnessR);
+	return view.sharpness < board.minSharpness ? CALIB_VIEW_BLURRY : CALIB_VIEW_ACCEPTED;
+}
+
+
+
+int CalibrateStereo(const CalibrationBoard& board, const vector<CalibrationView>& views, Size imageSize, StereoCalibration& calibration, CalibrationReport* report)
+{
+	if (static_cast<int>(views.size()) < CALIBRATION_MIN_VIEWS || imageSize.area() <= 0)
+	{
+		printf("Not enough calibration views\n");
+		return -1;
+	}
+
+	vector<Point3f> corners;
+	for (int y = 0; y < board.corners.height; y++)
+		for (int x = 0; x < board.corners.width; x++)
+			corners.push_back(Point3f(static_cast<float>(x * board.squareSize), static_cast<float>(y * board.squareSize), 0));
+
+	vector<vector<Point3f>> objectPoints(views.size(), corners);
+	vector<vector<Point2f>> pointsL, pointsR;
+	for (const CalibrationView& view : views)
+	{
+		pointsL.push_back(view.left);
+		pointsR.push_back(view.right);
+	}
+
+	StereoCalibration c;
+	c.imageSize = imageSize;
+
+	future<double> left = async(launch::async, [&]
+	{
+		return calibrateCamera(objectPoints, pointsL, imageSize, c.K1, c.D1, noArray(), noArray());
+	});
+	double rmsRight = calibrateCamera(objectPoints, pointsR, imageSize, c.K2, c.D2, noArray(), noArray());
+	double rmsLeft = left.get();
+
+	Mat E, F;
+	double rmsStereo = stereoCalibrate(objectPoints, pointsL, pointsR, c.K1, c.D1, c.K2, c.D2, imageSize, c.R, c.T, E, F,
+		CALIB_FIX_INTRINSIC, TermCriteria(TermCriteria::COUNT + TermCriteria::EPS, 100, 1e-6));
+
+	if (report != nullptr)
+	{
+		report->rmsLeft = rmsLeft;
+		report->rmsRight = rmsRight;
+		report->rmsStereo = rmsStereo;
+		report->views = static_cast<int>(views.size());
+	}
+
+	calibration = c;
+	return 0;
+}
+
+
+
+CalibrationCollector::CalibrationCollector(const CalibrationBoard& board, unsigned int numThreads) : board(board)
+{
+	for (unsigned int i = 0; i < WorkerCount(numThreads); i++)
+		workers.push_back(thread(&CalibrationCollector::Run, this));
+}
+
+
+CalibrationCollector::~CalibrationCollector()
+{
+	{
+		lock_guard<mutex> lock(queueMutex);
+		closing = true;
+		jobs.clear();
+	}
+	ready.notify_all();
+
+	for (thread& worker : workers)
+		worker.join();
+}
+
+
+bool CalibrationCollector::Submit(const Mat& left, const Mat& right)
+{
+	if (left.empty() || left.size() != right.size() || (imageSize.area() > 0 && left.size() != imageSize))
+		return false;
+
+	{
+		lock_guard<mutex> lock(queueMutex);
+		if (pending >= workers.size())
+			return false;
+		pending++;
+	}
+
+	// The grabbed frames are reused by the cameras
+	Job job = { left.clone(), right.clone() };
+	imageSize = left.size();
+
+	{
+		lock_guard<mutex> lock(queueMutex);
+		jobs.push_back(move(job));
+	}
+	ready.notify_one();
+	return true;
+}
+
+
+int CalibrationCollector::Poll(vector<CalibrationVerdict>* verdicts)
+{
+	vector<Detection> done;
+	{
+		lock_guard<mutex> lock(queueMutex);
+		done.swap(detections);
+	}
+
+	int accepted = 0;
+	for (Detection& d : done)
+	{
+		if (d.verdict == CALIB_VIEW_ACCEPTED && Duplicate(d.view))
+			d.verdict = CALIB_VIEW_DUPLICATE;
+
+		if (d.verdict == CALIB_VIEW_ACCEPTED)
+		{
+			views.push_back(move(d.view));
+			accepted++;
+		}
+
+		if (verdicts != nullptr)
+			verdicts->push_back(d.verdict);
+	}
+
+	return accepted;
+}
+
+
+bool CalibrationCollector::Duplicate(const CalibrationView& view) const
+{
+	double limit = board.minMotion * sqrt(static_cast<double>(imageSize.width) * imageSize.width + static_cast<double>(imageSize.height) * imageSize.height);
+
+	for (const CalibrationView& v : views)
+	{
+		double motion = 0;
+		for (size_t i = 0; i < view.left.size(); i++)
+			motion += norm(view.left[i] - v.left[i]);
+
+		if (motion < limit * view.left.size())
+			return true;
+	}
+
+	return false;
+}
+
+
+void CalibrationCollector::Run()
+{
+	for (;;)
+	{
+		Job job;
+		{
+			unique_lock<mutex> lock(queueMutex);
+			ready.wait(lock, [this] { return !jobs.empty() || closing; });
+			if (closing)
+				return;
+
+			job = move(jobs.front());
+			jobs.pop_front();
+		}
+
+		Detection d;
+		d.verdict = DetectCalibrationView(board, job.left, job.right, d.view);
+
+		lock_guard<mutex> lock(queueMutex);
+		detections.push_back(move(d));
+		pending--;
+	}
+}
@@ -0,0 +1,99 @@
+#ifndef CALIBRATION_H
+#define CALIBRATION_H
+
+#include "Rectify.h"
+
+#include <opencv2/opencv.hpp>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define CALIBRATION_BOARD_FILE "calibration_board.yml"
+#define CALIBRATION_MIN_VIEWS 3 // Fewest views the solver accepts
+
+// Checkerboard and the acceptance of its views. One corner count should be odd and the other even, so that the board
+// has a single orientation and both cameras find its corners in the same order.
+struct CalibrationBoard
+{
+	cv::Size corners = cv::Size(9, 6); // Inner corners along a row and along a column
+	double squareSize = 20; // mm
+	int views = 20; // Accepted views before solving
+	double minSharpness = 50; // Variance of the Laplacian over the board, below it a view is blurry
+	double minMotion = 0.05; // Mean corner displacement from every accepted view, fraction of the image diagonal
+};
+
+enum CalibrationVerdict
+{
+	CALIB_VIEW_ACCEPTED,
+	CALIB_VIEW_NO_BOARD, // Not found in both cameras
+	CALIB_VIEW_BLURRY,
+	CALIB_VIEW_DUPLICATE // Board pose too close to an accepted view
+};
+
+// Board corners of a stereo pair
+struct CalibrationView
+{
+	std::vector<cv::Point2f> left, right;
+	double sharpness = 0; // Lower of both cameras
+};
+
+// Reprojection errors of the solution in pixels
+struct CalibrationReport
+{
+	double rmsLeft = 0, rmsRight = 0, rmsStereo = 0;
+	int views = 0;
+};
+
+int LoadCalibrationBoard(const std::string&, CalibrationBoard&);
+bool FindCalibrationCorners(const CalibrationBoard&, const cv::Mat&, std::vector<cv::Point2f>&, double&); // 8-bit image, board sharpness
+CalibrationVerdict DetectCalibrationView(const CalibrationBoard&, const cv::Mat&, const cv::Mat&, CalibrationView&);
+int CalibrateStereo(const CalibrationBoard&, const std::vector<CalibrationView>&, cv::Size, StereoCalibration&, CalibrationReport* report = nullptr);
+
+// Stereo pairs searched for the board on worker threads as they arrive. Pairs submitted while every worker is busy
+// are dropped, so the live view never waits for a detection. Detections are judged against the accepted views on
+// the thread calling Poll().
+class CalibrationCollector
+{
+public:
+	CalibrationCollector(const CalibrationBoard&, unsigned int numThreads = 0);
+	~CalibrationCollector();
+
+	bool Submit(const cv::Mat&, const cv::Mat&);
+	int Poll(std::vector<CalibrationVerdict>* verdicts = nullptr); // Number of views accepted since the last call
+	const std::vector<CalibrationView>& Views() const { return views; }
+	cv::Size ImageSize() const { return imageSize; }
+	bool Enough() const { return static_cast<int>(views.size()) >= board.views; }
+
+private:
+	struct Job
+	{
+		cv::Mat left, right;
+	};
+
+	struct Detection
+	{
+		CalibrationVerdict verdict;
+		CalibrationView view;
+	};
+
+	void Run();
+	bool Duplicate(const CalibrationView&) const;
+
+	CalibrationBoard board;
+	cv::Size imageSize;
+	std::vector<CalibrationView> views;
+
+	std::vector<std::thread> workers;
+	std::mutex queueMutex;
+	std::condition_variable ready;
+	std::deque<Job> jobs;
+	std::vector<Detection> detections;
+	unsigned int pending = 0; // Pairs queued or being searched
+	bool closing = false;
+};
+
+#endif
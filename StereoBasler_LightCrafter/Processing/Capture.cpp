@@ -0,0 +1,105 @@
+// Capture.cpp : Decoded maps of a capture from the unwrapped phase to the point cloud, stored as files.
+//
+// Shared by the acquisition program, which processes every capture in the background while the next one is taken,
+// and by the batch tool, which reprocesses stored captures and can take the results of the first stages from the
+// decode cache. Both cameras are unwrapped and stored at the same time, then matched along the rectified rows and
+// triangulated.
+
+
+#include "Capture.h"
+#include "Stereo.h"
+#include "PointCloud.h"
+
+#include <chrono>
+#include <future>
+#include <iostream>
+
+using namespace cv;
+using namespace std;
+
+
+
+int DecodeCapture(const FringeDecoder& fringes, const string& prefix, CaptureMaps& maps, unsigned int numThreads, bool verbose)
+{
+	if (!fringes.Complete())
+		return -1;
+
+	maps.wrapped = fringes.Maps();
+	imwrite(prefix + "_phase.tiff", maps.wrapped.phase);
+	imwrite(prefix + "_modulation.tiff", maps.wrapped.modulation);
+	imwrite(prefix + "_background.tiff", maps.wrapped.background);
+
+	auto t0 = chrono::steady_clock::now();
+	maps.unwrapped = UnwrappedPhase();
+	if (fringes.Unwrap(maps.unwrapped, numThreads) < 0)
+		return 0;
+	double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count();
+
+	imwrite(prefix + "_unwrapped.tiff", maps.unwrapped.phase);
+	imwrite(prefix + "_quality.tiff", maps.unwrapped.quality);
+
+	if (verbose)
+		cout << "+Phase " << prefix << " unwrapped in " << ms << " ms" << endl;
+	return 0;
+}
+
+
+int RectifyCapture(const StereoRectification& rectification, const CaptureMaps& left, const CaptureMaps& right, RectifiedCapture& out,
+	unsigned int numThreads)
+{
+	if (RectifyPhase(rectification, left.unwrapped.phase, right.unwrapped.phase, out.phaseL, out.phaseR, numThreads) < 0)
+		return -1;
+
+	// Points are textured with the fringe background, which is the intensity without fringes
+	return RectifyImage(rectification, STEREO_LEFT, left.wrapped.background, out.texture, numThreads);
+}
+
+
+long long TriangulateCapture(const StereoRectification& rectification, const RectifiedCapture& rectified, const string& prefixL,
+	unsigned int numThreads, bool verbose)
+{
+	Mat disparity;
+	auto t0 = chrono::steady_clock::now();
+	int matches = MatchPhase(rectified.phaseL, rectified.phaseR, disparity, numThreads);
+	auto t1 = chrono::steady_clock::now();
+	if (matches < 0)
+		return -1;
+
+	imwrite(prefixL + "_disparity.tiff", disparity);
+
+	double seconds = chrono::duration<double>(t1 - t0).count();
+	if (verbose)
+		cout << "+Stereo " << prefixL << ": " << matches << " matches in " << 1000 * seconds << " ms (" << matches / seconds / 1e6
+			<< " M matches/s)" << endl;
+
+	long long points = TriangulateToPly(rectification, disparity, rectified.texture, prefixL + ".ply", numThreads);
+	if (points >= 0 && verbose)
+		cout << "+Cloud " << prefixL << ".ply: " << points << " points in "
+			<< chrono::duration<double, milli>(chrono::steady_clock::now() - t1).count() << " ms" << endl;
+
+	return points;
+}
+
+
+long long ProcessCapture(const FringeDecoder& fringesL, const FringeDecoder& fringesR, const string& prefixL, const string& prefixR,
+	const StereoRectification* rectification, unsigned int numThreads, bool verbose)
+{
+	CaptureMaps mapsL, mapsR;
+	future<int> left = async(launch::async, DecodeCapture, cref(fringesL), cref(prefixL), ref(mapsL), numThreads, verbose);
+	int decodedR = DecodeCapture(fringesR, prefixR, mapsR, numThreads, verbose);
+	int decodedL = left.get();
+
+	if (decodedL < 0 || decodedR < 0)
+		return -1;
+	if (rectification == nullptr || mapsL.unwrapped.phase.empty() || mapsR.unwrapped.phase.empty())
+		return 0;
+
+	RectifiedCapture rectified;
+	auto t0 = chrono::steady_clock::now();
+	if (RectifyCapture(*rectification, mapsL, mapsR, rectified, numThreads) < 0)
+		return -1;
+	if (verbose)
+		cout << "+Rectified " << prefixL << " in " << chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count() << " ms" << endl;
+
+	return TriangulateCapture(*rectification, rectified, prefixL, numThreads, verbose);
+}
@@ -0,0 +1,36 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include "Unwrap.h"
+#include "Rectify.h"
+
+#include <opencv2/opencv.hpp>
+
+#include <string>
+
+// Decoded maps of one camera, the unwrapped phase is empty when the sequence only gives the wrapped one
+struct CaptureMaps
+{
+	PhaseMaps wrapped;
+	UnwrappedPhase unwrapped;
+};
+
+// Both unwrapped phase maps and the left fringe background, rectified
+struct RectifiedCapture
+{
+	cv::Mat phaseL, phaseR;
+	cv::Mat texture;
+};
+
+// Stages of ProcessCapture(), for callers that keep some of their results. Maps are stored with the given prefix.
+int DecodeCapture(const FringeDecoder&, const std::string&, CaptureMaps&, unsigned int numThreads = 0, bool verbose = true);
+int RectifyCapture(const StereoRectification&, const CaptureMaps&, const CaptureMaps&, RectifiedCapture&, unsigned int numThreads = 0);
+long long TriangulateCapture(const StereoRectification&, const RectifiedCapture&, const std::string&, unsigned int numThreads = 0, bool verbose = true);
+
+// Maps of a decoded capture stored next to its fringe images: wrapped phase, modulation and background of both
+// cameras, their absolute phase and quality when unwrapped, and with a rectification the disparity and point cloud
+// with the left images. Returns the number of points, 0 when there is no cloud, or -1 if matching failed.
+long long ProcessCapture(const FringeDecoder&, const FringeDecoder&, const std::string&, const std::string&, const StereoRectification*,
+	unsigned int numThreads = 0, bool verbose = true);
+
+#endif
@@ -0,0 +1,363 @@
+// DecodeCache.cpp : Content addressed cache of the maps decoded from a capture.
+//
+// Every stage is stored under a key made of the hash of its input and of everything it depends on: the wrapped and
+// unwrapped phase of a camera by its frames and unwrapping sequence, the rectified phase of a pair by the keys of
+// both cameras and the calibration. Reprocessing a capture with other matching or triangulation settings reads the
+// earlier stages back, and changing the sequence or the calibration changes the keys, so only the invalidated
+// stages run again and stale entries age out of the cache on their own.
+// A file has a header with the type, size and offset of every map, then the maps raw at 64 byte aligned offsets, so
+// they are used straight from the file mapping without reading or copying them. The mapping is copy on write: a stage
+// that writes into a map gets private copies of the pages it touches and the file is never changed. The frames are
+// hashed four 64-bit lanes at a time, which is much faster than reading them from disk. Files are written under a
+// temporary name and renamed, and the recency order is kept in memory and in the file times, so it survives between
+// runs.
+
+
+#include "DecodeCache.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+
+using namespace cv;
+using namespace std;
+using namespace std::filesystem;
+
+
+#define DECODE_CACHE_MAGIC "SBLCDCM1"
+#define DECODE_CACHE_VERSION 1 // Changes with the file format or with the output of a stage
+#define DECODE_CACHE_EXTENSION ".dcm"
+#define DECODE_CACHE_ALIGN 64
+
+#define HASH_PRIME1 0x9e3779b185ebca87ULL
+#define HASH_PRIME2 0xc2b2ae3d27d4eb4fULL
+
+
+// Layout of a map in the file
+struct CachedMap
+{
+	int type, rows, cols, reserved;
+	uint64_t offset;
+};
+
+struct CacheHeader
+{
+	char magic[8];
+	int version, count;
+	uint64_t key;
+};
+
+
+
+static inline uint64_t Rotl(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+
+static inline uint64_t Mix(uint64_t lane, uint64_t word)
+{
+	return Rotl(lane + word * HASH_PRIME2, 31) * HASH_PRIME1;
+}
+
+
+static void HashBytes(uint64_t& h, const void* data, size_t size)
+{
+	const unsigned char* p = static_cast<const unsigned char*>(data);
+	for (size_t i = 0; i < size; i++)
+	{
+		h ^= p[i];
+		h *= 0x100000001b3ULL;
+	}
+}
+
+
+uint64_t HashFrames(const vector<Mat>& frames)
+{
+	uint64_t lanes[4] = { HASH_PRIME1 + HASH_PRIME2, HASH_PRIME2, 0, 0 - HASH_PRIME1 };
+	uint64_t tail = 0xcbf29ce484222325ULL;
+
+	for (const Mat& frame : frames)
+	{
+		int shape[3] = { frame.type(), frame.rows, frame.cols };
+		HashBytes(tail, shape, sizeof(shape));
+
+		// Continuous frames are hashed as a single row
+		int rows = frame.isContinuous() ? 1 : frame.rows;
+		size_t width = frame.isContinuous() ? frame.total() * frame.elemSize() : frame.cols * frame.elemSize();
+
+		for (int y = 0; y < rows; y++)
+		{
+			const unsigned char* p = frame.ptr(y);
+			size_t x = 0;
+			for (; x + 32 <= width; x += 32)
+			{
+				uint64_t w[4];
+				memcpy(w, p + x, sizeof(w));
+				lanes[0] = Mix(lanes[0], w[0]);
+				lanes[1] = Mix(lanes[1], w[1]);
+				lanes[2] = Mix(lanes[2], w[2]);
+				lanes[3] = Mix(lanes[3], w[3]);
+			}
+			HashBytes(tail, p + x, width - x);
+		}
+	}
+
+	uint64_t h = Rotl(lanes[0], 1) + Rotl(lanes[1], 7) + Rotl(lanes[2], 12) + Rotl(lanes[3], 18);
+	for (uint64_t lane : lanes)
+		h = (h ^ Mix(0, lane)) * HASH_PRIME1;
+	h ^= tail;
+
+	// Final avalanche, so close inputs give unrelated keys
+	h ^= h >> 33;
+	h *= HASH_PRIME2;
+	h ^= h >> 29;
+	return h;
+}
+
+
+uint64_t PhaseKey(uint64_t frames, const UnwrapSequence& s)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	int stage[7] = { DECODE_CACHE_VERSION, 1, s.mode, s.steps, s.grayBits, s.range, s.horizontal };
+	HashBytes(h, stage, sizeof(stage));
+	HashBytes(h, &frames, sizeof(frames));
+	HashBytes(h, &s.minQuality, sizeof(s.minQuality));
+	HashBytes(h, s.periods.data(), s.periods.size() * sizeof(double));
+	HashBytes(h, s.images.data(), s.images.size());
+	return h;
+}
+
+
+uint64_t RectifiedKey(uint64_t left, uint64_t right, uint64_t calibration)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	int stage[2] = { DECODE_CACHE_VERSION, 2 };
+	uint64_t inputs[3] = { left, right, calibration };
+	HashBytes(h, stage, sizeof(stage));
+	HashBytes(h, inputs, sizeof(inputs));
+	return h;
+}
+
+
+
+string DecodeCache::File(uint64_t key) const
+{
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx" DECODE_CACHE_EXTENSION, static_cast<unsigned long long>(key));
+	return (path(folder) / name).string();
+}
+
+
+int DecodeCache::Open(const string& dir, uint64_t max)
+{
+	error_code ec;
+	create_directories(dir, ec);
+	if (!is_directory(dir, ec))
+	{
+		printf("Unable to open the decode cache %s\n", dir.c_str());
+		return -1;
+	}
+
+	// Entries of earlier runs, least recently used first
+	vector<pair<file_time_type, pair<uint64_t, uint64_t>>> found;
+	for (const auto& entry : directory_iterator(dir, ec))
+	{
+		string name = entry.path().filename().string();
+		if (entry.path().extension() == ".tmp")
+			remove(entry.path(), ec); // Left by an interrupted write
+		else if (entry.path().extension() == DECODE_CACHE_EXTENSION && name.size() == 16 + strlen(DECODE_CACHE_EXTENSION) &&
+			name.find_first_not_of("0123456789abcdef") == 16)
+			found.push_back({ entry.last_write_time(ec), { stoull(name.substr(0, 16), nullptr, 16), entry.file_size(ec) } });
+	}
+	sort(found.begin(), found.end());
+
+	lock_guard<mutex> lock(indexMutex);
+	folder = dir;
+	maxBytes = max;
+	bytes = 0;
+	order.clear();
+	items.clear();
+
+	for (const auto& f : found)
+		Insert(f.second.first, f.second.second);
+	Evict();
+	return 0;
+}
+
+
+uint64_t DecodeCache::Size() const
+{
+	lock_guard<mutex> lock(indexMutex);
+	return bytes;
+}
+
+
+void DecodeCache::Insert(uint64_t key, uint64_t size)
+{
+	auto it = items.find(key);
+	if (it != items.end())
+	{
+		bytes -= it->second.bytes;
+		order.erase(it->second.order);
+	}
+
+	order.push_front(key);
+	items[key] = { order.begin(), size };
+	bytes += size;
+}
+
+
+void DecodeCache::Evict()
+{
+	// The newest entry is kept even when it is larger than the cache. Files still mapped can't be removed on Windows
+	// and stay until a later eviction.
+	error_code ec;
+	auto it = prev(order.end(), order.empty() ? 0 : 1);
+	while (bytes > maxBytes && it != order.begin())
+	{
+		auto older = it--;
+		if (!remove(File(*older), ec) && exists(File(*older), ec))
+			continue;
+
+		bytes -= items[*older].bytes;
+		items.erase(*older);
+		order.erase(older);
+	}
+}
+
+
+
+bool DecodeCache::Get(uint64_t key, DecodeCacheEntry& entry)
+{
+	string file;
+	{
+		lock_guard<mutex> lock(indexMutex);
+		auto it = items.find(key);
+		if (it == items.end())
+			return false;
+
+		order.splice(order.begin(), order, it->second.order);
+		file = File(key);
+	}
+
+	error_code ec;
+	last_write_time(file, file_time_type::clock::now(), ec);
+
+	auto mapped = make_shared<MappedFile>();
+	bool valid = mapped->Open(file, true) == 0 && mapped->Size() >= sizeof(CacheHeader);
+
+	CacheHeader header;
+	if (valid)
+	{
+		memcpy(&header, mapped->Data(), sizeof(header));
+		valid = memcmp(header.magic, DECODE_CACHE_MAGIC, sizeof(header.magic)) == 0 && header.version == DECODE_CACHE_VERSION &&
+			header.key == key && header.count >= 0 && sizeof(header) + header.count * sizeof(CachedMap) <= mapped->Size();
+	}
+
+	vector<Mat> maps;
+	for (int i = 0; valid && i < header.count; i++)
+	{
+		CachedMap m;
+		memcpy(&m, mapped->Data() + sizeof(header) + i * sizeof(CachedMap), sizeof(m));
+
+		size_t length = static_cast<size_t>(m.rows) * m.cols * CV_ELEM_SIZE(m.type);
+		valid = m.rows >= 0 && m.cols >= 0 && m.offset % DECODE_CACHE_ALIGN == 0 && m.offset <= mapped->Size() &&
+			length <= mapped->Size() - m.offset;
+
+		if (valid)
+			maps.push_back(m.rows * m.cols == 0 ? Mat() : Mat(m.rows, m.cols, m.type, mapped->WritableData() + m.offset));
+	}
+
+	if (!valid)
+	{
+		// Damaged or of another version, written again by the caller
+		mapped.reset();
+		lock_guard<mutex> lock(indexMutex);
+		auto it = items.find(key);
+		if (it != items.end())
+		{
+			bytes -= it->second.bytes;
+			order.erase(it->second.order);
+			items.erase(it);
+		}
+		remove(file, ec);
+		return false;
+	}
+
+	entry.file = mapped;
+	entry.maps = maps;
+	return true;
+}
+
+
+int DecodeCache::Put(uint64_t key, const vector<Mat>& maps)
+{
+	string file, temp;
+	{
+		lock_guard<mutex> lock(indexMutex);
+		if (folder.empty())
+			return -1;
+		file = File(key);
+		temp = file + "." + to_string(temps++) + ".tmp";
+	}
+
+	CacheHeader header;
+	memcpy(header.magic, DECODE_CACHE_MAGIC, sizeof(header.magic));
+	header.version = DECODE_CACHE_VERSION;
+	header.count = static_cast<int>(maps.size());
+	header.key = key;
+
+	vector<CachedMap> layout;
+	uint64_t offset = sizeof(header) + maps.size() * sizeof(CachedMap);
+	for (const Mat& m : maps)
+	{
+		offset = (offset + DECODE_CACHE_ALIGN - 1) / DECODE_CACHE_ALIGN * DECODE_CACHE_ALIGN;
+		layout.push_back({ m.type(), m.rows, m.cols, 0, offset });
+		offset += m.total() * m.elemSize();
+	}
+
+	{
+		ofstream out(temp, ios::binary | ios::trunc);
+		if (!out)
+			return -1;
+
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		out.write(reinterpret_cast<const char*>(layout.data()), layout.size() * sizeof(CachedMap));
+
+		const char padding[DECODE_CACHE_ALIGN] = {};
+		for (size_t i = 0; i < maps.size(); i++)
+		{
+			out.write(padding, layout[i].offset - static_cast<uint64_t>(out.tellp()));
+			for (int y = 0; y < maps[i].rows; y++)
+				out.write(reinterpret_cast<const char*>(maps[i].ptr(y)), maps[i].cols * maps[i].elemSize());
+		}
+
+		if (!out)
+		{
+			out.close();
+			remove(temp.c_str());
+			return -1;
+		}
+	}
+
+	// Same key, same content: another worker may have stored it first
+	error_code ec;
+	rename(temp, file, ec);
+	if (ec)
+	{
+		remove(temp, ec);
+		if (!exists(file, ec))
+			return -1;
+	}
+
+	lock_guard<mutex> lock(indexMutex);
+	Insert(key, offset);
+	Evict();
+	return 0;
+}
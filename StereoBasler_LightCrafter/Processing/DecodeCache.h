@@ -0,0 +1,62 @@
+#ifndef DECODE_CACHE_H
+#define DECODE_CACHE_H
+
+#include "Unwrap.h"
+
+#include "../LightCrafter/LC_FirmwareFile.h"
+
+#include <opencv2/opencv.hpp>
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define DECODE_CACHE_SIZE 8192 // MB kept by default
+
+// Keys of the cached stages, from the content of the frames and everything the stage depends on
+uint64_t HashFrames(const std::vector<cv::Mat>&);
+uint64_t PhaseKey(uint64_t, const UnwrapSequence&); // Frames hash of one camera
+uint64_t RectifiedKey(uint64_t, uint64_t, uint64_t); // Phase keys of both cameras and CalibrationHash()
+
+// Maps read from the cache. They point into the copy on write file mapping and are valid while the entry is. Writing
+// into them is allowed and never changes the cached file.
+struct DecodeCacheEntry
+{
+	std::shared_ptr<MappedFile> file;
+	std::vector<cv::Mat> maps;
+};
+
+// Decode products stored by key in a folder, one file per key, each map raw and aligned so it is used in place from
+// the mapping. The least recently used files are removed when the folder grows past its size. Thread safe.
+class DecodeCache
+{
+public:
+	int Open(const std::string&, uint64_t maxBytes);
+	bool Get(uint64_t, DecodeCacheEntry&);
+	int Put(uint64_t, const std::vector<cv::Mat>&);
+	uint64_t Size() const;
+
+private:
+	struct Item
+	{
+		std::list<uint64_t>::iterator order;
+		uint64_t bytes;
+	};
+
+	std::string File(uint64_t) const;
+	void Insert(uint64_t, uint64_t);
+	void Evict();
+
+	std::string folder;
+	uint64_t maxBytes = 0, bytes = 0;
+	std::list<uint64_t> order; // Most recently used first
+	std::unordered_map<uint64_t, Item> items;
+	mutable std::mutex indexMutex;
+	unsigned int temps = 0;
+};
+
+#endif
@@ -0,0 +1,225 @@
+// Parallel.cpp : Loop over independent work items on a set of threads.
+//
+// The threads are started once, on first use, and wait for loops to help with; the calling thread is always one of
+// the workers, so a loop finishes even when every pool thread is busy, and loops may nest. Items are handed out one
+// at a time from a shared counter, so a worker that finishes early takes more of them and uneven items balance out.
+// ParallelForStealing() gives every worker a contiguous range of items instead, taken from its front so that
+// neighbouring items run on the same thread. A worker whose range is empty steals the back half of the largest
+// remaining one. Ranges are packed in a single atomic word (begin in the high half), so the owner and the thieves
+// only need compare-and-swap.
+
+
+#include "Parallel.h"
+
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+
+
+using namespace std;
+
+
+unsigned int WorkerCount(unsigned int numThreads)
+{
+	return numThreads ? numThreads : max(1u, thread::hardware_concurrency());
+}
+
+
+
+// Loop posted to the pool: every thread that takes part calls work() once
+struct PoolJob
+{
+	const function<void()>* work;
+	unsigned int maxHelpers; // Pool threads wanted besides the caller
+	unsigned int helpers = 0;
+	unsigned int active = 0; // Pool threads still in work()
+};
+
+
+class ThreadPool
+{
+public:
+	ThreadPool()
+	{
+		for (unsigned int t = 1; t < WorkerCount(); t++)
+			threads.emplace_back([this]() { Worker(); });
+	}
+
+	~ThreadPool()
+	{
+		{
+			lock_guard<mutex> lock(m);
+			stopping = true;
+		}
+		wake.notify_all();
+
+		for (auto& t : threads)
+			t.join();
+	}
+
+	void Run(unsigned int participants, const function<void()>& work)
+	{
+		PoolJob job;
+		job.work = &work;
+		job.maxHelpers = min(participants - 1, static_cast<unsigned int>(threads.size()));
+
+		if (job.maxHelpers > 0)
+		{
+			{
+				lock_guard<mutex> lock(m);
+				jobs.push_back(&job);
+			}
+			wake.notify_all();
+		}
+
+		work();
+
+		// No more helpers once the caller is done, then wait for the ones that came
+		unique_lock<mutex> lock(m);
+		Remove(&job);
+		done.wait(lock, [&job]() { return job.active == 0; });
+	}
+
+private:
+	void Worker()
+	{
+		unique_lock<mutex> lock(m);
+		for (;;)
+		{
+			wake.wait(lock, [this]() { return stopping || !jobs.empty(); });
+			if (stopping)
+				return;
+
+			PoolJob* job = jobs.front();
+			if (++job->helpers == job->maxHelpers)
+				jobs.pop_front();
+			job->active++;
+
+			lock.unlock();
+			(*job->work)();
+			lock.lock();
+
+			Remove(job);
+			if (--job->active == 0)
+				done.notify_all();
+		}
+	}
+
+	void Remove(PoolJob* job)
+	{
+		auto it = find(jobs.begin(), jobs.end(), job);
+		if (it != jobs.end())
+			jobs.erase(it);
+	}
+
+	mutex m;
+	condition_variable wake, done;
+	deque<PoolJob*> jobs;
+	vector<thread> threads;
+	bool stopping = false;
+};
+
+
+static ThreadPool& Pool()
+{
+	static ThreadPool pool;
+	return pool;
+}
+
+
+
+void ParallelFor(int count, const function<void(int)>& body, unsigned int numThreads)
+{
+	if (count <= 0)
+		return;
+
+	atomic<int> next{ 0 };
+	numThreads = min(WorkerCount(numThreads), static_cast<unsigned int>(count));
+
+	function<void()> worker = [&]()
+	{
+		for (int i = next++; i < count; i = next++)
+			body(i);
+	};
+
+	if (numThreads == 1)
+		worker();
+	else
+		Pool().Run(numThreads, worker);
+}
+
+
+
+static inline uint64_t PackRange(uint32_t begin, uint32_t end)
+{
+	return static_cast<uint64_t>(begin) << 32 | end;
+}
+
+
+void ParallelForStealing(int count, const function<void(int)>& body, unsigned int numThreads)
+{
+	if (count <= 0)
+		return;
+
+	numThreads = min(WorkerCount(numThreads), static_cast<unsigned int>(count));
+	vector<atomic<uint64_t>> ranges(numThreads);
+	for (unsigned int t = 0; t < numThreads; t++)
+		ranges[t] = PackRange(static_cast<uint32_t>(static_cast<uint64_t>(count) * t / numThreads),
+			static_cast<uint32_t>(static_cast<uint64_t>(count) * (t + 1) / numThreads));
+
+	// Every worker starts on a range of its own; ranges of workers that never come are stolen by the others
+	atomic<unsigned int> slots{ 0 };
+	function<void()> worker = [&]()
+	{
+		unsigned int self = slots++;
+		for (;;)
+		{
+			// Own range from the front
+			uint64_t r = ranges[self].load();
+			while (static_cast<uint32_t>(r >> 32) < static_cast<uint32_t>(r))
+			{
+				uint32_t begin = static_cast<uint32_t>(r >> 32);
+				if (ranges[self].compare_exchange_weak(r, PackRange(begin + 1, static_cast<uint32_t>(r))))
+				{
+					body(static_cast<int>(begin));
+					r = ranges[self].load();
+				}
+			}
+
+			// Back half of the largest range, done when there is none left
+			unsigned int victim = self;
+			uint32_t largest = 0;
+			for (unsigned int t = 0; t < numThreads; t++)
+			{
+				uint64_t v = ranges[t].load();
+				uint32_t begin = static_cast<uint32_t>(v >> 32), end = static_cast<uint32_t>(v);
+				if (begin < end && end - begin > largest)
+				{
+					largest = end - begin;
+					victim = t;
+				}
+			}
+			if (largest == 0)
+				return;
+
+			uint64_t v = ranges[victim].load();
+			uint32_t begin = static_cast<uint32_t>(v >> 32), end = static_cast<uint32_t>(v);
+			if (begin >= end)
+				continue;
+
+			uint32_t middle = end - (end - begin + 1) / 2;
+			if (ranges[victim].compare_exchange_strong(v, PackRange(begin, middle)))
+				ranges[self].store(PackRange(middle, end));
+		}
+	};
+
+	if (numThreads == 1)
+		worker();
+	else
+		Pool().Run(numThreads, worker);
+}
@@ -0,0 +1,10 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <functional>
+
+unsigned int WorkerCount(unsigned int numThreads = 0);
+void ParallelFor(int, const std::function<void(int)>&, unsigned int numThreads = 0);
+void ParallelForStealing(int, const std::function<void(int)>&, unsigned int numThreads = 0);
+
+#endif
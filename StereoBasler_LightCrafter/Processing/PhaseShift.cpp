@@ -0,0 +1,214 @@
+// PhaseShift.cpp : Wrapped phase, modulation and background from phase shifted fringe images.
+//
+// With I_k = A + B cos(phi + 2*pi*k/N), S = sum I_k sin(2*pi*k/N), C = sum I_k cos(2*pi*k/N) and T = sum I_k
+//	phi = atan2(-S, C), B = 2 sqrt(S^2 + C^2) / N, A = T / N
+// which PhaseAccumulator updates one frame at a time, the last frame turning the sums into the maps in place.
+// Rows are split in blocks shared by the worker threads. Each row is computed 16 pixels at a time with SSE2 and a
+// polynomial atan2 (odd minimax polynomial of atan on [0, 1] plus octant folding) that stays within
+// PHASE_ATAN2_MAX_ERROR of the exact one. The scalar tail uses the same approximation.
+
+
+#include "PhaseShift.h"
+#include "Parallel.h"
+
+#include <cfloat>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PHASE_SSE2 1
+#endif
+
+
+using namespace cv;
+using namespace std;
+
+
+#define PHASE_ROWS_PER_BLOCK 16
+
+static const float halfPi = 1.57079632679f;
+static const float pi = 3.14159265359f;
+
+// atan(a) ~ a (c0 + c1 a^2 + ... + c5 a^10) for a in [0, 1]
+static const float atanCoeffs[6] = { 0.99997726f, -0.33262347f, 0.19354346f, -0.11643287f, 0.05265332f, -0.01172120f };
+
+
+
+float FastAtan2(float y, float x)
+{
+	float ax = fabs(x), ay = fabs(y);
+	float a = min(ax, ay) / max(max(ax, ay), FLT_MIN);
+	float s = a * a;
+
+	float r = atanCoeffs[5];
+	for (int i = 4; i >= 0; i--)
+		r = r * s + atanCoeffs[i];
+	r *= a;
+
+	if (ay > ax)
+		r = halfPi - r;
+	if (x < 0)
+		r = pi - r;
+
+	return y < 0 ? -r : r;
+}
+
+
+#ifdef PHASE_SSE2
+static inline __m128 Select(__m128 mask, __m128 a, __m128 b)
+{
+	return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+
+static inline __m128 FastAtan2(__m128 y, __m128 x)
+{
+	const __m128 signMask = _mm_set1_ps(-0.0f);
+	__m128 ax = _mm_andnot_ps(signMask, x), ay = _mm_andnot_ps(signMask, y);
+	__m128 a = _mm_div_ps(_mm_min_ps(ax, ay), _mm_max_ps(_mm_max_ps(ax, ay), _mm_set1_ps(FLT_MIN)));
+	__m128 s = _mm_mul_ps(a, a);
+
+	__m128 r = _mm_set1_ps(atanCoeffs[5]);
+	for (int i = 4; i >= 0; i--)
+		r = _mm_add_ps(_mm_mul_ps(r, s), _mm_set1_ps(atanCoeffs[i]));
+	r = _mm_mul_ps(r, a);
+
+	r = Select(_mm_cmpgt_ps(ay, ax), _mm_sub_ps(_mm_set1_ps(halfPi), r), r);
+	r = Select(_mm_cmplt_ps(x, _mm_setzero_ps()), _mm_sub_ps(_mm_set1_ps(pi), r), r);
+
+	return Select(_mm_cmplt_ps(y, _mm_setzero_ps()), _mm_sub_ps(_mm_setzero_ps(), r), r);
+}
+
+
+static inline void Widen(__m128i v, __m128 out[4])
+{
+	// 16 bytes to 16 floats
+	const __m128i zero = _mm_setzero_si128();
+	__m128i lo = _mm_unpacklo_epi8(v, zero), hi = _mm_unpackhi_epi8(v, zero);
+
+	out[0] = _mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero));
+	out[1] = _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero));
+	out[2] = _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero));
+	out[3] = _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero));
+}
+#endif
+
+
+static void AccumulateRow(const unsigned char* frame, int width, float sk, float ck, float* s, float* c, float* t)
+{
+	int x = 0;
+
+#ifdef PHASE_SSE2
+	const __m128 vs = _mm_set1_ps(sk), vc = _mm_set1_ps(ck);
+
+	for (; x + 16 <= width; x += 16)
+	{
+		__m128 f[4];
+		Widen(_mm_loadu_si128(reinterpret_cast<const __m128i*>(frame + x)), f);
+
+		for (int g = 0; g < 4; g++)
+		{
+			int i = x + 4 * g;
+			_mm_storeu_ps(s + i, _mm_add_ps(_mm_loadu_ps(s + i), _mm_mul_ps(f[g], vs)));
+			_mm_storeu_ps(c + i, _mm_add_ps(_mm_loadu_ps(c + i), _mm_mul_ps(f[g], vc)));
+			_mm_storeu_ps(t + i, _mm_add_ps(_mm_loadu_ps(t + i), f[g]));
+		}
+	}
+#endif
+
+	for (; x < width; x++)
+	{
+		s[x] += frame[x] * sk;
+		c[x] += frame[x] * ck;
+		t[x] += frame[x];
+	}
+}
+
+
+static void FinishRow(const unsigned char* frame, int width, float sk, float ck, float scale, float* s, float* c, float* t)
+{
+	// Last frame: the sums become phase (in s), modulation (in c) and background (in t)
+	int x = 0;
+
+#ifdef PHASE_SSE2
+	const __m128 vs = _mm_set1_ps(sk), vc = _mm_set1_ps(ck), vScale = _mm_set1_ps(scale), vMod = _mm_set1_ps(2 * scale);
+
+	for (; x + 16 <= width; x += 16)
+	{
+		__m128 f[4];
+		Widen(_mm_loadu_si128(reinterpret_cast<const __m128i*>(frame + x)), f);
+
+		for (int g = 0; g < 4; g++)
+		{
+			int i = x + 4 * g;
+			__m128 vsin = _mm_add_ps(_mm_loadu_ps(s + i), _mm_mul_ps(f[g], vs));
+			__m128 vcos = _mm_add_ps(_mm_loadu_ps(c + i), _mm_mul_ps(f[g], vc));
+			__m128 vsum = _mm_add_ps(_mm_loadu_ps(t + i), f[g]);
+
+			_mm_storeu_ps(s + i, FastAtan2(_mm_sub_ps(_mm_setzero_ps(), vsin), vcos));
+			_mm_storeu_ps(c + i, _mm_mul_ps(vMod, _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(vsin, vsin), _mm_mul_ps(vcos, vcos)))));
+			_mm_storeu_ps(t + i, _mm_mul_ps(vScale, vsum));
+		}
+	}
+#endif
+
+	for (; x < width; x++)
+	{
+		float vsin = s[x] + frame[x] * sk, vcos = c[x] + frame[x] * ck;
+
+		s[x] = FastAtan2(-vsin, vcos);
+		c[x] = 2 * scale * sqrt(vsin * vsin + vcos * vcos);
+		t[x] = scale * (t[x] + frame[x]);
+	}
+}
+
+
+int PhaseAccumulator::Reset(Size size, int numSteps)
+{
+	steps = 0;
+	added = 0;
+	if (numSteps < 3 || size.width <= 0 || size.height <= 0)
+		return -1;
+
+	// New buffers, the maps of the previous sequence may still be in use
+	steps = numSteps;
+	sinSum = Mat::zeros(size, CV_32FC1);
+	cosSum = Mat::zeros(size, CV_32FC1);
+	sum = Mat::zeros(size, CV_32FC1);
+	maps = PhaseMaps();
+
+	return 0;
+}
+
+
+int PhaseAccumulator::Add(const Mat& frame, unsigned int numThreads)
+{
+	if (added >= steps || frame.type() != CV_8UC1 || frame.size() != sum.size())
+		return -1;
+
+	double delta = 2 * CV_PI * added / steps;
+	float sk = static_cast<float>(sin(delta)), ck = static_cast<float>(cos(delta));
+	bool last = added + 1 == steps;
+	float scale = 1.0f / steps;
+
+	int blocks = (frame.rows + PHASE_ROWS_PER_BLOCK - 1) / PHASE_ROWS_PER_BLOCK;
+	ParallelFor(blocks, [&](int b)
+	{
+		for (int y = b * PHASE_ROWS_PER_BLOCK; y < min(frame.rows, (b + 1) * PHASE_ROWS_PER_BLOCK); y++)
+		{
+			if (last)
+				FinishRow(frame.ptr<unsigned char>(y), frame.cols, sk, ck, scale, sinSum.ptr<float>(y), cosSum.ptr<float>(y), sum.ptr<float>(y));
+			else
+				AccumulateRow(frame.ptr<unsigned char>(y), frame.cols, sk, ck, sinSum.ptr<float>(y), cosSum.ptr<float>(y), sum.ptr<float>(y));
+		}
+	}, numThreads);
+
+	if (++added == steps)
+	{
+		maps.phase = sinSum;
+		maps.modulation = cosSum;
+		maps.background = sum;
+	}
+
+	return 0;
+}
@@ -0,0 +1,37 @@
+#ifndef PHASE_SHIFT_H
+#define PHASE_SHIFT_H
+
+#include <opencv2/opencv.hpp>
+
+#define PHASE_ATAN2_MAX_ERROR 3e-6f // Worst case error of FastAtan2() in radians
+
+// Wrapped phase in [-pi, pi], fringe modulation and background intensity, all CV_32FC1
+struct PhaseMaps
+{
+	cv::Mat phase;
+	cv::Mat modulation;
+	cv::Mat background;
+};
+
+float FastAtan2(float, float);
+
+// N-step phase shift decoded while the frames arrive. Frame k (shifted by 2*pi*k/N) is folded into running sine,
+// cosine and intensity sums, so only those are kept, and adding the last frame computes the maps in the same pass.
+class PhaseAccumulator
+{
+public:
+	int Reset(cv::Size, int);
+	int Add(const cv::Mat&, unsigned int numThreads = 0);
+	int Steps() const { return steps; }
+	int Added() const { return added; }
+	bool Complete() const { return steps > 0 && added == steps; }
+	const PhaseMaps& Maps() const { return maps; } // Valid once complete
+
+private:
+	int steps = 0;
+	int added = 0;
+	cv::Mat sinSum, cosSum, sum; // CV_32FC1, become the phase, modulation and background maps
+	PhaseMaps maps;
+};
+
+#endif
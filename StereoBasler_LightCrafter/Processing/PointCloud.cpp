@@ -0,0 +1,265 @@
+// PointCloud.cpp : Triangulation of rectified disparity and streaming of the points to PLY files.
+//
+// With Q from stereoRectify(), (X, Y, Z, W) = Q (x, y, d, 1) and the point is (X, Y, Z) / W in the rectified left
+// frame. R1 is folded into Q once, so M = [R1^T 0; 0 1] Q gives the point in the left camera frame directly. For a
+// row y the terms M_i1 y + M_i3 are constant, leaving two products per coordinate and pixel, done four pixels at a
+// time with SSE2. Unmatched (NaN) pixels and points behind the camera are dropped.
+// Points are kept as separate coordinate arrays while computed and interleaved into PLY vertex records by the same
+// worker once its block is done. Blocks of rows are triangulated in parallel in groups, and every group is queued to the
+// AsyncFileWriter in row order while the next group is computed, so only a few blocks are in memory at once.
+
+
+#include "PointCloud.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define POINT_CLOUD_SSE2 1
+#endif
+
+
+using namespace cv;
+using namespace std;
+
+
+#define POINT_CLOUD_ROWS_PER_BLOCK 32
+#define POINT_CLOUD_COUNT_DIGITS 12 // Width of the vertex count field left in the header
+
+
+
+void PointCloud::Clear()
+{
+	x.clear();
+	y.clear();
+	z.clear();
+	intensity.clear();
+}
+
+
+
+int Triangulator::Setup(const StereoRectification& r)
+{
+	if (r.Q.empty() || r.R1.empty())
+		return -1;
+
+	Mat Q, R1;
+	r.Q.convertTo(Q, CV_64F);
+	r.R1.convertTo(R1, CV_64F);
+
+	for (int j = 0; j < 4; j++)
+	{
+		for (int i = 0; i < 3; i++)
+		{
+			double v = 0;
+			for (int k = 0; k < 3; k++)
+				v += R1.at<double>(k, i) * Q.at<double>(k, j);
+			m[i][j] = static_cast<float>(v);
+		}
+		m[3][j] = static_cast<float>(Q.at<double>(3, j));
+	}
+
+	return 0;
+}
+
+
+static inline unsigned char Intensity(float v)
+{
+	return static_cast<unsigned char>(min(max(v, 0.0f), 255.0f) + 0.5f);
+}
+
+
+size_t Triangulator::Row(int y, const float* disparity, const float* texture, int width, PointCloud& out) const
+{
+	// Row terms
+	float rx = m[0][1] * y + m[0][3], ry = m[1][1] * y + m[1][3], rz = m[2][1] * y + m[2][3], rw = m[3][1] * y + m[3][3];
+
+	size_t start = out.Size(), n = start;
+	out.x.resize(start + width);
+	out.y.resize(start + width);
+	out.z.resize(start + width);
+	if (texture)
+		out.intensity.resize(start + width);
+
+	int x = 0;
+
+#ifdef POINT_CLOUD_SSE2
+	const __m128 m00 = _mm_set1_ps(m[0][0]), m02 = _mm_set1_ps(m[0][2]), m10 = _mm_set1_ps(m[1][0]), m12 = _mm_set1_ps(m[1][2]);
+	const __m128 m20 = _mm_set1_ps(m[2][0]), m22 = _mm_set1_ps(m[2][2]), m30 = _mm_set1_ps(m[3][0]), m32 = _mm_set1_ps(m[3][2]);
+	const __m128 vrx = _mm_set1_ps(rx), vry = _mm_set1_ps(ry), vrz = _mm_set1_ps(rz), vrw = _mm_set1_ps(rw);
+	const __m128 step = _mm_setr_ps(0, 1, 2, 3), zero = _mm_setzero_ps();
+
+	for (; x + 4 <= width; x += 4)
+	{
+		__m128 d = _mm_loadu_ps(disparity + x);
+		__m128 matched = _mm_cmpord_ps(d, d);
+		if (_mm_movemask_ps(matched) == 0)
+			continue;
+
+		__m128 u = _mm_add_ps(_mm_set1_ps(static_cast<float>(x)), step);
+		__m128 X = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m00, u), _mm_mul_ps(m02, d)), vrx);
+		__m128 Y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m10, u), _mm_mul_ps(m12, d)), vry);
+		__m128 Z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m20, u), _mm_mul_ps(m22, d)), vrz);
+		__m128 W = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m30, u), _mm_mul_ps(m32, d)), vrw);
+
+		__m128 inv = _mm_div_ps(_mm_set1_ps(1), W);
+		X = _mm_mul_ps(X, inv);
+		Y = _mm_mul_ps(Y, inv);
+		Z = _mm_mul_ps(Z, inv);
+
+		int valid = _mm_movemask_ps(_mm_and_ps(matched, _mm_cmpgt_ps(Z, zero)));
+		if (valid == 0)
+			continue;
+
+		float px[4], py[4], pz[4];
+		_mm_storeu_ps(px, X);
+		_mm_storeu_ps(py, Y);
+		_mm_storeu_ps(pz, Z);
+
+		for (int i = 0; i < 4; i++)
+		{
+			if (valid >> i & 1)
+			{
+				out.x[n] = px[i];
+				out.y[n] = py[i];
+				out.z[n] = pz[i];
+				if (texture)
+					out.intensity[n] = Intensity(texture[x + i]);
+				n++;
+			}
+		}
+	}
+#endif
+
+	for (; x < width; x++)
+	{
+		float d = disparity[x];
+		if (d != d)
+			continue;
+
+		float inv = 1 / (m[3][0] * x + m[3][2] * d + rw);
+		float Z = (m[2][0] * x + m[2][2] * d + rz) * inv;
+		if (!(Z > 0))
+			continue;
+
+		out.x[n] = (m[0][0] * x + m[0][2] * d + rx) * inv;
+		out.y[n] = (m[1][0] * x + m[1][2] * d + ry) * inv;
+		out.z[n] = Z;
+		if (texture)
+			out.intensity[n] = Intensity(texture[x]);
+		n++;
+	}
+
+	out.x.resize(n);
+	out.y.resize(n);
+	out.z.resize(n);
+	if (texture)
+		out.intensity.resize(n);
+
+	return n - start;
+}
+
+
+
+int PlyStreamWriter::Open(const string& path, bool intensity)
+{
+	this->intensity = intensity;
+	count = 0;
+
+	if (file.Open(path) < 0)
+		return -1;
+
+	string header = "ply\nformat binary_little_endian 1.0\ncomment StereoBasler_LightCrafter capture\nelement vertex ";
+	countOffset = header.size();
+	header += string(POINT_CLOUD_COUNT_DIGITS, ' ') + "\nproperty float x\nproperty float y\nproperty float z\n";
+	if (intensity)
+		header += "property uchar intensity\n";
+	header += "end_header\n";
+
+	file.Write(vector<char>(header.begin(), header.end()));
+	return 0;
+}
+
+
+vector<char> PlyStreamWriter::Records(const PointCloud& points) const
+{
+	// Interleaved vertex records, the host is little endian as the format
+	size_t record = 3 * sizeof(float) + (intensity ? 1 : 0);
+	vector<char> data(points.Size() * record);
+	char* p = data.data();
+
+	for (size_t i = 0; i < points.Size(); i++, p += record)
+	{
+		memcpy(p, &points.x[i], sizeof(float));
+		memcpy(p + 4, &points.y[i], sizeof(float));
+		memcpy(p + 8, &points.z[i], sizeof(float));
+		if (intensity)
+			p[12] = static_cast<char>(points.intensity[i]);
+	}
+
+	return data;
+}
+
+
+void PlyStreamWriter::Append(vector<char>&& records, size_t points)
+{
+	count += points;
+	file.Write(move(records));
+}
+
+
+int PlyStreamWriter::Close()
+{
+	string digits = to_string(count);
+	digits.resize(POINT_CLOUD_COUNT_DIGITS, ' ');
+	file.WriteAt(countOffset, vector<char>(digits.begin(), digits.end()));
+
+	return file.Close();
+}
+
+
+
+long long TriangulateToPly(const StereoRectification& r, const Mat& disparity, const Mat& texture, const string& path, unsigned int numThreads)
+{
+	Triangulator triangulator;
+	bool textured = !texture.empty();
+	if (disparity.empty() || disparity.type() != CV_32FC1 || (textured && (texture.type() != CV_32FC1 || texture.size() != disparity.size())) ||
+		triangulator.Setup(r) < 0)
+		return -1;
+
+	PlyStreamWriter ply;
+	if (ply.Open(path, textured) < 0)
+		return -1;
+
+	int blocks = (disparity.rows + POINT_CLOUD_ROWS_PER_BLOCK - 1) / POINT_CLOUD_ROWS_PER_BLOCK;
+	int group = static_cast<int>(WorkerCount(numThreads));
+	vector<PointCloud> clouds(group);
+	vector<vector<char>> records(group);
+
+	for (int first = 0; first < blocks; first += group)
+	{
+		int count = min(group, blocks - first);
+		ParallelFor(count, [&](int i)
+		{
+			int b = first + i;
+			clouds[i].Clear();
+			for (int y = b * POINT_CLOUD_ROWS_PER_BLOCK; y < min(disparity.rows, (b + 1) * POINT_CLOUD_ROWS_PER_BLOCK); y++)
+				triangulator.Row(y, disparity.ptr<float>(y), textured ? texture.ptr<float>(y) : nullptr, disparity.cols, clouds[i]);
+			records[i] = ply.Records(clouds[i]);
+		}, numThreads);
+
+		for (int i = 0; i < count; i++)
+			ply.Append(move(records[i]), clouds[i].Size());
+	}
+
+	size_t points = ply.Count();
+	if (ply.Close() < 0)
+	{
+		printf("Unable to write %s\n", path.c_str());
+		return -1;
+	}
+
+	return static_cast<long long>(points);
+}
@@ -0,0 +1,56 @@
+#ifndef POINT_CLOUD_H
+#define POINT_CLOUD_H
+
+#include "Rectify.h"
+#include "../Acquisition/Storage.h"
+
+#include <opencv2/opencv.hpp>
+
+#include <string>
+#include <vector>
+
+// Points in the left camera frame, in calibration units, one array per coordinate
+struct PointCloud
+{
+	std::vector<float> x, y, z;
+	std::vector<unsigned char> intensity; // Empty without texture
+
+	size_t Size() const { return x.size(); }
+	void Clear();
+};
+
+// Disparity to points with the reprojection matrix Q of the rectification, rotated back by R1 so that points are
+// in the left camera frame. Terms that only depend on the row are computed once per row.
+class Triangulator
+{
+public:
+	int Setup(const StereoRectification&);
+	size_t Row(int, const float*, const float*, int, PointCloud&) const; // Appends the valid points of a row
+private:
+	float m[4][4] = {};
+};
+
+// Binary little endian PLY written while its points are produced. The vertex count is left blank in the header and
+// filled in by Close().
+class PlyStreamWriter
+{
+public:
+	int Open(const std::string&, bool intensity);
+	std::vector<char> Records(const PointCloud&) const; // Vertex records of the points, can be built on any thread
+	void Append(std::vector<char>&&, size_t); // Records of that many points
+	void Append(const PointCloud& points) { Append(Records(points), points.Size()); }
+	int Close();
+	size_t Count() const { return count; }
+
+private:
+	AsyncFileWriter file;
+	bool intensity = false;
+	size_t count = 0;
+	uint64_t countOffset = 0;
+};
+
+// Triangulates a rectified disparity map block by block, every block written out while the next ones are computed.
+// The texture (CV_32FC1 rectified intensity) is optional. Returns the number of points or -1.
+long long TriangulateToPly(const StereoRectification&, const cv::Mat&, const cv::Mat&, const std::string&, unsigned int numThreads = 0);
+
+#endif
@@ -0,0 +1,216 @@
+// ProjectorCalibration.cpp : Calibration of the projector as an inverse camera from phase coded board views.
+//
+// Every view is the board lit by vertical and then horizontal fringes, both unwrapped to absolute phase, which is
+// the DMD column and row every camera pixel sees. The corners are found in the fringe background and each one is
+// taken to the projector with a homography fitted to the camera and projector positions of the valid pixels around
+// it: the board is planar, so the mapping is a homography locally even with lens distortion, and fitting it over
+// hundreds of pixels averages the phase noise down to a fraction of a DMD pixel.
+// The camera and the projector are then calibrated on their own at the same time and stereoCalibrate() finds the
+// pose of the projector with their intrinsics fixed, as for the stereo cameras. The projector calibration starts from
+// the intrinsics of the DMD and optics: its focal lengths differ by a factor two and the offset optics put the
+// principal point at the edge of the image, far from the centre calibrateCamera() would start from otherwise.
+
+
+#include "ProjectorCalibration.h"
+
+#include <cmath>
+#include <cstdio>
+#include <future>
+
+using namespace cv;
+using namespace std;
+
+
+#define PROJECTOR_MIN_VALID 0.5 // Fraction of the window around a corner that must have both phases
+
+
+
+int LoadProjectorFringes(ProjectorFringes& fringes)
+{
+	ProjectorFringes f;
+	if (LoadUnwrapSequence(PROJECTOR_VERTICAL_FILE, f.vertical) < 0 || LoadUnwrapSequence(PROJECTOR_HORIZONTAL_FILE, f.horizontal) < 0)
+		return -1;
+
+	if (ProjectorFringeFrames(f) < 0)
+		return -1;
+
+	fringes = f;
+	return 0;
+}
+
+
+int ProjectorFringeFrames(const ProjectorFringes& f)
+{
+	if (f.vertical.horizontal || !f.horizontal.horizontal || f.vertical.mode == UNWRAP_NONE || f.horizontal.mode == UNWRAP_NONE)
+	{
+		printf("Projector calibration needs unwrapped vertical and horizontal fringes\n");
+		return -1;
+	}
+
+	int vertical = CheckUnwrapSequence(f.vertical), horizontal = CheckUnwrapSequence(f.horizontal);
+	return vertical < 0 || horizontal < 0 ? -1 : vertical + horizontal;
+}
+
+
+string ProjectorFringeImages(const ProjectorFringes& f)
+{
+	return f.vertical.images + "-" + f.horizontal.images;
+}
+
+
+
+int ProjectCorners(const ProjectorFringes& f, const UnwrappedPhase& vertical, const UnwrappedPhase& horizontal, const vector<Point2f>& corners,
+	vector<Point2f>& projector, int window)
+{
+	Size size = vertical.phase.size();
+	if (vertical.phase.type() != CV_32FC1 || horizontal.phase.type() != CV_32FC1 || horizontal.phase.size() != size || window < 2)
+		return -1;
+
+	// Absolute phase to flash image pixels
+	double scaleX = f.vertical.periods[0] / (2 * CV_PI), scaleY = f.horizontal.periods[0] / (2 * CV_PI);
+	size_t minValid = static_cast<size_t>(PROJECTOR_MIN_VALID * (2 * window + 1) * (2 * window + 1));
+
+	vector<Point2f> cam, proj;
+	projector.clear();
+
+	for (const Point2f& corner : corners)
+	{
+		int cx = cvRound(corner.x), cy = cvRound(corner.y);
+		cam.clear();
+		proj.clear();
+
+		for (int y = max(0, cy - window); y <= min(size.height - 1, cy + window); y++)
+		{
+			const float* pv = vertical.phase.ptr<float>(y);
+			const float* ph = horizontal.phase.ptr<float>(y);
+			for (int x = max(0, cx - window); x <= min(size.width - 1, cx + window); x++)
+			{
+				if (pv[x] != pv[x] || ph[x] != ph[x])
+					continue;
+
+				cam.push_back(Point2f(static_cast<float>(x), static_cast<float>(y)));
+				proj.push_back(Point2f(static_cast<float>(pv[x] * scaleX), static_cast<float>(ph[x] * scaleY)));
+			}
+		}
+
+		// Corner in the projector shadow or off the fringes
+		if (cam.size() < minValid)
+			return -1;
+
+		Mat H = findHomography(cam, proj);
+		if (H.empty())
+			return -1;
+
+		const double* h = H.ptr<double>(0);
+		double w = h[6] * corner.x + h[7] * corner.y + h[8];
+		projector.push_back(Point2f(static_cast<float>((h[0] * corner.x + h[1] * corner.y + h[2]) / w),
+			static_cast<float>((h[3] * corner.x + h[4] * corner.y + h[5]) / w)));
+	}
+
+	return 0;
+}
+
+
+int DecodeProjectorView(const CalibrationBoard& board, const ProjectorFringes& f, const vector<Mat>& frames, ProjectorView& view, int window,
+	unsigned int numThreads)
+{
+	int count = ProjectorFringeFrames(f);
+	if (count < 0 || frames.size() != static_cast<size_t>(count) || frames[0].empty())
+		return -1;
+
+	// Vertical fringes first, then horizontal ones
+	FringeDecoder vertical, horizontal;
+	if (vertical.Reset(f.vertical, frames[0].size()) < 0 || horizontal.Reset(f.horizontal, frames[0].size()) < 0)
+		return -1;
+
+	for (const Mat& frame : frames)
+		if ((vertical.Complete() ? horizontal : vertical).Add(frame, numThreads) < 0)
+			return -1;
+
+	UnwrappedPhase phaseV, phaseH;
+	if (vertical.Unwrap(phaseV, numThreads) < 0 || horizontal.Unwrap(phaseH, numThreads) < 0)
+		return -1;
+
+	// The background is the board under uniform light
+	Mat image;
+	double sharpness;
+	vertical.Maps().background.convertTo(image, CV_8U);
+	if (!FindCalibrationCorners(board, image, view.camera, sharpness))
+		return -1;
+
+	return ProjectCorners(f, phaseV, phaseH, view.camera, view.projector, window);
+}
+
+
+
+Mat ProjectorIntrinsicGuess()
+{
+	// Columns are a full mirror diagonal apart, rows half of one, so fy is twice fx in flash image pixels
+	double fx = PROJECTOR_THROW_RATIO * PTN_WIDTH, fy = 2 * fx;
+	double cx = PTN_WIDTH / 2.0, cy = PTN_HEIGHT / 2.0 * (1 + PROJECTOR_OFFSET);
+
+	return (Mat_<double>(3, 3) << fx, 0, cx, 0, fy, cy, 0, 0, 1);
+}
+
+
+
+int CalibrateProjector(const CalibrationBoard& board, const vector<ProjectorView>& views, Size cameraSize, ProjectorCalibration& calibration)
+{
+	if (static_cast<int>(views.size()) < CALIBRATION_MIN_VIEWS || cameraSize.area() <= 0)
+	{
+		printf("Not enough calibration views\n");
+		return -1;
+	}
+
+	vector<Point3f> corners;
+	for (int y = 0; y < board.corners.height; y++)
+		for (int x = 0; x < board.corners.width; x++)
+			corners.push_back(Point3f(static_cast<float>(x * board.squareSize), static_cast<float>(y * board.squareSize), 0));
+
+	vector<vector<Point3f>> objectPoints(views.size(), corners);
+	vector<vector<Point2f>> pointsC, pointsP;
+	for (const ProjectorView& view : views)
+	{
+		pointsC.push_back(view.camera);
+		pointsP.push_back(view.projector);
+	}
+
+	ProjectorCalibration c;
+	c.cameraSize = cameraSize;
+
+	future<double> camera = async(launch::async, [&]
+	{
+		return calibrateCamera(objectPoints, pointsC, c.cameraSize, c.Kc, c.Dc, noArray(), noArray());
+	});
+	c.Kp = ProjectorIntrinsicGuess();
+	c.rmsProjector = calibrateCamera(objectPoints, pointsP, c.projectorSize, c.Kp, c.Dp, noArray(), noArray(), CALIB_USE_INTRINSIC_GUESS);
+	c.rmsCamera = camera.get();
+
+	Mat E, F;
+	c.rmsStereo = stereoCalibrate(objectPoints, pointsC, pointsP, c.Kc, c.Dc, c.Kp, c.Dp, cameraSize, c.R, c.T, E, F,
+		CALIB_FIX_INTRINSIC, TermCriteria(TermCriteria::COUNT + TermCriteria::EPS, 100, 1e-6));
+
+	calibration = c;
+	return 0;
+}
+
+
+int SaveProjectorCalibration(const string& file, const ProjectorCalibration& c)
+{
+	FileStorage fs(file, FileStorage::WRITE);
+	if (!fs.isOpened())
+		return -1;
+
+	fs << "Kc" << c.Kc;
+	fs << "Dc" << c.Dc;
+	fs << "Kp" << c.Kp;
+	fs << "Dp" << c.Dp;
+	fs << "R" << c.R;
+	fs << "T" << c.T;
+	fs << "cameraSize" << c.cameraSize;
+	fs << "projectorSize" << c.projectorSize;
+	fs << "rmsCamera" << c.rmsCamera;
+	fs << "rmsProjector" << c.rmsProjector;
+	fs << "rmsStereo" << c.rmsStereo;
+	return 0;
+}
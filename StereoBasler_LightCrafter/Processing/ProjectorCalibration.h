@@ -0,0 +1,59 @@
+#ifndef PROJECTOR_CALIBRATION_H
+#define PROJECTOR_CALIBRATION_H
+
+#include "Calibration.h"
+#include "Unwrap.h"
+
+#include "../LightCrafter/dlpc350_common.h"
+
+#include <opencv2/opencv.hpp>
+
+#include <string>
+#include <vector>
+
+#define PROJECTOR_VERTICAL_FILE "projector_vertical.yml" // Unwrapping sequence of fringes across the DMD columns
+#define PROJECTOR_HORIZONTAL_FILE "projector_horizontal.yml" // Unwrapping sequence of fringes across the DMD rows
+#define PROJECTOR_CALIBRATION_FILE "projector_calibration.yml"
+#define PROJECTOR_VIEWS_FILE "projector_views.txt" // Capture indices of the views, in the acquisition folder
+#define PROJECTOR_WINDOW 15 // Half size in camera pixels of the neighbourhood of a corner mapped to the projector
+#define PROJECTOR_THROW_RATIO 1.65 // Throw distance over image width of the LightCrafter 4500 optics, for the initial focal length
+#define PROJECTOR_OFFSET 1.0 // Vertical offset of the optics: the optical axis meets the image at its bottom edge
+
+// Both fringe directions of a projector calibration view, projected in one sequence, vertical fringes first
+struct ProjectorFringes
+{
+	UnwrapSequence vertical;
+	UnwrapSequence horizontal;
+};
+
+// Board corners seen by the camera and where the projector put them on its DMD, in flash image pixels
+struct ProjectorView
+{
+	std::vector<cv::Point2f> camera;
+	std::vector<cv::Point2f> projector;
+};
+
+// The projector as an inverse camera. Its image is the PTN_WIDTH x PTN_HEIGHT flash image grid, whose rows are half
+// as far apart as its columns on the diamond DMD, so in these pixels the vertical focal length is about twice the
+// horizontal one.
+struct ProjectorCalibration
+{
+	cv::Mat Kc, Dc; // Camera
+	cv::Mat Kp, Dp; // Projector
+	cv::Mat R, T; // Camera to projector: a point X of the camera frame is R X + T in the projector frame
+	cv::Size cameraSize;
+	cv::Size projectorSize = cv::Size(PTN_WIDTH, PTN_HEIGHT);
+	double rmsCamera = 0, rmsProjector = 0, rmsStereo = 0; // Reprojection errors in pixels
+};
+
+int LoadProjectorFringes(ProjectorFringes&);
+int ProjectorFringeFrames(const ProjectorFringes&); // Frames of the combined sequence, or -1
+std::string ProjectorFringeImages(const ProjectorFringes&); // Flash images of the combined sequence
+
+int ProjectCorners(const ProjectorFringes&, const UnwrappedPhase&, const UnwrappedPhase&, const std::vector<cv::Point2f>&, std::vector<cv::Point2f>&, int window = PROJECTOR_WINDOW);
+int DecodeProjectorView(const CalibrationBoard&, const ProjectorFringes&, const std::vector<cv::Mat>&, ProjectorView&, int window = PROJECTOR_WINDOW, unsigned int numThreads = 0);
+cv::Mat ProjectorIntrinsicGuess();
+int CalibrateProjector(const CalibrationBoard&, const std::vector<ProjectorView>&, cv::Size, ProjectorCalibration&);
+int SaveProjectorCalibration(const std::string&, const ProjectorCalibration&);
+
+#endif
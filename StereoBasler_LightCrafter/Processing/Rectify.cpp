@@ -0,0 +1,293 @@
+// Rectify.cpp : Stereo rectification of the camera images, with maps built once and cached on disk.
+//
+// The maps are computed by initUndistortRectifyMap() directly in OpenCV's fixed point format: the integer source
+// position (CV_16SC2) and the index of the bilinear weights of its 1/32 pixel fraction (CV_16UC1), which remap()
+// uses without converting coordinates. Building them, undistortion included, takes longer than a capture, so they
+// are written to a binary file named by a hash of the calibration and the image size and read back from it while
+// the calibration is unchanged.
+// Remapping is split into tiles that go to the worker threads. A tile only reads a small window of the source, and
+// each remap() call is small enough for OpenCV to run it without dispatching it further. Only the decoded phase of
+// every capture is rectified, never its raw fringe frames.
+
+
+#include "Rectify.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <limits>
+
+using namespace cv;
+using namespace std;
+
+
+#define RECTIFY_CACHE_MAGIC "SBLCRECT"
+#define RECTIFY_CACHE_VERSION 1
+#define RECTIFY_TILE_WIDTH 256
+#define RECTIFY_TILE_HEIGHT 64
+
+
+
+int LoadStereoCalibration(const string& file, StereoCalibration& calibration)
+{
+	FileStorage fs(file, FileStorage::READ);
+	if (!fs.isOpened())
+		return -1;
+
+	StereoCalibration c;
+	fs["K1"] >> c.K1;
+	fs["D1"] >> c.D1;
+	fs["K2"] >> c.K2;
+	fs["D2"] >> c.D2;
+	fs["R"] >> c.R;
+	fs["T"] >> c.T;
+	fs["imageSize"] >> c.imageSize;
+
+	if (c.K1.empty() || c.K2.empty() || c.R.empty() || c.T.empty() || c.imageSize.area() <= 0)
+	{
+		printf("Incomplete stereo calibration %s\n", file.c_str());
+		return -1;
+	}
+
+	calibration = c;
+	return 0;
+}
+
+
+int SaveStereoCalibration(const string& file, const StereoCalibration& c)
+{
+	FileStorage fs(file, FileStorage::WRITE);
+	if (!fs.isOpened())
+		return -1;
+
+	fs << "K1" << c.K1;
+	fs << "D1" << c.D1;
+	fs << "K2" << c.K2;
+	fs << "D2" << c.D2;
+	fs << "R" << c.R;
+	fs << "T" << c.T;
+	fs << "imageSize" << c.imageSize;
+	return 0;
+}
+
+
+
+// 64-bit FNV-1a
+static void HashBytes(uint64_t& h, const void* data, size_t size)
+{
+	const unsigned char* p = static_cast<const unsigned char*>(data);
+	for (size_t i = 0; i < size; i++)
+	{
+		h ^= p[i];
+		h *= 0x100000001b3ULL;
+	}
+}
+
+
+static void HashMat(uint64_t& h, const Mat& m)
+{
+	Mat values;
+	if (!m.empty())
+		m.convertTo(values, CV_64F);
+
+	int shape[2] = { values.rows, values.cols };
+	HashBytes(h, shape, sizeof(shape));
+	for (int y = 0; y < values.rows; y++)
+		HashBytes(h, values.ptr<double>(y), values.cols * values.channels() * sizeof(double));
+}
+
+
+uint64_t CalibrationHash(const StereoCalibration& c)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	// The fixed point format is part of the cached maps
+	int format[4] = { RECTIFY_CACHE_VERSION, INTER_BITS, c.imageSize.width, c.imageSize.height };
+	HashBytes(h, format, sizeof(format));
+
+	for (const Mat* m : { &c.K1, &c.D1, &c.K2, &c.D2, &c.R, &c.T })
+		HashMat(h, *m);
+
+	return h;
+}
+
+
+int RectifyStereo(const StereoCalibration& c, StereoRectification& r)
+{
+	if (c.K1.empty() || c.K2.empty() || c.imageSize.area() <= 0)
+		return -1;
+
+	stereoRectify(c.K1, c.D1, c.K2, c.D2, c.imageSize, c.R, c.T, r.R1, r.R2, r.P1, r.P2, r.Q, CALIB_ZERO_DISPARITY, 0);
+	initUndistortRectifyMap(c.K1, c.D1, r.R1, r.P1, c.imageSize, CV_16SC2, r.mapL1, r.mapL2);
+	initUndistortRectifyMap(c.K2, c.D2, r.R2, r.P2, c.imageSize, CV_16SC2, r.mapR1, r.mapR2);
+	r.size = c.imageSize;
+
+	return 0;
+}
+
+
+
+static string CacheFile(const StereoCalibration& c)
+{
+	char name[64];
+	snprintf(name, sizeof(name), RECTIFY_CACHE_PREFIX "%016llx_%dx%d.bin", static_cast<unsigned long long>(CalibrationHash(c)),
+		c.imageSize.width, c.imageSize.height);
+	return name;
+}
+
+
+static void WriteMat(ofstream& file, const Mat& m)
+{
+	int header[3] = { m.type(), m.rows, m.cols };
+	file.write(reinterpret_cast<const char*>(header), sizeof(header));
+	for (int y = 0; y < m.rows; y++)
+		file.write(reinterpret_cast<const char*>(m.ptr(y)), m.cols * m.elemSize());
+}
+
+
+static bool ReadMat(ifstream& file, Mat& m)
+{
+	int header[3];
+	if (!file.read(reinterpret_cast<char*>(header), sizeof(header)) || header[1] < 0 || header[2] < 0)
+		return false;
+
+	m.create(header[1], header[2], header[0]);
+	for (int y = 0; y < m.rows; y++)
+		if (!file.read(reinterpret_cast<char*>(m.ptr(y)), m.cols * m.elemSize()))
+			return false;
+
+	return true;
+}
+
+
+static int ReadCache(const string& path, uint64_t hash, StereoRectification& r)
+{
+	ifstream file(path, ios::binary);
+	if (!file)
+		return -1;
+
+	char magic[8];
+	int version, size[2];
+	uint64_t stored;
+	file.read(magic, sizeof(magic));
+	file.read(reinterpret_cast<char*>(&version), sizeof(version));
+	file.read(reinterpret_cast<char*>(&stored), sizeof(stored));
+	file.read(reinterpret_cast<char*>(size), sizeof(size));
+	if (!file || !equal(magic, magic + sizeof(magic), RECTIFY_CACHE_MAGIC) || version != RECTIFY_CACHE_VERSION || stored != hash)
+		return -1;
+
+	StereoRectification c;
+	c.size = Size(size[0], size[1]);
+	for (Mat* m : { &c.R1, &c.R2, &c.P1, &c.P2, &c.Q, &c.mapL1, &c.mapL2, &c.mapR1, &c.mapR2 })
+		if (!ReadMat(file, *m))
+			return -1;
+
+	if (c.mapL1.size() != c.size || c.mapL1.type() != CV_16SC2 || c.mapL2.size() != c.size || c.mapL2.type() != CV_16UC1 ||
+		c.mapR1.size() != c.size || c.mapR1.type() != CV_16SC2 || c.mapR2.size() != c.size || c.mapR2.type() != CV_16UC1)
+		return -1;
+
+	r = c;
+	return 0;
+}
+
+
+// Written next to the final name and renamed, so an interrupted write never leaves a truncated cache
+static int WriteCache(const string& path, uint64_t hash, const StereoRectification& r)
+{
+	string temp = path + ".tmp";
+	{
+		ofstream file(temp, ios::binary | ios::trunc);
+		if (!file)
+			return -1;
+
+		int version = RECTIFY_CACHE_VERSION, size[2] = { r.size.width, r.size.height };
+		file.write(RECTIFY_CACHE_MAGIC, 8);
+		file.write(reinterpret_cast<const char*>(&version), sizeof(version));
+		file.write(reinterpret_cast<const char*>(&hash), sizeof(hash));
+		file.write(reinterpret_cast<const char*>(size), sizeof(size));
+		for (const Mat* m : { &r.R1, &r.R2, &r.P1, &r.P2, &r.Q, &r.mapL1, &r.mapL2, &r.mapR1, &r.mapR2 })
+			WriteMat(file, *m);
+
+		if (!file)
+		{
+			file.close();
+			remove(temp.c_str());
+			return -1;
+		}
+	}
+
+	remove(path.c_str());
+	return rename(temp.c_str(), path.c_str()) == 0 ? 0 : -1;
+}
+
+
+int LoadRectification(const StereoCalibration& c, StereoRectification& r, bool* cached)
+{
+	string path = CacheFile(c);
+	uint64_t hash = CalibrationHash(c);
+
+	if (cached != nullptr)
+		*cached = false;
+
+	if (ReadCache(path, hash, r) == 0)
+	{
+		if (cached != nullptr)
+			*cached = true;
+		return 0;
+	}
+
+	if (RectifyStereo(c, r) < 0)
+		return -1;
+
+	if (WriteCache(path, hash, r) < 0)
+		printf("Unable to write the rectification cache %s\n", path.c_str());
+
+	return 0;
+}
+
+
+
+void RemapTiled(const Mat& src, Mat& dst, const Mat& map1, const Mat& map2, int interpolation, const Scalar& border, unsigned int numThreads)
+{
+	dst.create(map1.size(), src.type());
+
+	int tilesX = (map1.cols + RECTIFY_TILE_WIDTH - 1) / RECTIFY_TILE_WIDTH;
+	int tilesY = (map1.rows + RECTIFY_TILE_HEIGHT - 1) / RECTIFY_TILE_HEIGHT;
+
+	ParallelFor(tilesX * tilesY, [&](int i)
+	{
+		int x = i % tilesX * RECTIFY_TILE_WIDTH, y = i / tilesX * RECTIFY_TILE_HEIGHT;
+		Rect tile(x, y, min(RECTIFY_TILE_WIDTH, map1.cols - x), min(RECTIFY_TILE_HEIGHT, map1.rows - y));
+
+		// Map values are absolute source positions, so the tile of the destination only needs the tile of the maps
+		Mat out = dst(tile);
+		remap(src, out, map1(tile), map2.empty() ? map2 : map2(tile), interpolation, BORDER_CONSTANT, border);
+	}, numThreads);
+}
+
+
+int RectifyImage(const StereoRectification& r, StereoCamera camera, const Mat& src, Mat& dst, unsigned int numThreads)
+{
+	const Mat& map1 = camera == STEREO_LEFT ? r.mapL1 : r.mapR1;
+	const Mat& map2 = camera == STEREO_LEFT ? r.mapL2 : r.mapR2;
+	if (map1.empty() || src.size() != r.size)
+		return -1;
+
+	RemapTiled(src, dst, map1, map2, INTER_LINEAR, Scalar(), numThreads);
+	return 0;
+}
+
+
+int RectifyPhase(const StereoRectification& r, const Mat& phaseL, const Mat& phaseR, Mat& rectL, Mat& rectR, unsigned int numThreads)
+{
+	if (r.mapL1.empty() || phaseL.size() != r.size || phaseR.size() != r.size || phaseL.type() != CV_32FC1 || phaseR.type() != CV_32FC1)
+		return -1;
+
+	// Outside the images and next to masked pixels the phase is NaN
+	Scalar nan = Scalar::all(numeric_limits<double>::quiet_NaN());
+	RemapTiled(phaseL, rectL, r.mapL1, r.mapL2, INTER_LINEAR, nan, numThreads);
+	RemapTiled(phaseR, rectR, r.mapR1, r.mapR2, INTER_LINEAR, nan, numThreads);
+
+	return 0;
+}
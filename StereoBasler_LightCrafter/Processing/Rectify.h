@@ -0,0 +1,45 @@
+#ifndef RECTIFY_H
+#define RECTIFY_H
+
+#include <opencv2/opencv.hpp>
+
+#include <cstdint>
+#include <string>
+
+#define STEREO_CALIBRATION_FILE "stereo_calibration.yml"
+#define RECTIFY_CACHE_PREFIX "rectify_" // Cache files are named by calibration hash and image size
+
+// Intrinsics of the left (1) and right (2) cameras and the pose of the right camera in the left one
+struct StereoCalibration
+{
+	cv::Mat K1, D1, K2, D2;
+	cv::Mat R, T;
+	cv::Size imageSize;
+};
+
+enum StereoCamera
+{
+	STEREO_LEFT,
+	STEREO_RIGHT
+};
+
+// Rectifying maps of both cameras in fixed point, integer source positions (CV_16SC2) and the index of the
+// interpolation weights of their fraction (CV_16UC1). Built once per calibration and used for every capture.
+struct StereoRectification
+{
+	cv::Mat mapL1, mapL2, mapR1, mapR2;
+	cv::Mat R1, R2, P1, P2, Q;
+	cv::Size size;
+};
+
+int LoadStereoCalibration(const std::string&, StereoCalibration&);
+int SaveStereoCalibration(const std::string&, const StereoCalibration&);
+uint64_t CalibrationHash(const StereoCalibration&);
+int RectifyStereo(const StereoCalibration&, StereoRectification&);
+int LoadRectification(const StereoCalibration&, StereoRectification&, bool* cached = nullptr); // From the cache, built and cached if missing
+
+void RemapTiled(const cv::Mat&, cv::Mat&, const cv::Mat&, const cv::Mat&, int, const cv::Scalar&, unsigned int numThreads = 0);
+int RectifyImage(const StereoRectification&, StereoCamera, const cv::Mat&, cv::Mat&, unsigned int numThreads = 0);
+int RectifyPhase(const StereoRectification&, const cv::Mat&, const cv::Mat&, cv::Mat&, cv::Mat&, unsigned int numThreads = 0);
+
+#endif
@@ -0,0 +1,206 @@
+// Stereo.cpp : Correspondence of the left and right cameras through their absolute phase.
+//
+// Both unwrapped phase maps are rectified (see Rectify.cpp), so that matching pixels lie on the same row. With
+// vertical fringes the phase grows along the rows, and the left pixel matches the right position with the same phase.
+// The valid right pixels of a row are kept in increasing phase order, as their longest increasing subsequence (the
+// other samples, outliers, are dropped). Every left pixel is located among them with a binary search and the position
+// is interpolated between the two samples around it, which must be neighbouring pixels.
+// The searches of four left pixels run interleaved and without branches, all of them doing the same steps since
+// they search the same row, so that their loads overlap, and the interpolation is done for the four at once with
+// SSE2. Rows go to the worker threads in contiguous ranges with work stealing, as their cost depends on how much of
+// them is valid.
+
+
+#include "Stereo.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define STEREO_SSE2 1
+#endif
+
+
+using namespace cv;
+using namespace std;
+
+
+#define STEREO_MAX_GAP 1.5f // Largest distance in pixels between the right samples a match is interpolated in
+
+
+
+// Right samples of a row in increasing phase order
+struct PhaseRow
+{
+	vector<float> phase;
+	vector<float> x;
+
+	vector<int> valid; // Scratch of BuildRow(): columns with a phase, ends of the increasing runs and their links
+	vector<int> tails;
+	vector<int> prev;
+};
+
+
+static void BuildRow(const float* right, int width, PhaseRow& row)
+{
+	// Longest strictly increasing subsequence of the valid samples, so a single outlier only costs its own sample
+	// instead of hiding every later one below it. tails[k] is the sample ending the best increasing run of length
+	// k + 1 found so far, prev links every sample to the one before it in its run.
+	row.valid.clear();
+	row.tails.clear();
+	row.prev.clear();
+
+	for (int x = 0; x < width; x++)
+	{
+		float p = right[x];
+		if (p != p)
+			continue;
+
+		int k = static_cast<int>(lower_bound(row.tails.begin(), row.tails.end(), p, [&](int t, float v) { return right[row.valid[t]] < v; }) -
+			row.tails.begin());
+		int i = static_cast<int>(row.valid.size());
+
+		row.valid.push_back(x);
+		row.prev.push_back(k > 0 ? row.tails[k - 1] : -1);
+		if (k == static_cast<int>(row.tails.size()))
+			row.tails.push_back(i);
+		else
+			row.tails[k] = i;
+	}
+
+	size_t n = row.tails.size();
+	row.phase.resize(n);
+	row.x.resize(n);
+
+	int i = n ? row.tails.back() : -1;
+	for (size_t k = n; k > 0; k--, i = row.prev[i])
+	{
+		row.phase[k - 1] = right[row.valid[i]];
+		row.x[k - 1] = static_cast<float>(row.valid[i]);
+	}
+}
+
+
+// Last sample with a phase not above p, for p in [phase[0], phase[n - 1])
+static inline int Locate(const float* phase, int n, float p)
+{
+	int base = 0;
+	while (n > 1)
+	{
+		int half = n / 2;
+		base = phase[base + half] <= p ? base + half : base;
+		n -= half;
+	}
+	return base;
+}
+
+
+static int MatchRow(const float* left, const PhaseRow& row, int width, float* disparity)
+{
+	const float nan = numeric_limits<float>::quiet_NaN();
+	const float* phase = row.phase.data();
+	const float* xs = row.x.data();
+	int n = static_cast<int>(row.phase.size());
+	int matches = 0;
+
+	if (n < 2)
+	{
+		for (int x = 0; x < width; x++)
+			disparity[x] = nan;
+		return 0;
+	}
+
+	float first = phase[0], last = phase[n - 1];
+	int x = 0;
+
+#ifdef STEREO_SSE2
+	const __m128 vFirst = _mm_set1_ps(first), vLast = _mm_set1_ps(last), vGap = _mm_set1_ps(STEREO_MAX_GAP);
+	const __m128 vNan = _mm_set1_ps(nan), step = _mm_setr_ps(0, 1, 2, 3);
+
+	for (; x + 4 <= width; x += 4)
+	{
+		__m128 p = _mm_loadu_ps(left + x);
+		__m128 inside = _mm_and_ps(_mm_cmpge_ps(p, vFirst), _mm_cmplt_ps(p, vLast)); // False for NaN
+		int mask = _mm_movemask_ps(inside);
+		if (mask == 0)
+		{
+			_mm_storeu_ps(disparity + x, vNan);
+			continue;
+		}
+
+		// Four searches in lockstep, lanes outside the row search its first sample
+		float q[4];
+		_mm_storeu_ps(q, _mm_or_ps(_mm_and_ps(inside, p), _mm_andnot_ps(inside, vFirst)));
+
+		int b0 = 0, b1 = 0, b2 = 0, b3 = 0;
+		for (int len = n; len > 1; len -= len / 2)
+		{
+			int half = len / 2;
+			b0 = phase[b0 + half] <= q[0] ? b0 + half : b0;
+			b1 = phase[b1 + half] <= q[1] ? b1 + half : b1;
+			b2 = phase[b2 + half] <= q[2] ? b2 + half : b2;
+			b3 = phase[b3 + half] <= q[3] ? b3 + half : b3;
+		}
+
+		__m128 p0 = _mm_setr_ps(phase[b0], phase[b1], phase[b2], phase[b3]);
+		__m128 p1 = _mm_setr_ps(phase[b0 + 1], phase[b1 + 1], phase[b2 + 1], phase[b3 + 1]);
+		__m128 x0 = _mm_setr_ps(xs[b0], xs[b1], xs[b2], xs[b3]);
+		__m128 x1 = _mm_setr_ps(xs[b0 + 1], xs[b1 + 1], xs[b2 + 1], xs[b3 + 1]);
+
+		__m128 gap = _mm_sub_ps(x1, x0);
+		__m128 xr = _mm_add_ps(x0, _mm_div_ps(_mm_mul_ps(_mm_sub_ps(p, p0), gap), _mm_sub_ps(p1, p0)));
+		__m128 d = _mm_sub_ps(_mm_add_ps(_mm_set1_ps(static_cast<float>(x)), step), xr);
+
+		__m128 valid = _mm_and_ps(inside, _mm_cmple_ps(gap, vGap));
+		_mm_storeu_ps(disparity + x, _mm_or_ps(_mm_and_ps(valid, d), _mm_andnot_ps(valid, vNan)));
+
+		int v = _mm_movemask_ps(valid);
+		matches += (v & 1) + (v >> 1 & 1) + (v >> 2 & 1) + (v >> 3 & 1);
+	}
+#endif
+
+	for (; x < width; x++)
+	{
+		float p = left[x];
+		disparity[x] = nan;
+		if (!(p >= first && p < last))
+			continue;
+
+		int b = Locate(phase, n, p);
+		float gap = xs[b + 1] - xs[b];
+		if (gap > STEREO_MAX_GAP)
+			continue;
+
+		disparity[x] = x - (xs[b] + (p - phase[b]) * gap / (phase[b + 1] - phase[b]));
+		matches++;
+	}
+
+	return matches;
+}
+
+
+int MatchPhase(const Mat& rectL, const Mat& rectR, Mat& disparity, unsigned int numThreads)
+{
+	if (rectL.empty() || rectL.type() != CV_32FC1 || rectR.type() != CV_32FC1 || rectL.size() != rectR.size())
+		return -1;
+
+	disparity.create(rectL.size(), CV_32FC1);
+
+	vector<int> matches(rectL.rows);
+	ParallelForStealing(rectL.rows, [&](int y)
+	{
+		thread_local PhaseRow row;
+		BuildRow(rectR.ptr<float>(y), rectR.cols, row);
+		matches[y] = MatchRow(rectL.ptr<float>(y), row, rectL.cols, disparity.ptr<float>(y));
+	}, numThreads);
+
+	int total = 0;
+	for (int m : matches)
+		total += m;
+
+	return total;
+}
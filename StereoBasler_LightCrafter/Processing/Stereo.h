@@ -0,0 +1,12 @@
+#ifndef STEREO_H
+#define STEREO_H
+
+#include "Rectify.h"
+
+#include <opencv2/opencv.hpp>
+
+// Disparity (left x - right x, CV_32FC1, NaN where unmatched) of rectified absolute phase maps of vertical fringes.
+// Returns the number of matched pixels or -1.
+int MatchPhase(const cv::Mat&, const cv::Mat&, cv::Mat&, unsigned int numThreads = 0);
+
+#endif
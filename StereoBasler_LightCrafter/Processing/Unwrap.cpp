@@ -0,0 +1,652 @@
+// Unwrap.cpp : Temporal phase unwrapping of fringe sequences projected from flash.
+//
+// Heterodyne: the wrapped phases of periods p_0, ..., p_K-1 are combined pairwise into beat phases of frequency
+// |1/p_i - 1/p_i+1|, and the beats again, up to a single phase whose period must cover the range. Going back down,
+// every level is unwrapped with the level above it scaled by the ratio of their periods, so that the first period
+// ends up with its fringe order. The distance of that scaled phase to the nearest fringe order (half a fringe at
+// worst) is the unwrapping ambiguity. The top phase is wrapped at the middle of the unused part of its period so
+// that noise at projector pixel 0 does not jump to the far end.
+// Gray code: the Gray code patterns give the fringe order k1 of the phase period, with edges where the phase
+// wraps. The complementary pattern adds a finer bit whose code gives k2 = round(x / p), with edges at the middle of
+// the fringes. The phase uses k2 within a quarter period of its wrap and k1 elsewhere, so no code edge is read
+// where it is blurred. Both orders are checked against each other away from their edges. Code pixels are
+// thresholded with the background of the phase shifted set.
+// The quality is the fringe contrast (modulation over background, lowest of all periods) scaled by the ambiguity,
+// or zero when the Gray code orders disagree. Rows are unwrapped in blocks shared by the worker threads, four pixels
+// at a time with SSE2 and without branches, each map being read once in row order.
+
+
+#include "Unwrap.h"
+#include "Parallel.h"
+
+#include "../LightCrafter/LC_Sequence.h"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define UNWRAP_SSE2 1
+#endif
+
+using namespace cv;
+using namespace std;
+
+
+#define UNWRAP_ROWS_PER_BLOCK 16
+#define UNWRAP_ORDER_OFFSET 1024
+
+static const float twoPi = 6.28318530718f;
+
+
+
+// Frequencies (fringes per projector pixel) of the beat phases, level l holding K - l of them
+struct BeatCascade
+{
+	int levels = 0;
+	double freq[UNWRAP_MAX_PERIODS][UNWRAP_MAX_PERIODS];
+	float sign[UNWRAP_MAX_PERIODS][UNWRAP_MAX_PERIODS]; // Order of the difference giving a positive frequency
+	float ratio[UNWRAP_MAX_PERIODS]; // Period of level l + 1 over level l, first phases
+	float topLimit; // Top phases above it are taken as negative
+};
+
+
+static int BuildCascade(const UnwrapSequence& s, BeatCascade& c)
+{
+	c.levels = static_cast<int>(s.periods.size());
+	for (int i = 0; i < c.levels; i++)
+		c.freq[0][i] = 1 / s.periods[i];
+
+	for (int l = 1; l < c.levels; l++)
+	{
+		for (int i = 0; i < c.levels - l; i++)
+		{
+			double d = c.freq[l - 1][i] - c.freq[l - 1][i + 1];
+			if (fabs(d) < 1e-9)
+			{
+				printf("Periods without beat at level %d\n", l);
+				return -1;
+			}
+			c.freq[l][i] = fabs(d);
+			c.sign[l][i] = d > 0 ? 1.0f : -1.0f;
+		}
+		c.ratio[l - 1] = static_cast<float>(c.freq[l - 1][0] / c.freq[l][0]);
+	}
+
+	double top = 1 / c.freq[c.levels - 1][0];
+	if (top < s.range)
+	{
+		printf("Longest beat period %.1f does not cover the range of %d pixels\n", top, s.range);
+		return -1;
+	}
+	c.topLimit = static_cast<float>(twoPi * (s.range + (top - s.range) / 2) / top);
+
+	return 0;
+}
+
+
+// Phase in [0, 2*pi), without a branch since the sign of wrapped phases is random
+static inline float Positive(float phase)
+{
+	return phase + twoPi * static_cast<float>(phase < 0);
+}
+
+
+// Nearest integer of a fringe order above -UNWRAP_ORDER_OFFSET, without a call to floor()
+static inline float Nearest(float t)
+{
+	return static_cast<float>(static_cast<int>(t + (UNWRAP_ORDER_OFFSET + 0.5f)) - UNWRAP_ORDER_OFFSET);
+}
+
+
+static inline float Contrast(float modulation, float background)
+{
+	return min(modulation / max(background, 1.0f), 1.0f);
+}
+
+
+#ifdef UNWRAP_SSE2
+static inline __m128 Positive(__m128 phase)
+{
+	return _mm_add_ps(phase, _mm_and_ps(_mm_cmplt_ps(phase, _mm_setzero_ps()), _mm_set1_ps(twoPi)));
+}
+
+
+static inline __m128 Nearest(__m128 t)
+{
+	__m128i k = _mm_cvttps_epi32(_mm_add_ps(t, _mm_set1_ps(UNWRAP_ORDER_OFFSET + 0.5f)));
+	return _mm_cvtepi32_ps(_mm_sub_epi32(k, _mm_set1_epi32(UNWRAP_ORDER_OFFSET)));
+}
+
+
+static inline __m128 Contrast(__m128 modulation, __m128 background)
+{
+	const __m128 one = _mm_set1_ps(1);
+	return _mm_min_ps(_mm_div_ps(modulation, _mm_max_ps(background, one)), one);
+}
+
+
+// Phase where the quality reaches the minimum, NaN elsewhere
+static inline __m128 Masked(__m128 phase, __m128 quality, __m128 minQuality)
+{
+	__m128 valid = _mm_cmpge_ps(quality, minQuality);
+	return _mm_or_ps(_mm_and_ps(valid, phase), _mm_andnot_ps(valid, _mm_set1_ps(numeric_limits<float>::quiet_NaN())));
+}
+#endif
+
+
+static unsigned int GrayToBinary(unsigned int g)
+{
+	for (unsigned int shift = 1; shift < 32; shift <<= 1)
+		g ^= g >> shift;
+	return g;
+}
+
+
+static unsigned int BinaryToGray(unsigned int b)
+{
+	return b ^ (b >> 1);
+}
+
+
+// Unwraps a row with K periods, the loops over the levels unrolled. The SSE2 path computes the same as the scalar one.
+template <int K>
+static void HeterodyneRow(const BeatCascade& c, const float* const* phase, const float* const* modulation, const float* const* background,
+	int width, float minQuality, float* unwrapped, float* quality)
+{
+	const float nan = numeric_limits<float>::quiet_NaN();
+	int x = 0;
+
+#ifdef UNWRAP_SSE2
+	const __m128 vTwoPi = _mm_set1_ps(twoPi), vInvTwoPi = _mm_set1_ps(1 / twoPi), vLimit = _mm_set1_ps(c.topLimit);
+	const __m128 vMin = _mm_set1_ps(minQuality), absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+
+	for (; x + 4 <= width; x += 4)
+	{
+		__m128 p[K], first[K];
+		__m128 contrast = _mm_set1_ps(1);
+		for (int i = 0; i < K; i++)
+		{
+			p[i] = Positive(_mm_loadu_ps(phase[i] + x));
+			contrast = _mm_min_ps(contrast, Contrast(_mm_loadu_ps(modulation[i] + x), _mm_loadu_ps(background[i] + x)));
+		}
+		first[0] = p[0];
+
+		for (int l = 1; l < K; l++)
+		{
+			for (int i = 0; i < K - l; i++)
+				p[i] = Positive(_mm_mul_ps(_mm_set1_ps(c.sign[l][i]), _mm_sub_ps(p[i], p[i + 1])));
+			first[l] = p[0];
+		}
+
+		__m128 a = first[K - 1];
+		a = _mm_sub_ps(a, _mm_and_ps(_mm_cmpgt_ps(a, vLimit), vTwoPi));
+
+		__m128 ambiguity = _mm_setzero_ps();
+		for (int l = K - 2; l >= 0; l--)
+		{
+			__m128 t = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(a, _mm_set1_ps(c.ratio[l])), first[l]), vInvTwoPi);
+			__m128 k = Nearest(t);
+			ambiguity = _mm_max_ps(ambiguity, _mm_and_ps(absMask, _mm_sub_ps(t, k)));
+			a = _mm_add_ps(first[l], _mm_mul_ps(vTwoPi, k));
+		}
+
+		__m128 q = _mm_mul_ps(contrast, _mm_sub_ps(_mm_set1_ps(1), _mm_add_ps(ambiguity, ambiguity)));
+		_mm_storeu_ps(quality + x, q);
+		_mm_storeu_ps(unwrapped + x, Masked(a, q, vMin));
+	}
+#endif
+
+	for (; x < width; x++)
+	{
+		// Beat phases, keeping the first one of every level
+		float p[K], first[K];
+		float contrast = 1;
+		for (int i = 0; i < K; i++)
+		{
+			p[i] = Positive(phase[i][x]);
+			contrast = min(contrast, Contrast(modulation[i][x], background[i][x]));
+		}
+		first[0] = p[0];
+
+		for (int l = 1; l < K; l++)
+		{
+			for (int i = 0; i < K - l; i++)
+				p[i] = Positive(c.sign[l][i] * (p[i] - p[i + 1]));
+			first[l] = p[0];
+		}
+
+		// Unwrap down to the first period
+		float a = first[K - 1];
+		if (a > c.topLimit)
+			a -= twoPi;
+
+		float ambiguity = 0;
+		for (int l = K - 2; l >= 0; l--)
+		{
+			float t = (a * c.ratio[l] - first[l]) * (1 / twoPi);
+			float k = Nearest(t);
+			ambiguity = max(ambiguity, fabs(t - k));
+			a = first[l] + twoPi * k;
+		}
+
+		float q = contrast * (1 - 2 * ambiguity);
+		quality[x] = q;
+		unwrapped[x] = q >= minQuality ? a : nan;
+	}
+}
+
+
+// Unwraps a row with the Gray code patterns (bits of them, then the complementary one)
+static void GrayCodeRow(const unsigned char* const* code, int bits, const float* phase, const float* modulation, const float* background,
+	int width, float minQuality, float* unwrapped, float* quality)
+{
+	const float nan = numeric_limits<float>::quiet_NaN();
+	int x = 0;
+
+#ifdef UNWRAP_SSE2
+	const __m128 vTwoPi = _mm_set1_ps(twoPi), vInvTwoPi = _mm_set1_ps(1 / twoPi), vMin = _mm_set1_ps(minQuality);
+	const __m128i zero = _mm_setzero_si128(), oneI = _mm_set1_epi32(1);
+
+	for (; x + 4 <= width; x += 4)
+	{
+		__m128 A = _mm_loadu_ps(background + x);
+		__m128i gray = zero;
+		for (int j = 0; j <= bits; j++)
+		{
+			int packed;
+			memcpy(&packed, code[j] + x, sizeof(packed));
+			__m128i v = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero), zero);
+			__m128i bit = _mm_and_si128(_mm_castps_si128(_mm_cmpgt_ps(_mm_cvtepi32_ps(v), A)), oneI);
+			gray = _mm_or_si128(_mm_slli_epi32(gray, 1), bit);
+		}
+
+		// Both codes to binary, the complementary bit is the lowest one of the second
+		__m128i k1 = _mm_srli_epi32(gray, 1), k2 = gray;
+		for (int shift = 1; shift <= 16; shift <<= 1)
+		{
+			k1 = _mm_xor_si128(k1, _mm_srl_epi32(k1, _mm_cvtsi32_si128(shift)));
+			k2 = _mm_xor_si128(k2, _mm_srl_epi32(k2, _mm_cvtsi32_si128(shift)));
+		}
+		k2 = _mm_srli_epi32(_mm_add_epi32(k2, oneI), 1);
+
+		__m128 p = Positive(_mm_loadu_ps(phase + x));
+		__m128 f = _mm_mul_ps(p, vInvTwoPi);
+		__m128 low = _mm_cmplt_ps(f, _mm_set1_ps(0.25f)), high = _mm_cmpgt_ps(f, _mm_set1_ps(0.75f));
+		__m128i middle = _mm_castps_si128(_mm_or_ps(low, high));
+
+		// k2 near the phase wrap (minus one above it), k1 elsewhere
+		__m128i order = _mm_add_epi32(k2, _mm_castps_si128(high));
+		order = _mm_or_si128(_mm_and_si128(middle, order), _mm_andnot_si128(middle, k1));
+		__m128 a = _mm_add_ps(p, _mm_mul_ps(vTwoPi, _mm_cvtepi32_ps(order)));
+
+		__m128 near = _mm_cmplt_ps(_mm_and_ps(_mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF)), _mm_sub_ps(f, _mm_set1_ps(0.5f))), _mm_set1_ps(0.125f));
+		near = _mm_or_ps(near, _mm_or_ps(_mm_cmplt_ps(f, _mm_set1_ps(0.125f)), _mm_cmpgt_ps(f, _mm_set1_ps(0.875f))));
+		__m128i expected = _mm_sub_epi32(k1, _mm_castps_si128(_mm_cmpge_ps(f, _mm_set1_ps(0.5f))));
+		__m128 consistent = _mm_or_ps(near, _mm_castsi128_ps(_mm_cmpeq_epi32(k2, expected)));
+
+		__m128 q = _mm_and_ps(consistent, Contrast(_mm_loadu_ps(modulation + x), A));
+		_mm_storeu_ps(quality + x, q);
+		_mm_storeu_ps(unwrapped + x, Masked(a, q, vMin));
+	}
+#endif
+
+	for (; x < width; x++)
+	{
+		float A = background[x];
+		unsigned int gray = 0;
+		for (int j = 0; j < bits; j++)
+			gray = gray << 1 | (code[j][x] > A);
+
+		int k1 = static_cast<int>(GrayToBinary(gray));
+		int k2 = static_cast<int>((GrayToBinary(gray << 1 | (code[bits][x] > A)) + 1) >> 1);
+
+		float p = Positive(phase[x]);
+		float f = p / twoPi;
+
+		float a;
+		if (f < 0.25f)
+			a = p + twoPi * k2;
+		else if (f > 0.75f)
+			a = p + twoPi * (k2 - 1);
+		else
+			a = p + twoPi * k1;
+
+		bool consistent = fabs(f - 0.5f) < 0.125f || f < 0.125f || f > 0.875f || k2 == k1 + (f >= 0.5f);
+		float q = consistent ? Contrast(modulation[x], A) : 0;
+		quality[x] = q;
+		unwrapped[x] = q >= minQuality ? a : nan;
+	}
+}
+
+
+static int NumPhaseSets(const UnwrapSequence& s)
+{
+	return s.mode == UNWRAP_HETERODYNE ? static_cast<int>(s.periods.size()) : 1;
+}
+
+
+static int NumCodeFrames(const UnwrapSequence& s)
+{
+	return s.mode == UNWRAP_GRAY_CODE ? s.grayBits + 1 : 0;
+}
+
+
+
+int LoadUnwrapSequence(const string& file, UnwrapSequence& sequence)
+{
+	FileStorage fs(file, FileStorage::READ);
+	if (!fs.isOpened())
+		return -1;
+
+	UnwrapSequence s;
+	string mode;
+	int horizontal = 0;
+	fs["mode"] >> mode;
+	fs["images"] >> s.images;
+	fs["steps"] >> s.steps;
+	fs["periods"] >> s.periods;
+	fs["grayBits"] >> s.grayBits;
+	fs["range"] >> s.range;
+	fs["horizontal"] >> horizontal;
+	fs["minQuality"] >> s.minQuality;
+
+	if (mode == "none")
+		s.mode = UNWRAP_NONE;
+	else if (mode == "heterodyne")
+		s.mode = UNWRAP_HETERODYNE;
+	else if (mode == "graycode")
+		s.mode = UNWRAP_GRAY_CODE;
+	else
+	{
+		printf("Unknown unwrapping mode \"%s\"\n", mode.c_str());
+		return -1;
+	}
+	s.horizontal = horizontal != 0;
+
+	if (CheckUnwrapSequence(s) < 0)
+		return -1;
+
+	sequence = s;
+	return 0;
+}
+
+
+int SaveUnwrapSequence(const string& file, const UnwrapSequence& s)
+{
+	FileStorage fs(file, FileStorage::WRITE);
+	if (!fs.isOpened())
+		return -1;
+
+	const char* modes[] = { "none", "heterodyne", "graycode" };
+	fs << "mode" << modes[s.mode];
+	fs << "images" << s.images;
+	fs << "steps" << s.steps;
+	fs << "periods" << s.periods;
+	fs << "grayBits" << s.grayBits;
+	fs << "range" << s.range;
+	fs << "horizontal" << static_cast<int>(s.horizontal);
+	fs << "minQuality" << s.minQuality;
+	return 0;
+}
+
+
+int CheckUnwrapSequence(const UnwrapSequence& s)
+{
+	if (s.steps < 3 || s.range <= 0 || s.periods.empty())
+	{
+		printf("Unwrapping needs at least three steps, a range and a period\n");
+		return -1;
+	}
+	for (double p : s.periods)
+	{
+		if (!(p >= 2))
+		{
+			printf("Invalid fringe period %g\n", p);
+			return -1;
+		}
+	}
+
+	switch (s.mode)
+	{
+	case UNWRAP_NONE:
+		break;
+
+	case UNWRAP_HETERODYNE:
+	{
+		BeatCascade cascade;
+		if (s.periods.size() < 2 || s.periods.size() > UNWRAP_MAX_PERIODS)
+		{
+			printf("Heterodyne unwrapping needs 2 to %d periods\n", UNWRAP_MAX_PERIODS);
+			return -1;
+		}
+		if (BuildCascade(s, cascade) < 0)
+			return -1;
+		break;
+	}
+
+	case UNWRAP_GRAY_CODE:
+		if (s.periods.size() != 1 || s.grayBits < 1 || s.grayBits > 16 || (1 << s.grayBits) * s.periods[0] < s.range)
+		{
+			printf("Gray code unwrapping needs one period and 2^bits periods covering the range\n");
+			return -1;
+		}
+		break;
+
+	default:
+		return -1;
+	}
+
+	int frames = NumPhaseSets(s) * s.steps + NumCodeFrames(s);
+
+	vector<unsigned int> images;
+	if (ParseImageList(s.images, images) < 0 || images.size() != static_cast<size_t>(frames))
+	{
+		printf("The sequence needs %d flash images, \"%s\" given\n", frames, s.images.c_str());
+		return -1;
+	}
+
+	return frames;
+}
+
+
+static Mat PatternFromLine(const vector<unsigned char>& line, bool horizontal)
+{
+	Mat pattern(PTN_HEIGHT, PTN_WIDTH, CV_8UC1);
+	for (int y = 0; y < PTN_HEIGHT; y++)
+		for (int x = 0; x < PTN_WIDTH; x++)
+			pattern.at<unsigned char>(y, x) = line[horizontal ? y : x];
+	return pattern;
+}
+
+
+int UnwrapPatterns(const UnwrapSequence& s, vector<Mat>& patterns)
+{
+	if (CheckUnwrapSequence(s) < 0)
+		return -1;
+
+	// Intensity along the phase, the same for every projector line
+	vector<unsigned char> line(s.horizontal ? PTN_HEIGHT : PTN_WIDTH);
+	patterns.clear();
+
+	for (int set = 0; set < NumPhaseSets(s); set++)
+	{
+		for (int k = 0; k < s.steps; k++)
+		{
+			for (size_t x = 0; x < line.size(); x++)
+				line[x] = saturate_cast<unsigned char>(127.5 + 127.5 * cos(2 * CV_PI * (x / s.periods[set] + static_cast<double>(k) / s.steps)));
+			patterns.push_back(PatternFromLine(line, s.horizontal));
+		}
+	}
+
+	for (int j = 0; j < NumCodeFrames(s); j++)
+	{
+		// Gray code of the fringe order from its most significant bit, then the lowest bit of the half period code
+		for (size_t x = 0; x < line.size(); x++)
+		{
+			bool bit = j < s.grayBits ? (BinaryToGray(static_cast<unsigned int>(x / s.periods[0])) >> (s.grayBits - 1 - j)) & 1
+				: BinaryToGray(static_cast<unsigned int>(2 * x / s.periods[0])) & 1;
+			line[x] = bit ? 255 : 0;
+		}
+		patterns.push_back(PatternFromLine(line, s.horizontal));
+	}
+
+	return 0;
+}
+
+
+
+static int CheckMaps(const PhaseMaps& maps, Size size)
+{
+	return maps.phase.size() == size && maps.phase.type() == CV_32FC1 && maps.modulation.size() == size &&
+		maps.modulation.type() == CV_32FC1 && maps.background.size() == size && maps.background.type() == CV_32FC1 ? 0 : -1;
+}
+
+
+int UnwrapHeterodyne(const UnwrapSequence& s, const vector<PhaseMaps>& maps, UnwrappedPhase& out, unsigned int numThreads)
+{
+	BeatCascade c;
+	if (s.mode != UNWRAP_HETERODYNE || maps.size() != s.periods.size() || maps.size() > UNWRAP_MAX_PERIODS || BuildCascade(s, c) < 0)
+		return -1;
+
+	Size size = maps[0].phase.size();
+	for (const PhaseMaps& m : maps)
+		if (CheckMaps(m, size) < 0)
+			return -1;
+
+	out.phase.create(size, CV_32FC1);
+	out.quality.create(size, CV_32FC1);
+
+	int K = c.levels;
+	int blocks = (size.height + UNWRAP_ROWS_PER_BLOCK - 1) / UNWRAP_ROWS_PER_BLOCK;
+
+	ParallelFor(blocks, [&](int b)
+	{
+		const float* phase[UNWRAP_MAX_PERIODS];
+		const float* modulation[UNWRAP_MAX_PERIODS];
+		const float* background[UNWRAP_MAX_PERIODS];
+
+		for (int y = b * UNWRAP_ROWS_PER_BLOCK; y < min(size.height, (b + 1) * UNWRAP_ROWS_PER_BLOCK); y++)
+		{
+			for (int i = 0; i < K; i++)
+			{
+				phase[i] = maps[i].phase.ptr<float>(y);
+				modulation[i] = maps[i].modulation.ptr<float>(y);
+				background[i] = maps[i].background.ptr<float>(y);
+			}
+
+			switch (K)
+			{
+			case 2: HeterodyneRow<2>(c, phase, modulation, background, size.width, s.minQuality, out.phase.ptr<float>(y), out.quality.ptr<float>(y)); break;
+			case 3: HeterodyneRow<3>(c, phase, modulation, background, size.width, s.minQuality, out.phase.ptr<float>(y), out.quality.ptr<float>(y)); break;
+			default: HeterodyneRow<4>(c, phase, modulation, background, size.width, s.minQuality, out.phase.ptr<float>(y), out.quality.ptr<float>(y)); break;
+			}
+		}
+	}, numThreads);
+
+	return 0;
+}
+
+
+int UnwrapGrayCode(const UnwrapSequence& s, const PhaseMaps& maps, const vector<Mat>& codes, UnwrappedPhase& out, unsigned int numThreads)
+{
+	if (s.mode != UNWRAP_GRAY_CODE || s.grayBits < 1 || s.grayBits > 16 || codes.size() != static_cast<size_t>(s.grayBits + 1))
+		return -1;
+
+	Size size = maps.phase.size();
+	if (CheckMaps(maps, size) < 0)
+		return -1;
+	for (const Mat& code : codes)
+		if (code.size() != size || code.type() != CV_8UC1)
+			return -1;
+
+	out.phase.create(size, CV_32FC1);
+	out.quality.create(size, CV_32FC1);
+
+	int bits = s.grayBits;
+	int blocks = (size.height + UNWRAP_ROWS_PER_BLOCK - 1) / UNWRAP_ROWS_PER_BLOCK;
+
+	ParallelFor(blocks, [&](int b)
+	{
+		vector<const unsigned char*> code(codes.size());
+
+		for (int y = b * UNWRAP_ROWS_PER_BLOCK; y < min(size.height, (b + 1) * UNWRAP_ROWS_PER_BLOCK); y++)
+		{
+			for (size_t j = 0; j < codes.size(); j++)
+				code[j] = codes[j].ptr<unsigned char>(y);
+			GrayCodeRow(code.data(), bits, maps.phase.ptr<float>(y), maps.modulation.ptr<float>(y), maps.background.ptr<float>(y),
+				size.width, s.minQuality, out.phase.ptr<float>(y), out.quality.ptr<float>(y));
+		}
+	}, numThreads);
+
+	return 0;
+}
+
+
+
+int FringeDecoder::Reset(const UnwrapSequence& s, Size size)
+{
+	// New accumulators, so that copies keep the buffers of the previous sequence
+	phases.assign(1, PhaseAccumulator());
+	codes.clear();
+	sequence = s;
+
+	if (CheckUnwrapSequence(s) < 0)
+		return -1;
+
+	phases.assign(NumPhaseSets(s), PhaseAccumulator());
+	for (PhaseAccumulator& phase : phases)
+		if (phase.Reset(size, s.steps) < 0)
+			return -1;
+
+	return 0;
+}
+
+
+int FringeDecoder::Add(const Mat& frame, unsigned int numThreads)
+{
+	for (PhaseAccumulator& phase : phases)
+		if (!phase.Complete())
+			return phase.Add(frame, numThreads);
+
+	if (codes.size() >= static_cast<size_t>(NumCodeFrames(sequence)) || frame.type() != CV_8UC1 || frame.size() != phases[0].Maps().phase.size())
+		return -1;
+
+	codes.push_back(frame.clone());
+	return 0;
+}
+
+
+bool FringeDecoder::Complete() const
+{
+	for (const PhaseAccumulator& phase : phases)
+		if (!phase.Complete())
+			return false;
+
+	return codes.size() == static_cast<size_t>(NumCodeFrames(sequence));
+}
+
+
+int FringeDecoder::Unwrap(UnwrappedPhase& out, unsigned int numThreads) const
+{
+	if (!Complete())
+		return -1;
+
+	switch (sequence.mode)
+	{
+	case UNWRAP_HETERODYNE:
+	{
+		vector<PhaseMaps> maps;
+		for (const PhaseAccumulator& phase : phases)
+			maps.push_back(phase.Maps());
+		return UnwrapHeterodyne(sequence, maps, out, numThreads);
+	}
+
+	case UNWRAP_GRAY_CODE:
+		return UnwrapGrayCode(sequence, phases[0].Maps(), codes, out, numThreads);
+
+	default:
+		return -1;
+	}
+}
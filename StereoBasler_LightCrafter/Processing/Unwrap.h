@@ -0,0 +1,71 @@
+#ifndef UNWRAP_H
+#define UNWRAP_H
+
+#include "PhaseShift.h"
+
+#include "../LightCrafter/dlpc350_common.h"
+
+#include <opencv2/opencv.hpp>
+
+#include <string>
+#include <vector>
+
+#define UNWRAP_SEQUENCE_FILE "unwrap_sequence.yml"
+#define UNWRAP_MAX_PERIODS 4
+
+enum UnwrapMode
+{
+	UNWRAP_NONE, // Single phase shifted set, wrapped phase only
+	UNWRAP_HETERODYNE, // Phase shifted sets of several periods, unwrapped with their beat phases
+	UNWRAP_GRAY_CODE // One phase shifted set plus Gray code patterns and a complementary pattern
+};
+
+// Fringe sequence stored in flash. The frames are the phase shifted sets of every period in order, steps frames
+// each, followed in Gray code mode by the grayBits patterns (most significant first) and the complementary one.
+struct UnwrapSequence
+{
+	UnwrapMode mode = UNWRAP_NONE;
+	std::string images = "0-1-2"; // Flash image of every frame, as given to LightCrafterFlash()
+	int steps = 3; // Phase shifts per period
+	std::vector<double> periods = { 912 }; // Fringe periods in projector pixels, the first one is unwrapped
+	int grayBits = 0; // Gray code patterns without the complementary one
+	int range = PTN_WIDTH; // Projector pixels covered by the phase
+	bool horizontal = false; // Fringes along the DMD rows, the phase runs over the height
+	float minQuality = 0.1f; // Pixels of lower quality are masked
+};
+
+// Absolute phase of the first period, 2*pi per period from projector pixel 0 and NaN where masked, and its
+// quality in [0, 1]: fringe contrast scaled down by the unwrapping ambiguity. Both CV_32FC1.
+struct UnwrappedPhase
+{
+	cv::Mat phase;
+	cv::Mat quality;
+};
+
+int LoadUnwrapSequence(const std::string&, UnwrapSequence&);
+int SaveUnwrapSequence(const std::string&, const UnwrapSequence&);
+int CheckUnwrapSequence(const UnwrapSequence&); // Number of frames, or -1 if the sequence cannot be unwrapped
+int UnwrapPatterns(const UnwrapSequence&, std::vector<cv::Mat>&); // PTN_WIDTH x PTN_HEIGHT 8-bit patterns of every frame
+
+int UnwrapHeterodyne(const UnwrapSequence&, const std::vector<PhaseMaps>&, UnwrappedPhase&, unsigned int numThreads = 0);
+int UnwrapGrayCode(const UnwrapSequence&, const PhaseMaps&, const std::vector<cv::Mat>&, UnwrappedPhase&, unsigned int numThreads = 0);
+
+// Frames of one camera decoded as they arrive: phase shifted frames go into a PhaseAccumulator per period and code
+// frames are kept. Copies share the buffers, which Reset() replaces, so a copy can be unwrapped while the next
+// sequence is acquired.
+class FringeDecoder
+{
+public:
+	int Reset(const UnwrapSequence&, cv::Size);
+	int Add(const cv::Mat&, unsigned int numThreads = 0);
+	bool Complete() const;
+	const PhaseMaps& Maps() const { return phases[0].Maps(); } // Wrapped phase of the first period, once complete
+	int Unwrap(UnwrappedPhase&, unsigned int numThreads = 0) const;
+
+private:
+	UnwrapSequence sequence;
+	std::vector<PhaseAccumulator> phases = std::vector<PhaseAccumulator>(1);
+	std::vector<cv::Mat> codes;
+};
+
+#endif
@@ -6,8 +6,31 @@
 #include <string>
 #include <algorithm>
 #include <filesystem>
+#include <mutex>
+#include <fstream>
+#include <future>
+#include <chrono>
+#include <memory>
 
 #include "LightCrafter/LC_Flash.h"
+#include "LightCrafter/LC_Bank.h"
+#include "LightCrafter/LC_Projectors.h"
+#include "LightCrafter/LC_Timing.h"
+#include "LightCrafter/LC_PixelFormat.h"
+#include "Acquisition/DeviceSupervisor.h"
+#include "Acquisition/Telemetry.h"
+#include "Processing/PhaseShift.h"
+#include "Processing/Unwrap.h"
+#include "Processing/Capture.h"
+#include "Processing/Calibration.h"
+#include "Processing/ProjectorCalibration.h"
+#include "Tools/SplashTool.h"
+#include "Tools/TuneTool.h"
+#include "Tools/ConvertBenchTool.h"
+#include "Tools/FirmwareTool.h"
+#include "Tools/ProjectorCalibrationTool.h"
+#include "Tools/BatchTool.h"
+#include "Tools/I2CBenchTool.h"
 
 using namespace Pylon;
 using namespace cv;
@@ -15,8 +38,137 @@ using namespace std;
 using namespace std::filesystem;
 
 
+// Grabbed frame as an 8-bit image. Mono8 frames are wrapped without a copy, Mono10 frames go through the GREY10
+// converter into buf and other formats through the pylon converter into image.
+static Mat GrabbedImage(const CGrabResultPtr& result, CImageFormatConverter& converter, CPylonImage& image, vector<unsigned char>& buf)
+{
+	int width = static_cast<int>(result->GetWidth()), height = static_cast<int>(result->GetHeight());
+	unsigned char* data = static_cast<unsigned char*>(result->GetBuffer());
+
+	switch (result->GetPixelType())
+	{
+	case PixelType_Mono8:
+		return Mat(height, width, CV_8UC1, data, width + result->GetPaddingX());
+
+	case PixelType_Mono10:
+	{
+		buf.resize(static_cast<size_t>(width) * height);
+		Image_t frame = { data, static_cast<unsigned>(width), static_cast<unsigned>(height), 2 * width + result->GetPaddingX(), IMAGE_PIX_FORMAT_GREY10 };
+		unsigned char* planes[3] = { buf.data(), nullptr, nullptr };
+		if (ImageToPlanar(frame, planes, width) == 0)
+			return Mat(height, width, CV_8UC1, buf.data());
+		break;
+	}
+
+	default:
+		break;
+	}
+
+	converter.Convert(image, result);
+	return Mat(height, width, CV_8UC1, image.GetBuffer());
+}
+
+
+// Suffix of the maps decoded from one projector of a capture, with several projectors each one gets its own maps
+static string ProjectorSuffix(size_t projector, size_t numProjectors)
+{
+	return numProjectors > 1 ? "_projector" + to_string(projector) : "";
+}
+
+
 int main(int argc, char* argv[])
 {
+	// Command line tools
+	if (argc > 1 && string(argv[1]) == "splash")
+		return SplashTool(argc - 2, argv + 2);
+	if (argc > 1 && string(argv[1]) == "tune")
+		return TuneTool(argc - 2, argv + 2);
+	if (argc > 1 && string(argv[1]) == "convbench")
+		return ConvertBenchTool(argc - 2, argv + 2);
+	if (argc > 1 && string(argv[1]) == "firmware")
+		return FirmwareTool(argc - 2, argv + 2);
+	if (argc > 1 && string(argv[1]) == "projcalib")
+		return ProjectorCalibrationTool(argc - 2, argv + 2);
+	if (argc > 1 && string(argv[1]) == "batch")
+		return BatchTool(argc - 2, argv + 2);
+	if (argc > 1 && string(argv[1]) == "i2cbench")
+		return I2CBenchTool(argc - 2, argv + 2);
+
+	// Serial numbers of the connected projectors, for the -s option
+	if (argc > 1 && string(argv[1]) == "projectors")
+	{
+		vector<ProjectorInfo> found;
+		if (EnumerateProjectors(found) == 0)
+			cout << "No projector found" << endl;
+		for (const auto& p : found)
+			cout << p.serial << "\t" << p.path << endl;
+		return 0;
+	}
+
+	// Projectors of the acquisition, one -s <serial> for each. Without any the first projector found is used.
+	vector<string> projectorSerials;
+	for (int i = 1; i < argc; i++)
+	{
+		if (string(argv[i]) == "-s" && i + 1 < argc)
+			projectorSerials.push_back(argv[++i]);
+		else
+		{
+			cerr << "Usage: StereoBasler_LightCrafter [-s <projector serial>]...\n"
+				"       StereoBasler_LightCrafter splash|tune|convbench|firmware|projcalib|batch|i2cbench|projectors ..." << endl;
+			return -1;
+		}
+	}
+
+
+	// Projector and camera settings, from the tuner profile when there is one
+	TuneProfile profile;
+	if (LoadTuneProfile(TUNE_PROFILE_FILE, profile) == 0)
+		cout << "Using tuned profile " << TUNE_PROFILE_FILE << endl;
+
+	// Fringe sequence and its unwrapping, otherwise the tuned sequence with its wrapped phase
+	UnwrapSequence unwrap;
+	unwrap.images = profile.seq;
+	unwrap.steps = static_cast<int>(count(profile.seq.begin(), profile.seq.end(), '-') + 1);
+	if (LoadUnwrapSequence(UNWRAP_SEQUENCE_FILE, unwrap) == 0)
+		cout << "Using unwrapping sequence " << UNWRAP_SEQUENCE_FILE << endl;
+
+	// Rectification for the stereo correspondence of unwrapped captures
+	StereoCalibration calibration;
+	StereoRectification rectification;
+	bool cached = false;
+	bool rectified = LoadStereoCalibration(STEREO_CALIBRATION_FILE, calibration) == 0 && LoadRectification(calibration, rectification, &cached) == 0;
+	if (rectified)
+		cout << "Using stereo calibration " << STEREO_CALIBRATION_FILE << (cached ? ", rectification maps from cache" : "") << endl;
+
+	// Checkerboard of the calibration mode
+	CalibrationBoard board;
+	if (LoadCalibrationBoard(CALIBRATION_BOARD_FILE, board) == 0)
+		cout << "Using calibration board " << CALIBRATION_BOARD_FILE << endl;
+
+	// Vertical and horizontal fringes of the projector calibration views
+	ProjectorFringes projectorFringes;
+	bool projectorViews = LoadProjectorFringes(projectorFringes) == 0;
+	if (projectorViews)
+		cout << "Using projector calibration fringes " << PROJECTOR_VERTICAL_FILE << ", " << PROJECTOR_HORIZONTAL_FILE << endl;
+
+	// Several projectors take turns pattern by pattern, the cameras follow the trigger output of the first one
+	ProjectorArray projectors;
+	if (!projectorSerials.empty())
+	{
+		if (projectors.Open(projectorSerials) < 0)
+			return -1;
+
+		for (size_t i = 0; i < projectors.Size(); i++)
+			cout << "Using projector " << i << " " << projectors.Serial(i) << endl;
+	}
+	size_t numProjectors = max<size_t>(1, projectors.Size());
+	if (numProjectors > 1 && projectorViews)
+	{
+		projectorViews = false;
+		cout << "!Projector calibration views need a single projector" << endl;
+	}
+
+
 	// Root path to store images
 	path root = "F:\\StereoBasler_LightCrafter\\acquisition\\";
 
@@ -53,32 +205,38 @@ int main(int argc, char* argv[])
 		// Create an array of instant cameras for the found devices and avoid exceeding a maximum number of devices.
 		CBaslerUsbInstantCameraArray cameras(2); //Equivalent to: CInstantCameraArray cameras(2); but for usb cameras Basler_UsbCameraParams::
 
-		// Create and attach all Pylon Devices.
-		for (size_t i = 0; i < cameras.GetSize(); ++i)
+		// Camera settings, also applied to a camera reconnected by the supervisor
+		auto configure = [&profile](CBaslerUsbInstantCamera& camera)
 		{
-			cameras[i].Attach(tlFactory.CreateDevice(devices[i]));
+			camera.LineSelector.SetValue(Basler_UsbCameraParams::LineSelector_Line1);
+			camera.LineMode.SetValue(Basler_UsbCameraParams::LineMode_Input);
 
-			cameras[i].Open();
+			camera.AcquisitionMode.SetValue(Basler_UsbCameraParams::AcquisitionMode_Continuous); //AcquisitionMode_SingleFrame - AcquisitionMode_Continuous
+
+			//camera.TriggerSelector.SetValue(Basler_UsbCameraParams::TriggerSelector_FrameBurstStart);
+			//camera.TriggerMode.SetValue(Basler_UsbCameraParams::TriggerMode_Off);
+			//camera.TriggerSelector.SetValue(Basler_UsbCameraParams::TriggerSelector_FrameStart);
+			camera.TriggerMode.SetValue(Basler_UsbCameraParams::TriggerMode_Off);
 
-			cameras[i].LineSelector.SetValue(Basler_UsbCameraParams::LineSelector_Line1);
-			cameras[i].LineMode.SetValue(Basler_UsbCameraParams::LineMode_Input);
+			camera.AcquisitionFrameRateEnable.SetValue(false);
+			camera.TriggerSource.SetValue(Basler_UsbCameraParams::TriggerSource_Line1);
+			camera.TriggerActivation.SetValue(Basler_UsbCameraParams::TriggerActivation_RisingEdge);
 
-			cameras[i].AcquisitionMode.SetValue(Basler_UsbCameraParams::AcquisitionMode_Continuous); //AcquisitionMode_SingleFrame - AcquisitionMode_Continuous
+			camera.ExposureMode.SetValue(Basler_UsbCameraParams::ExposureMode_Timed);
+			camera.ExposureAuto.SetValue(Basler_UsbCameraParams::ExposureAuto_Off);
+			camera.ExposureTime.SetValue(profile.cameraExposure);
+			camera.TriggerDelay.SetValue(profile.triggerDelay);
+			camera.SensorReadoutMode.SetValue(Basler_UsbCameraParams::SensorReadoutMode_Fast);
+		};
 
-			//cameras[i].TriggerSelector.SetValue(Basler_UsbCameraParams::TriggerSelector_FrameBurstStart);
-			//cameras[i].TriggerMode.SetValue(Basler_UsbCameraParams::TriggerMode_Off);
-			//cameras[i].TriggerSelector.SetValue(Basler_UsbCameraParams::TriggerSelector_FrameStart);
-			cameras[i].TriggerMode.SetValue(Basler_UsbCameraParams::TriggerMode_Off);
+		// Create and attach all Pylon Devices.
+		for (size_t i = 0; i < cameras.GetSize(); ++i)
+		{
+			cameras[i].Attach(tlFactory.CreateDevice(devices[i]));
 
-			cameras[i].AcquisitionFrameRateEnable.SetValue(false);
-			cameras[i].TriggerSource.SetValue(Basler_UsbCameraParams::TriggerSource_Line1);
-			cameras[i].TriggerActivation.SetValue(Basler_UsbCameraParams::TriggerActivation_RisingEdge);
+			cameras[i].Open();
 
-			cameras[i].ExposureMode.SetValue(Basler_UsbCameraParams::ExposureMode_Timed);
-			cameras[i].ExposureAuto.SetValue(Basler_UsbCameraParams::ExposureAuto_Off);
-			cameras[i].ExposureTime.SetValue(2000);
-			cameras[i].TriggerDelay.SetValue(0);
-			cameras[i].SensorReadoutMode.SetValue(Basler_UsbCameraParams::SensorReadoutMode_Fast);
+			configure(cameras[i]);
 
 			//cameras[i].Close();
 
@@ -96,14 +254,23 @@ int main(int argc, char* argv[])
 		string strFileName; // Filename string of images to store
 		int cntImTrigg = -1; // Initialize counter of images acquired through trigger sent by the LightCrafter in each sequence of images
 		bool capture = 0; // Bool variable to handle the image capture process. True if capture, false if not
+		bool projectorCapture = false; // The capture is a projector calibration view, stored but not decoded
 		int cntCapt = -1; // Capture process counter
 
-		string seq{ "0-1-2" }; // Sequence of images to project
-		auto n = count(seq.begin(), seq.end(), '-') + 1; // Number of images to project
+		string seq{ unwrap.images }; // Sequence of images to project
+		int exposurePeriod = profile.projectorExposure, framePeriod = profile.projectorPeriod; // Projector exposure time and frame period in us
+		auto n = (count(seq.begin(), seq.end(), '-') + 1) * static_cast<int>(numProjectors); // Number of images to project, by all projectors
 		n += 3; // Three images without fringes are acquired with the trigger signal
 
 		CPylonImage imgLeft, imgRight; // pylon images
+		vector<unsigned char> bufLeft, bufRight; // 8-bit images converted from Mono10
 		Mat imL, imR, imLrs, imRrs, cat; // OpenCV matrices
+		vector<FringeDecoder> fringesL(numProjectors), fringesR(numProjectors); // Fringe images of each projector in the capture in progress, decoded as they arrive
+		bool decodeFringes = CheckUnwrapSequence(unwrap) > 0; // Otherwise the images are only stored
+		future<long long> decoding; // Last capture being unwrapped, matched and stored
+		unique_ptr<CalibrationCollector> collector; // Checkerboard views of the calibration, kept until it is solved
+		bool calibrating = false; // Calibration mode, the projector shows a white field that triggers the cameras
+		future<int> solving; // Stereo calibration being solved
 		CImageFormatConverter formatConverter;
 
 
@@ -117,6 +284,66 @@ int main(int argc, char* argv[])
 		}
 
 
+		// Predict the capture rate from the projector sequence and the camera timing
+		vector<unsigned int> images;
+		SequenceProgram program;
+		if (ParseImageList(seq, images) == 0 && CompileSequence(SequenceFromImages(images, exposurePeriod, framePeriod, false), program) == 0)
+		{
+			CameraTiming camTiming;
+			camTiming.exposure = static_cast<unsigned int>(cameras[iL].ExposureTime.GetValue());
+			camTiming.readout = static_cast<unsigned int>(cameras[iL].SensorReadoutTime.GetValue());
+			camTiming.triggerDelay = static_cast<unsigned int>(cameras[iL].TriggerDelay.GetValue());
+
+			SequenceTimingReport timing;
+			CheckSequenceTiming(program, timing, &camTiming);
+			PrintSequenceTimingReport(timing);
+			cout << endl;
+		}
+
+		// With several projectors every one gets the fringes, interleaved with the others
+		vector<SequenceProgram> interleaved;
+		if (numProjectors > 1 && !program.patLut.empty())
+		{
+			vector<SequenceDescription> fringes(numProjectors, SequenceFromImages(images, exposurePeriod, framePeriod, false)), turns;
+			bool valid = InterleaveSequences(fringes, turns) == 0;
+
+			interleaved.resize(numProjectors);
+			for (size_t i = 0; valid && i < numProjectors; i++)
+				valid = CompileSequence(turns[i], interleaved[i]) == 0;
+
+			if (!valid)
+			{
+				interleaved.clear();
+				cout << "!Invalid interleaved fringe sequence " << seq << endl;
+			}
+		}
+
+
+		// White field repeated at the projector period, each frame triggers both cameras
+		SequenceDescription whiteDesc;
+		SequencePattern fill;
+		fill.patNum = SEQ_FILL_PATTERN;
+		fill.bitDepth = 1;
+		whiteDesc.patterns.push_back(fill);
+		whiteDesc.exposure = exposurePeriod;
+		whiteDesc.period = framePeriod;
+		whiteDesc.repeat = true;
+		const SequenceProgram* whiteField = CompileSequenceCached(whiteDesc);
+
+		// The fringes, the projector calibration fringes and the white field share the device LUT, switching between
+		// them only writes the entries that differ
+		SequenceBank bank;
+		int fringeSequence = program.patLut.empty() ? -1 : bank.Add(program);
+		int whiteSequence = whiteField ? bank.Add(*whiteField) : -1;
+		int projectorSequence = -1;
+		SequenceProgram projectorProgram;
+		if (projectorViews && ParseImageList(ProjectorFringeImages(projectorFringes), images) == 0 &&
+			CompileSequence(SequenceFromImages(images, exposurePeriod, framePeriod, false), projectorProgram) == 0)
+			projectorSequence = bank.Add(projectorProgram);
+		if (fringeSequence < 0)
+			cout << "!Invalid fringe sequence " << seq << endl;
+
+
 		// Set up format convert to store pylon image as grayscale
 		formatConverter.OutputPixelFormat = PixelType_Mono8;
 		// Set up window to show acquisition
@@ -124,24 +351,148 @@ int main(int argc, char* argv[])
 		// Start grabbing cameras
 		cameras.StartGrabbing(Pylon::GrabStrategy_LatestImageOnly, Pylon::GrabLoop_ProvidedByUser);
 
+		// Reconnect cameras and projector in the background when they are unplugged
+		DeviceSupervisor supervisor(cameras, configure);
+		unsigned int losses = supervisor.Losses();
+		supervisor.Start();
+
+		// Sample projector and camera health, each stored image pair gets the record nearest to its grab
+		TelemetrySampler telemetry(cameras, &supervisor, 2); // Samples per second
+		bool newTelemetryFile = !exists(root / "telemetry.csv");
+		ofstream telemetryFile((root / "telemetry.csv").string(), ios::app);
+		if (newTelemetryFile)
+		{
+			telemetryFile << "capture,image,";
+			TelemetrySampler::WriteHeader(telemetryFile);
+			telemetryFile << endl;
+		}
+		telemetry.Start();
+		double grabTime = 0;
+
+		// Stop the capture in progress, the next one reuses its index
+		auto abortCapture = [&](const char* reason)
+		{
+			capture = 0;
+			cntImagesNum = -1;
+			cntImTrigg = -1;
+			telemetry.SetQuiet(false);
+
+			if (supervisor.CamerasReady())
+			{
+				lock_guard<mutex> lock(supervisor.CameraMutex());
+				cameras[0].TriggerMode.SetValue(Basler_UsbCameraParams::TriggerMode_Off);
+				cameras[1].TriggerMode.SetValue(Basler_UsbCameraParams::TriggerMode_Off);
+			}
+
+			cout << "!Capture " << cntCapt-- << " " << reason << endl;
+		};
+
+		// Leave the calibration mode, solving the collected views in the background if asked and there are enough
+		auto stopCalibration = [&](bool solve)
+		{
+			calibrating = false;
+			telemetry.SetQuiet(false);
+			if (numProjectors > 1)
+				projectors.Stop();
+			else
+				LightCrafterStop();
+
+			if (supervisor.CamerasReady())
+			{
+				lock_guard<mutex> lock(supervisor.CameraMutex());
+				cameras[0].TriggerMode.SetValue(Basler_UsbCameraParams::TriggerMode_Off);
+				cameras[1].TriggerMode.SetValue(Basler_UsbCameraParams::TriggerMode_Off);
+			}
+
+			collector->Poll();
+			if (!solve || collector->Views().size() < CALIBRATION_MIN_VIEWS)
+			{
+				cout << "+Calibration paused with " << collector->Views().size() << " views, 'k' to continue" << endl;
+				return;
+			}
 
-		while (cameras.IsGrabbing())
+			solving = async(launch::async, [board](vector<CalibrationView> views, Size size)
+			{
+				StereoCalibration result;
+				CalibrationReport report;
+				auto t0 = chrono::steady_clock::now();
+				if (CalibrateStereo(board, views, size, result, &report) < 0 || SaveStereoCalibration(STEREO_CALIBRATION_FILE, result) < 0)
+					return -1;
+
+				cout << "+Calibration " << STEREO_CALIBRATION_FILE << " from " << report.views << " views in "
+					<< chrono::duration<double>(chrono::steady_clock::now() - t0).count() << " s, rms " << report.rmsLeft
+					<< " / " << report.rmsRight << " px, stereo " << report.rmsStereo << " px" << endl;
+				return 0;
+			}, collector->Views(), collector->ImageSize());
+			collector.reset();
+		};
+
+
+		while (true)
 		{
-			// Basler frame capture
-			cameras[iL].RetrieveResult(INFINITE, ptrGrabResultL, TimeoutHandling_ThrowException);
-			cameras[iR].RetrieveResult(INFINITE, ptrGrabResultR, TimeoutHandling_ThrowException);
+			// A device was lost: the capture in progress is incomplete, the next one reuses its index
+			if (supervisor.Losses() != losses)
+			{
+				losses = supervisor.Losses();
+
+				if (capture)
+					abortCapture("aborted, a device was lost");
+
+				if (calibrating)
+					stopCalibration(false);
+			}
+
+			// A new calibration is used from the next capture on
+			if (solving.valid() && solving.wait_for(chrono::seconds(0)) == future_status::ready)
+			{
+				if (solving.get() == 0)
+				{
+					if (decoding.valid())
+						decoding.wait();
+					rectified = LoadStereoCalibration(STEREO_CALIBRATION_FILE, calibration) == 0 && LoadRectification(calibration, rectification) == 0;
+				}
+				else
+					cout << "!Calibration failed" << endl;
+			}
+
+			// Basler frame capture, the timeout keeps the window responsive while a device is away. Both cameras are
+			// always retrieved, so a timeout on one side drops the pair instead of pairing frames of different triggers.
+			bool grabbed = false, dropped = false;
+			if (supervisor.CamerasReady())
+			{
+				try
+				{
+					lock_guard<mutex> lock(supervisor.CameraMutex());
+					bool left = cameras[iL].RetrieveResult(1000, ptrGrabResultL, TimeoutHandling_Return);
+					bool right = cameras[iR].RetrieveResult(1000, ptrGrabResultR, TimeoutHandling_Return);
+					grabbed = left && right;
+					dropped = left != right;
+					grabTime = TelemetryClock();
+				}
+				catch (const GenericException &)
+				{
+					grabbed = false; // Camera removed while grabbing, the supervisor takes over
+				}
+			}
+
+			// A capture missing a frame of one camera can't be completed
+			if (dropped && capture)
+				abortCapture("aborted, a camera missed a frame");
+
+			if (!grabbed)
+			{
+				if (waitKey(supervisor.CamerasReady() ? 1 : 100) == 27)
+					break;
+				continue;
+			}
 
 
 			// If the image was grabbed successfully.
 			if (ptrGrabResultL->GrabSucceeded() && ptrGrabResultR->GrabSucceeded())
 			{
-				// Convet left image to pylon image and then to Mat
-				formatConverter.Convert(imgLeft, ptrGrabResultL);
-				imL = Mat(ptrGrabResultL->GetHeight(), ptrGrabResultL->GetWidth(), CV_8UC1, (uint8_t *)imgLeft.GetBuffer());
-
-				// Convet right image to pylon image and then to Mat
-				formatConverter.Convert(imgRight, ptrGrabResultR);
-				imR = Mat(ptrGrabResultR->GetHeight(), ptrGrabResultR->GetWidth(), CV_8UC1, (uint8_t *)imgRight.GetBuffer());
+				// Left and right grabbed images as 8-bit Mat
+				imL = GrabbedImage(ptrGrabResultL, formatConverter, imgLeft, bufLeft);
+				imR = GrabbedImage(ptrGrabResultR, formatConverter, imgRight, bufRight);
 
 
 				if (capture)
@@ -157,19 +508,86 @@ int main(int argc, char* argv[])
 
 						strFileName = root.string() + "R\\right" + to_string(cntCapt) + "_" + to_string(cntImagesNum) + ".bmp";
 						imwrite(strFileName, imR);
+
+						// The projectors take turns, frame by frame
+						size_t projector = static_cast<size_t>(cntImagesNum) % numProjectors;
+
+						auto t0 = chrono::steady_clock::now();
+						fringesL[projector].Add(imL);
+						fringesR[projector].Add(imR);
+						if (fringesL[projector].Complete() && fringesR[projector].Complete())
+							cout << "+Phase ready " << chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count()
+								<< " ms after the last fringe image" << endl;
+
+						TelemetrySample sample;
+						if (telemetry.Ring().Nearest(grabTime, sample))
+						{
+							telemetryFile << cntCapt << ',' << cntImagesNum << ',';
+							TelemetrySampler::Write(telemetryFile, sample);
+							telemetryFile << endl;
+						}
 					}
 					else if (cntImTrigg == n-1)
 					{
 						capture = 0; // Not capture
 						cntImagesNum = -1; // Restart counter
 						cntImTrigg = -1; // Restart counter
+						telemetry.SetQuiet(false);
 
-						cameras[0].TriggerMode.SetValue(Basler_UsbCameraParams::TriggerMode_Off);
-						cameras[1].TriggerMode.SetValue(Basler_UsbCameraParams::TriggerMode_Off);
+						{
+							lock_guard<mutex> lock(supervisor.CameraMutex());
+							cameras[0].TriggerMode.SetValue(Basler_UsbCameraParams::TriggerMode_Off);
+							cameras[1].TriggerMode.SetValue(Basler_UsbCameraParams::TriggerMode_Off);
+						}
 
 						cout << "+Capture " << cntCapt << " complete" << endl;
+
+						// Listed for the projector calibration tool
+						if (projectorCapture)
+							ofstream((root / PROJECTOR_VIEWS_FILE).string(), ios::app) << cntCapt << endl;
+
+						// The maps are unwrapped and stored in the background while the live view goes on
+						auto complete = [](const FringeDecoder& d) { return d.Complete(); };
+						if (all_of(fringesL.begin(), fringesL.end(), complete) && all_of(fringesR.begin(), fringesR.end(), complete))
+						{
+							if (decoding.valid())
+								decoding.wait();
+							decoding = async(launch::async, [fringesL, fringesR](string left, string right, const StereoRectification* rect)
+							{
+								long long points = 0;
+								for (size_t p = 0; p < fringesL.size(); p++)
+								{
+									string suffix = ProjectorSuffix(p, fringesL.size());
+									long long result = ProcessCapture(fringesL[p], fringesR[p], left + suffix, right + suffix, rect, 0, true);
+									points = points < 0 || result < 0 ? -1 : points + result;
+								}
+								return points;
+							}, root.string() + "L\\left" + to_string(cntCapt), root.string() + "R\\right" + to_string(cntCapt),
+								rectified ? &rectification : nullptr);
+						}
+					}
+
+				}
+
+				// Calibration views are searched while the frames keep coming, busy workers skip the pair
+				if (calibrating)
+				{
+					collector->Submit(imL, imR);
+
+					vector<CalibrationVerdict> verdicts;
+					collector->Poll(&verdicts);
+					for (CalibrationVerdict verdict : verdicts)
+					{
+						if (verdict == CALIB_VIEW_ACCEPTED)
+							cout << "+View " << collector->Views().size() << "/" << board.views << " accepted" << endl;
+						else if (verdict == CALIB_VIEW_BLURRY)
+							cout << "-View rejected, blurry" << endl;
+						else if (verdict == CALIB_VIEW_DUPLICATE)
+							cout << "-View rejected, same pose as an accepted one" << endl;
 					}
 
+					if (collector->Enough())
+						stopCalibration(true);
 				}
 
 
@@ -186,18 +604,69 @@ int main(int argc, char* argv[])
 
 				if (c == 27)
 					break;
-				else if ((c == 'c') & !capture)
+				else if (((c == 'c') | ((c == 'p') & projectorViews)) & !capture & !calibrating)
 				{
 					cntCapt++; // New capture
 					capture = 1; // Enable capture
+					telemetry.SetQuiet(true); // No projector reads while the sequence is armed and acquired
+
+					// 'p' captures the board under vertical and horizontal fringes for the projector calibration
+					projectorCapture = c == 'p';
+					seq = projectorCapture ? ProjectorFringeImages(projectorFringes) : unwrap.images;
+					n = (count(seq.begin(), seq.end(), '-') + 1) * static_cast<int>(numProjectors) + 3;
 
-					cameras[0].TriggerMode.SetValue(Basler_UsbCameraParams::TriggerMode_On);
-					cameras[1].TriggerMode.SetValue(Basler_UsbCameraParams::TriggerMode_On);
+					for (size_t p = 0; p < numProjectors; p++)
+					{
+						if (projectorCapture)
+						{
+							fringesL[p] = FringeDecoder();
+							fringesR[p] = FringeDecoder();
+						}
+						else if (decodeFringes)
+						{
+							fringesL[p].Reset(unwrap, imL.size());
+							fringesR[p].Reset(unwrap, imR.size());
+						}
+					}
 
-					if (LightCrafterFlash(150000, 150000, 0, seq) < 0) // LightCrafterFlash(120000, 120000, 0, "0-1-2") LightCrafterFlash(400000, 400000, 0, "0-1-2")
-						return -1;
+					{
+						lock_guard<mutex> lock(supervisor.CameraMutex());
+						cameras[0].TriggerMode.SetValue(Basler_UsbCameraParams::TriggerMode_On);
+						cameras[1].TriggerMode.SetValue(Basler_UsbCameraParams::TriggerMode_On);
+					}
+
+					// The cameras are free while the projector is programmed, several projectors are loaded in parallel
+					int armed = numProjectors == 1 ? bank.Select(projectorCapture ? projectorSequence : fringeSequence) :
+						interleaved.empty() ? -1 : projectors.Arm(interleaved);
+					if (armed < 0)
+						abortCapture("cancelled, projector not available"); // Keep the live view
+				}
+				else if ((c == 'k') & calibrating)
+				{
+					stopCalibration(true);
 				}
-				else if ((c == 'd') & (cntCapt > -1) & !capture)
+				else if ((c == 'k') & !capture & !solving.valid())
+				{
+					if (!collector)
+						collector = make_unique<CalibrationCollector>(board);
+
+					int armed = numProjectors == 1 ? bank.Select(whiteSequence) : whiteField ? projectors.ArmAll(*whiteField) : -1;
+					if (armed < 0)
+					{
+						cout << "!Calibration not started, projector not available" << endl;
+					}
+					else
+					{
+						calibrating = true;
+						telemetry.SetQuiet(true);
+
+						lock_guard<mutex> lock(supervisor.CameraMutex());
+						cameras[0].TriggerMode.SetValue(Basler_UsbCameraParams::TriggerMode_On);
+						cameras[1].TriggerMode.SetValue(Basler_UsbCameraParams::TriggerMode_On);
+						cout << "+Calibration mode, " << collector->Views().size() << "/" << board.views << " views, 'k' to solve" << endl;
+					}
+				}
+				else if ((c == 'd') & (cntCapt > -1) & !capture & !calibrating)
 				{
 					for (int i = 0; i < n - 3; i++)
 					{
@@ -209,6 +678,17 @@ int main(int argc, char* argv[])
 						strFileName = root.string() + "R\\left" + to_string(cntCapt) + "_" + to_string(cntImagesNum) + ".bmp";
 						remove((path)strFileName);
 					}
+
+					// Decoded phase maps of the capture
+					if (decoding.valid())
+						decoding.wait();
+					for (size_t p = 0; p < numProjectors; p++)
+						for (const char* map : { "_phase.tiff", "_modulation.tiff", "_background.tiff", "_unwrapped.tiff", "_quality.tiff", "_disparity.tiff", ".ply" })
+						{
+							string name = to_string(cntCapt) + ProjectorSuffix(p, numProjectors) + map;
+							remove(root / ("L\\left" + name));
+							remove(root / ("R\\right" + name));
+						}
 					cout << "-Capture " << cntCapt-- << " has been deleted" << endl;
 
 					cntImagesNum = -1; // Restart counter
@@ -216,6 +696,19 @@ int main(int argc, char* argv[])
 			}
 		}
 
+		if (decoding.valid())
+			decoding.wait();
+		if (calibrating)
+			stopCalibration(false);
+		collector.reset();
+		if (solving.valid())
+			solving.wait();
+
+		telemetry.Stop();
+		supervisor.Stop();
+		supervisor.PrintRecoveries();
+		bank.PrintSwitchLatency();
+
 		//cameras[0].Close();
 		//cameras[1].Close();
 		cameras.Close();
@@ -0,0 +1,192 @@
+// HidrawCheck.cpp : The Linux USB path of the DLPC350 API against simulated projectors on socketpairs.
+//
+// The host end of a SOCK_SEQPACKET socketpair is opened with DLPC350_USB_OpenDescriptor(), so every command goes
+// through the HidrawEventLoop of dlpc350_usb.cpp, as with a /dev/hidraw node; two threads serve the device end with
+// a SimulatedDLPC350. Single and batched I2C0 transactions, messages and replies longer than a report, a NACK, two
+// projectors driven at once from two threads and an unplugged projector are checked. The exit code is the number of
+// failed checks.
+
+
+#include "../LightCrafter/dlpc350_common.h"
+#include "../LightCrafter/dlpc350_usb.h"
+#include "../LightCrafter/dlpc350_api.h"
+#include "../LightCrafter/LC_Simulator.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <cstdio>
+#include <csignal>
+
+#include <unistd.h>
+#include <sys/socket.h>
+
+using namespace std;
+
+
+#define CHECK_CLK 400000
+
+
+
+// A simulated projector on the device end of a socketpair
+class SocketProjector
+{
+public:
+	SocketProjector(unsigned int i2cAddress) : simulated(i2cAddress, Timing())
+	{
+		int fds[2] = { -1, -1 };
+		if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) < 0)
+			perror("socketpair");
+
+		hostFd = fds[0];
+		deviceFd = fds[1];
+		receiver = thread(&SocketProjector::Receive, this);
+		sender = thread(&SocketProjector::Send, this);
+	}
+
+	~SocketProjector()
+	{
+		Unplug();
+		receiver.join();
+		sender.join();
+		close(deviceFd);
+	}
+
+	int HostFd() const { return hostFd; }
+
+	void Unplug()
+	{
+		unplugged = true;
+		shutdown(deviceFd, SHUT_RDWR);
+	}
+
+private:
+	static SimulatorTiming Timing()
+	{
+		// High-speed microframes keep the check short
+		SimulatorTiming timing;
+		timing.frameUs = 125;
+		timing.commandUs = 50;
+		return timing;
+	}
+
+	void Receive()
+	{
+		// Reports as written by hid_write(): report number and 64 bytes
+		unsigned char report[SIMULATOR_REPORT_SIZE + 1];
+		ssize_t n;
+		while ((n = read(deviceFd, report, sizeof(report))) > 0)
+			simulated.Write(report, static_cast<size_t>(n));
+	}
+
+	void Send()
+	{
+		// Reports as read from hidraw: 64 bytes without report number
+		unsigned char report[SIMULATOR_REPORT_SIZE];
+		while (!unplugged)
+			if (simulated.Read(report, sizeof(report), 20) > 0 && write(deviceFd, report, sizeof(report)) < 0)
+				return;
+	}
+
+	SimulatedDLPC350 simulated;
+	int hostFd, deviceFd;
+	atomic<bool> unplugged{ false };
+	thread receiver, sender;
+};
+
+
+
+static int failures = 0;
+
+static void Check(const string& name, bool ok)
+{
+	cout << (ok ? "ok      " : "FAILED  ") << name << endl;
+	if (!ok)
+		failures++;
+}
+
+
+
+static bool WriteRead(unsigned int devAddr, unsigned char reg, unsigned int length, unsigned char seed)
+{
+	// Register address then data, read back from the same register
+	vector<unsigned char> w(length + 1), r(length);
+	w[0] = reg;
+	for (unsigned int i = 0; i < length; i++)
+		w[i + 1] = static_cast<unsigned char>(seed + i);
+
+	unsigned char stat = 0xFF;
+	return DLPC350_I2C0WriteData(true, CHECK_CLK, devAddr, length + 1, w.data()) >= 0 && DLPC350_I2C0TranStat(&stat) >= 0 &&
+		stat == 0 && DLPC350_I2C0ReadData(true, CHECK_CLK, devAddr, 1, length, &reg, r.data()) >= 0 &&
+		equal(r.begin(), r.end(), w.begin() + 1);
+}
+
+
+
+int main()
+{
+	// Writes to an unplugged socket fail instead of raising SIGPIPE
+	signal(SIGPIPE, SIG_IGN);
+	DLPC350_USB_Init();
+
+	SocketProjector first(0x50), second(0x60);
+
+	DLPC350_USB_Select(0);
+	Check("open socket", DLPC350_USB_OpenDescriptor(first.HostFd()) == 0 && DLPC350_USB_IsConnected());
+	Check("single report write and read", WriteRead(0x50, 0x10, 2, 0x5A));
+	Check("write and read over several reports", WriteRead(0x50, 0x20, 100, 0x01));
+
+	// Writes and block reads, pipelined
+	vector<unsigned char> data(4 * 8), expected(data.size());
+	unsigned char writes[4][9];
+	unsigned char readAddr[4];
+	unsigned char stat = 0xFF;
+	DLPC350_I2C0BatchBegin(true, CHECK_CLK);
+	for (unsigned int i = 0; i < 4; i++)
+	{
+		readAddr[i] = writes[i][0] = static_cast<unsigned char>(0x80 + 8 * i);
+		for (unsigned int j = 0; j < 8; j++)
+			expected[8 * i + j] = writes[i][j + 1] = static_cast<unsigned char>(i * 16 + j);
+
+		DLPC350_I2C0BatchWrite(0x50, 9, writes[i]);
+		DLPC350_I2C0BatchRead(0x50, 1, 8, &readAddr[i], &data[8 * i]);
+	}
+	Check("batch, 4 reads in flight", DLPC350_I2C0BatchExecute(4, 0, &stat) == 8 && stat == 0 && data == expected);
+
+	// A missing slave is NACKed, the projector stays connected
+	unsigned char reg = 0;
+	bool nacked = DLPC350_I2C0ReadData(true, CHECK_CLK, 0x51, 1, 4, &reg, data.data()) < 0;
+	Check("NACK of a missing slave", nacked && DLPC350_I2C0TranStat(&stat) >= 0 && stat == 0x01 && DLPC350_USB_IsConnected());
+
+	// Two projectors from two threads, each on its own slot
+	DLPC350_USB_Select(1);
+	Check("open second socket", DLPC350_USB_OpenDescriptor(second.HostFd()) == 0);
+
+	atomic<int> bad{ 0 };
+	auto drive = [&](int slot, unsigned int devAddr)
+	{
+		DLPC350_USB_Select(slot);
+		for (unsigned int i = 0; i < 20; i++)
+			if (!WriteRead(devAddr, static_cast<unsigned char>(i * 4), 3, static_cast<unsigned char>(slot * 100 + i)))
+				bad++;
+	};
+	thread t0(drive, 0, 0x50), t1(drive, 1, 0x60);
+	t0.join();
+	t1.join();
+	Check("two projectors at once", bad == 0);
+
+	// An unplugged projector fails the next command and is disconnected
+	DLPC350_USB_Select(0);
+	first.Unplug();
+	Check("unplugged projector", DLPC350_I2C0TranStat(&stat) < 0 && !DLPC350_USB_IsConnected());
+
+	DLPC350_USB_Select(1);
+	Check("other projector still there", WriteRead(0x60, 0x40, 4, 0x33));
+	DLPC350_USB_Close();
+
+	cout << failures << " failed" << endl;
+	return failures;
+}
@@ -0,0 +1,350 @@
+// BatchTool.cpp : Reprocesses stored captures with the current decoding, matching and triangulation.
+//
+// Usage: StereoBasler_LightCrafter batch [-r <acquisition folder>] [-u <unwrap sequence.yml>] [-j <workers>] [-p <prefetch>]
+//                                        [-c <cache folder>] [-m <cache MB>] [-f] [-v]
+//
+// Captures are found by the names the acquisition program gives them, L\left<capture>_<image>.bmp with its
+// R\right<capture>_<image>.bmp pair, and only those with exactly the frames of the unwrapping sequence
+// (unwrap_sequence.yml, or the sequence of the tuned profile by default) are processed. The maps and point clouds
+// are written next to the images, as the acquisition program does.
+// Captures go to the workers in contiguous ranges with work stealing, every worker decoding one capture at a time on
+// its own thread. While a capture is decoded the images of the next ones in its range are already being read by
+// asynchronous loads (-p, 2 by default), so the disks and the processors stay busy together.
+// Processed captures are appended to batch_done.txt in the acquisition folder and skipped by the next run, which
+// resumes an interrupted batch. With -f the list is cleared and everything is processed again.
+// The phase of every camera and the rectified phase of every pair are kept in a decode cache (-c, decode_cache in the
+// acquisition folder by default) of at most -m MB (8192 by default, 0 disables it), keyed by the content of the
+// frames and the parameters of the stage. Reprocessing with -f only runs the stages whose input or parameters
+// changed. The maps of a cached stage are only written again when their files are missing, and the frames are still
+// read, as their content is the key.
+
+
+#include "BatchTool.h"
+#include "TuneTool.h"
+
+#include "../Processing/Capture.h"
+#include "../Processing/DecodeCache.h"
+#include "../Processing/Parallel.h"
+
+#include <opencv2/opencv.hpp>
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <mutex>
+#include <future>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <filesystem>
+
+using namespace cv;
+using namespace std;
+using namespace std::filesystem;
+
+
+#define BATCH_DONE_FILE "batch_done.txt"
+#define BATCH_PREFETCH 2 // Captures read ahead of the one being decoded by each worker
+#define BATCH_CACHE_FOLDER "decode_cache"
+
+
+// Images of one capture
+struct BatchCapture
+{
+	int index = 0;
+	vector<Mat> left, right;
+	size_t bytes = 0; // Read from disk
+};
+
+
+
+// Capture index and image number of "<name><capture>_<image>.bmp"
+static bool ParseImageName(const string& file, const string& name, int& capture, int& image)
+{
+	if (file.compare(0, name.size(), name) != 0 || file.size() <= name.size() + 4 || file.compare(file.size() - 4, 4, ".bmp") != 0)
+		return false;
+
+	string numbers = file.substr(name.size(), file.size() - name.size() - 4);
+	size_t sep = numbers.find('_');
+	if (sep == 0 || sep == string::npos || sep + 1 == numbers.size() ||
+		numbers.find_first_not_of("0123456789_") != string::npos || numbers.find('_', sep + 1) != string::npos)
+		return false;
+
+	capture = stoi(numbers.substr(0, sep));
+	image = stoi(numbers.substr(sep + 1));
+	return true;
+}
+
+
+// Captures with images 0 to frames - 1 in both cameras, in increasing order
+static vector<int> DiscoverCaptures(const path& root, int frames)
+{
+	map<int, set<int>> left, right;
+	int capture, image;
+	error_code ec;
+
+	for (const auto& entry : directory_iterator(root / "L", ec))
+		if (ParseImageName(entry.path().filename().string(), "left", capture, image))
+			left[capture].insert(image);
+
+	for (const auto& entry : directory_iterator(root / "R", ec))
+		if (ParseImageName(entry.path().filename().string(), "right", capture, image))
+			right[capture].insert(image);
+
+	vector<int> captures;
+	for (const auto& l : left)
+	{
+		auto r = right.find(l.first);
+		bool complete = static_cast<int>(l.second.size()) == frames && *l.second.rbegin() == frames - 1;
+		if (complete && r != right.end() && r->second == l.second)
+			captures.push_back(l.first);
+	}
+
+	return captures;
+}
+
+
+static BatchCapture LoadCapture(const string& root, int index, int frames)
+{
+	BatchCapture c;
+	c.index = index;
+
+	for (int i = 0; i < frames; i++)
+	{
+		Mat l = imread(root + "L\\left" + to_string(index) + "_" + to_string(i) + ".bmp", IMREAD_GRAYSCALE);
+		Mat r = imread(root + "R\\right" + to_string(index) + "_" + to_string(i) + ".bmp", IMREAD_GRAYSCALE);
+		if (l.empty() || r.empty())
+		{
+			c.left.clear();
+			c.right.clear();
+			return c;
+		}
+
+		c.bytes += l.total() + r.total();
+		c.left.push_back(l);
+		c.right.push_back(r);
+	}
+
+	return c;
+}
+
+
+// Writes the maps of a cached stage whose files were removed, with the names DecodeCapture() gives them
+static void WriteMissing(const string& prefix, const vector<pair<const char*, Mat>>& outputs)
+{
+	error_code ec;
+	for (const auto& output : outputs)
+		if (!output.second.empty() && !exists(prefix + output.first, ec))
+			imwrite(prefix + output.first, output.second);
+}
+
+
+// Phase of one camera from the cache, or decoded and stored. The maps of a hit point into entry.
+static int DecodeCamera(DecodeCache* cache, const UnwrapSequence& unwrap, const vector<Mat>& frames, const string& prefix, CaptureMaps& maps,
+	DecodeCacheEntry& entry, uint64_t& key, bool verbose)
+{
+	key = cache ? PhaseKey(HashFrames(frames), unwrap) : 0;
+	if (cache && cache->Get(key, entry) && entry.maps.size() == 5)
+	{
+		maps.wrapped = { entry.maps[0], entry.maps[1], entry.maps[2] };
+		maps.unwrapped = { entry.maps[3], entry.maps[4] };
+		WriteMissing(prefix, { { "_phase.tiff", maps.wrapped.phase }, { "_modulation.tiff", maps.wrapped.modulation },
+			{ "_background.tiff", maps.wrapped.background }, { "_unwrapped.tiff", maps.unwrapped.phase },
+			{ "_quality.tiff", maps.unwrapped.quality } });
+		return 1;
+	}
+
+	FringeDecoder fringes;
+	if (frames.empty() || fringes.Reset(unwrap, frames[0].size()) < 0)
+		return -1;
+	for (const Mat& frame : frames)
+		if (fringes.Add(frame, 1) < 0)
+			return -1;
+
+	if (DecodeCapture(fringes, prefix, maps, 1, verbose) < 0)
+		return -1;
+
+	if (cache && cache->Put(key, { maps.wrapped.phase, maps.wrapped.modulation, maps.wrapped.background, maps.unwrapped.phase,
+		maps.unwrapped.quality }) < 0)
+		cout << "!Unable to cache " << prefix << endl;
+	return 0;
+}
+
+
+
+int BatchTool(int argc, char* argv[])
+{
+	string root = "F:\\StereoBasler_LightCrafter\\acquisition\\", sequenceFile = UNWRAP_SEQUENCE_FILE;
+	unsigned int numThreads = 0;
+	int prefetch = BATCH_PREFETCH;
+	string cacheFolder;
+	unsigned long long cacheSize = DECODE_CACHE_SIZE;
+	bool restart = false, verbose = false;
+
+	for (int i = 0; i < argc; i++)
+	{
+		string arg = argv[i];
+
+		if (arg == "-r" && i + 1 < argc)
+		{
+			root = argv[++i];
+			if (!root.empty() && root.back() != '\\' && root.back() != '/')
+				root += "\\";
+		}
+		else if (arg == "-u" && i + 1 < argc)
+			sequenceFile = argv[++i];
+		else if (arg == "-j" && i + 1 < argc)
+			numThreads = stoul(argv[++i]);
+		else if (arg == "-p" && i + 1 < argc)
+			prefetch = max(0, stoi(argv[++i]));
+		else if (arg == "-c" && i + 1 < argc)
+			cacheFolder = argv[++i];
+		else if (arg == "-m" && i + 1 < argc)
+			cacheSize = stoull(argv[++i]);
+		else if (arg == "-f")
+			restart = true;
+		else if (arg == "-v")
+			verbose = true;
+		else
+		{
+			cerr << "Usage: batch [-r <acquisition folder>] [-u <unwrap sequence.yml>] [-j <workers>] [-p <prefetch>] [-c <cache folder>] [-m <cache MB>] [-f] [-v]"
+				<< endl;
+			return -1;
+		}
+	}
+
+	// Same sequence and calibration as the acquisition program
+	TuneProfile profile;
+	LoadTuneProfile(TUNE_PROFILE_FILE, profile);
+
+	UnwrapSequence unwrap;
+	unwrap.images = profile.seq;
+	unwrap.steps = static_cast<int>(count(profile.seq.begin(), profile.seq.end(), '-') + 1);
+	LoadUnwrapSequence(sequenceFile, unwrap);
+
+	int frames = CheckUnwrapSequence(unwrap);
+	if (frames <= 0)
+		return -1;
+
+	StereoCalibration calibration;
+	StereoRectification rectification;
+	bool rectified = LoadStereoCalibration(STEREO_CALIBRATION_FILE, calibration) == 0 && LoadRectification(calibration, rectification) == 0;
+	if (!rectified)
+		cout << "No stereo calibration, only the phase maps are computed" << endl;
+	uint64_t calibrationKey = rectified ? CalibrationHash(calibration) : 0;
+
+	DecodeCache cache;
+	bool cached = cacheSize > 0 && cache.Open(cacheFolder.empty() ? root + BATCH_CACHE_FOLDER : cacheFolder, cacheSize << 20) == 0;
+	if (cached)
+		cout << "Decode cache: " << cache.Size() / 1e6 << " MB of " << cacheSize << " MB" << endl;
+
+
+
+	// Captures left from an earlier run
+	string donePath = root + BATCH_DONE_FILE;
+	set<int> done;
+	if (restart)
+		ofstream(donePath, ios::trunc);
+	else
+	{
+		ifstream list(donePath);
+		for (int capture; list >> capture;)
+			done.insert(capture);
+	}
+
+	vector<int> captures;
+	for (int capture : DiscoverCaptures(root, frames))
+		if (!done.count(capture))
+			captures.push_back(capture);
+
+	cout << captures.size() << " captures to process, " << done.size() << " already done, " << WorkerCount(numThreads) << " workers" << endl;
+	if (captures.empty())
+		return 0;
+
+
+
+	// Loads started once, by the worker that reaches the capture or the one before it
+	int total = static_cast<int>(captures.size());
+	vector<once_flag> started(total);
+	vector<future<BatchCapture>> loads(total);
+	auto load = [&](int i)
+	{
+		call_once(started[i], [&] { loads[i] = async(launch::async, LoadCapture, cref(root), captures[i], frames); });
+	};
+
+	ofstream doneFile(donePath, ios::app);
+	mutex doneMutex;
+	atomic<int> processed{ 0 }, failed{ 0 }, hits{ 0 }, stages{ 0 };
+	atomic<unsigned long long> bytes{ 0 };
+	auto t0 = chrono::steady_clock::now();
+
+	ParallelForStealing(total, [&](int i)
+	{
+		for (int k = 0; k <= prefetch && i + k < total; k++)
+			load(i + k);
+
+		BatchCapture c = loads[i].get();
+		bytes += c.bytes;
+
+		string prefixL = root + "L\\left" + to_string(c.index), prefixR = root + "R\\right" + to_string(c.index);
+		DecodeCache* stageCache = cached ? &cache : nullptr;
+
+		// Entries stay mapped until the capture is done
+		CaptureMaps mapsL, mapsR;
+		DecodeCacheEntry entryL, entryR, entryRect;
+		uint64_t keyL, keyR;
+		int decodedL = DecodeCamera(stageCache, unwrap, c.left, prefixL, mapsL, entryL, keyL, verbose);
+		int decodedR = decodedL < 0 ? -1 : DecodeCamera(stageCache, unwrap, c.right, prefixR, mapsR, entryR, keyR, verbose);
+		c.left.clear();
+		c.right.clear();
+
+		bool ok = decodedL >= 0 && decodedR >= 0;
+		hits += (decodedL > 0) + (decodedR > 0);
+		stages += 2;
+
+		if (ok && rectified && !mapsL.unwrapped.phase.empty() && !mapsR.unwrapped.phase.empty())
+		{
+			RectifiedCapture rect;
+			uint64_t key = RectifiedKey(keyL, keyR, calibrationKey);
+			stages++;
+
+			if (stageCache && stageCache->Get(key, entryRect) && entryRect.maps.size() == 3)
+			{
+				rect = { entryRect.maps[0], entryRect.maps[1], entryRect.maps[2] };
+				hits++;
+			}
+			else
+			{
+				ok = RectifyCapture(rectification, mapsL, mapsR, rect, 1) == 0;
+				if (ok && stageCache && stageCache->Put(key, { rect.phaseL, rect.phaseR, rect.texture }) < 0)
+					cout << "!Unable to cache " << prefixL << endl;
+			}
+
+			ok = ok && TriangulateCapture(rectification, rect, prefixL, 1, verbose) >= 0;
+		}
+
+		lock_guard<mutex> lock(doneMutex);
+		int n = ++processed;
+		if (ok)
+			doneFile << c.index << endl;
+		else
+		{
+			failed++;
+			cout << "!Capture " << c.index << " failed" << endl;
+		}
+
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+		cout << "+Batch " << n << "/" << total << ", capture " << c.index << ", " << n / seconds << " captures/s" << endl;
+	}, numThreads);
+
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+	cout << processed << " captures (" << failed << " failed) in " << seconds << " s: " << processed / seconds << " captures/s, "
+		<< bytes / seconds / 1e6 << " MB/s read" << endl;
+	if (cached)
+		cout << "Decode cache: " << hits << " of " << stages << " stages reused, " << cache.Size() / 1e6 << " MB" << endl;
+
+	return failed ? -1 : 0;
+}
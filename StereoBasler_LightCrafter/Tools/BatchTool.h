@@ -0,0 +1,6 @@
+#ifndef BATCH_TOOL_H
+#define BATCH_TOOL_H
+
+int BatchTool(int, char*[]);
+
+#endif
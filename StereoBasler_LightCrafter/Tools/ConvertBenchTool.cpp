@@ -0,0 +1,145 @@
+// ConvertBenchTool.cpp : Micro-benchmark of the pixel format converters.
+//
+// Usage: StereoBasler_LightCrafter convbench [-s <width>x<height>] [-r <repeats>]
+//
+// Every format is converted to planar 8-bit and back at each instruction set the CPU supports, on random images of the
+// given size (PTN_WIDTH x PTN_HEIGHT by default). The best time of the repeats is reported in megapixels per second
+// with the speed-up over scalar code, and SIMD results are checked against the scalar ones.
+
+
+#include "ConvertBenchTool.h"
+
+#include "../LightCrafter/LC_PixelFormat.h"
+#include "../LightCrafter/dlpc350_common.h"
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <algorithm>
+
+using namespace std;
+
+
+template <class F>
+static double BestSeconds(int repeats, F run)
+{
+	double best = 1e9;
+	for (int i = 0; i < repeats; i++)
+	{
+		auto t0 = chrono::steady_clock::now();
+		run();
+		best = min(best, chrono::duration<double>(chrono::steady_clock::now() - t0).count());
+	}
+
+	return best;
+}
+
+
+
+int ConvertBenchTool(int argc, char* argv[])
+{
+	unsigned int width = PTN_WIDTH, height = PTN_HEIGHT;
+	int repeats = 20;
+
+	for (int i = 0; i < argc; i++)
+	{
+		string arg = argv[i];
+
+		if (arg == "-s" && i + 1 < argc)
+		{
+			string s = argv[++i];
+			size_t x = s.find('x');
+			if (x == string::npos)
+			{
+				cerr << "Size must be <width>x<height>" << endl;
+				return -1;
+			}
+			width = stoul(s.substr(0, x));
+			height = stoul(s.substr(x + 1));
+		}
+		else if (arg == "-r" && i + 1 < argc)
+			repeats = max(1, stoi(argv[++i]));
+		else
+		{
+			cerr << "Usage: convbench [-s <width>x<height>] [-r <repeats>]" << endl;
+			return -1;
+		}
+	}
+
+	// Pairs of pixels and Bayer cells
+	width &= ~1u;
+	height &= ~1u;
+	if (width == 0 || height == 0)
+	{
+		cerr << "Invalid size" << endl;
+		return -1;
+	}
+
+
+
+	const ImagePixFormat_t formats[] = { IMAGE_PIX_FORMAT_GREY8, IMAGE_PIX_FORMAT_GREY10, IMAGE_PIX_FORMAT_RGB16,
+		IMAGE_PIX_FORMAT_UYVY16, IMAGE_PIX_FORMAT_RGB24, IMAGE_PIX_FORMAT_RGB32, IMAGE_PIX_FORMAT_SBGGR };
+
+	int maxLevel = PixelSimdLevel(), failures = 0;
+	double mpix = static_cast<double>(width) * height / 1e6;
+	size_t planeSize = static_cast<size_t>(width) * height;
+	mt19937 rng(1);
+
+	cout << width << "x" << height << ", best of " << repeats << ", " << PixelSimdName(maxLevel) << " build" << endl;
+	cout << left << setw(18) << "Conversion" << setw(8) << "SIMD" << right << setw(10) << "MPix/s" << setw(10) << "Speed-up" << endl;
+
+	for (ImagePixFormat_t format : formats)
+	{
+		unsigned int lineWidth = width * PixelFormatBytes(format);
+		vector<unsigned char> packed(static_cast<size_t>(lineWidth) * height);
+		for (auto& b : packed)
+			b = static_cast<unsigned char>(rng());
+
+		// Valid 10-bit samples
+		if (format == IMAGE_PIX_FORMAT_GREY10)
+			for (size_t i = 1; i < packed.size(); i += 2)
+				packed[i] &= 3;
+
+		vector<unsigned char> planar(3 * planeSize), scalarPlanar, repacked(packed.size()), scalarRepacked;
+		unsigned char* planes[3] = { planar.data(), planar.data() + planeSize, planar.data() + 2 * planeSize };
+		const unsigned char* constPlanes[3] = { planes[0], planes[1], planes[2] };
+		Image_t src = { packed.data(), width, height, lineWidth, format };
+		Image_t dst = { repacked.data(), width, height, lineWidth, format };
+
+		for (int dir = 0; dir < 2; dir++)
+		{
+			double scalarSeconds = 0;
+			string name = dir == 0 ? string(PixelFormatName(format)) + " > planar" : string("planar > ") + PixelFormatName(format);
+
+			for (int level = PIXEL_SIMD_SCALAR; level <= maxLevel; level++)
+			{
+				PixelSimdLevel(level);
+				double seconds = dir == 0 ? BestSeconds(repeats, [&]() { ImageToPlanar(src, planes, width); }) :
+					BestSeconds(repeats, [&]() { ImageFromPlanar(constPlanes, width, dst); });
+
+				// Same output as the scalar converter
+				bool same = true;
+				if (level == PIXEL_SIMD_SCALAR)
+				{
+					scalarSeconds = seconds;
+					scalarPlanar = planar;
+					scalarRepacked = repacked;
+				}
+				else
+					same = dir == 0 ? planar == scalarPlanar : repacked == scalarRepacked;
+
+				cout << left << setw(18) << name << setw(8) << PixelSimdName(level) << right << fixed << setprecision(0) << setw(10)
+					<< mpix / seconds << setprecision(2) << setw(9) << scalarSeconds / seconds << "x" << (same ? "" : "  MISMATCH") << endl;
+
+				if (!same)
+					failures++;
+			}
+		}
+	}
+
+	PixelSimdLevel(maxLevel);
+	return failures ? -1 : 0;
+}
@@ -0,0 +1,6 @@
+#ifndef CONVERT_BENCH_TOOL_H
+#define CONVERT_BENCH_TOOL_H
+
+int ConvertBenchTool(int, char*[]);
+
+#endif
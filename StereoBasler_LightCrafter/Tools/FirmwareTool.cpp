@@ -0,0 +1,313 @@
+// FirmwareTool.cpp : Streams a firmware or splash image file into the projector flash.
+//
+// Usage: StereoBasler_LightCrafter firmware <image.bin|image.hex> [-a <flash address>] [-b] [-e] [-n]
+//        StereoBasler_LightCrafter firmware <settings.ini> [-n]
+//
+// The file is memory-mapped and fed to the flash programmer one sector at a time (LC_FirmwareFile), only the
+// sectors that differ from the flash are rewritten. Binary and hex dump images are written at the address given
+// with -a, Intel HEX images at their own base address unless -a is given. The first FLASH_BOOTLOADER_SIZE bytes of
+// the flash hold the bootloader and are left out of the image unless -b is given. An image that does not start and
+// end on flash sector boundaries is refused unless -e confirms that the rest of those sectors is erased. With -n the
+// image is only decoded and checksummed. The run-time settings of an .ini file (DEFAULT.* keys such as the LED
+// currents, trigger outputs or port configuration) are sent to the projector, the others are listed as not applied;
+// with -n they are only listed.
+
+
+#include "FirmwareTool.h"
+
+#include "../LightCrafter/LC_FirmwareFile.h"
+#include "../LightCrafter/LC_FlashProgram.h"
+#include "../LightCrafter/LC_Flash.h"
+#include "../LightCrafter/dlpc350_common.h"
+#include "../LightCrafter/dlpc350_api.h"
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <functional>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+
+using namespace std;
+
+
+#define FIRMWARE_USAGE "Usage: firmware <image.bin|image.hex> [-a <flash address>] [-b] [-e] [-n] | <settings.ini> [-n]"
+
+
+// Run-time setting of a firmware .ini file, keys without the DEFAULT. prefix. The keys of a setting are sent with one
+// command, keys missing from the file keep the value the device has.
+struct IniSetting
+{
+	vector<string> keys;
+	function<int(unsigned int*)> get; // nullptr for single keys
+	function<int(const unsigned int*)> set;
+};
+
+
+static IniSetting StrobeSetting(const string& color, int (*get)(unsigned char*, unsigned char*), int (*set)(unsigned char, unsigned char))
+{
+	return { { color + "_STROBE.RDELAY", color + "_STROBE.FDELAY" },
+		[get](unsigned int* v) { unsigned char r, f; int result = get(&r, &f); v[0] = r; v[1] = f; return result; },
+		[set](const unsigned int* v) { return set(static_cast<unsigned char>(v[0]), static_cast<unsigned char>(v[1])); } };
+}
+
+
+static vector<IniSetting> IniSettings()
+{
+	// Input port first, then the display mode, then what depends on it
+	return
+	{
+		{ { "PORTCONFIG.PORT", "PORTCONFIG.BPP" },
+			[](unsigned int* v) { return DLPC350_GetInputSource(&v[0], &v[1]); },
+			[](const unsigned int* v) { return DLPC350_SetInputSource(v[0], v[1]); } },
+		{ { "PORTCONFIG.PIX_FMT" }, nullptr, [](const unsigned int* v) { return DLPC350_SetPixelFormat(v[0]); } },
+		{ { "PORTCONFIG.PORT_CLK" }, nullptr, [](const unsigned int* v) { return DLPC350_SetPortClock(v[0]); } },
+		{ { "DISPMODE" }, nullptr, [](const unsigned int* v) { return DLPC350_SetMode(v[0] != 0); } },
+		{ { "TESTPATTERN" }, nullptr, [](const unsigned int* v) { return DLPC350_SetTPGSelect(v[0]); } },
+		{ { "SHORT_FLIP" }, nullptr, [](const unsigned int* v) { return DLPC350_SetShortAxisImageFlip(v[0] != 0); } },
+		{ { "LONG_FLIP" }, nullptr, [](const unsigned int* v) { return DLPC350_SetLongAxisImageFlip(v[0] != 0); } },
+		{ { "INVERTDATA" }, nullptr, [](const unsigned int* v) { return DLPC350_SetInvertData(v[0] != 0); } },
+		{ { "LEDCURRENT_RED", "LEDCURRENT_GREEN", "LEDCURRENT_BLUE" },
+			[](unsigned int* v)
+			{
+				unsigned char r, g, b;
+				int result = DLPC350_GetLedCurrents(&r, &g, &b);
+				v[0] = r;
+				v[1] = g;
+				v[2] = b;
+				return result;
+			},
+			[](const unsigned int* v) { return DLPC350_SetLedCurrents(static_cast<unsigned char>(v[0]), static_cast<unsigned char>(v[1]), static_cast<unsigned char>(v[2])); } },
+		{ { "LED_ENABLE_MAN_MODE", "MAN_ENABLE_RED_LED", "MAN_ENABLE_GRN_LED", "MAN_ENABLE_BLU_LED" },
+			[](unsigned int* v)
+			{
+				bool seq, r, g, b;
+				int result = DLPC350_GetLedEnables(&seq, &r, &g, &b);
+				v[0] = !seq;
+				v[1] = r;
+				v[2] = g;
+				v[3] = b;
+				return result;
+			},
+			[](const unsigned int* v) { return DLPC350_SetLedEnables(v[0] == 0, v[1] != 0, v[2] != 0, v[3] != 0); } },
+		StrobeSetting("RED", DLPC350_GetRedLEDStrobeDelay, DLPC350_SetRedLEDStrobeDelay),
+		StrobeSetting("GREEN", DLPC350_GetGreenLEDStrobeDelay, DLPC350_SetGreenLEDStrobeDelay),
+		StrobeSetting("BLUE", DLPC350_GetBlueLEDStrobeDelay, DLPC350_SetBlueLEDStrobeDelay),
+		{ { "TRIG_OUT_1.POL", "TRIG_OUT_1.RDELAY", "TRIG_OUT_1.FDELAY" },
+			[](unsigned int* v) { bool invert; int result = DLPC350_GetTrigOutConfig(1, &invert, &v[1], &v[2]); v[0] = invert; return result; },
+			[](const unsigned int* v) { return DLPC350_SetTrigOutConfig(1, v[0] != 0, v[1], v[2]); } },
+		{ { "TRIG_OUT_2.POL", "TRIG_OUT_2.WIDTH" },
+			[](unsigned int* v) { bool invert; unsigned int falling; int result = DLPC350_GetTrigOutConfig(2, &invert, &v[1], &falling); v[0] = invert; return result; },
+			[](const unsigned int* v) { return DLPC350_SetTrigOutConfig(2, v[0] != 0, v[1], 0); } },
+		{ { "TRIG_IN_1.DELAY" }, nullptr, [](const unsigned int* v) { return DLPC350_SetTrigIn1Delay(v[0]); } },
+		{ { "PATTERNCONFIG.TRIG_MODE" }, nullptr, [](const unsigned int* v) { return DLPC350_SetPatternTriggerMode(static_cast<int>(v[0])); } },
+		{ { "PATTERNCONFIG.PAT_EXPOSURE", "PATTERNCONFIG.PAT_PERIOD" },
+			[](unsigned int* v) { return DLPC350_GetExposure_FramePeriod(&v[0], &v[1]); },
+			[](const unsigned int* v) { return DLPC350_SetExposure_FramePeriod(v[0], v[1]); } },
+	};
+}
+
+
+
+static int ApplyIniFile(const string& path, bool dryRun)
+{
+	// Single-valued DEFAULT.* keys are settings the device may take, anything else only goes into a firmware build
+	map<string, unsigned int> values;
+	vector<string> notApplied;
+	unsigned int count = 0;
+	int result = ReadIniFile(path, [&](const IniEntry& e)
+	{
+		count++;
+		if (dryRun)
+		{
+			cout << e.key;
+			for (unsigned int v : e.values)
+				cout << " 0x" << hex << v << dec;
+			cout << endl;
+		}
+
+		if (e.key.compare(0, 8, "DEFAULT.") == 0 && e.values.size() == 1)
+			values[e.key.substr(8)] = e.values[0];
+		else
+			notApplied.push_back(e.key);
+		return 0;
+	});
+
+	if (result < 0)
+		return -1;
+
+	vector<IniSetting> settings = IniSettings();
+	vector<const IniSetting*> used;
+	for (const IniSetting& setting : settings)
+		if (any_of(setting.keys.begin(), setting.keys.end(), [&](const string& k) { return values.count(k) > 0; }))
+			used.push_back(&setting);
+
+	for (const auto& v : values)
+		if (none_of(settings.begin(), settings.end(), [&](const IniSetting& s) { return find(s.keys.begin(), s.keys.end(), v.first) != s.keys.end(); }))
+			notApplied.push_back("DEFAULT." + v.first);
+
+	if (dryRun)
+	{
+		cout << count << " settings, " << used.size() << " commands to send to the projector" << endl;
+		return 0;
+	}
+
+
+
+	lock_guard<recursive_mutex> lock(LightCrafterMutex());
+	if (LightCrafterReconnect() < 0)
+	{
+		cerr << "Projector not found" << endl;
+		return -1;
+	}
+
+	int failures = 0;
+	for (const IniSetting* setting : used)
+	{
+		// Keys missing from the file keep the current value
+		unsigned int v[4] = {};
+		bool complete = all_of(setting->keys.begin(), setting->keys.end(), [&](const string& k) { return values.count(k) > 0; });
+		if (!complete && setting->get(v) < 0)
+		{
+			cerr << "Failed to read DEFAULT." << setting->keys[0] << endl;
+			failures++;
+			continue;
+		}
+
+		for (size_t i = 0; i < setting->keys.size(); i++)
+		{
+			auto it = values.find(setting->keys[i]);
+			if (it != values.end())
+				v[i] = it->second;
+		}
+
+		if (setting->set(v) < 0)
+		{
+			cerr << "Failed to set DEFAULT." << setting->keys[0] << endl;
+			failures++;
+		}
+	}
+
+	cout << used.size() - failures << " of " << used.size() << " settings sent to the projector" << endl;
+	if (!notApplied.empty())
+	{
+		cout << notApplied.size() << " entries only apply to a firmware build:";
+		for (const string& key : notApplied)
+			cout << " " << key;
+		cout << endl;
+	}
+
+	return failures ? -1 : 0;
+}
+
+
+
+int FirmwareTool(int argc, char* argv[])
+{
+	if (argc < 1)
+	{
+		cerr << FIRMWARE_USAGE << endl;
+		return -1;
+	}
+
+	string path = argv[0];
+	bool haveAddr = false, bootloader = false, erasedAround = false, dryRun = false;
+	unsigned int addr = 0;
+
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+
+		if (arg == "-a" && i + 1 < argc)
+		{
+			// Decimal, or hexadecimal with 0x
+			char* end;
+			const char* value = argv[++i];
+			unsigned long long a = strtoull(value, &end, 0);
+			if (*value == 0 || *end != 0 || *value == '-' || a > 0xFFFFFFFFull)
+			{
+				cerr << "Invalid flash address " << value << endl << FIRMWARE_USAGE << endl;
+				return -1;
+			}
+
+			haveAddr = true;
+			addr = static_cast<unsigned int>(a);
+		}
+		else if (arg == "-b")
+			bootloader = true;
+		else if (arg == "-e")
+			erasedAround = true;
+		else if (arg == "-n")
+			dryRun = true;
+		else
+		{
+			cerr << "Unknown option " << arg << endl << FIRMWARE_USAGE << endl;
+			return -1;
+		}
+	}
+
+	string ext = path.size() >= 4 ? path.substr(path.size() - 4) : "";
+	transform(ext.begin(), ext.end(), ext.begin(), [](char c) { return static_cast<char>(tolower(c)); });
+	if (ext == ".ini")
+		return ApplyIniFile(path, dryRun);
+
+
+
+	auto t0 = chrono::steady_clock::now();
+	FirmwareFile image;
+	if (image.Open(path) < 0)
+		return -1;
+
+	// Only Intel HEX files know where they go
+	if (!haveAddr && image.Format() != FIRMWARE_INTEL_HEX)
+	{
+		cerr << "The flash address of a binary or hex dump image must be given with -a" << endl << FIRMWARE_USAGE << endl;
+		return -1;
+	}
+
+	if (!haveAddr)
+		addr = image.BaseAddress();
+
+	const char* formats[] = { "binary", "hex dump", "Intel HEX" };
+	cout << path << ": " << formats[image.Format()] << ", " << image.Size() << " bytes at flash address 0x"
+		<< hex << addr << dec << endl;
+
+	if (!dryRun)
+	{
+		FlashProgramReport report;
+		int result = LightCrafterUpdateFlash(addr, image, report,
+			[](unsigned int done, unsigned int total) { cout << "\rProgramming " << 100ull * done / total << "%" << flush; }, bootloader, erasedAround);
+		cout << endl;
+
+		if (result == 0)
+			PrintFlashProgramReport(report);
+
+		return result;
+	}
+
+	// Decode every sector as the programmer would
+	unsigned int sum = 0;
+	for (unsigned int offset = 0; offset < image.Size(); offset += FLASH_SECTOR_SIZE)
+	{
+		unsigned int len = min<unsigned int>(FLASH_SECTOR_SIZE, image.Size() - offset);
+		const unsigned char* data = image.Read(offset, len);
+		if (data == nullptr)
+		{
+			cerr << "Failed to read " << path << " at offset " << offset << endl;
+			return -1;
+		}
+
+		for (unsigned int i = 0; i < len; i++)
+			sum += data[i];
+	}
+
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+	cout << "Checksum 0x" << hex << setw(8) << setfill('0') << sum << dec << setfill(' ') << ", read in " << seconds << " s ("
+		<< image.Size() / 1e6 / max(seconds, 1e-9) << " MB/s)" << endl;
+
+	return 0;
+}
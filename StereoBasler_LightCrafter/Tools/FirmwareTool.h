@@ -0,0 +1,6 @@
+#ifndef FIRMWARE_TOOL_H
+#define FIRMWARE_TOOL_H
+
+int FirmwareTool(int, char*[]);
+
+#endif
@@ -0,0 +1,162 @@
+// I2CBenchTool.cpp : Throughput of I2C0 master transactions through the projector, one at a time and batched.
+//
+// Usage: StereoBasler_LightCrafter i2cbench -d <device address> [-r <register>] [-n <transactions>] [-c <SCL Hz>] [-s]
+//
+// The workload alternates 3-byte writes (register and two data bytes) with register block reads (register, 16 bytes),
+// against a slave on the I2C0 port of the DLPC350. The writes store the same value every time, so every read returns
+// the same data. It runs one transaction at a time with a status read after each write, then batched at several
+// pipelining depths, with the status read after every transaction and once per batch. The time and transactions per
+// second of each run are reported, and the read data of the batches is checked against the one-at-a-time run.
+// With -s a simulated projector with a slave at the -d address is used instead of the one on USB, see LC_Simulator.
+
+
+#include "I2CBenchTool.h"
+
+#include "../LightCrafter/LC_Flash.h"
+#include "../LightCrafter/dlpc350_common.h"
+#include "../LightCrafter/dlpc350_api.h"
+#include "../LightCrafter/dlpc350_usb.h"
+#include "../LightCrafter/LC_Simulator.h"
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <mutex>
+#include <memory>
+#include <cstdlib>
+
+using namespace std;
+
+
+#define I2C_BENCH_READ_BYTES 16
+
+
+
+static bool ParseNumber(const char* s, unsigned long& value)
+{
+	// Decimal, or hexadecimal with 0x
+	char* end;
+	value = strtoul(s, &end, 0);
+	return *s && *end == 0;
+}
+
+
+
+int I2CBenchTool(int argc, char* argv[])
+{
+	unsigned long devAddr = 0, reg = 0, transactions = 64, clk = 100000;
+	bool haveDevice = false, simulate = false, valid = true;
+
+	for (int i = 0; i < argc && valid; i++)
+	{
+		string arg = argv[i];
+
+		if (arg == "-d" && i + 1 < argc)
+			valid = haveDevice = ParseNumber(argv[++i], devAddr);
+		else if (arg == "-r" && i + 1 < argc)
+			valid = ParseNumber(argv[++i], reg) && reg < 256;
+		else if (arg == "-n" && i + 1 < argc)
+			valid = ParseNumber(argv[++i], transactions) && transactions > 0 && transactions <= MAX_I2C0_BATCH_OPS;
+		else if (arg == "-c" && i + 1 < argc)
+			valid = ParseNumber(argv[++i], clk) && clk >= 18194 && clk <= 400000;
+		else if (arg == "-s")
+			simulate = true;
+		else
+			valid = false;
+	}
+
+	if (!valid || !haveDevice)
+	{
+		cerr << "Usage: i2cbench -d <device address> [-r <register>] [-n <transactions, up to " << MAX_I2C0_BATCH_OPS
+			<< ">] [-c <SCL Hz>] [-s]" << endl;
+		return -1;
+	}
+
+	lock_guard<recursive_mutex> lock(LightCrafterMutex());
+	unique_ptr<SimulatedDLPC350> simulated;
+	if (simulate)
+	{
+		simulated.reset(new SimulatedDLPC350(static_cast<unsigned int>(devAddr)));
+		DLPC350_USB_Port port = simulated->Port();
+		DLPC350_USB_OpenPort(&port);
+	}
+	else if (LightCrafterReconnect() < 0)
+	{
+		cerr << "Projector not found" << endl;
+		return -1;
+	}
+
+	// The USB layer lets go of the simulated projector before it is destroyed
+	auto finish = [&](int result)
+	{
+		if (simulated)
+			DLPC350_USB_Close();
+		return result;
+	};
+
+
+
+	unsigned char writeData[3] = { static_cast<unsigned char>(reg), 0x5A, 0xA5 };
+	unsigned char readAddr = static_cast<unsigned char>(reg);
+	unsigned int numReads = static_cast<unsigned int>(transactions / 2);
+	vector<unsigned char> expected(numReads * I2C_BENCH_READ_BYTES), data(expected.size());
+	unsigned char stat = 0;
+	int failures = 0;
+
+	cout << transactions << " transactions to 0x" << hex << devAddr << dec << " at " << clk << " Hz"
+		<< (simulated ? ", simulated" : "") << endl;
+	cout << left << setw(30) << "Mode" << right << setw(10) << "ms" << setw(12) << "ops/s" << endl;
+
+	auto report = [&](const string& mode, chrono::steady_clock::time_point t0, bool ok)
+	{
+		double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count();
+		cout << left << setw(30) << mode << right << fixed << setprecision(1) << setw(10) << ms << setprecision(0) << setw(12)
+			<< transactions * 1000.0 / ms << (ok ? "" : "  FAILED") << endl;
+		if (!ok)
+			failures++;
+	};
+
+	// One at a time, as without batching: every write checked with a status read
+	auto t0 = chrono::steady_clock::now();
+	bool ok = true;
+	for (unsigned int i = 0, r = 0; i < transactions && ok; i++)
+	{
+		if (i % 2 == 0)
+			ok = DLPC350_I2C0WriteData(true, clk, devAddr, 3, writeData) >= 0 && DLPC350_I2C0TranStat(&stat) >= 0 && stat == 0;
+		else
+			ok = DLPC350_I2C0ReadData(true, clk, devAddr, 1, I2C_BENCH_READ_BYTES, &readAddr, &expected[I2C_BENCH_READ_BYTES * r++]) >= 0;
+	}
+	report("One at a time", t0, ok);
+	if (!ok)
+	{
+		cerr << "Transactions fail, I2C0 status 0x" << hex << static_cast<int>(stat) << dec << endl;
+		return finish(-1);
+	}
+
+	// Batched, with the status after every transaction and once per batch
+	const unsigned int depths[] = { 1, 2, 4 };
+	const unsigned int groups[] = { 1, 0 };
+	for (unsigned int group : groups)
+		for (unsigned int depth : depths)
+		{
+			fill(data.begin(), data.end(), 0);
+
+			t0 = chrono::steady_clock::now();
+			DLPC350_I2C0BatchBegin(true, clk);
+			for (unsigned int i = 0, r = 0; i < transactions; i++)
+			{
+				if (i % 2 == 0)
+					DLPC350_I2C0BatchWrite(devAddr, 3, writeData);
+				else
+					DLPC350_I2C0BatchRead(devAddr, 1, I2C_BENCH_READ_BYTES, &readAddr, &data[I2C_BENCH_READ_BYTES * r++]);
+			}
+			int done = DLPC350_I2C0BatchExecute(depth, group, &stat);
+
+			string mode = "Batch depth " + to_string(depth) + (group ? ", status each" : ", status once");
+			report(mode, t0, done == static_cast<int>(transactions) && data == expected);
+		}
+
+	return finish(failures ? -1 : 0);
+}
@@ -0,0 +1,6 @@
+#ifndef I2C_BENCH_TOOL_H
+#define I2C_BENCH_TOOL_H
+
+int I2CBenchTool(int, char*[]);
+
+#endif
@@ -0,0 +1,143 @@
+// ProjectorCalibrationTool.cpp : Calibrates the projector and one camera from projector calibration captures.
+//
+// Usage: StereoBasler_LightCrafter projcalib [-r <acquisition folder>] [-c left|right] [-w <window>] [-o <calibration.yml>] [<captures...>]
+//
+// The captures are taken with 'p' in the acquisition program: the board lit by the sequences of
+// projector_vertical.yml and projector_horizontal.yml, whose indices are listed in projector_views.txt of the
+// acquisition folder when none are given. The board is described by calibration_board.yml. Views are decoded in
+// parallel, one per worker, and those where the board is not found or partly out of the fringes are skipped. The
+// camera is the left one by default and the result goes to projector_calibration.yml.
+
+
+#include "ProjectorCalibrationTool.h"
+
+#include "../Processing/ProjectorCalibration.h"
+#include "../Processing/Parallel.h"
+
+#include <opencv2/opencv.hpp>
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cctype>
+
+using namespace cv;
+using namespace std;
+
+
+int ProjectorCalibrationTool(int argc, char* argv[])
+{
+	string root = "F:\\StereoBasler_LightCrafter\\acquisition\\", prefix = "L\\left", output = PROJECTOR_CALIBRATION_FILE;
+	int window = PROJECTOR_WINDOW;
+	vector<int> captures;
+
+	for (int i = 0; i < argc; i++)
+	{
+		string arg = argv[i];
+
+		if (arg == "-r" && i + 1 < argc)
+		{
+			root = argv[++i];
+			if (!root.empty() && root.back() != '\\' && root.back() != '/')
+				root += "\\";
+		}
+		else if (arg == "-c" && i + 1 < argc)
+		{
+			string c = argv[++i];
+			if (c == "left")
+				prefix = "L\\left";
+			else if (c == "right")
+				prefix = "R\\right";
+			else
+			{
+				cerr << "Unknown camera " << c << endl;
+				return -1;
+			}
+		}
+		else if (arg == "-w" && i + 1 < argc)
+			window = stoi(argv[++i]);
+		else if (arg == "-o" && i + 1 < argc)
+			output = argv[++i];
+		else if (!arg.empty() && isdigit(static_cast<unsigned char>(arg[0])))
+			captures.push_back(stoi(arg));
+		else
+		{
+			cerr << "Usage: projcalib [-r <acquisition folder>] [-c left|right] [-w <window>] [-o <calibration.yml>] [<captures...>]" << endl;
+			return -1;
+		}
+	}
+
+	ProjectorFringes fringes;
+	if (LoadProjectorFringes(fringes) < 0)
+	{
+		cerr << "Missing " << PROJECTOR_VERTICAL_FILE << " or " << PROJECTOR_HORIZONTAL_FILE << endl;
+		return -1;
+	}
+
+	CalibrationBoard board;
+	LoadCalibrationBoard(CALIBRATION_BOARD_FILE, board);
+
+	if (captures.empty())
+	{
+		ifstream list(root + PROJECTOR_VIEWS_FILE);
+		for (int capture; list >> capture;)
+			captures.push_back(capture);
+	}
+	if (captures.empty())
+	{
+		cerr << "No projector calibration captures" << endl;
+		return -1;
+	}
+
+
+
+	// One view per worker, each decoded on its own thread
+	int frames = ProjectorFringeFrames(fringes);
+	vector<ProjectorView> views(captures.size());
+	vector<int> status(captures.size(), -1);
+	vector<Size> sizes(captures.size());
+
+	auto t0 = chrono::steady_clock::now();
+	ParallelFor(static_cast<int>(captures.size()), [&](int v)
+	{
+		vector<Mat> images;
+		for (int i = 0; i < frames; i++)
+		{
+			Mat im = imread(root + prefix + to_string(captures[v]) + "_" + to_string(i) + ".bmp", IMREAD_GRAYSCALE);
+			if (im.empty())
+				return;
+			images.push_back(im);
+		}
+
+		sizes[v] = images[0].size();
+		status[v] = DecodeProjectorView(board, fringes, images, views[v], window, 1);
+	});
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+
+	vector<ProjectorView> accepted;
+	Size cameraSize;
+	for (size_t v = 0; v < captures.size(); v++)
+	{
+		if (status[v] < 0 || (cameraSize.area() > 0 && sizes[v] != cameraSize))
+		{
+			cout << "Capture " << captures[v] << " skipped" << endl;
+			continue;
+		}
+
+		cameraSize = sizes[v];
+		accepted.push_back(views[v]);
+	}
+	cout << accepted.size() << " of " << captures.size() << " views decoded in " << seconds << " s" << endl;
+
+
+
+	ProjectorCalibration calibration;
+	if (CalibrateProjector(board, accepted, cameraSize, calibration) < 0 || SaveProjectorCalibration(output, calibration) < 0)
+		return -1;
+
+	cout << "Projector calibration " << output << ": rms camera " << calibration.rmsCamera << " px, projector "
+		<< calibration.rmsProjector << " px, stereo " << calibration.rmsStereo << " px" << endl;
+	return 0;
+}
@@ -0,0 +1,6 @@
+#ifndef PROJECTOR_CALIBRATION_TOOL_H
+#define PROJECTOR_CALIBRATION_TOOL_H
+
+int ProjectorCalibrationTool(int, char*[]);
+
+#endif
@@ -0,0 +1,205 @@
+// SplashTool.cpp : Builds DLPC350 splash images from pattern files and optionally writes them to the projector flash.
+//
+// Usage: StereoBasler_LightCrafter splash <output.bin> [-c none|rle|4line] [-b <bit depth>] [-f <flash address> [-e]] [-u <unwrap sequence.yml>] <pattern images...>
+//
+// Patterns must be PTN_WIDTH x PTN_HEIGHT grayscale images. With -u, which can be given more than once, the patterns
+// of every frame of an unwrapping sequence are generated and put before them. They are packed into the bit planes of
+// 24-bit splash images at the given bit depth (8 by default: three patterns per image in the G, R and B channels)
+// and the matching pattern LUT numbers are printed. With -u every pattern gets an image of its own instead, in the
+// first bit planes (PatNum 0), since the acquisition program and LightCrafterFlash() project the first pattern of
+// each image of the sequence and the unwrapping sequence lists one image per frame.
+// The encoded images are written back to back, each one 4-byte aligned. With -f they are also programmed at the
+// given flash address, which must be the start of the splash data of the installed firmware. The firmware splash
+// table is not rewritten, so compressed images may only replace images of the same size. The data must start and
+// end on flash sector boundaries, unless -e confirms that the rest of the first and last sector is erased.
+
+
+#include "SplashTool.h"
+
+#include "../LightCrafter/LC_Splash.h"
+#include "../LightCrafter/LC_Bitplane.h"
+#include "../LightCrafter/LC_FlashProgram.h"
+#include "../LightCrafter/dlpc350_common.h"
+#include "../Processing/Unwrap.h"
+
+#include <opencv2/opencv.hpp>
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+
+using namespace cv;
+using namespace std;
+
+
+static int ProgramSplashData(unsigned int addr, const vector<unsigned char>& data, bool erasedAround)
+{
+	FlashProgramReport report;
+	MemoryImageSource source(data.data(), static_cast<unsigned int>(data.size()));
+	int result = LightCrafterUpdateFlash(addr, source, report,
+		[](unsigned int done, unsigned int total) { cout << "\rProgramming " << 100ull * done / total << "%" << flush; }, false, erasedAround);
+	cout << endl;
+
+	if (result == 0)
+		PrintFlashProgramReport(report);
+
+	return result;
+}
+
+
+int SplashTool(int argc, char* argv[])
+{
+	if (argc < 2)
+	{
+		cerr << "Usage: splash <output.bin> [-c none|rle|4line] [-b <bit depth>] [-f <flash address> [-e]] [-u <unwrap sequence.yml>] <pattern images...>" << endl;
+		return -1;
+	}
+
+	string output = argv[0];
+	SplashCompression compression = SPLASH_4LINE_COMPRESSION;
+	int bitDepth = 8;
+	bool program = false, erasedAround = false;
+	unsigned int flashAddr = 0;
+	vector<string> files;
+	vector<string> sequenceFiles;
+
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+
+		if (arg == "-c" && i + 1 < argc)
+		{
+			string c = argv[++i];
+			if (c == "none")
+				compression = SPLASH_UNCOMPRESSED;
+			else if (c == "rle")
+				compression = SPLASH_RLE_COMPRESSION;
+			else if (c == "4line")
+				compression = SPLASH_4LINE_COMPRESSION;
+			else
+			{
+				cerr << "Unknown compression " << c << endl;
+				return -1;
+			}
+		}
+		else if (arg == "-b" && i + 1 < argc)
+			bitDepth = stoi(argv[++i]);
+		else if (arg == "-f" && i + 1 < argc)
+		{
+			program = true;
+			flashAddr = stoul(argv[++i], 0, 0);
+		}
+		else if (arg == "-e")
+			erasedAround = true;
+		else if (arg == "-u" && i + 1 < argc)
+			sequenceFiles.push_back(argv[++i]);
+		else
+			files.push_back(arg);
+	}
+
+
+
+	// Load or generate patterns and pack them into bit planes
+	vector<Mat> patterns;
+	vector<string> names;
+	for (const auto& sequenceFile : sequenceFiles)
+	{
+		UnwrapSequence sequence;
+		vector<Mat> frames;
+		if (LoadUnwrapSequence(sequenceFile, sequence) < 0 || UnwrapPatterns(sequence, frames) < 0)
+		{
+			cerr << "Invalid unwrapping sequence " << sequenceFile << endl;
+			return -1;
+		}
+		for (size_t i = 0; i < frames.size(); i++)
+		{
+			patterns.push_back(frames[i]);
+			names.push_back(sequenceFile + " frame " + to_string(i));
+		}
+	}
+
+	for (const auto& f : files)
+	{
+		Mat im = imread(f, IMREAD_GRAYSCALE);
+		if (im.empty() || im.cols != PTN_WIDTH || im.rows != PTN_HEIGHT)
+		{
+			cerr << "Pattern " << f << " missing or not " << PTN_WIDTH << "x" << PTN_HEIGHT << endl;
+			return -1;
+		}
+		patterns.push_back(im.isContinuous() ? im : im.clone());
+		names.push_back(f);
+	}
+
+	if (patterns.empty())
+	{
+		cerr << "No patterns given" << endl;
+		return -1;
+	}
+
+	vector<const unsigned char*> planes;
+	for (const auto& p : patterns)
+		planes.push_back(p.data);
+
+	// Patterns of an unwrapping sequence go one per image, in the order the sequence projects them
+	vector<SplashFrame> frames;
+	vector<BitplaneLutEntry> lut;
+	size_t perPack = sequenceFiles.empty() ? planes.size() : 1;
+	for (size_t first = 0; first < planes.size(); first += perPack)
+	{
+		vector<const unsigned char*> group(planes.begin() + first, planes.begin() + first + perPack);
+		vector<SplashFrame> groupFrames;
+		vector<BitplaneLutEntry> groupLut;
+		if (PackBitplanes(group, PTN_WIDTH, PTN_HEIGHT, bitDepth, groupFrames, groupLut) < 0)
+		{
+			cerr << "Invalid bit depth " << bitDepth << endl;
+			return -1;
+		}
+
+		for (auto& entry : groupLut)
+			entry.image += static_cast<unsigned int>(frames.size());
+		frames.insert(frames.end(), groupFrames.begin(), groupFrames.end());
+		lut.insert(lut.end(), groupLut.begin(), groupLut.end());
+	}
+
+	for (size_t i = 0; i < lut.size(); i++)
+		cout << names[i] << " -> image " << lut[i].image << ", PatNum " << lut[i].patNum << ", BitDepth " << lut[i].bitDepth << endl;
+
+
+
+	// Encode all frames in parallel and check them with the decoder
+	auto t0 = chrono::steady_clock::now();
+	vector<vector<unsigned char>> images = EncodeSplashImages(frames, compression);
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+
+	vector<unsigned char> data;
+	for (size_t i = 0; i < images.size(); i++)
+	{
+		SplashFrame decoded;
+		if (DecodeSplash(images[i].data(), images[i].size(), decoded) < 0 || decoded.pixels != frames[i].pixels)
+		{
+			cerr << "Splash image " << i << " failed the round trip check" << endl;
+			return -1;
+		}
+
+		cout << "Splash image " << i << ": " << images[i].size() << " bytes" << endl;
+		data.insert(data.end(), images[i].begin(), images[i].end());
+	}
+	cout << images.size() << " splash images encoded in " << seconds << " s, " << data.size() << " bytes total" << endl;
+
+	ofstream out(output, ios::binary);
+	if (!out.write(reinterpret_cast<const char*>(data.data()), data.size()))
+	{
+		cerr << "Unable to write " << output << endl;
+		return -1;
+	}
+	out.close();
+
+
+
+	if (program)
+		return ProgramSplashData(flashAddr, data, erasedAround);
+
+	return 0;
+}
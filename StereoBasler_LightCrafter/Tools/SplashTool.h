@@ -0,0 +1,6 @@
+#ifndef SPLASH_TOOL_H
+#define SPLASH_TOOL_H
+
+int SplashTool(int, char*[]);
+
+#endif
@@ -0,0 +1,544 @@
+// TuneTool.cpp : Searches the shortest projector frame period and the matching camera exposure and trigger delay.
+//
+// Usage: StereoBasler_LightCrafter tune [-s] [-q <sequence>] [-p <start period>] [-e <camera exposure>] [-m <min modulation>] [-n <trials>] [-o <profile.yml>]
+//
+// A setting is accepted when the projector validates the pattern LUT, both cameras return one frame per Trigger Out 1
+// pulse in every trial, and the mean fringe modulation of the N-step sequence stays above the threshold. The period
+// is bisected between the lower bound of the timing model and the start period (150 ms by default), trying camera
+// exposures of half, one and two times the start one (2 ms by default) and a few trigger delays at each step. With -s a simulated projector/camera pair is used instead of
+// the rig. The best setting is saved as a profile that the acquisition program loads at startup.
+
+
+#include "TuneTool.h"
+
+#include "../LightCrafter/LC_Flash.h"
+#include "../LightCrafter/LC_Sequence.h"
+#include "../LightCrafter/LC_Timing.h"
+
+#include <pylon/PylonIncludes.h>
+#include <pylon/usb/BaslerUsbInstantCameraArray.h>
+#include <opencv2/opencv.hpp>
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <random>
+#include <cmath>
+#include <algorithm>
+
+using namespace Pylon;
+using namespace cv;
+using namespace std;
+
+
+int LoadTuneProfile(const string& file, TuneProfile& profile)
+{
+	FileStorage fs(file, FileStorage::READ);
+	if (!fs.isOpened())
+		return -1;
+
+	TuneProfile p;
+	int exposure, period;
+	fs["seq"] >> p.seq;
+	fs["projectorExposure"] >> exposure;
+	fs["projectorPeriod"] >> period;
+	fs["cameraExposure"] >> p.cameraExposure;
+	fs["triggerDelay"] >> p.triggerDelay;
+	fs["modulation"] >> p.modulation;
+	fs["rate"] >> p.rate;
+
+	if (p.seq.empty() || exposure <= 0 || period <= 0 || p.cameraExposure <= 0)
+		return -1;
+
+	p.projectorExposure = exposure;
+	p.projectorPeriod = period;
+	profile = p;
+	return 0;
+}
+
+
+int SaveTuneProfile(const string& file, const TuneProfile& profile)
+{
+	FileStorage fs(file, FileStorage::WRITE);
+	if (!fs.isOpened())
+		return -1;
+
+	fs << "seq" << profile.seq;
+	fs << "projectorExposure" << static_cast<int>(profile.projectorExposure);
+	fs << "projectorPeriod" << static_cast<int>(profile.projectorPeriod);
+	fs << "cameraExposure" << profile.cameraExposure;
+	fs << "triggerDelay" << profile.triggerDelay;
+	fs << "modulation" << profile.modulation;
+	fs << "rate" << profile.rate;
+	return 0;
+}
+
+
+
+// Projector and camera pair under test
+class TuneRig
+{
+public:
+	virtual ~TuneRig() {}
+
+	// Camera timing without exposure and delay
+	virtual CameraTiming Camera() = 0;
+
+	// Arms the projector with the profile and grabs until the sequence is over.
+	// Returns -1 if the projector rejects the sequence, else the frames grabbed by the slowest camera.
+	virtual int Run(const TuneProfile&, unsigned int, vector<Mat>&, vector<Mat>&) = 0;
+};
+
+
+
+class BaslerRig : public TuneRig
+{
+public:
+	BaslerRig() : cameras(2) {}
+
+	~BaslerRig()
+	{
+		cameras.Close();
+	}
+
+	int Open()
+	{
+		CTlFactory& tlFactory = CTlFactory::GetInstance();
+
+		DeviceInfoList_t devices;
+		if (static_cast<size_t>(tlFactory.EnumerateDevices(devices)) < cameras.GetSize())
+		{
+			cerr << "Two cameras are needed" << endl;
+			return -1;
+		}
+
+		// Same trigger setup as the acquisition program, with the trigger always on
+		for (size_t i = 0; i < cameras.GetSize(); ++i)
+		{
+			cameras[i].Attach(tlFactory.CreateDevice(devices[i]));
+			cameras[i].Open();
+
+			cameras[i].LineSelector.SetValue(Basler_UsbCameraParams::LineSelector_Line1);
+			cameras[i].LineMode.SetValue(Basler_UsbCameraParams::LineMode_Input);
+			cameras[i].AcquisitionMode.SetValue(Basler_UsbCameraParams::AcquisitionMode_Continuous);
+			cameras[i].AcquisitionFrameRateEnable.SetValue(false);
+			cameras[i].TriggerSource.SetValue(Basler_UsbCameraParams::TriggerSource_Line1);
+			cameras[i].TriggerActivation.SetValue(Basler_UsbCameraParams::TriggerActivation_RisingEdge);
+			cameras[i].TriggerMode.SetValue(Basler_UsbCameraParams::TriggerMode_On);
+			cameras[i].ExposureMode.SetValue(Basler_UsbCameraParams::ExposureMode_Timed);
+			cameras[i].ExposureAuto.SetValue(Basler_UsbCameraParams::ExposureAuto_Off);
+			cameras[i].SensorReadoutMode.SetValue(Basler_UsbCameraParams::SensorReadoutMode_Fast);
+		}
+
+		formatConverter.OutputPixelFormat = PixelType_Mono8;
+		return 0;
+	}
+
+	CameraTiming Camera()
+	{
+		CameraTiming camera;
+		for (size_t i = 0; i < cameras.GetSize(); ++i)
+			camera.readout = max(camera.readout, static_cast<unsigned int>(cameras[i].SensorReadoutTime.GetValue()));
+
+		return camera;
+	}
+
+	int Run(const TuneProfile& profile, unsigned int expected, vector<Mat>& left, vector<Mat>& right)
+	{
+		for (size_t i = 0; i < cameras.GetSize(); ++i)
+		{
+			cameras[i].ExposureTime.SetValue(profile.cameraExposure);
+			cameras[i].TriggerDelay.SetValue(profile.triggerDelay);
+		}
+
+		cameras.StartGrabbing(GrabStrategy_OneByOne);
+
+		if (LightCrafterFlash(profile.projectorExposure, profile.projectorPeriod, 0, profile.seq) < 0)
+		{
+			cameras.StopGrabbing();
+			return -1;
+		}
+
+		// Grab until no frame arrives for two pattern periods: frames beyond the expected ones are kept too,
+		// the caller picks the fringe frames
+		unsigned int timeout = 2 * profile.projectorPeriod / 1000 + 500;
+		vector<Mat>* frames[] = { &left, &right };
+		size_t counts[2] = { 0, 0 };
+
+		left.clear();
+		right.clear();
+
+		for (size_t i = 0; i < cameras.GetSize(); ++i)
+		{
+			CGrabResultPtr ptrGrabResult;
+			while (frames[i]->size() < expected + 4 && cameras[i].RetrieveResult(timeout, ptrGrabResult, TimeoutHandling_Return))
+			{
+				if (!ptrGrabResult->GrabSucceeded())
+					continue;
+
+				CPylonImage image;
+				formatConverter.Convert(image, ptrGrabResult);
+				frames[i]->push_back(Mat(ptrGrabResult->GetHeight(), ptrGrabResult->GetWidth(), CV_8UC1, (uint8_t *)image.GetBuffer()).clone());
+			}
+			counts[i] = frames[i]->size();
+		}
+
+		cameras.StopGrabbing();
+
+		return static_cast<int>(min(counts[0], counts[1]));
+	}
+
+private:
+	CBaslerUsbInstantCameraArray cameras;
+	CImageFormatConverter formatConverter;
+};
+
+
+
+class SimulatedRig : public TuneRig
+{
+public:
+	CameraTiming Camera()
+	{
+		CameraTiming camera;
+		camera.readout = readout;
+		return camera;
+	}
+
+	int Run(const TuneProfile& profile, unsigned int expected, vector<Mat>& left, vector<Mat>& right)
+	{
+		// The projector validates with the device rules of the timing model
+		vector<unsigned int> images;
+		SequenceProgram program;
+		SequenceTimingReport report;
+
+		if (ParseImageList(profile.seq, images) < 0 ||
+			CompileSequence(SequenceFromImages(images, profile.projectorExposure, profile.projectorPeriod, false), program) < 0 ||
+			CheckSequenceTiming(program, report) < 0)
+			return -1;
+
+		CameraTiming camera = Camera();
+		camera.exposure = static_cast<unsigned int>(profile.cameraExposure);
+		double cameraPeriod = camera.overlapped ? max<double>(camera.exposure, camera.readout) : camera.exposure + camera.readout;
+
+		// One trigger per pattern; a trigger is lost while the camera is busy
+		left.clear();
+		right.clear();
+
+		double busyUntil = -1e9;
+		size_t numPatterns = program.patLut.size();
+
+		for (size_t k = 0; k < numPatterns; k++)
+		{
+			double start = static_cast<double>(k) * profile.projectorPeriod;
+			if (start < busyUntil)
+				continue;
+
+			busyUntil = start + latency + profile.triggerDelay + cameraPeriod;
+
+			// Light integrated from this pattern and from the next one when the exposure runs past it
+			double w0 = start + latency + profile.triggerDelay, w1 = w0 + profile.cameraExposure;
+			double lit[2];
+			for (int j = 0; j < 2; j++)
+			{
+				double p0 = start + j * static_cast<double>(profile.projectorPeriod), p1 = p0 + profile.projectorExposure;
+				lit[j] = k + j < numPatterns ? max(0.0, min(w1, p1) - max(w0, p0)) : 0;
+			}
+
+			left.push_back(Render(k, numPatterns, lit, profile.cameraExposure));
+			right.push_back(Render(k, numPatterns, lit, profile.cameraExposure));
+		}
+
+		(void)expected;
+		return static_cast<int>(left.size());
+	}
+
+private:
+	Mat Render(size_t k, size_t n, const double lit[2], double exposure)
+	{
+		// Fringes with a period of 20 pixels, shifted by 2*pi/n per pattern, clipped at 255
+		Mat frame(height, width, CV_8UC1);
+		normal_distribution<double> noise(0.0, 2.0);
+
+		for (int y = 0; y < height; y++)
+		{
+			unsigned char* row = frame.ptr<unsigned char>(y);
+			for (int x = 0; x < width; x++)
+			{
+				double value = ambient * exposure;
+				for (int j = 0; j < 2; j++)
+					value += gain * lit[j] * (0.5 + 0.4 * cos(2 * CV_PI * x / 20 + 2 * CV_PI * (k + j) / n));
+
+				row[x] = saturate_cast<unsigned char>(value + noise(rng));
+			}
+		}
+
+		return frame;
+	}
+
+	const int width = 160, height = 120;
+	const unsigned int readout = 5000; // us
+	const double latency = 30; // Trigger to exposure start, us
+	const double gain = 0.1; // Gray levels per us of full illumination
+	const double ambient = 0.002; // Gray levels per us of exposure
+	mt19937 rng{ 0 };
+};
+
+
+
+static double FringeModulation(const vector<Mat>& frames, size_t first, size_t n)
+{
+	// Mean modulation 2/n*|sum(I_k*exp(-i*2*pi*k/n))| over the central quarter of the image
+	const Mat& f0 = frames[first];
+	int x0 = f0.cols / 4, x1 = 3 * f0.cols / 4, y0 = f0.rows / 4, y1 = 3 * f0.rows / 4;
+
+	vector<double> c(n), s(n);
+	for (size_t k = 0; k < n; k++)
+	{
+		c[k] = cos(2 * CV_PI * k / n);
+		s[k] = sin(2 * CV_PI * k / n);
+	}
+
+	double sum = 0;
+	for (int y = y0; y < y1; y++)
+	{
+		for (int x = x0; x < x1; x++)
+		{
+			double re = 0, im = 0;
+			for (size_t k = 0; k < n; k++)
+			{
+				double v = frames[first + k].ptr<unsigned char>(y)[x];
+				re += v * c[k];
+				im += v * s[k];
+			}
+			sum += 2.0 / n * sqrt(re * re + im * im);
+		}
+	}
+
+	return sum / max(1, (x1 - x0) * (y1 - y0));
+}
+
+
+static double BestModulation(const vector<Mat>& frames, size_t n)
+{
+	// The fringe frames are the n consecutive frames with the highest modulation, extra triggers around the
+	// sequence give frames without fringes
+	double best = 0;
+	for (size_t first = 0; first + n <= frames.size(); first++)
+		best = max(best, FringeModulation(frames, first, n));
+
+	return best;
+}
+
+
+
+static bool Trial(TuneRig& rig, const TuneProfile& profile, unsigned int expected, int trials, double minModulation, double& modulation)
+{
+	modulation = 1e9;
+
+	for (int t = 0; t < trials; t++)
+	{
+		vector<Mat> left, right;
+		int grabbed = rig.Run(profile, expected, left, right);
+		if (grabbed < 0)
+		{
+			cout << "rejected by projector";
+			return false;
+		}
+		if (static_cast<unsigned int>(grabbed) < expected)
+		{
+			cout << "dropped frames (" << grabbed << "/" << expected << ")";
+			return false;
+		}
+
+		modulation = min(modulation, min(BestModulation(left, expected), BestModulation(right, expected)));
+		if (modulation < minModulation)
+		{
+			cout << "modulation " << modulation;
+			return false;
+		}
+	}
+
+	cout << "ok, modulation " << modulation;
+	return true;
+}
+
+
+static bool TryPeriod(TuneRig& rig, const TuneProfile& base, const SequenceProgram& program, unsigned int period,
+	int trials, double minModulation, TuneProfile& best)
+{
+	// Camera exposures around the start one, cut to the pattern exposure: longer ones raise the modulation
+	// until the sensor saturates
+	const double guard = 200; // Margin for trigger latency and jitter, us
+	const double delays[] = { 0, 100 };
+	const double scales[] = { 2, 1, 0.5 };
+
+	CameraTiming camera = rig.Camera();
+	bool found = false;
+	best.modulation = 0;
+
+	for (double delay : delays)
+	{
+		double last = 0;
+		for (double scale : scales)
+		{
+			TuneProfile p = base;
+			p.projectorExposure = p.projectorPeriod = period;
+			p.triggerDelay = delay;
+			p.cameraExposure = floor(min(scale * base.cameraExposure, period - delay - guard));
+			if (p.cameraExposure < 20 || p.cameraExposure == last)
+				continue;
+			last = p.cameraExposure;
+
+			// Skip settings the timing model already rejects
+			SequenceProgram prog = program;
+			for (auto& e : prog.patLut)
+				e.exposure = e.period = period;
+			prog.exposure = prog.period = period;
+
+			camera.exposure = static_cast<unsigned int>(p.cameraExposure);
+			camera.triggerDelay = static_cast<unsigned int>(delay);
+			SequenceTimingReport report;
+			if (CheckSequenceTiming(prog, report, &camera) < 0)
+				continue;
+
+			cout << "  period " << period << " us, camera exposure " << p.cameraExposure << " us, delay " << delay << " us: ";
+			double modulation;
+			bool ok = Trial(rig, p, report.numTriggers, trials, minModulation, modulation);
+			cout << endl;
+
+			if (ok && modulation > best.modulation)
+			{
+				p.modulation = modulation;
+				p.rate = report.rate;
+				best = p;
+				found = true;
+			}
+		}
+	}
+
+	return found;
+}
+
+
+
+int TuneTool(int argc, char* argv[])
+{
+	TuneProfile base;
+	bool simulate = false;
+	double minModulation = 20;
+	int trials = 3;
+	string output = TUNE_PROFILE_FILE;
+
+	for (int i = 0; i < argc; i++)
+	{
+		string arg = argv[i];
+
+		if (arg == "-s")
+			simulate = true;
+		else if (arg == "-q" && i + 1 < argc)
+			base.seq = argv[++i];
+		else if (arg == "-p" && i + 1 < argc)
+			base.projectorExposure = base.projectorPeriod = stoul(argv[++i]);
+		else if (arg == "-e" && i + 1 < argc)
+			base.cameraExposure = stod(argv[++i]);
+		else if (arg == "-m" && i + 1 < argc)
+			minModulation = stod(argv[++i]);
+		else if (arg == "-n" && i + 1 < argc)
+			trials = max(1, stoi(argv[++i]));
+		else if (arg == "-o" && i + 1 < argc)
+			output = argv[++i];
+		else
+		{
+			cerr << "Usage: tune [-s] [-q <sequence>] [-p <start period>] [-e <camera exposure>] [-m <min modulation>] [-n <trials>] [-o <profile.yml>]" << endl;
+			return -1;
+		}
+	}
+
+	vector<unsigned int> images;
+	SequenceProgram program;
+	if (ParseImageList(base.seq, images) < 0 ||
+		CompileSequence(SequenceFromImages(images, base.projectorExposure, base.projectorPeriod, false), program) < 0)
+	{
+		cerr << "Invalid sequence " << base.seq << endl;
+		return -1;
+	}
+
+
+
+	int exitCode = 0;
+	PylonInitialize();
+
+	try
+	{
+		unique_ptr<TuneRig> rig;
+		if (simulate)
+			rig.reset(new SimulatedRig());
+		else
+		{
+			unique_ptr<BaslerRig> basler(new BaslerRig());
+			if (basler->Open() < 0)
+				throw RUNTIME_EXCEPTION("Unable to open the cameras");
+			rig = move(basler);
+		}
+
+		// Lower bound from the timing model with the shortest camera exposure tried
+		CameraTiming camera = rig->Camera();
+		camera.exposure = static_cast<unsigned int>(base.cameraExposure / 2);
+		SequenceTimingReport report;
+		CheckSequenceTiming(program, report, &camera);
+		unsigned int lo = static_cast<unsigned int>(report.minDuration / program.patLut.size());
+		unsigned int hi = base.projectorPeriod;
+
+		cout << "Searching frame periods from " << lo << " to " << hi << " us" << endl;
+
+		TuneProfile best, candidate;
+		if (!TryPeriod(*rig, base, program, hi, trials, minModulation, best))
+		{
+			cerr << "The start period " << hi << " us does not pass, nothing to tune" << endl;
+			exitCode = -1;
+		}
+		else
+		{
+			// Bisect down to 1% of the period
+			if (lo < hi && TryPeriod(*rig, base, program, lo, trials, minModulation, candidate))
+				best = candidate;
+			else
+			{
+				while (hi - lo > max(100u, hi / 100))
+				{
+					unsigned int mid = lo + (hi - lo) / 2;
+					if (TryPeriod(*rig, base, program, mid, trials, minModulation, candidate))
+					{
+						best = candidate;
+						hi = mid;
+					}
+					else
+						lo = mid;
+				}
+			}
+
+			cout << endl << "Best: projector period " << best.projectorPeriod << " us, camera exposure " << best.cameraExposure
+				<< " us, trigger delay " << best.triggerDelay << " us, modulation " << best.modulation << ", "
+				<< best.rate << " captures/s" << endl;
+
+			if (SaveTuneProfile(output, best) < 0)
+			{
+				cerr << "Unable to write " << output << endl;
+				exitCode = -1;
+			}
+			else
+				cout << "Profile saved to " << output << endl;
+		}
+	}
+	catch (const GenericException &e)
+	{
+		cerr << "An exception occurred." << endl << e.GetDescription() << endl;
+		exitCode = -1;
+	}
+
+	PylonTerminate();
+
+	return exitCode;
+}
@@ -0,0 +1,24 @@
+#ifndef TUNE_TOOL_H
+#define TUNE_TOOL_H
+
+#include <string>
+
+#define TUNE_PROFILE_FILE "tune_profile.yml"
+
+// Projector and camera settings found by the tuner, defaults are the hand-tuned values
+struct TuneProfile
+{
+	std::string seq = "0-1-2"; // Sequence of flash images, N-step phase shifted fringes
+	unsigned int projectorExposure = 150000; // us
+	unsigned int projectorPeriod = 150000; // us
+	double cameraExposure = 2000; // us
+	double triggerDelay = 0; // us
+	double modulation = 0; // Mean fringe modulation measured with these settings, gray levels
+	double rate = 0; // Captures per second
+};
+
+int LoadTuneProfile(const std::string&, TuneProfile&);
+int SaveTuneProfile(const std::string&, const TuneProfile&);
+int TuneTool(int, char*[]);
+
+#endif